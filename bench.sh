@@ -0,0 +1,100 @@
+#!/bin/bash
+# Micro-benchmarks: each case generates a source into bin/bench/<case>/test.c and
+# times cfcc on it, or the code cfcc makes of it. Usage: ./bench.sh [case...]
+make -j8 > /dev/null || exit 1
+
+bench_dir() {
+    mkdir -p bin/bench/$1 && echo bin/bench/$1
+}
+
+run_cfcc() {
+    local TIMEFORMAT="$2: %R s"
+    time (cd $1 && ../../cfcc > test.S)
+}
+
+# identifier resolution: 100k function declarations, each referenced once
+bench_symbols() {
+    local dir=$(bench_dir symbols)
+    {
+        seq 0 99999 | awk '{ print "int f" $1 "(int x);" }'
+        echo "int main() {"
+        echo "    int x;"
+        echo "    x = 0;"
+        seq 0 99999 | awk '{ print "    x = f" $1 "(x);" }'
+        echo "    return x;"
+        echo "}"
+    } > $dir/test.c
+    run_cfcc $dir "symbols (100k declarations)"
+}
+
+# variable access: one function with 5k locals accessed 50k times
+bench_locals() {
+    local dir=$(bench_dir locals)
+    {
+        echo "int main() {"
+        seq 0 4999 | awk '{ print "    int v" $1 ";" }'
+        seq 0 49999 | awk '{ print "    v" ($1 % 5000) " = v" (($1 * 7) % 5000) " + 1;" }'
+        echo "    return v0;"
+        echo "}"
+    } > $dir/test.c
+    run_cfcc $dir "locals (5k locals, 50k accesses)"
+}
+
+# generated code: a rule 110 stencil over 1024 cells for 4000 generations at each
+# optimization level, timed with rdtsc by a helper linked in from C
+bench_stencil() {
+    local dir=$(bench_dir stencil)
+    local cells=1024 generations=4000
+    cat > $dir/cycles.c <<'END'
+#include <stdio.h>
+#include <x86intrin.h>
+
+static unsigned long long start;
+
+int bench_start(void) {
+    start = __rdtsc();
+    return 0;
+}
+
+int bench_stop(int elements) {
+    printf("%.2f cycles per element, ", (double) (__rdtsc() - start) / elements);
+    return 0;
+}
+END
+    {
+        echo "int bench_start();"
+        echo "int bench_stop(int elements);"
+        echo "int printn_int(int _1);"
+        echo ""
+        echo "int main() {"
+        echo "    int a[$((cells + 2))];"
+        echo "    int b[$((cells + 2))];"
+        echo "    int rule[8];"
+        echo "    rule[0] = 0; rule[1] = 1; rule[2] = 1; rule[3] = 1;"
+        echo "    rule[4] = 0; rule[5] = 1; rule[6] = 1; rule[7] = 0;"
+        echo "    for (int i = 0; i < $((cells + 2)); i = i + 1) { a[i] = 0; b[i] = 0; }"
+        echo "    a[$cells] = 1;"
+        echo "    bench_start();"
+        echo "    for (int g = 0; g < $generations; g = g + 1) {"
+        echo "        for (int i = 0; i < $cells; i = i + 1) b[i + 1] = rule[a[i] * 4 + a[i + 1] * 2 + a[i + 2]];"
+        echo "        for (int i = 1; i <= $cells; i = i + 1) a[i] = b[i];"
+        echo "    }"
+        echo "    bench_stop($((cells * generations)));"
+        echo "    int live = 0;"
+        echo "    for (int i = 0; i < $((cells + 2)); i = i + 1) live = live + a[i];"
+        echo "    printn_int(live);"
+        echo "    return 0;"
+        echo "}"
+    } > $dir/test.c
+    for level in 0 1 2; do
+        (cd $dir && ../../cfcc -O$level -o test.S test.c) || return 1
+        cc -w -Wl,-z,noexecstack $dir/test.S $dir/cycles.c -o $dir/stencil || return 1
+        # the best of five runs, the others are mostly noise
+        echo -n "stencil -O$level: " && for run in 1 2 3 4 5; do $dir/stencil; done | sort -n | head -1
+    done
+}
+
+cases=${@:-symbols locals stencil}
+for c in $cases; do
+    bench_$c
+done
@@ -0,0 +1,109 @@
+#ifndef CFCC_ARENA_C
+#define CFCC_ARENA_C
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+// Bump allocator: every allocation lives until the whole arena is freed.
+struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t used;
+    size_t capacity;
+    _Alignas(ARENA_ALIGNMENT) char data[];
+};
+
+struct Arena {
+    struct ArenaChunk* head;
+
+    // most recent allocation, can be grown in place
+    void* last;
+};
+
+void init_arena(struct Arena* arena) {
+    arena->head = NULL;
+    arena->last = NULL;
+}
+
+void free_arena(struct Arena* arena) {
+    struct ArenaChunk* chunk = arena->head;
+    while (chunk != NULL) {
+        struct ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    init_arena(arena);
+}
+
+static size_t arena_align(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+}
+
+static struct ArenaChunk* arena_new_chunk(struct Arena* arena, size_t size) {
+    size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    struct ArenaChunk* chunk = malloc(sizeof(struct ArenaChunk) + capacity);
+    if (chunk == NULL) {
+        printf("failed to allocate arena chunk of %zu bytes\n", capacity);
+        exit(1);
+    }
+
+    chunk->used = 0;
+    chunk->capacity = capacity;
+    chunk->next = arena->head;
+    arena->head = chunk;
+    return chunk;
+}
+
+void* arena_alloc(struct Arena* arena, size_t size) {
+    size = arena_align(size);
+
+    struct ArenaChunk* chunk = arena->head;
+    if (chunk == NULL || chunk->capacity - chunk->used < size) {
+        chunk = arena_new_chunk(arena, size);
+    }
+
+    void* ptr = &chunk->data[chunk->used];
+    chunk->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+void* arena_calloc(struct Arena* arena, size_t size) {
+    void* ptr = arena_alloc(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+// resizes an allocation, extending it in place when it is the most recent one
+void* arena_grow(struct Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+
+    struct ArenaChunk* chunk = arena->head;
+    if (ptr == arena->last) {
+        size_t offset = (char*) ptr - chunk->data;
+        if (offset + arena_align(new_size) <= chunk->capacity) {
+            chunk->used = offset + arena_align(new_size);
+            return ptr;
+        }
+    }
+
+    void* grown = arena_alloc(arena, new_size);
+    memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    return grown;
+}
+
+char* arena_strndup(struct Arena* arena, const char* str, size_t length) {
+    char* buffer = arena_alloc(arena, length + 1);
+    memcpy(buffer, str, length);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef CFCC_BACKEND_C
+#define CFCC_BACKEND_C
+
+#include "buffer.c"
+#include "codegen.c"
+#include "dce.c"
+#include "gvn.c"
+#include "hir.c"
+#include "inline.c"
+#include "isel.c"
+#include "iv.c"
+#include "licm.c"
+#include "loop.c"
+#include "options.c"
+#include "pass.c"
+#include "peephole.c"
+#include "ssa.c"
+#include "tailrec.c"
+#include "vectorize.c"
+
+// Backend driver: emits the runtime helpers, then every function definition
+// of the unit, straight from the hir at -O0 and through the SSA IR and the
+// pass pipeline of the optimization level otherwise.
+
+// passes run at each optimization level, cheap cleanups come first
+static void add_optimization_passes(struct PassManager* pm, int level) {
+    add_pass(pm, &simplify_cfg_pass);
+    add_pass(pm, &simplify_phis_pass);
+
+    // self-recursive functions that become loops can be inlined like any other
+    add_pass(pm, &tail_recursion_pass);
+
+    // inlined bodies are cleaned up together with the rest of the caller,
+    // mutual recursion may have become self recursion by then
+    add_pass(pm, &inline_pass);
+    add_pass(pm, &simplify_cfg_pass);
+    add_pass(pm, &simplify_phis_pass);
+    add_pass(pm, &tail_recursion_pass);
+
+    // loops test at the bottom before the values in them get numbered
+    add_pass(pm, &loop_rotate_pass);
+    add_pass(pm, &simplify_phis_pass);
+
+    add_pass(pm, &gvn_pass);
+    add_pass(pm, &dead_store_pass);
+    add_pass(pm, &dce_pass);
+    add_pass(pm, &simplify_cfg_pass);
+    if (level < 2) return;
+
+    // numbered values are hoisted as a whole, what stays is what changes per iteration
+    add_pass(pm, &licm_pass);
+    add_pass(pm, &strength_reduce_pass);
+    add_pass(pm, &gvn_pass);
+    add_pass(pm, &dce_pass);
+    add_pass(pm, &simplify_cfg_pass);
+
+    // loops are vectorized in the shape strength reduction leaves them in
+    add_pass(pm, &loop_vectorize_pass);
+    add_pass(pm, &slp_vectorize_pass);
+    add_pass(pm, &gvn_pass);
+    add_pass(pm, &dce_pass);
+    add_pass(pm, &simplify_cfg_pass);
+}
+
+// helpers that test programs print with, each passing its argument to
+// printf after the format string at .LC<n> of the same index
+static const char* runtime_helpers[] = { "printn_int", "print_char", "print_newline" };
+static const char* runtime_formats[] = { "%d\n", "%c", "\n" };
+
+static void generate_runtime(struct Context* ctx, struct Buffer* buffer) {
+    struct MirFunction* mf = &ctx->mir;
+    size_t count = sizeof(runtime_helpers) / sizeof(runtime_helpers[0]);
+
+    if (ctx->object == NULL) {
+        buffer_append(buffer,
+            "\t.text\n"
+            "\t.globl main\n"
+            "\t.type  main, @function\n"
+        );
+    }
+
+    const char** formats = arena_alloc(&ctx->arena, sizeof(const char*) * count);
+    for (size_t i = 0; i < count; i++) {
+        char* name = arena_alloc(&ctx->arena, 16);
+        snprintf(name, 16, ".LC%zu", i);
+        formats[i] = name;
+
+        if (ctx->object != NULL) {
+            object_add_string(ctx->object, name, runtime_formats[i]);
+            continue;
+        }
+
+        buffer_format(buffer, "\n%s:\n\t.string\t\"", name);
+        for (const char* c = runtime_formats[i]; *c != '\0'; c++) {
+            if (*c == '\n') {
+                buffer_append(buffer, "\\n");
+            } else {
+                buffer_append_n(buffer, c, 1);
+            }
+        }
+
+        buffer_append(buffer, "\"\n");
+    }
+
+    // the helper functions live in the arena of the unit along with the
+    // names, the frame is set up to keep the stack aligned at the call
+    for (size_t i = 0; i < count; i++) {
+        init_mir_function(mf, &ctx->arena, runtime_helpers[i], 0);
+        emit(mf, MIR_PUSH, mop_none(), mop_reg(REG_RBP, 8));
+        emit(mf, MIR_MOV, mop_reg(REG_RSP, 8), mop_reg(REG_RBP, 8));
+        emit(mf, MIR_MOV, mop_reg(REG_RDI, 4), mop_reg(REG_RSI, 4));
+        emit(mf, MIR_LEA, mop_symbol(formats[i]), mop_reg(REG_RDI, 8));
+        emit(mf, MIR_MOV, mop_imm(0, 4), mop_reg(REG_RAX, 4));
+        emit_call(mf, "printf@PLT", 2);
+        emit(mf, MIR_POP, mop_none(), mop_reg(REG_RBP, 8));
+        emit(mf, MIR_RET, mop_none(), mop_none());
+        output_function(ctx, mf, buffer);
+    }
+}
+
+void generate(struct Unit* unit, struct Context* ctx, struct Options* options, struct Buffer* buffer) {
+    ctx->free_label = 0;
+    ctx->red_zone = options->red_zone;
+    ctx->omit_frame_pointer = options->omit_frame_pointer;
+    init_arena(&ctx->arena);
+    generate_runtime(ctx, buffer);
+
+    struct PassManager pm;
+    init_pass_manager(&pm);
+    add_optimization_passes(&pm, options->optimize);
+    pm.verify = options->verify_ir;
+
+#ifdef DBG
+    pm.verify = true;
+#endif
+
+    struct Buffer dump;
+    init_buffer(&dump, stderr);
+    if (options->dump_ir) {
+        pm.dump = &dump;
+    }
+
+    if (options->optimize == 0) {
+        for (int i = 0; i < unit->scope.functions_length; i++) {
+            struct Function* func = unit->scope.functions[i];
+            if (!func->prototype) generate_function(func, ctx, buffer);
+        }
+    } else {
+        // the whole unit is in the IR at once, so callees can be inlined
+        struct IrModule module;
+        init_ir_module(&module);
+        module.inline_threshold = options->inline_threshold;
+        module.vector_width = options->vector_width;
+
+        for (int i = 0; i < unit->scope.functions_length; i++) {
+            struct Function* func = unit->scope.functions[i];
+            if (!func->prototype) ir_add_function(&module, build_ssa(func, &module.arena));
+        }
+
+        run_module_passes(&pm, &module);
+        for (size_t i = 0; i < module.functions_length; i++) {
+            select_function(module.functions[i], ctx, buffer);
+        }
+
+        free_ir_module(&module);
+    }
+
+    if (pm.dump != NULL) {
+        buffer_flush(&dump, stderr);
+    }
+
+    if (options->peephole_stats) {
+        print_peephole_stats(stderr);
+    }
+
+    free_buffer(&dump);
+    free_pass_manager(&pm);
+    free_arena(&ctx->arena);
+}
+
+#endif
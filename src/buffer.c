@@ -0,0 +1,126 @@
+#ifndef CFCC_BUFFER_C
+#define CFCC_BUFFER_C
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BUFFER_INITIAL_CAPACITY 4096
+#define BUFFER_SINK_THRESHOLD (64 * 1024)
+
+// Growable output buffer used for emitting assembly.
+// Length is tracked explicitly so appends never rescan the contents,
+// and capacity grows geometrically so emission is linear in output size.
+// When a sink is attached, full chunks are written out instead of growing.
+struct Buffer {
+    char* data;
+    size_t length;
+    size_t capacity;
+
+    FILE* sink;
+};
+
+void init_buffer(struct Buffer* buffer, FILE* sink) {
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+    buffer->sink = sink;
+}
+
+void free_buffer(struct Buffer* buffer) {
+    free(buffer->data);
+    init_buffer(buffer, NULL);
+}
+
+size_t buffer_flush(struct Buffer* buffer, FILE* file) {
+    size_t written = fwrite(buffer->data, 1, buffer->length, file);
+    buffer->length = 0;
+    return written;
+}
+
+ssize_t buffer_flush_fd(struct Buffer* buffer, int fd) {
+    size_t written = 0;
+    while (written < buffer->length) {
+        ssize_t result = write(fd, buffer->data + written, buffer->length - written);
+        if (result < 0) {
+            return -1;
+        }
+
+        written += result;
+    }
+
+    buffer->length = 0;
+    return written;
+}
+
+// makes room for at least `additional` more bytes plus a terminator
+void buffer_reserve(struct Buffer* buffer, size_t additional) {
+    size_t required = buffer->length + additional + 1;
+    if (required <= buffer->capacity) {
+        return;
+    }
+
+    // streaming buffers drain into the sink before considering growth
+    if (buffer->sink != NULL && buffer->length > 0 && buffer->capacity >= BUFFER_SINK_THRESHOLD) {
+        buffer_flush(buffer, buffer->sink);
+        required = additional + 1;
+        if (required <= buffer->capacity) {
+            return;
+        }
+    }
+
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : BUFFER_INITIAL_CAPACITY;
+    while (capacity < required) {
+        capacity *= 2;
+    }
+
+    char* data = realloc(buffer->data, capacity);
+    if (data == NULL) {
+        printf("failed to grow output buffer to %zu bytes\n", capacity);
+        exit(1);
+    }
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+}
+
+void buffer_append_n(struct Buffer* buffer, const char* str, size_t length) {
+    buffer_reserve(buffer, length);
+    memcpy(buffer->data + buffer->length, str, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+}
+
+void buffer_append(struct Buffer* buffer, const char* str) {
+    buffer_append_n(buffer, str, strlen(str));
+}
+
+// formats directly into the reserved tail, growing and retrying only
+// when the formatted text does not fit in the remaining capacity
+void buffer_format(struct Buffer* buffer, const char* format, ...) {
+    buffer_reserve(buffer, 64);
+
+    va_list args;
+    va_start(args, format);
+    size_t available = buffer->capacity - buffer->length;
+    int length = vsnprintf(buffer->data + buffer->length, available, format, args);
+    va_end(args);
+
+    if (length < 0) {
+        return;
+    }
+
+    if ((size_t) length >= available) {
+        buffer_reserve(buffer, length);
+
+        va_start(args, format);
+        vsnprintf(buffer->data + buffer->length, length + 1, format, args);
+        va_end(args);
+    }
+
+    buffer->length += length;
+}
+
+#endif
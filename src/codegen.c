@@ -1,265 +1,508 @@
 #ifndef CFCC_CODEGEN_C
 #define CFCC_CODEGEN_C
 
+#include <stdint.h>
 #include <stdio.h>
-#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "buffer.c"
+#include "encode.c"
+#include "fold.c"
+#include "frame.c"
 #include "hir.c"
+#include "mir.c"
+#include "peephole.c"
+#include "regalloc.c"
+#include "symbol.c"
 
-static int strapp(char** buffer_ptr, char* appendage) {
-    size_t length_appendage = strlen(appendage);
+// SysV x86-64: the first six arguments go in registers, the rest on the
+// stack, 8 bytes each from %rsp up at the call
+static const int argument_registers[] = { REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9 };
 
-    char* ptr;
-    if (*buffer_ptr != NULL) {
-        ptr = realloc(*buffer_ptr, strlen(*buffer_ptr) + length_appendage + 1);
-        strcat(ptr, appendage);
-    } else {
-        ptr = malloc(length_appendage + 1);
-        memcpy(ptr, appendage, length_appendage);
-        ptr[length_appendage] = '\0';
-    }
+// incoming stack arguments are above the return address and the saved %rbp
+#define STACK_ARGUMENTS_OFFSET 16
 
-    if (ptr != NULL) {
-        *buffer_ptr = ptr;
-        return 0; // Success
-    } else {
-        return -1; // Failed to reallocate
-    }
+struct Context {
+    size_t free_label;
+
+    // instructions of the function being generated, reset for every function
+    struct Arena arena;
+    struct MirFunction mir;
+
+    // user label -> mir label id + 1
+    struct SymbolTable labels;
+    size_t exit_label;
+
+    // innermost switch and the label of each of its cases, and where
+    // `break` and `continue` jump to as label id + 1 (0 where they can't)
+    struct StmtSwitch* switch_stmt;
+    size_t* case_labels;
+    size_t break_label;
+    size_t continue_label;
+
+    // frame layout of every function, see struct MirFunction
+    bool red_zone;
+    bool omit_frame_pointer;
+
+    // the function being generated; calls in tail position leave through a
+    // jump when nothing in its frame can be pointed to, and calls to itself
+    // jump back to `start_label` right after the arguments are received
+    struct Function* function;
+    bool tail_calls;
+    size_t start_label;
+
+    // finished functions are encoded into this object file instead of printed when set
+    struct ObjectFile* object;
+};
+
+// where an assignable expression lives: a promoted variable's register or memory
+struct LValue {
+    int vreg;
+    struct MirOperand memory;
+};
+
+static bool is_indirect(struct Type* type) {
+    return type != NULL && (type->kind == TYPE_KIND_ARRAY || type->kind == TYPE_KIND_POINTER);
 }
 
-static int strfmt(char** buffer_ptr, const char* format, ...) {
-    va_list args;
-    va_start(args, format);    
-    int length = vsnprintf(NULL, 0, format, args);
-    char* temp = malloc(length + 1);
-    va_end(args);
-
-    va_start(args, format);
-    vsnprintf(temp, length + 1, format, args);
-    va_end(args);
-    
-    int result = strapp(buffer_ptr, temp);
-    free(temp);
-
-    return result;
+static struct Type* element_type(struct Type* type) {
+    return type->kind == TYPE_KIND_ARRAY ? type->array.type : type->pointer.type;
 }
 
-struct RegisterAllocator {
-    int* scratch_state;
-    const char** scratch;
-    size_t scratch_count;
+// static type of an expression where the hir records one, NULL for plain ints
+static struct Type* expression_type(struct Expression* expr) {
+    switch (expr->kind) {
+        case EXPR_VARIABLE:
+            return expr->expr_variable.variable->type;
 
-    const char** argument;
-    size_t argument_count;
-};
+        case EXPR_INDEX: {
+            struct Type* type = expression_type(expr->expr_index.location);
+            if (!is_indirect(type)) type = expression_type(expr->expr_index.expression);
+            return is_indirect(type) ? element_type(type) : NULL;
+        }
 
-struct Context {
-    struct RegisterAllocator allocator;
-    size_t free_label;
-    size_t frame_size;
-};
+        case EXPR_ASSIGNMENT:
+            return expression_type(expr->expr_assignment.location);
 
-size_t alloc_register(struct RegisterAllocator* registers) {
-    for (int i = 0; i < registers->scratch_count; i++) {
-        // 0 means register has not been taken yet
-        if (registers->scratch_state[i] == 0) {
-            // mark the register as taken
-            registers->scratch_state[i] = 1;
+        case EXPR_CALL:
+            return expr->expr_call.func != NULL ? expr->expr_call.func->return_type : NULL;
 
-            // return it's index
-            return i;
-        }
+        case EXPR_LITERAL:
+            return expr->expr_literal.type;
+
+        default:
+            return NULL;
     }
+}
 
-    return -1;
+// width of the value an expression produces, addresses are 8 bytes
+static int value_size(struct Expression* expr) {
+    if (expr->kind == EXPR_ADDRESS_OF) return 8;
+    return is_indirect(expression_type(expr)) ? 8 : 4;
 }
 
-void free_register(struct RegisterAllocator* registers, size_t idx) {
-    registers->scratch_state[idx] = 0;
+static int type_value_size(struct Type* type) {
+    return is_indirect(type) ? 8 : 4;
 }
 
-void free_all_registers(struct RegisterAllocator* registers) {
-    for (int i = 0; i < registers->scratch_count; i++) {
-        registers->scratch_state[i] = 0;
+static size_t user_label(struct Context* ctx, const char* name) {
+    size_t label = (size_t) symbol_table_find(&ctx->labels, name);
+    if (label == 0) {
+        label = new_label(&ctx->mir, name) + 1;
+        symbol_table_insert(&ctx->labels, &ctx->arena, name, (void*) label);
     }
+
+    return label - 1;
 }
 
-size_t calc_var_offset(struct Scope* scope, struct Variable* var, bool* found) {
-    size_t offset = 0;
-    for (int i = 0; i < scope->variables_length; i++) {
-        offset += type_size(scope->variables[i]->type);
+// passes `args` to a call: the ones past the argument registers are stored
+// at the bottom of the frame, where the callee finds them above its return
+// address; returns how many go in registers
+int emit_call_arguments(struct MirFunction* mf, struct MirOperand* args, size_t args_length) {
+    size_t registers = args_length < mf->argument_count ? args_length : mf->argument_count;
+    size_t stack_size = 8 * (args_length - registers);
+    if (stack_size > mf->outgoing_size) mf->outgoing_size = stack_size;
 
-        if (var == scope->variables[i]) {
-            if (found != NULL) {
-                *found = true;
-            }
+    for (size_t i = registers; i < args_length; i++) {
+        emit(mf, MIR_MOV, args[i], mop_mem(REG_RSP, REG_NONE, 1, 8 * (i - registers), args[i].size));
+    }
 
-            return offset;
-        }
+    for (size_t i = 0; i < registers; i++) {
+        emit(mf, MIR_MOV, args[i], mop_reg(mf->argument_registers[i], args[i].size));
     }
 
-    for (int i = 0; i < scope->statements_length; i++) {
-        if (scope->statements[i]->kind == STMT_COMPOUND) {
-            size_t scope_offset = calc_var_offset(&scope->statements[i]->stmt_compound.scope, var, found);
-            offset += scope_offset;
-        }
+    return registers;
+}
+
+int generate_expr(struct Expression* expr, struct Context* ctx);
+
+// `x * c` as lea/shift/add sequences where those beat imul
+static int generate_constant_product(int x, int32_t c, int size, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+    int r = new_vreg(mf);
+
+    uint32_t magnitude = c < 0 ? -(uint32_t) c : (uint32_t) c;
+    if (magnitude == 0) {
+        emit(mf, MIR_MOV, mop_imm(0, size), mop_reg(r, size));
+        return r;
+    }
+
+    // c = ±odd * 2^shift, the odd factor is built from x with lea or a shift
+    int shift = __builtin_ctz(magnitude);
+    uint32_t odd = magnitude >> shift;
+    bool odd_is_lea = odd == 3 || odd == 5 || odd == 9;
+    bool odd_plus = odd > 1 && ((odd - 1) & (odd - 2)) == 0;
+    bool odd_minus = odd > 1 && ((odd + 1) & odd) == 0;
+
+    bool cheap = odd == 1 || odd_is_lea || odd_plus || odd_minus;
+    int steps = (shift > 0) + (c < 0);
+    if (odd_is_lea) {
+        steps += 1;
+    } else if (odd != 1) {
+        steps += 2;
+    }
+
+    // imul has a latency of 3, beyond 2 dependent steps it is the better choice
+    if (!cheap || steps > 2) {
+        emit(mf, MIR_MOV, mop_reg(x, size), mop_reg(r, size));
+        emit(mf, MIR_IMUL, mop_imm(c, 4), mop_reg(r, size));
+        return r;
     }
 
-    return offset;
+    if (odd_is_lea) {
+        emit(mf, MIR_LEA, mop_mem(x, x, odd - 1, 0, size), mop_reg(r, size));
+    } else if (odd_plus) {
+        emit(mf, MIR_MOV, mop_reg(x, size), mop_reg(r, size));
+        emit(mf, MIR_SHL, mop_imm(__builtin_ctz(odd - 1), 1), mop_reg(r, size));
+        emit(mf, MIR_ADD, mop_reg(x, size), mop_reg(r, size));
+    } else if (odd_minus) {
+        emit(mf, MIR_MOV, mop_reg(x, size), mop_reg(r, size));
+        emit(mf, MIR_SHL, mop_imm(__builtin_ctz(odd + 1), 1), mop_reg(r, size));
+        emit(mf, MIR_SUB, mop_reg(x, size), mop_reg(r, size));
+    } else {
+        emit(mf, MIR_MOV, mop_reg(x, size), mop_reg(r, size));
+    }
+
+    if (shift > 0) emit(mf, MIR_SHL, mop_imm(shift, 1), mop_reg(r, size));
+    if (c < 0) emit(mf, MIR_NEG, mop_none(), mop_reg(r, size));
+    return r;
 }
 
-void generate_logical_op(const char* suffix, size_t r1, size_t r2, struct Context* ctx, char** buffer) {
-    strfmt(buffer, "\tcmpl %%%sd, %%%sd\n", ctx->allocator.scratch[r2], ctx->allocator.scratch[r1]);
-    strfmt(buffer, "\tset%s %%%sb\n", suffix, ctx->allocator.scratch[r1]);
-    strfmt(buffer, "\tmovzbl %%%sb, %%%sd\n", ctx->allocator.scratch[r1], ctx->allocator.scratch[r1]);
+// literals are used as immediates, everything else is evaluated into a register
+struct MirOperand generate_operand(struct Expression* expr, struct Context* ctx) {
+    if (expr->kind == EXPR_LITERAL && expr->expr_literal.type->kind == TYPE_KIND_BASIC && expr->expr_literal.type->basic == TYPE_I32) {
+        return mop_imm(expr->expr_literal.integer, 4);
+    }
+
+    return mop_reg(generate_expr(expr, ctx), value_size(expr));
 }
 
-struct LValue {
-    size_t offset;
-    size_t r_index;
-    size_t r_address;
-    // in case lvalue is actually an expression
-    size_t r_expr;
-};
+struct LValue generate_lvalue(struct Expression* expr, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
 
-size_t generate_expr(struct Expression* expr, struct Scope* scope, struct Function* func, struct Context* ctx, char** buffer);
+    struct LValue out;
+    out.vreg = REG_NONE;
+    out.memory = mop_none();
 
-struct LValue generate_lvalue(struct Expression* expr, struct Scope* scope, struct Function* func, struct Context* ctx, char** buffer) {
     switch (expr->kind) {
         case EXPR_VARIABLE: {
-            size_t offset = calc_var_offset(&func->scope, expr->expr_variable.variable, NULL);
+            struct Variable* var = expr->expr_variable.variable;
+            if (var->vreg != REG_NONE) {
+                out.vreg = var->vreg;
+            } else {
+                out.memory = mop_mem(REG_RBP, REG_NONE, 1, -(int32_t) var->offset, type_value_size(var->type));
+            }
 
-            struct LValue out;
-            out.offset = offset;
-            out.r_index = -1;
-            out.r_address = -1;
-            out.r_expr = -1;
             return out;
         }
 
         case EXPR_INDEX: {
-            struct LValue lval_location = generate_lvalue(expr->expr_index.location, scope, func, ctx, buffer);
-            struct LValue lval_index;
+            // `a[i]` and `i[a]` are the same thing
+            struct Expression* base = expr->expr_index.location;
+            struct Expression* index = expr->expr_index.expression;
+            if (!is_indirect(expression_type(base))) {
+                base = expr->expr_index.expression;
+                index = expr->expr_index.location;
+            }
+
+            struct Type* base_type = expression_type(base);
+            if (!is_indirect(base_type)) {
+                fprintf(stderr, "subscripted value is neither array nor pointer\n");
+                out.vreg = new_vreg(mf);
+                return out;
+            }
 
-            if (lval_location.r_expr != -1) {
-                lval_index = lval_location;
-                lval_location = generate_lvalue(expr->expr_index.expression, scope, func, ctx, buffer);
+            struct Type* element = element_type(base_type);
+            int64_t scale = type_size(element);
+
+            // constant parts of the index go into the displacement
+            int64_t displacement = 0;
+            int32_t constant;
+            if (is_constant(index, &constant)) {
+                displacement = constant * scale;
+                index = NULL;
+            } else if (index->kind == EXPR_BIN_OP && is_constant(index->expr_binary_op.right, &constant)) {
+                enum BinaryOperation op = index->expr_binary_op.kind;
+                if (op == BINARY_OP_ADD || op == BINARY_OP_SUB) {
+                    displacement = (op == BINARY_OP_ADD ? constant : -(int64_t) constant) * scale;
+                    index = index->expr_binary_op.left;
+                }
+            }
+
+            if (base_type->kind == TYPE_KIND_ARRAY) {
+                // the array itself is in memory
+                struct LValue array = generate_lvalue(base, ctx);
+                out.memory = array.memory;
             } else {
-                lval_index.offset = -1;
-                lval_index.r_index = -1;
-                lval_index.r_address = -1;
-                lval_index.r_expr = generate_expr(expr->expr_index.expression, scope, func, ctx, buffer);
+                out.memory = mop_mem(generate_expr(base, ctx), REG_NONE, 1, 0, 8);
             }
 
-            lval_location.r_index = lval_index.r_expr;
-            return lval_location;
+            out.memory.mem.disp += displacement;
+            out.memory.size = type_value_size(element);
+            if (index == NULL) {
+                return out;
+            }
+
+            int offset = generate_expr(index, ctx);
+            int wide_offset = new_vreg(mf);
+            emit(mf, MIR_MOVSX, mop_reg(offset, 4), mop_reg(wide_offset, 8));
+
+            // addressing modes scale by 1, 2, 4 or 8 only
+            if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+                wide_offset = generate_constant_product(wide_offset, scale, 8, ctx);
+                scale = 1;
+            }
+
+            if (out.memory.mem.index != REG_NONE) {
+                int base_reg = new_vreg(mf);
+                emit(mf, MIR_LEA, out.memory, mop_reg(base_reg, 8));
+                out.memory = mop_mem(base_reg, REG_NONE, 1, 0, type_value_size(element));
+            }
+
+            out.memory.mem.index = wide_offset;
+            out.memory.mem.scale = scale;
+            return out;
         }
+
+        default:
+            break;
     }
 
-    struct LValue out;
-    out.offset = -1;
-    out.r_index = -1;
-    out.r_address = -1;
-    out.r_expr = generate_expr(expr, scope, func, ctx, buffer);
+    out.vreg = generate_expr(expr, ctx);
     return out;
 }
 
-size_t generate_expr(struct Expression* expr, struct Scope* scope, struct Function* func, struct Context* ctx, char** buffer) {    
-    switch (expr->kind) {
-        case EXPR_VARIABLE: {
-            size_t r = alloc_register(&ctx->allocator);
-            size_t offset = calc_var_offset(&func->scope, expr->expr_variable.variable, NULL);
-            strfmt(buffer, "\tmovl -%i(%%rbp), %%%sd\n", offset, ctx->allocator.scratch[r]);
-            return r;
+// stores the value and returns the operand that was stored
+struct MirOperand generate_assignment(struct Expression* expr, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+
+    struct LValue lval = generate_lvalue(expr->expr_assignment.location, ctx);
+    struct MirOperand value = generate_operand(expr->expr_assignment.expression, ctx);
+
+    if (lval.vreg != REG_NONE) {
+        emit(mf, MIR_MOV, value, mop_reg(lval.vreg, value.size));
+    } else {
+        value.size = lval.memory.size;
+        emit(mf, MIR_MOV, value, lval.memory);
+    }
+
+    return value;
+}
+
+static bool comparison_condition(enum BinaryOperation op, enum Condition* cond) {
+    switch (op) {
+        case BINARY_OP_LT:  *cond = COND_L;  return true;
+        case BINARY_OP_GT:  *cond = COND_G;  return true;
+        case BINARY_OP_LET: *cond = COND_LE; return true;
+        case BINARY_OP_GET: *cond = COND_GE; return true;
+        case BINARY_OP_EQ:  *cond = COND_E;  return true;
+        case BINARY_OP_NE:  *cond = COND_NE; return true;
+        default:            return false;
+    }
+}
+
+void generate_branch(struct Expression* expr, struct Context* ctx, bool when, size_t target);
+
+static void generate_comparison(enum Condition cond, int left, struct MirOperand right, int out, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+    emit(mf, MIR_CMP, right, mop_reg(left, right.size));
+    emit_setcc(mf, cond, out);
+    emit(mf, MIR_MOVZB, mop_reg(out, 1), mop_reg(out, 4));
+}
+
+// multiplier and shift for signed division by `d` >= 2, see Hacker's Delight 10-1
+static void signed_magic(uint32_t d, int32_t* multiplier, int* shift) {
+    const uint32_t two31 = 0x80000000u;
+    uint32_t anc = two31 - 1 - two31 % d;
+    uint32_t q1 = two31 / anc;
+    uint32_t r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / d;
+    uint32_t r2 = two31 - q2 * d;
+    uint32_t delta;
+    int p = 31;
+
+    do {
+        p += 1;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1 += 1;
+            r1 -= anc;
         }
 
-        case EXPR_INDEX: {
-            size_t r = alloc_register(&ctx->allocator);
-            struct LValue lval_location = generate_lvalue(expr->expr_index.location, scope, func, ctx, buffer);
-            struct LValue lval_index;
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d) {
+            q2 += 1;
+            r2 -= d;
+        }
+
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    *multiplier = (int32_t) (q2 + 1);
+    *shift = p - 32;
+}
 
-            if (lval_location.r_expr != -1) {
-                lval_index = lval_location;
-                lval_location = generate_lvalue(expr->expr_index.expression, scope, func, ctx, buffer);
+// quotient of `dividend` by a constant 2 <= `d`, rounded towards zero
+static int generate_constant_quotient(int dividend, uint32_t d, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+    int q = new_vreg(mf);
+
+    if ((d & (d - 1)) == 0) {
+        // negative dividends are biased by d - 1 so the shift rounds towards zero
+        int k = __builtin_ctz(d);
+        emit(mf, MIR_MOV, mop_reg(dividend, 4), mop_reg(q, 4));
+        if (k > 1) emit(mf, MIR_SAR, mop_imm(31, 1), mop_reg(q, 4));
+        emit(mf, MIR_SHR, mop_imm(32 - k, 1), mop_reg(q, 4));
+        emit(mf, MIR_ADD, mop_reg(dividend, 4), mop_reg(q, 4));
+        emit(mf, MIR_SAR, mop_imm(k, 1), mop_reg(q, 4));
+        return q;
+    }
+
+    int32_t multiplier;
+    int shift;
+    signed_magic(d, &multiplier, &shift);
+
+    // high half of the 64-bit product
+    emit(mf, MIR_MOVSX, mop_reg(dividend, 4), mop_reg(q, 8));
+    emit(mf, MIR_IMUL, mop_imm(multiplier, 4), mop_reg(q, 8));
+    if (multiplier >= 0) {
+        emit(mf, MIR_SAR, mop_imm(32 + shift, 1), mop_reg(q, 8));
+    } else {
+        // the multiplier wrapped negative, add the dividend back once
+        emit(mf, MIR_SAR, mop_imm(32, 1), mop_reg(q, 8));
+        emit(mf, MIR_ADD, mop_reg(dividend, 4), mop_reg(q, 4));
+        if (shift > 0) emit(mf, MIR_SAR, mop_imm(shift, 1), mop_reg(q, 4));
+    }
+
+    // round towards zero: add one for negative dividends
+    int sign = new_vreg(mf);
+    emit(mf, MIR_MOV, mop_reg(dividend, 4), mop_reg(sign, 4));
+    emit(mf, MIR_SHR, mop_imm(31, 1), mop_reg(sign, 4));
+    emit(mf, MIR_ADD, mop_reg(sign, 4), mop_reg(q, 4));
+    return q;
+}
+
+// `/` and `%`: constant divisors are strength reduced, others use idivl
+static int generate_division(enum BinaryOperation op, int dividend, struct MirOperand divisor, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+    bool modulo = op == BINARY_OP_MOD;
+    int r = new_vreg(mf);
+
+    if (divisor.kind == MOP_IMM && divisor.imm != 0 && divisor.imm != INT32_MIN) {
+        int32_t d = divisor.imm;
+        uint32_t magnitude = d < 0 ? -(uint32_t) d : (uint32_t) d;
+
+        if (magnitude == 1) {
+            if (modulo) {
+                emit(mf, MIR_MOV, mop_imm(0, 4), mop_reg(r, 4));
             } else {
-                lval_index.offset = -1;
-                lval_index.r_index = -1;
-                lval_index.r_address = -1;
-                lval_index.r_expr = generate_expr(expr->expr_index.expression, scope, func, ctx, buffer);
+                emit(mf, MIR_MOV, mop_reg(dividend, 4), mop_reg(r, 4));
+                if (d < 0) emit(mf, MIR_NEG, mop_none(), mop_reg(r, 4));
             }
 
-            strfmt(buffer, "\tmovl %%%sd, %%eax\n", ctx->allocator.scratch[lval_index.r_expr]);
-            free_register(&ctx->allocator, lval_index.r_expr);
+            return r;
+        }
 
-            strapp(buffer, "\tcltq\n");
-            if (lval_location.r_address == -1) {
-                strfmt(buffer, "\tmovl -%i(%%rbp,%%rax,4), %%%sd\n", lval_location.offset, ctx->allocator.scratch[r]);
-            } else {
-                strfmt(buffer, "\tmovl (%%%s,%%%s,4), %%%sd\n", ctx->allocator.scratch[lval_location.r_address], ctx->allocator.scratch[lval_location.r_index], ctx->allocator.scratch[r]);
-                free_register(&ctx->allocator, lval_index.r_index);
-                free_register(&ctx->allocator, lval_index.r_address);
+        int q = generate_constant_quotient(dividend, magnitude, ctx);
+        if (modulo) {
+            // the remainder takes the sign of the dividend only
+            q = generate_constant_product(q, magnitude, 4, ctx);
+            emit(mf, MIR_MOV, mop_reg(dividend, 4), mop_reg(r, 4));
+            emit(mf, MIR_SUB, mop_reg(q, 4), mop_reg(r, 4));
+            return r;
+        }
+
+        if (d < 0) emit(mf, MIR_NEG, mop_none(), mop_reg(q, 4));
+        return q;
+    }
+
+    if (divisor.kind == MOP_IMM) {
+        int d = new_vreg(mf);
+        emit(mf, MIR_MOV, divisor, mop_reg(d, 4));
+        divisor = mop_reg(d, 4);
+    }
+
+    emit(mf, MIR_MOV, mop_reg(dividend, 4), mop_reg(REG_RAX, 4));
+    emit(mf, MIR_CLTD, mop_none(), mop_none());
+    emit(mf, MIR_IDIV, mop_none(), divisor);
+    emit(mf, MIR_MOV, mop_reg(modulo ? REG_RDX : REG_RAX, 4), mop_reg(r, 4));
+    return r;
+}
+
+int generate_expr(struct Expression* expr, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+
+    switch (expr->kind) {
+        case EXPR_VARIABLE: {
+            struct Variable* var = expr->expr_variable.variable;
+            if (var->vreg != REG_NONE) {
+                return var->vreg;
             }
 
+            // arrays decay to the address of their first element
+            int r = new_vreg(mf);
+            struct MirOperand slot = mop_mem(REG_RBP, REG_NONE, 1, -(int32_t) var->offset, type_value_size(var->type));
+            emit(mf, var->type->kind == TYPE_KIND_ARRAY ? MIR_LEA : MIR_MOV, slot, mop_reg(r, slot.size));
+            return r;
+        }
+
+        case EXPR_INDEX: {
+            struct LValue lval = generate_lvalue(expr, ctx);
+            if (lval.vreg != REG_NONE) {
+                return lval.vreg;
+            }
+
+            int r = new_vreg(mf);
+            emit(mf, MIR_MOV, lval.memory, mop_reg(r, lval.memory.size));
             return r;
         }
 
         case EXPR_ADDRESS_OF: {
-            struct LValue lval = generate_lvalue(expr->expr_address_of.expression, scope, func, ctx, buffer);
-            if (lval.r_address == -1)  {
-                size_t r = alloc_register(&ctx->allocator);
-                strfmt(buffer, "\tleaq -%i(%%rbp), %%%s\n", lval.offset, ctx->allocator.scratch[r]);
-                return r;
-            } else {
-                return lval.r_address;
+            struct LValue lval = generate_lvalue(expr->expr_address_of.expression, ctx);
+            if (lval.vreg != REG_NONE) {
+                printf("cannot take the address of a register value\n");
+                return lval.vreg;
             }
+
+            int r = new_vreg(mf);
+            emit(mf, MIR_LEA, lval.memory, mop_reg(r, 8));
+            return r;
         }
 
         case EXPR_ASSIGNMENT: {
-            struct LValue lval = generate_lvalue(expr->expr_assignment.location, scope, func, ctx, buffer);
-            size_t r = generate_expr(expr->expr_assignment.expression, scope, func, ctx, buffer);
-            
-            if (lval.r_index != -1) {
-                // stack array
-                strfmt(buffer, "\tmovl %%%sd, %%eax\n", ctx->allocator.scratch[lval.r_index]);
-                free_register(&ctx->allocator, lval.r_index);
-                
-                strfmt(buffer, "\tmovl %%%sd, -%i(%%rbp,%%rax,4)\n", ctx->allocator.scratch[r], lval.offset);
-            } else if (lval.r_address == -1)  {
-                // stack
-                strfmt(buffer, "\tmovl %%%sd, -%i(%%rbp)\n", ctx->allocator.scratch[r], lval.offset);
-            } else {
-                // heap/stack
-                strfmt(buffer, "\tmovl %%%sd, (%%%s)\n", ctx->allocator.scratch[r], ctx->allocator.scratch[lval.r_address]);
+            struct MirOperand value = generate_assignment(expr, ctx);
+            if (value.kind == MOP_REG) {
+                return value.reg;
             }
 
+            int r = new_vreg(mf);
+            emit(mf, MIR_MOV, value, mop_reg(r, value.size));
             return r;
         }
 
-        // case EXPR_ASSIGNMENT_INDEX: {
-        //     size_t r = generate_expr(expr->expr_assignment_index.expression, scope, func, ctx, buffer);
-        //     size_t r_index_offset = generate_expr(expr->expr_assignment_index.index_expression, scope, func, ctx, buffer);
-        //     size_t stack_offset = calc_var_offset(&func->scope, expr->expr_assignment_index.variable, NULL);
-        //     strfmt(buffer, "\tmovl %%%sd, %%eax\n", ctx->allocator.scratch[r_index_offset], stack_offset);
-        //     free_register(&ctx->allocator, r_index_offset);
-
-        //     strapp(buffer, "\tcltq\n");
-        //     strfmt(buffer, "\tmovl %%%sd, -%i(%%rbp,%%rax,4)\n", ctx->allocator.scratch[r], stack_offset);
-        //     return r;
-        // }
-
-        // case EXPR_ASSIGNMENT_POINTER: {
-        //     size_t r = generate_expr(expr->expr_assignment_pointer.expression, scope, func, ctx, buffer);
-        //     size_t r_memory_address = generate_expr(expr->expr_assignment_pointer.expression, scope, func, ctx, buffer);
-        //     size_t offset = calc_var_offset(&func->scope, expr->expr_assignment_pointer.variable, NULL);
-        //     strfmt(buffer, "\tmovq -%i(%%rbp), %%%s\n", offset, ctx->allocator.scratch[r_memory_address]);
-        //     strfmt(buffer, "\tmovl %%%sd, (%%%s)\n", ctx->allocator.scratch[r], ctx->allocator.scratch[r_memory_address]);
-        //     free_register(&ctx->allocator, r_memory_address);
-
-        //     return r;
-        // }
-
         case EXPR_LITERAL: {
             struct ExprLiteral* lit = &expr->expr_literal;
             switch (lit->type->kind) {
@@ -270,8 +513,8 @@ size_t generate_expr(struct Expression* expr, struct Scope* scope, struct Functi
                         }
 
                         case TYPE_I32: {
-                            size_t r = alloc_register(&ctx->allocator);
-                            strfmt(buffer, "\tmovl $%s, %%%sd\n", expr->expr_literal.value, ctx->allocator.scratch[r]);
+                            int r = new_vreg(mf);
+                            emit(mf, MIR_MOV, generate_operand(expr, ctx), mop_reg(r, 4));
                             return r;
                         }
 
@@ -289,65 +532,38 @@ size_t generate_expr(struct Expression* expr, struct Scope* scope, struct Functi
                 // TODO:
                 case TYPE_KIND_ARRAY:
                     break;
+
+                // TODO:
+                case TYPE_KIND_POINTER:
+                    break;
             }
 
-            return -1;
+            return REG_NONE;
         }
 
         case EXPR_CALL: {
-            // store scratch registers
-            for (int i = 0; i < ctx->allocator.scratch_count; i++) {
-                if (ctx->allocator.scratch_state[i] != 0) {
-                    strfmt(buffer, "\tpushq %%%s\n", ctx->allocator.scratch[i]);
-                }
+            struct Function* callee = expr->expr_call.func;
+            if (callee == NULL) {
+                return REG_NONE;
             }
 
-            // load args into arg registers
-            for (int i = 0; i < expr->expr_call.args_length; i++) {
-                size_t r = generate_expr(expr->expr_call.args[i], scope, func, ctx, buffer);
-                strfmt(buffer, "\tmovl %%%sd, %%e%s\n", ctx->allocator.scratch[r], ctx->allocator.argument[i]);
-                free_register(&ctx->allocator, r);
+            // evaluate every argument before pinning any argument register
+            size_t args_length = expr->expr_call.args_length;
+            struct MirOperand args[args_length + 1];
+            for (int i = 0; i < args_length; i++) {
+                args[i] = generate_operand(expr->expr_call.args[i], ctx);
             }
 
-            // call function
-            strfmt(buffer, "\tcall %s\n", expr->expr_call.func->identifier);
-
-            // restore scratch registers
-            for (int i = 0; i < ctx->allocator.scratch_count; i++) {
-                if (ctx->allocator.scratch_state[i] != 0) {
-                    strfmt(buffer, "\tpopq %%%s\n", ctx->allocator.scratch[i]);
-                }
-            }
-
-            size_t r = alloc_register(&ctx->allocator);
-            struct Type* return_type = expr->expr_call.func->return_type;
-            switch (return_type->kind) {
-                case TYPE_KIND_BASIC: {
-                    switch (return_type->basic) {
-                        case TYPE_VOID:
-                            break;
-
-                        case TYPE_I32:
-                            strfmt(buffer, "\tmovl %%eax, %%%sd\n", ctx->allocator.scratch[r]);
-                            break;
-
-                        case TYPE_F32:
-                            break;
-                    }
-                    break;
-                }
-
-                case TYPE_KIND_COMPOUND: {
+            emit_call(mf, callee->identifier, emit_call_arguments(mf, args, args_length));
 
-                    break;
-                }
-
-                case TYPE_KIND_ARRAY: {
-
-                    break;
-                }
+            struct Type* return_type = callee->return_type;
+            if (return_type->kind == TYPE_KIND_BASIC && return_type->basic == TYPE_VOID) {
+                return REG_NONE;
             }
 
+            int size = type_value_size(return_type);
+            int r = new_vreg(mf);
+            emit(mf, MIR_MOV, mop_reg(REG_RAX, size), mop_reg(r, size));
             return r;
         }
 
@@ -355,322 +571,564 @@ size_t generate_expr(struct Expression* expr, struct Scope* scope, struct Functi
             struct ExprBinaryOp* bin_op = &expr->expr_binary_op;
             switch (bin_op->kind) {
                 // logical
-                case BINARY_OP_AND: {
-                    size_t r1 = generate_expr(bin_op->left, scope, func, ctx, buffer);
-                    size_t r2 = generate_expr(bin_op->right, scope, func, ctx, buffer);
-
-                    strfmt(buffer, "\tcmpl $1, %%%sd\n", ctx->allocator.scratch[r1]);
-                    strfmt(buffer, "\tjne .L%zu\n", ctx->free_label);
-
-                    strfmt(buffer, "\tcmpl $1, %%%sd\n", ctx->allocator.scratch[r2]);
-                    strfmt(buffer, "\tjne .L%zu\n", ctx->free_label);
-
-                    strfmt(buffer, "\tmovl $1, %%%sd\n", ctx->allocator.scratch[r1]);
-                    strfmt(buffer, "\tjmp .L%zu\n", ctx->free_label + 1);
-
-                    strfmt(buffer, ".L%zu:\n", ctx->free_label);
-                    ctx->free_label += 1;
-
-                    strfmt(buffer, "\tmovl $0, %%%sd\n", ctx->allocator.scratch[r1]);
-                    strfmt(buffer, ".L%zu:\n", ctx->free_label);
-                    ctx->free_label += 1;
-
-                    free_register(&ctx->allocator, r2);
-                    return r1;
-                }
-
+                case BINARY_OP_AND:
                 case BINARY_OP_OR: {
-                    size_t r1 = generate_expr(bin_op->left, scope, func, ctx, buffer);
-                    size_t r2 = generate_expr(bin_op->right, scope, func, ctx, buffer);
-
-                    strfmt(buffer, "\tcmpl $1, %%%sd\n", ctx->allocator.scratch[r1]);
-                    strfmt(buffer, "\tje .L%zu\n", ctx->free_label);
-
-                    strfmt(buffer, "\tcmpl $1, %%%sd\n", ctx->allocator.scratch[r2]);
-                    strfmt(buffer, "\tje .L%zu\n", ctx->free_label);
-
-                    strfmt(buffer, "\tmovl $0, %%%sd\n", ctx->allocator.scratch[r1]);
-                    strfmt(buffer, "\tjmp .L%zu\n", ctx->free_label + 1);
-
-                    strfmt(buffer, ".L%zu:\n", ctx->free_label);
-                    ctx->free_label += 1;
-
-                    strfmt(buffer, "\tmovl $1, %%%sd\n", ctx->allocator.scratch[r1]);
-
-                    strfmt(buffer, ".L%zu:\n", ctx->free_label);
-                    ctx->free_label += 1;
-
-                    free_register(&ctx->allocator, r2);
-                    return r1;
+                    int r = new_vreg(mf);
+                    size_t label_false = new_label(mf, NULL);
+                    size_t label_end = new_label(mf, NULL);
+
+                    generate_branch(expr, ctx, false, label_false);
+                    emit(mf, MIR_MOV, mop_imm(1, 4), mop_reg(r, 4));
+                    emit_jmp(mf, label_end);
+
+                    emit_label(mf, label_false);
+                    emit(mf, MIR_MOV, mop_imm(0, 4), mop_reg(r, 4));
+                    emit_label(mf, label_end);
+                    return r;
                 }
+
+                default:
+                    break;
             }
 
-            size_t r1 = generate_expr(bin_op->left, scope, func, ctx, buffer);
-            size_t r2 = generate_expr(bin_op->right, scope, func, ctx, buffer);
+            int r1 = generate_expr(bin_op->left, ctx);
+            struct MirOperand r2 = generate_operand(bin_op->right, ctx);
+            int r = new_vreg(mf);
+
             switch (bin_op->kind) {
                 // math
                 case BINARY_OP_ADD:
-                    strfmt(buffer, "\taddl %%%sd, %%%sd\n", ctx->allocator.scratch[r2], ctx->allocator.scratch[r1]);
+                    emit(mf, MIR_MOV, mop_reg(r1, 4), mop_reg(r, 4));
+                    emit(mf, MIR_ADD, r2, mop_reg(r, 4));
                     break;
 
                 case BINARY_OP_SUB:
-                    strfmt(buffer, "\tsubl %%%sd, %%%sd\n", ctx->allocator.scratch[r2], ctx->allocator.scratch[r1]);
+                    emit(mf, MIR_MOV, mop_reg(r1, 4), mop_reg(r, 4));
+                    emit(mf, MIR_SUB, r2, mop_reg(r, 4));
                     break;
 
                 case BINARY_OP_DIV:
-                    // TODO: division is hard :\
-                    break;
+                case BINARY_OP_MOD:
+                    return generate_division(bin_op->kind, r1, r2, ctx);
 
                 case BINARY_OP_MUL:
-                    strfmt(buffer, "\timull %%%sd, %%%sd\n", ctx->allocator.scratch[r2], ctx->allocator.scratch[r1]);
+                    if (r2.kind == MOP_IMM) {
+                        return generate_constant_product(r1, r2.imm, 4, ctx);
+                    }
+
+                    emit(mf, MIR_MOV, mop_reg(r1, 4), mop_reg(r, 4));
+                    emit(mf, MIR_IMUL, r2, mop_reg(r, 4));
                     break;
 
                 // relational
                 case BINARY_OP_LT:
-                    generate_logical_op("l", r1, r2, ctx, buffer);
+                    generate_comparison(COND_L, r1, r2, r, ctx);
                     break;
 
                 case BINARY_OP_GT:
-                    generate_logical_op("g", r1, r2, ctx, buffer);
+                    generate_comparison(COND_G, r1, r2, r, ctx);
                     break;
 
                 case BINARY_OP_LET:
-                    generate_logical_op("le", r1, r2, ctx, buffer);
+                    generate_comparison(COND_LE, r1, r2, r, ctx);
                     break;
 
                 case BINARY_OP_GET:
-                    generate_logical_op("ge", r1, r2, ctx, buffer);
+                    generate_comparison(COND_GE, r1, r2, r, ctx);
                     break;
 
                 // equality
                 case BINARY_OP_EQ:
-                    generate_logical_op("e", r1, r2, ctx, buffer);
+                    generate_comparison(COND_E, r1, r2, r, ctx);
                     break;
 
                 case BINARY_OP_NE:
-                    generate_logical_op("ne", r1, r2, ctx, buffer);
+                    generate_comparison(COND_NE, r1, r2, r, ctx);
                     break;
-                }
 
-            free_register(&ctx->allocator, r2);
-            return r1;
+                default:
+                    break;
+            }
+
+            return r;
+        }
+    }
+
+    return REG_NONE;
+}
+
+// jumps to `target` if the truth of `expr` equals `when`, falls through otherwise;
+// comparisons branch on the flags directly and logical operators short-circuit
+void generate_branch(struct Expression* expr, struct Context* ctx, bool when, size_t target) {
+    struct MirFunction* mf = &ctx->mir;
+
+    if (expr->kind == EXPR_BIN_OP) {
+        struct ExprBinaryOp* bin_op = &expr->expr_binary_op;
+
+        enum Condition cond;
+        if (comparison_condition(bin_op->kind, &cond)) {
+            int left = generate_expr(bin_op->left, ctx);
+            struct MirOperand right = generate_operand(bin_op->right, ctx);
+            emit(mf, MIR_CMP, right, mop_reg(left, right.size));
+            emit_jcc(mf, when ? cond : negate_condition(cond), target);
+            return;
+        }
+
+        if (bin_op->kind == BINARY_OP_AND || bin_op->kind == BINARY_OP_OR) {
+            // `a && b` is false as soon as `a` is, `a || b` true as soon as `a` is
+            bool decides = bin_op->kind == BINARY_OP_OR;
+            if (when == decides) {
+                generate_branch(bin_op->left, ctx, when, target);
+                generate_branch(bin_op->right, ctx, when, target);
+            } else {
+                size_t label_skip = new_label(mf, NULL);
+                generate_branch(bin_op->left, ctx, decides, label_skip);
+                generate_branch(bin_op->right, ctx, when, target);
+                emit_label(mf, label_skip);
+            }
+
+            return;
         }
     }
 
-    return -1;
+    int r = generate_expr(expr, ctx);
+    emit(mf, MIR_CMP, mop_imm(0, 4), mop_reg(r, value_size(expr)));
+    emit_jcc(mf, when ? COND_NE : COND_E, target);
 }
 
-void generate_statement(struct Statement* stmt, struct Scope* scope, struct Function* func, struct Context* ctx, char** buffer);
+// `return f(...)` as a jump to f with this frame torn down, or as a jump
+// back to the start with new parameters when f is the function itself;
+// false when the call has to return here, which includes calls with stack
+// arguments, as those would go where the caller's own are
+static bool generate_tail_call(struct Expression* expr, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+    struct Function* callee = expr->expr_call.func;
+    struct Function* func = ctx->function;
+    size_t args_length = expr->expr_call.args_length;
+    if (!ctx->tail_calls || callee == NULL || args_length > mf->argument_count) {
+        return false;
+    }
+
+    struct MirOperand args[args_length + 1];
+    for (int i = 0; i < args_length; i++) {
+        args[i] = generate_operand(expr->expr_call.args[i], ctx);
+    }
+
+    if (strcmp(callee->identifier, func->identifier) == 0 && args_length == func->params_length) {
+        // every argument is copied out before any parameter is overwritten
+        int copies[args_length + 1];
+        for (int i = 0; i < args_length; i++) {
+            copies[i] = new_vreg(mf);
+            emit(mf, MIR_MOV, args[i], mop_reg(copies[i], args[i].size));
+        }
+
+        for (int i = 0; i < args_length; i++) {
+            int size = type_value_size(func->params[i]->type);
+            emit(mf, MIR_MOV, mop_reg(copies[i], size), mop_reg(func->params[i]->vreg, size));
+        }
+
+        emit_jmp(mf, ctx->start_label);
+        return true;
+    }
+
+    emit_tail_call(mf, callee->identifier, emit_call_arguments(mf, args, args_length));
+    return true;
+}
 
-void generate_scope(struct Scope* scope, struct Function* func, struct Context* ctx, char** buffer) {
+void generate_statement(struct Statement* stmt, struct Function* func, struct Context* ctx);
+
+void generate_scope(struct Scope* scope, struct Function* func, struct Context* ctx) {
     for (int i = 0; i < scope->statements_length; i++) {
         struct Statement* stmt = scope->statements[i];
-        generate_statement(stmt, scope, func, ctx, buffer);
+        generate_statement(stmt, func, ctx);
     }
 }
 
-void generate_statement(struct Statement* stmt, struct Scope* scope, struct Function* func, struct Context* ctx, char** buffer) {
+void generate_statement(struct Statement* stmt, struct Function* func, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+
     switch (stmt->kind) {
         case STMT_COMPOUND: {
             struct Scope* compound_scope = &stmt->stmt_compound.scope;
-            generate_scope(compound_scope, func, ctx, buffer);
+            generate_scope(compound_scope, func, ctx);
             break;
         }
 
         case STMT_GOTO: {
-            strfmt(buffer, "\tjmp %s\n", stmt->stmt_goto.label);
+            emit_jmp(mf, user_label(ctx, stmt->stmt_goto.label));
             break;
         }
 
         case STMT_LABEL: {
-            strfmt(buffer, "%s:\n", stmt->stmt_label.label);
-            generate_scope(&stmt->stmt_label.scope, func, ctx, buffer);
+            emit_label(mf, user_label(ctx, stmt->stmt_label.label));
+            generate_scope(&stmt->stmt_label.scope, func, ctx);
             break;
         }
-        
+
         case STMT_IF:
         case STMT_IF_ELSE: {
-            size_t r = generate_expr(&stmt->stmt_if.condition_expr, scope, func, ctx, buffer);
-            strfmt(buffer, "\tcmpl $1, %%%sd\n", ctx->allocator.scratch[r]);
-            free_register(&ctx->allocator, r);
+            struct Expression* condition = &stmt->stmt_if.condition_expr;
 
             if (stmt->kind == STMT_IF_ELSE) {
-                size_t label_else = ctx->free_label;
-                ctx->free_label += 1;
+                size_t label_else = new_label(mf, NULL);
+                size_t label_end = new_label(mf, NULL);
 
-                size_t label_end = ctx->free_label;
-                ctx->free_label += 1;
+                generate_branch(condition, ctx, false, label_else);
 
-                strfmt(buffer, "\tjne .L%zu\n", label_else);
+                generate_scope(&stmt->stmt_if.success_scope, func, ctx);
+                emit_jmp(mf, label_end);
 
-                generate_scope(&stmt->stmt_if.success_scope, func, ctx, buffer);
-                strfmt(buffer, "\tjmp .L%zu\n", label_end);
+                emit_label(mf, label_else);
+                generate_scope(&stmt->stmt_if.failure_scope, func, ctx);
 
-                strfmt(buffer, ".L%zu:\n", label_else);
-                generate_scope(&stmt->stmt_if.failure_scope, func, ctx, buffer);
-
-                strfmt(buffer, ".L%zu:\n", label_end);
+                emit_label(mf, label_end);
             } else {
-                size_t label_end = ctx->free_label;
-                ctx->free_label += 1;
+                size_t label_end = new_label(mf, NULL);
 
-                strfmt(buffer, "\tjne .L%zu\n", label_end);
-                generate_scope(&stmt->stmt_if.success_scope, func, ctx, buffer);
+                generate_branch(condition, ctx, false, label_end);
+                generate_scope(&stmt->stmt_if.success_scope, func, ctx);
 
-                strfmt(buffer, ".L%zu:\n", label_end);
+                emit_label(mf, label_end);
             }
 
             break;
         }
 
         case STMT_RETURN: {
-            size_t r = generate_expr(&stmt->stmt_return.expr, scope, func, ctx, buffer);
-            strfmt(buffer, "\tmovl %%%sd, %%eax\n", ctx->allocator.scratch[r]);
-            free_register(&ctx->allocator, r);
-
-            strfmt(buffer, "\tjmp .%s_exit\n", func->identifier);
-            // strfmt(buffer, "\taddq $%zu, %%rsp\n", ctx->frame_size);
-            // strapp(buffer, "\tpopq %rbp\n");
-            // strapp(buffer, "\tretq\n");
+            if (stmt->stmt_return.expr.kind == EXPR_CALL && generate_tail_call(&stmt->stmt_return.expr, ctx)) {
+                break;
+            }
+
+            struct MirOperand value = generate_operand(&stmt->stmt_return.expr, ctx);
+            if (value.kind != MOP_REG || value.reg != REG_NONE) {
+                emit(mf, MIR_MOV, value, mop_reg(REG_RAX, value.size));
+            }
+
+            emit_jmp(mf, ctx->exit_label);
             break;
         }
 
         case STMT_EXPRESSION: {
-            size_t r = generate_expr(&stmt->stmt_expression.expr, scope, func, ctx, buffer);
-            free_register(&ctx->allocator, r);
+            struct Expression* expr = &stmt->stmt_expression.expr;
+            if (expr->kind == EXPR_ASSIGNMENT) {
+                generate_assignment(expr, ctx);
+            } else {
+                generate_expr(expr, ctx);
+            }
             break;
         }
-    }
-}
 
-size_t calc_scope_frame_size(struct Scope* scope) {
-    size_t frame_size = 0;
-    for (int j = 0; j < scope->variables_length; j++) frame_size += type_size(scope->variables[j]->type);
-    for (int j = 0; j < scope->statements_length; j++) {
-        switch (scope->statements[j]->kind) {
-            case STMT_COMPOUND:
-                frame_size += calc_scope_frame_size(&scope->statements[j]->stmt_compound.scope);
+        case STMT_SWITCH: {
+            // compares against every case in turn, the SSA path builds real dispatch
+            struct StmtSwitch* switch_stmt = &stmt->stmt_switch;
+            int value = generate_expr(&switch_stmt->value, ctx);
+            int size = value_size(&switch_stmt->value);
+
+            size_t* case_labels = arena_alloc(&ctx->arena, sizeof(size_t) * (switch_stmt->cases_length + 1));
+            size_t label_end = new_label(mf, NULL);
+            size_t label_default = label_end;
+
+            for (size_t i = 0; i < switch_stmt->cases_length; i++) {
+                struct StmtCase* case_stmt = &switch_stmt->cases[i]->stmt_case;
+                case_labels[i] = new_label(mf, NULL);
+
+                int32_t case_constant;
+                if (case_stmt->is_default) {
+                    label_default = case_labels[i];
+                } else if (case_value(case_stmt, &case_constant)) {
+                    emit(mf, MIR_CMP, mop_imm(case_constant, size), mop_reg(value, size));
+                    emit_jcc(mf, COND_E, case_labels[i]);
+                } else {
+                    printf("case label does not reduce to an integer constant\n");
+                }
+            }
+
+            emit_jmp(mf, label_default);
+
+            struct StmtSwitch* outer_switch = ctx->switch_stmt;
+            size_t* outer_labels = ctx->case_labels;
+            size_t outer_break = ctx->break_label;
+            ctx->switch_stmt = switch_stmt;
+            ctx->case_labels = case_labels;
+            ctx->break_label = label_end + 1;
+
+            generate_scope(&switch_stmt->scope, func, ctx);
+
+            ctx->switch_stmt = outer_switch;
+            ctx->case_labels = outer_labels;
+            ctx->break_label = outer_break;
+
+            emit_label(mf, label_end);
+            break;
+        }
+
+        case STMT_CASE: {
+            struct StmtSwitch* switch_stmt = ctx->switch_stmt;
+            for (size_t i = 0; switch_stmt != NULL && i < switch_stmt->cases_length; i++) {
+                if (switch_stmt->cases[i] == stmt) emit_label(mf, ctx->case_labels[i]);
+            }
+            break;
+        }
+
+        case STMT_BREAK:
+            if (ctx->break_label == 0) {
+                printf("`break` outside of a loop or switch\n");
                 break;
+            }
 
-            case STMT_IF:
-                frame_size += calc_scope_frame_size(&scope->statements[j]->stmt_if.success_scope);
+            emit_jmp(mf, ctx->break_label - 1);
+            break;
+
+        case STMT_CONTINUE:
+            if (ctx->continue_label == 0) {
+                printf("`continue` outside of a loop\n");
                 break;
+            }
+
+            emit_jmp(mf, ctx->continue_label - 1);
+            break;
+
+        case STMT_WHILE:
+        case STMT_DO_WHILE: {
+            // the condition is tested at the bottom, so an iteration takes a
+            // single branch; a `while` jumps down to it first
+            struct StmtLoop* loop = &stmt->stmt_loop;
+            generate_scope(&loop->scope, func, ctx);
+
+            // `continue` still runs the step, which the first test skips
+            size_t label_body = new_label(mf, NULL);
+            size_t label_continue = new_label(mf, NULL);
+            size_t label_test = loop->has_step ? new_label(mf, NULL) : label_continue;
+            size_t label_end = new_label(mf, NULL);
+            if (stmt->kind == STMT_WHILE && loop->has_condition) emit_jmp(mf, label_test);
+
+            size_t outer_break = ctx->break_label;
+            size_t outer_continue = ctx->continue_label;
+            ctx->break_label = label_end + 1;
+            ctx->continue_label = label_continue + 1;
+
+            emit_label(mf, label_body);
+            generate_scope(&loop->body, func, ctx);
+
+            ctx->break_label = outer_break;
+            ctx->continue_label = outer_continue;
+
+            emit_label(mf, label_continue);
+            if (loop->has_step) {
+                if (loop->step.kind == EXPR_ASSIGNMENT) {
+                    generate_assignment(&loop->step, ctx);
+                } else {
+                    generate_expr(&loop->step, ctx);
+                }
 
-            default: break;
+                emit_label(mf, label_test);
+            }
+
+            if (loop->has_condition) {
+                generate_branch(&loop->condition, ctx, true, label_body);
+            } else {
+                emit_jmp(mf, label_body);
+            }
+
+            emit_label(mf, label_end);
+            break;
         }
     }
+}
 
-    return frame_size;
+// the SysV ABI leaves the 128 bytes below %rsp alone, signal handlers included
+#define RED_ZONE_SIZE 128
+
+static bool is_leaf_function(struct MirFunction* mf) {
+    for (size_t i = 0; i < mf->insts_length; i++) {
+        if (mf->insts[i].op == MIR_CALL) return false;
+    }
+
+    return true;
 }
 
-char* generate(struct Unit* unit, struct Context* ctx) {
-    char* buffer = NULL;
-    strapp(&buffer,
-        "\t.text\n"
-        "\t.globl main\n"
-        "\t.type  main, @function\n"
-        "\n"
-        ".LC0:\n"
-        "\t.string\t\"%d\\n\"\n"
-        "\n"
-        ".LC1:\n"
-        "\t.string\t\"%c\"\n"
-        "\n"
-        ".LC2:\n"
-        "\t.string\t\"\\n\"\n"
-        "\n"
-        "printn_int:\n"
-        "\tpushq\t%rbp\n"
-        "\tmovq\t%rsp, %rbp\n"
-        "\tsubq\t$16, %rsp\n"
-        "\tmovl\t%edi, -4(%rbp)\n"
-        "\tmovl\t-4(%rbp), %eax\n"
-        "\tmovl\t%eax, %esi\n"
-        "\tleaq	.LC0(%rip), %rdi\n"
-        "\tmovl	$0, %eax\n"
-        "\tcall	printf@PLT\n"
-        "\tnop\n"
-        "\tleave\n"
-        "\tret\n"
-        "\n"
-        "print_char:\n"
-        "\tpushq\t%rbp\n"
-        "\tmovq\t%rsp, %rbp\n"
-        "\tsubq\t$16, %rsp\n"
-        "\tmovl\t%edi, -4(%rbp)\n"
-        "\tmovl\t-4(%rbp), %eax\n"
-        "\tmovl\t%eax, %esi\n"
-        "\tleaq	.LC1(%rip), %rdi\n"
-        "\tmovl	$0, %eax\n"
-        "\tcall	printf@PLT\n"
-        "\tnop\n"
-        "\tleave\n"
-        "\tret\n"
-        "\n"
-        "print_newline:\n"
-        "\tpushq\t%rbp\n"
-        "\tmovq\t%rsp, %rbp\n"
-        "\tsubq\t$16, %rsp\n"
-        "\tmovl\t-4(%rbp), %eax\n"
-        "\tmovl\t%eax, %esi\n"
-        "\tleaq	.LC2(%rip), %rdi\n"
-        "\tmovl	$0, %eax\n"
-        "\tcall	printf@PLT\n"
-        "\tnop\n"
-        "\tleave\n"
-        "\tret\n"
-    );
-
-    ctx->free_label = 0;
-
-    for (int i = 0; i < unit->scope.functions_length; i++) {
-        struct Function* func = unit->scope.functions[i];
-        if (func->prototype) continue;
-
-        free_all_registers(&ctx->allocator);
-        strfmt(&buffer, "\n%s:\n", func->identifier);
-
-        // save prevoius base pointer
-        strapp(&buffer, "\tpushq %rbp\n");
-        
-        // load current stack position as base
-        strapp(&buffer, "\tmovq %rsp, %rbp\n");
-
-        // calculate stack frame size
-        ctx->frame_size = calc_scope_frame_size(&func->scope);
-        for (int j = 0; j < func->params_length; j++) ctx->frame_size += type_size(func->params[j]->type);
-
-        // align stack frame to 16 bytes
-        if (ctx->frame_size % 16 != 0) {
-            ctx->frame_size += 16 - ctx->frame_size % 16;
-        }
+// frame operands are relative to %rbp, 8 bytes below %rsp at the entry,
+// which puts them `frame_size - 8` above %rsp once the frame is set up
+// without the frame pointer
+static void rebase_frame_operand(struct MirOperand* op, size_t frame_size) {
+    if (op->kind != MOP_MEM || op->mem.base != REG_RBP) return;
+    op->mem.base = REG_RSP;
+    op->mem.disp += (int32_t) frame_size - 8;
+}
 
-        // allocate stack space for locals and parameters
-        strfmt(&buffer, "\tsubq $%zu, %%rsp\n", ctx->frame_size);
+// restores what the prologue saved, up to the return or a tail call
+static void emit_epilogue(struct MirFunction* mf, size_t frame_size) {
+    for (int r = 0; r < REG_COUNT; r++) {
+        if (mf->saved_offsets[r] == 0) continue;
+        emit(mf, MIR_MOV, mop_mem(REG_RBP, REG_NONE, 1, -(int32_t) mf->saved_offsets[r], 8), mop_reg(r, 8));
+    }
 
-        // store function arguments
-        for (int j = 0; j < func->params_length; j++) {
-            size_t offset = calc_var_offset(&func->scope, func->params[j], NULL);
-            strfmt(&buffer, "\tmovl %%e%s, -%i(%%rbp)\n", ctx->allocator.argument[j], offset);
-        }
+    if (frame_size > 0) {
+        emit(mf, MIR_ADD, mop_imm(frame_size, 8), mop_reg(REG_RSP, 8));
+    }
 
-        // generate statements
-        for (int j = 0; j < func->scope.statements_length; j++) {
-            struct Statement* stmt = func->scope.statements[j];
-            generate_statement(stmt, &func->scope, func, ctx, &buffer);
+    if (!mf->omit_frame_pointer) {
+        emit(mf, MIR_POP, mop_none(), mop_reg(REG_RBP, 8));
+    }
+}
+
+// wraps the allocated body in the prologue and epilogue, now that the
+// frame size and the callee-saved registers in use are known
+static void insert_prologue_epilogue(struct MirFunction* mf) {
+    bool leaf = is_leaf_function(mf);
+    struct MirInst* body = mf->insts;
+    size_t body_length = mf->insts_length;
+    mf->insts = NULL;
+    mf->insts_length = 0;
+    mf->insts_capacity = 0;
+
+    // calls need %rsp 16-byte aligned and their stack arguments at the
+    // bottom, leaf frames that fit the red zone need no room below %rsp at
+    // all; without the pushed %rbp the return address alone leaves %rsp 8
+    // bytes off, and the frame starts 8 bytes further down
+    size_t frame_size = (mf->frame_size + mf->outgoing_size + 15) & ~(size_t) 15;
+    size_t red_zone_size = mf->omit_frame_pointer ? RED_ZONE_SIZE - 8 : RED_ZONE_SIZE;
+    if (leaf && mf->red_zone && mf->frame_size <= red_zone_size) {
+        frame_size = 0;
+    } else if (mf->omit_frame_pointer) {
+        frame_size += 8;
+    }
+
+    if (!mf->omit_frame_pointer) {
+        emit(mf, MIR_PUSH, mop_none(), mop_reg(REG_RBP, 8));
+        emit(mf, MIR_MOV, mop_reg(REG_RSP, 8), mop_reg(REG_RBP, 8));
+    }
+
+    if (frame_size > 0) {
+        emit(mf, MIR_SUB, mop_imm(frame_size, 8), mop_reg(REG_RSP, 8));
+    }
+
+    for (int r = 0; r < REG_COUNT; r++) {
+        if (mf->saved_offsets[r] == 0) continue;
+        emit(mf, MIR_MOV, mop_reg(r, 8), mop_mem(REG_RBP, REG_NONE, 1, -(int32_t) mf->saved_offsets[r], 8));
+    }
+
+    // the body ends with the exit label and a return, tail calls leave
+    // with the frame torn down as well
+    for (size_t i = 0; i + 1 < body_length; i++) {
+        if (body[i].op == MIR_TAIL_CALL) emit_epilogue(mf, frame_size);
+        *append_inst(mf) = body[i];
+    }
+
+    emit_epilogue(mf, frame_size);
+    if (mf->omit_frame_pointer) {
+        for (size_t i = 0; i < mf->insts_length; i++) {
+            rebase_frame_operand(&mf->insts[i].src, frame_size);
+            rebase_frame_operand(&mf->insts[i].dst, frame_size);
         }
+    }
+
+    emit(mf, MIR_RET, mop_none(), mop_none());
+}
+
+// resets the per-function state of `ctx`, the arena is reused for every function
+static void begin_function(struct Function* func, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+
+    free_arena(&ctx->arena);
+    init_mir_function(mf, &ctx->arena, func->identifier, ctx->free_label);
+    init_symbol_table(&ctx->labels);
+    ctx->switch_stmt = NULL;
+    ctx->case_labels = NULL;
+    ctx->break_label = 0;
+    ctx->continue_label = 0;
+    ctx->function = func;
+    ctx->tail_calls = false;
+    mf->argument_registers = argument_registers;
+    mf->argument_count = sizeof(argument_registers) / sizeof(argument_registers[0]);
+    mf->red_zone = ctx->red_zone;
+    mf->omit_frame_pointer = ctx->omit_frame_pointer;
+}
+
+// creates the exit label that returns jump to
+static void emit_function_entry(struct Function* func, struct Context* ctx) {
+    struct MirFunction* mf = &ctx->mir;
+    struct Arena* arena = &ctx->arena;
 
-        // add exit label (avoids code duplication, adds one jump)
-        strfmt(&buffer, ".%s_exit:\n", func->identifier);
+    // exit label (avoids code duplication, adds one jump)
+    char* exit_name = arena_alloc(arena, strlen(func->identifier) + 7);
+    sprintf(exit_name, ".%s_exit", func->identifier);
+    ctx->exit_label = new_label(mf, exit_name);
+}
+
+// prints the function as assembly, or encodes it into the object file
+static void output_function(struct Context* ctx, struct MirFunction* mf, struct Buffer* buffer) {
+    if (ctx->object != NULL) {
+        encode_function(ctx->object, mf);
+        return;
+    }
+
+    buffer_format(buffer, "\n%s:\n", mf->name);
+    print_mir_function(mf, buffer);
+}
 
-        // free stack space for locals and parameters
-        strfmt(&buffer, "\taddq $%zu, %%rsp\n", ctx->frame_size);
+// allocates registers for the body and outputs the finished function
+static void finish_function(struct Function* func, struct Context* ctx, size_t frame_size, struct Buffer* buffer) {
+    struct MirFunction* mf = &ctx->mir;
 
-        strapp(&buffer, "\tpopq %rbp\n");
-        strapp(&buffer, "\tretq\n");
+    // a return at the very end needs no jump to the exit label right after it
+    struct MirInst* last = mf->insts_length > 0 ? &mf->insts[mf->insts_length - 1] : NULL;
+    if (last != NULL && last->op == MIR_JMP && last->dst.label == ctx->exit_label) {
+        mf->insts_length -= 1;
     }
-    
-    return buffer;
+
+    emit_label(mf, ctx->exit_label);
+    emit(mf, MIR_RET, mop_none(), mop_none());
+
+    allocate_registers(mf, frame_size);
+    insert_prologue_epilogue(mf);
+    peephole_function(mf);
+
+    output_function(ctx, mf, buffer);
+    ctx->free_label += mf->label_count;
+}
+
+// generates code straight from the hir, one expression at a time
+void generate_function(struct Function* func, struct Context* ctx, struct Buffer* buffer) {
+    struct MirFunction* mf = &ctx->mir;
+    begin_function(func, ctx);
+
+    // scalars go to registers, everything else gets a frame slot
+    mf->vreg_count = promote_variables(func, REG_COUNT) - REG_COUNT;
+    size_t frame_size = layout_frame(func);
+    emit_function_entry(func, ctx);
+
+    // receive function arguments, the ones on the stack go through a register
+    for (int j = 0; j < func->params_length; j++) {
+        struct Variable* param = func->params[j];
+        int size = type_value_size(param->type);
+        struct MirOperand incoming;
+
+        if (j < mf->argument_count) {
+            incoming = mop_reg(mf->argument_registers[j], size);
+        } else {
+            struct MirOperand slot = mop_mem(REG_RBP, REG_NONE, 1, STACK_ARGUMENTS_OFFSET + 8 * (j - mf->argument_count), size);
+            incoming = mop_reg(param->vreg != REG_NONE ? param->vreg : new_vreg(mf), size);
+            emit(mf, MIR_MOV, slot, incoming);
+        }
+
+        if (param->vreg != REG_NONE) {
+            if (incoming.reg != param->vreg) emit(mf, MIR_MOV, incoming, mop_reg(param->vreg, size));
+        } else {
+            emit(mf, MIR_MOV, incoming, mop_mem(REG_RBP, REG_NONE, 1, -(int32_t) param->offset, size));
+        }
+    }
+
+    // without frame variables every parameter is in a register
+    ctx->tail_calls = frame_size == 0 && func->params_length <= mf->argument_count;
+    if (ctx->tail_calls) {
+        ctx->start_label = new_label(mf, NULL);
+        emit_label(mf, ctx->start_label);
+    }
+
+    // generate statements
+    generate_scope(&func->scope, func, ctx);
+    finish_function(func, ctx, frame_size, buffer);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,361 @@
+#ifndef CFCC_DCE_C
+#define CFCC_DCE_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.c"
+#include "ir.c"
+#include "pass.c"
+#include "symbol.c"
+
+// Dead code elimination: branches on constants become jumps, blocks no path
+// reaches from the entry are dropped (gotos and labels are ordinary edges by
+// now), jumps to blocks that only jump on are sent to the final target and
+// blocks with a single way in are merged into their predecessor. What is
+// left of the instructions only survives if something with a side effect
+// depends on it, and stores that nothing can read are dropped first.
+
+static bool evaluate_condition(enum Condition cond, int64_t a, int64_t b) {
+    switch (cond) {
+        case COND_E:  return a == b;
+        case COND_NE: return a != b;
+        case COND_L:  return a < b;
+        case COND_G:  return a > b;
+        case COND_LE: return a <= b;
+        case COND_GE: return a >= b;
+
+        // sign-extended 32-bit values order the same as 64-bit ones
+        case COND_B:  return (uint64_t) a < (uint64_t) b;
+        case COND_A:  return (uint64_t) a > (uint64_t) b;
+        case COND_BE: return (uint64_t) a <= (uint64_t) b;
+        case COND_AE: return (uint64_t) a >= (uint64_t) b;
+    }
+
+    return false;
+}
+
+// 0 or 1 for the target a branch always takes, -1 when that is not known
+static int constant_target(struct IrInst* branch) {
+    struct IrInst* condition = branch->operands[0];
+    if (branch->targets[0] == branch->targets[1]) return 0;
+    if (condition->op == IR_CONST) return condition->imm != 0 ? 0 : 1;
+
+    if (condition->op == IR_CMP && condition->operands[0]->op == IR_CONST && condition->operands[1]->op == IR_CONST) {
+        bool taken = evaluate_condition(condition->cond, condition->operands[0]->imm, condition->operands[1]->imm);
+        return taken ? 0 : 1;
+    }
+
+    return -1;
+}
+
+static bool fold_branches(struct IrFunction* fn) {
+    bool changed = false;
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        struct IrInst* term = ir_terminator(block);
+        if (term->op != IR_BRANCH) continue;
+
+        int taken = constant_target(term);
+        if (taken < 0) continue;
+
+        struct IrBlock* dropped = term->targets[1 - taken];
+        ir_remove_pred(dropped, ir_pred_index(dropped, block));
+
+        term->op = IR_JUMP;
+        term->targets[0] = term->targets[taken];
+        term->targets[1] = NULL;
+        term->operands_length = 0;
+        changed = true;
+    }
+
+    return changed;
+}
+
+static bool remove_unreachable_blocks(struct IrFunction* fn) {
+    // dominator computation numbers exactly the reachable blocks
+    ir_compute_dominators(fn);
+    if (fn->rpo_length == fn->blocks_length) return false;
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        if (block->order >= 0) continue;
+
+        struct IrBlock* succs[2];
+        int succs_length = ir_successors(block, succs);
+        for (int k = 0; k < succs_length; k++) {
+            int index = ir_pred_index(succs[k], block);
+            if (index >= 0) ir_remove_pred(succs[k], index);
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        if (fn->blocks[i]->order >= 0) fn->blocks[kept++] = fn->blocks[i];
+    }
+
+    fn->blocks_length = kept;
+    return true;
+}
+
+static bool is_phi_block(struct IrBlock* block) {
+    return block->insts_length > 0 && block->insts[0]->op == IR_PHI;
+}
+
+static bool is_jump_block(struct IrBlock* block) {
+    return block->insts_length == 1 && block->insts[0]->op == IR_JUMP;
+}
+
+// predecessors of a block that only jumps on jump to its target directly
+static bool thread_jumps(struct IrFunction* fn) {
+    bool changed = false;
+
+    for (size_t i = 1; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        if (!is_jump_block(block)) continue;
+
+        // chains are threaded from their far end, which also keeps cycles of jumps intact
+        struct IrBlock* target = block->insts[0]->targets[0];
+        if (target == block || is_jump_block(target)) continue;
+
+        for (size_t j = block->preds_length; j-- > 0;) {
+            if (j >= block->preds_length) continue;
+            struct IrBlock* pred = block->preds[j];
+
+            // the phis of the target could not tell the two edges from `pred` apart
+            if (is_phi_block(target) && ir_pred_index(target, pred) >= 0) continue;
+
+            struct IrInst* term = ir_terminator(pred);
+            int from = ir_pred_index(target, block);
+            for (int k = 0; k < 2; k++) {
+                if (term->targets[k] != block) continue;
+
+                term->targets[k] = target;
+                ir_add_pred(fn, target, pred);
+                for (size_t l = 0; l < target->insts_length && target->insts[l]->op == IR_PHI; l++) {
+                    struct IrInst* phi = target->insts[l];
+                    ir_add_operand(fn, phi, phi->operands[from]);
+                }
+
+                ir_remove_pred(block, ir_pred_index(block, pred));
+            }
+
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+// a block ending in a jump to a block with no other way in takes over its instructions
+static bool merge_blocks(struct IrFunction* fn) {
+    bool changed = false;
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+
+        while (true) {
+            struct IrInst* term = ir_terminator(block);
+            if (term->op != IR_JUMP) break;
+
+            struct IrBlock* succ = term->targets[0];
+            if (succ == block || succ == fn->blocks[0] || succ->preds_length != 1) break;
+
+            // phis with a single predecessor are just that value
+            size_t first = 0;
+            while (first < succ->insts_length && succ->insts[first]->op == IR_PHI) {
+                succ->insts[first]->replacement = succ->insts[first]->operands[0];
+                first += 1;
+            }
+
+            block->insts_length -= 1;
+            for (size_t j = first; j < succ->insts_length; j++) {
+                ir_append(fn, block, succ->insts[j]);
+            }
+
+            struct IrBlock* succs[2];
+            int succs_length = ir_successors(block, succs);
+            for (int k = 0; k < succs_length; k++) {
+                struct IrBlock* next = succs[k];
+                for (size_t l = 0; l < next->preds_length; l++) {
+                    if (next->preds[l] == succ) next->preds[l] = block;
+                }
+            }
+
+            // leaves `succ` without predecessors, so it goes with the unreachable blocks
+            succ->insts_length = 0;
+            succ->preds_length = 0;
+            ir_append(fn, succ, ir_new_inst(fn, IR_RETURN, 0));
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        ir_apply_replacements(fn);
+        remove_unreachable_blocks(fn);
+    }
+
+    return changed;
+}
+
+static bool simplify_cfg(struct IrFunction* fn) {
+    bool changed = false;
+
+    bool progress = true;
+    while (progress) {
+        progress = fold_branches(fn);
+        progress |= remove_unreachable_blocks(fn);
+        progress |= thread_jumps(fn);
+        progress |= remove_unreachable_blocks(fn);
+        progress |= merge_blocks(fn);
+        changed |= progress;
+    }
+
+    return changed;
+}
+
+static bool has_side_effects(struct IrInst* inst) {
+    return inst->op == IR_STORE || inst->op == IR_CALL || ir_is_terminator(inst->op);
+}
+
+// keeps the instructions with side effects and everything they use
+static bool eliminate_dead_code(struct IrFunction* fn) {
+    bool* live = arena_calloc(fn->arena, sizeof(bool) * fn->value_count);
+    struct IrInst** worklist = arena_alloc(fn->arena, sizeof(struct IrInst*) * fn->value_count);
+    size_t worklist_length = 0;
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            if (!has_side_effects(inst)) continue;
+
+            live[inst->id] = true;
+            worklist[worklist_length++] = inst;
+        }
+    }
+
+    while (worklist_length > 0) {
+        struct IrInst* inst = worklist[--worklist_length];
+        for (size_t k = 0; k < inst->operands_length; k++) {
+            struct IrInst* operand = inst->operands[k];
+            if (live[operand->id]) continue;
+
+            live[operand->id] = true;
+            worklist[worklist_length++] = operand;
+        }
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+
+        size_t kept = 0;
+        for (size_t j = 0; j < block->insts_length; j++) {
+            if (live[block->insts[j]->id]) block->insts[kept++] = block->insts[j];
+        }
+
+        changed |= kept != block->insts_length;
+        block->insts_length = kept;
+    }
+
+    return changed;
+}
+
+static bool same_address(struct IrInst* a, struct IrInst* b) {
+    if (a->operands_length != b->operands_length || a->imm != b->imm || a->scale != b->scale) return false;
+    if (a->operands[0]->size != b->operands[0]->size) return false;
+
+    struct IrInst* base_a = a->operands[1];
+    struct IrInst* base_b = b->operands[1];
+    bool same_base = base_a == base_b || (base_a->op == IR_SLOT && base_b->op == IR_SLOT && base_a->variable == base_b->variable);
+    return same_base && (!ir_has_index(a) || a->operands[2] == b->operands[2]);
+}
+
+// drops stores to frame variables that are never read and never escape, and
+// stores overwritten in the same block before anything could read them
+static bool eliminate_dead_stores(struct IrFunction* fn) {
+    // frame variable -> non-NULL once something other than a store uses its address
+    struct SymbolTable read;
+    init_symbol_table(&read);
+
+    size_t longest = 0;
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        if (block->insts_length > longest) longest = block->insts_length;
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                struct IrInst* operand = inst->operands[k];
+                if (operand->op != IR_SLOT || (inst->op == IR_STORE && k == 1)) continue;
+
+                symbol_table_set(&read, fn->arena, (const char*) operand->variable, operand);
+            }
+        }
+    }
+
+    bool* dead = arena_calloc(fn->arena, sizeof(bool) * fn->value_count);
+    struct IrInst** pending = arena_alloc(fn->arena, sizeof(struct IrInst*) * (longest + 1));
+    bool changed = false;
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        size_t pending_length = 0;
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+
+            // anything that can read memory keeps the stores before it
+            if (inst->op == IR_LOAD || inst->op == IR_CALL) {
+                pending_length = 0;
+                continue;
+            }
+
+            if (inst->op != IR_STORE) continue;
+
+            struct IrInst* base = inst->operands[1];
+            if (base->op == IR_SLOT && symbol_table_find(&read, (const char*) base->variable) == NULL) {
+                dead[inst->id] = true;
+                changed = true;
+                continue;
+            }
+
+            size_t kept = 0;
+            for (size_t k = 0; k < pending_length; k++) {
+                if (same_address(pending[k], inst)) {
+                    dead[pending[k]->id] = true;
+                    changed = true;
+                } else {
+                    pending[kept++] = pending[k];
+                }
+            }
+
+            pending_length = kept;
+            pending[pending_length++] = inst;
+        }
+    }
+
+    if (!changed) return false;
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+
+        size_t kept = 0;
+        for (size_t j = 0; j < block->insts_length; j++) {
+            if (!dead[block->insts[j]->id]) block->insts[kept++] = block->insts[j];
+        }
+
+        block->insts_length = kept;
+    }
+
+    return true;
+}
+
+const struct IrPass simplify_cfg_pass = { "simplify-cfg", simplify_cfg };
+const struct IrPass dead_store_pass = { "dead-stores", eliminate_dead_stores };
+const struct IrPass dce_pass = { "dce", eliminate_dead_code };
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef CFCC_ELF_C
+#define CFCC_ELF_C
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.c"
+#include "buffer.c"
+#include "symbol.c"
+
+// Relocatable object files: the encoder appends machine code to .text and
+// constants to .rodata, defines a symbol for every function and records a
+// relocation for every reference to a symbol. Writing the file resolves the
+// references between functions of the object itself, leaving relocations
+// only for what the linker has to fill in: calls to other objects and
+// shared libraries through the PLT, and addresses in .rodata.
+
+enum ObjectSection {
+    OBJECT_UNDEFINED,
+    OBJECT_TEXT,
+    OBJECT_RODATA,
+};
+
+struct ObjectSymbol {
+    const char* name;
+    enum ObjectSection section;
+    size_t offset;
+    size_t size;
+    bool global;
+};
+
+// a 32-bit field at `offset` in .text that holds `symbol + addend - offset`
+struct ObjectRelocation {
+    size_t offset;
+    size_t symbol;
+    int64_t addend;
+};
+
+struct ObjectFile {
+    struct Arena arena;
+    struct Interner names;
+
+    // interned name -> symbol index + 1
+    struct SymbolTable symbol_indices;
+
+    struct Buffer text;
+    struct Buffer rodata;
+
+    struct ObjectSymbol* symbols;
+    size_t symbols_length;
+    size_t symbols_capacity;
+
+    struct ObjectRelocation* relocations;
+    size_t relocations_length;
+    size_t relocations_capacity;
+};
+
+void init_object_file(struct ObjectFile* obj) {
+    memset(obj, 0, sizeof(struct ObjectFile));
+    init_arena(&obj->arena);
+    init_interner(&obj->names);
+    init_symbol_table(&obj->symbol_indices);
+    init_buffer(&obj->text, NULL);
+    init_buffer(&obj->rodata, NULL);
+}
+
+void free_object_file(struct ObjectFile* obj) {
+    free_buffer(&obj->text);
+    free_buffer(&obj->rodata);
+    free_arena(&obj->arena);
+}
+
+// the symbol called `name`, undefined until object_define_symbol is called for it;
+// calls through the PLT name the symbol itself
+size_t object_symbol(struct ObjectFile* obj, const char* name) {
+    size_t length = strlen(name);
+    if (length > 4 && strcmp(name + length - 4, "@PLT") == 0) {
+        length -= 4;
+    }
+
+    const char* key = intern(&obj->names, &obj->arena, name, length);
+    size_t index = (size_t) symbol_table_find(&obj->symbol_indices, key);
+    if (index != 0) {
+        return index - 1;
+    }
+
+    if (obj->symbols_length == obj->symbols_capacity) {
+        size_t capacity = obj->symbols_capacity > 0 ? obj->symbols_capacity * 2 : 16;
+        obj->symbols = arena_grow(&obj->arena, obj->symbols, sizeof(struct ObjectSymbol) * obj->symbols_capacity, sizeof(struct ObjectSymbol) * capacity);
+        obj->symbols_capacity = capacity;
+    }
+
+    struct ObjectSymbol* symbol = &obj->symbols[obj->symbols_length];
+    memset(symbol, 0, sizeof(struct ObjectSymbol));
+    symbol->name = key;
+    symbol_table_insert(&obj->symbol_indices, &obj->arena, key, (void*) (obj->symbols_length + 1));
+    return obj->symbols_length++;
+}
+
+void object_define_symbol(struct ObjectFile* obj, const char* name, enum ObjectSection section, size_t offset, size_t size, bool global) {
+    size_t index = object_symbol(obj, name);
+    struct ObjectSymbol* symbol = &obj->symbols[index];
+    if (symbol->section != OBJECT_UNDEFINED) {
+        fprintf(stderr, "cfcc: symbol `%s` is defined more than once\n", symbol->name);
+    }
+
+    symbol->section = section;
+    symbol->offset = offset;
+    symbol->size = size;
+    symbol->global = global;
+}
+
+// null-terminated constant in .rodata
+void object_add_string(struct ObjectFile* obj, const char* name, const char* str) {
+    size_t offset = obj->rodata.length;
+    buffer_append_n(&obj->rodata, str, strlen(str) + 1);
+    object_define_symbol(obj, name, OBJECT_RODATA, offset, strlen(str) + 1, false);
+}
+
+void object_add_relocation(struct ObjectFile* obj, size_t offset, const char* name, int64_t addend) {
+    if (obj->relocations_length == obj->relocations_capacity) {
+        size_t capacity = obj->relocations_capacity > 0 ? obj->relocations_capacity * 2 : 64;
+        obj->relocations = arena_grow(&obj->arena, obj->relocations, sizeof(struct ObjectRelocation) * obj->relocations_capacity, sizeof(struct ObjectRelocation) * capacity);
+        obj->relocations_capacity = capacity;
+    }
+
+    struct ObjectRelocation* relocation = &obj->relocations[obj->relocations_length++];
+    relocation->offset = offset;
+    relocation->symbol = object_symbol(obj, name);
+    relocation->addend = addend;
+}
+
+// section header indices, and the symbols of .text and .rodata
+// that relocations into .rodata are relative to
+enum {
+    ELF_SECTION_NULL,
+    ELF_SECTION_TEXT,
+    ELF_SECTION_RODATA,
+    ELF_SECTION_RELA_TEXT,
+    ELF_SECTION_SYMTAB,
+    ELF_SECTION_STRTAB,
+    ELF_SECTION_SHSTRTAB,
+    ELF_SECTION_NOTE_GNU_STACK,
+    ELF_SECTION_COUNT,
+};
+
+#define ELF_SYMBOL_TEXT 1
+#define ELF_SYMBOL_RODATA 2
+#define ELF_FIRST_SYMBOL 3
+
+static void elf_align(struct Buffer* buffer, size_t alignment) {
+    static const char zeros[16];
+    buffer_append_n(buffer, zeros, (alignment - buffer->length % alignment) % alignment);
+}
+
+static uint32_t elf_add_string(struct Buffer* strtab, const char* str) {
+    uint32_t offset = strtab->length;
+    buffer_append_n(strtab, str, strlen(str) + 1);
+    return offset;
+}
+
+static void elf_section_header(Elf64_Shdr* header, uint32_t name, uint32_t type, uint64_t flags, size_t offset, size_t size, size_t alignment) {
+    memset(header, 0, sizeof(Elf64_Shdr));
+    header->sh_name = name;
+    header->sh_type = type;
+    header->sh_flags = flags;
+    header->sh_offset = offset;
+    header->sh_size = size;
+    header->sh_addralign = alignment;
+}
+
+// writes an x86-64 ELF relocatable file, returns false if it could not be written
+bool write_object_file(struct ObjectFile* obj, FILE* file) {
+    // calls between functions of the object are resolved here, a field
+    // relative to the end of itself needs no linker to hold `target - end`
+    size_t kept = 0;
+    for (size_t i = 0; i < obj->relocations_length; i++) {
+        struct ObjectRelocation* relocation = &obj->relocations[i];
+        struct ObjectSymbol* symbol = &obj->symbols[relocation->symbol];
+        if (symbol->section == OBJECT_TEXT) {
+            int32_t value = (int32_t) (symbol->offset + relocation->addend - relocation->offset);
+            memcpy(obj->text.data + relocation->offset, &value, sizeof(value));
+        } else {
+            obj->relocations[kept++] = *relocation;
+        }
+    }
+
+    obj->relocations_length = kept;
+
+    struct Buffer strtab;
+    init_buffer(&strtab, NULL);
+    elf_add_string(&strtab, "");
+
+    // the null symbol and the two section symbols, then the functions with
+    // local ones first as ELF requires; .rodata constants are only reached
+    // through its section symbol, like the .L labels of assembly
+    size_t* indices = arena_calloc(&obj->arena, sizeof(size_t) * (obj->symbols_length + 1));
+    Elf64_Sym* elf_symbols = arena_calloc(&obj->arena, sizeof(Elf64_Sym) * (obj->symbols_length + ELF_FIRST_SYMBOL));
+    elf_symbols[ELF_SYMBOL_TEXT].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    elf_symbols[ELF_SYMBOL_TEXT].st_shndx = ELF_SECTION_TEXT;
+    elf_symbols[ELF_SYMBOL_RODATA].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    elf_symbols[ELF_SYMBOL_RODATA].st_shndx = ELF_SECTION_RODATA;
+
+    size_t symbols_length = ELF_FIRST_SYMBOL;
+    size_t first_global = 0;
+    for (int global = 0; global < 2; global++) {
+        if (global) first_global = symbols_length;
+
+        for (size_t i = 0; i < obj->symbols_length; i++) {
+            struct ObjectSymbol* symbol = &obj->symbols[i];
+            if (symbol->section == OBJECT_RODATA) continue;
+
+            // whatever is left undefined comes from another object
+            bool is_global = symbol->global || symbol->section == OBJECT_UNDEFINED;
+            if (is_global != (global != 0)) continue;
+
+            Elf64_Sym* elf_symbol = &elf_symbols[symbols_length];
+            elf_symbol->st_name = elf_add_string(&strtab, symbol->name);
+            if (symbol->section == OBJECT_TEXT) {
+                elf_symbol->st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, STT_FUNC);
+                elf_symbol->st_shndx = ELF_SECTION_TEXT;
+                elf_symbol->st_value = symbol->offset;
+                elf_symbol->st_size = symbol->size;
+            } else {
+                elf_symbol->st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+                elf_symbol->st_shndx = SHN_UNDEF;
+            }
+
+            indices[i] = symbols_length++;
+        }
+    }
+
+    // calls go through the PLT, the linker drops it for functions it finds statically
+    Elf64_Rela* relas = arena_calloc(&obj->arena, sizeof(Elf64_Rela) * (obj->relocations_length + 1));
+    for (size_t i = 0; i < obj->relocations_length; i++) {
+        struct ObjectRelocation* relocation = &obj->relocations[i];
+        struct ObjectSymbol* symbol = &obj->symbols[relocation->symbol];
+        relas[i].r_offset = relocation->offset;
+        if (symbol->section == OBJECT_RODATA) {
+            relas[i].r_info = ELF64_R_INFO(ELF_SYMBOL_RODATA, R_X86_64_PC32);
+            relas[i].r_addend = symbol->offset + relocation->addend;
+        } else {
+            relas[i].r_info = ELF64_R_INFO(indices[relocation->symbol], R_X86_64_PLT32);
+            relas[i].r_addend = relocation->addend;
+        }
+    }
+
+    struct Buffer shstrtab;
+    init_buffer(&shstrtab, NULL);
+    uint32_t names[ELF_SECTION_COUNT];
+    names[ELF_SECTION_NULL] = elf_add_string(&shstrtab, "");
+    names[ELF_SECTION_TEXT] = elf_add_string(&shstrtab, ".text");
+    names[ELF_SECTION_RODATA] = elf_add_string(&shstrtab, ".rodata");
+    names[ELF_SECTION_RELA_TEXT] = elf_add_string(&shstrtab, ".rela.text");
+    names[ELF_SECTION_SYMTAB] = elf_add_string(&shstrtab, ".symtab");
+    names[ELF_SECTION_STRTAB] = elf_add_string(&shstrtab, ".strtab");
+    names[ELF_SECTION_SHSTRTAB] = elf_add_string(&shstrtab, ".shstrtab");
+    names[ELF_SECTION_NOTE_GNU_STACK] = elf_add_string(&shstrtab, ".note.GNU-stack");
+
+    // the header, the contents of every section and the section headers last
+    struct Buffer out;
+    init_buffer(&out, NULL);
+    Elf64_Shdr headers[ELF_SECTION_COUNT];
+    memset(headers, 0, sizeof(headers));
+
+    Elf64_Ehdr header;
+    memset(&header, 0, sizeof(header));
+    buffer_append_n(&out, (const char*) &header, sizeof(header));
+
+    elf_align(&out, 16);
+    elf_section_header(&headers[ELF_SECTION_TEXT], names[ELF_SECTION_TEXT], SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, out.length, obj->text.length, 16);
+    buffer_append_n(&out, obj->text.data, obj->text.length);
+
+    elf_section_header(&headers[ELF_SECTION_RODATA], names[ELF_SECTION_RODATA], SHT_PROGBITS, SHF_ALLOC, out.length, obj->rodata.length, 1);
+    buffer_append_n(&out, obj->rodata.data, obj->rodata.length);
+
+    elf_align(&out, 8);
+    elf_section_header(&headers[ELF_SECTION_RELA_TEXT], names[ELF_SECTION_RELA_TEXT], SHT_RELA, SHF_INFO_LINK, out.length, sizeof(Elf64_Rela) * obj->relocations_length, 8);
+    headers[ELF_SECTION_RELA_TEXT].sh_link = ELF_SECTION_SYMTAB;
+    headers[ELF_SECTION_RELA_TEXT].sh_info = ELF_SECTION_TEXT;
+    headers[ELF_SECTION_RELA_TEXT].sh_entsize = sizeof(Elf64_Rela);
+    buffer_append_n(&out, (const char*) relas, sizeof(Elf64_Rela) * obj->relocations_length);
+
+    elf_section_header(&headers[ELF_SECTION_SYMTAB], names[ELF_SECTION_SYMTAB], SHT_SYMTAB, 0, out.length, sizeof(Elf64_Sym) * symbols_length, 8);
+    headers[ELF_SECTION_SYMTAB].sh_link = ELF_SECTION_STRTAB;
+    headers[ELF_SECTION_SYMTAB].sh_info = first_global;
+    headers[ELF_SECTION_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    buffer_append_n(&out, (const char*) elf_symbols, sizeof(Elf64_Sym) * symbols_length);
+
+    elf_section_header(&headers[ELF_SECTION_STRTAB], names[ELF_SECTION_STRTAB], SHT_STRTAB, 0, out.length, strtab.length, 1);
+    buffer_append_n(&out, strtab.data, strtab.length);
+
+    elf_section_header(&headers[ELF_SECTION_SHSTRTAB], names[ELF_SECTION_SHSTRTAB], SHT_STRTAB, 0, out.length, shstrtab.length, 1);
+    buffer_append_n(&out, shstrtab.data, shstrtab.length);
+
+    // an empty note keeps the stack of the linked program non-executable
+    elf_section_header(&headers[ELF_SECTION_NOTE_GNU_STACK], names[ELF_SECTION_NOTE_GNU_STACK], SHT_PROGBITS, 0, out.length, 0, 1);
+
+    elf_align(&out, 8);
+    size_t section_headers_offset = out.length;
+    buffer_append_n(&out, (const char*) headers, sizeof(headers));
+
+    Elf64_Ehdr* ehdr = (Elf64_Ehdr*) out.data;
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr->e_type = ET_REL;
+    ehdr->e_machine = EM_X86_64;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_shoff = section_headers_offset;
+    ehdr->e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr->e_shentsize = sizeof(Elf64_Shdr);
+    ehdr->e_shnum = ELF_SECTION_COUNT;
+    ehdr->e_shstrndx = ELF_SECTION_SHSTRTAB;
+
+    bool written = fwrite(out.data, 1, out.length, file) == out.length;
+
+    free_buffer(&out);
+    free_buffer(&shstrtab);
+    free_buffer(&strtab);
+    return written;
+}
+
+#endif
@@ -0,0 +1,513 @@
+#ifndef CFCC_ENCODE_C
+#define CFCC_ENCODE_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.c"
+#include "buffer.c"
+#include "elf.c"
+#include "mir.c"
+
+// Machine code encoder: turns finished functions, with every register
+// allocated, into x86-64 instructions in the .text of an object file, the
+// same ones the assembler would pick for the printed function up to the
+// choice between equivalent encodings. Jumps are always 32-bit so their
+// size is known before their target is; they are patched once the whole
+// function is encoded. Calls and addresses of other symbols become object
+// file relocations.
+
+// a 32-bit field at `offset` in .text that holds `label - base`
+struct LabelFixup {
+    size_t offset;
+    size_t label;
+    size_t base;
+};
+
+struct Encoder {
+    struct ObjectFile* obj;
+    struct MirFunction* mf;
+    struct Buffer* text;
+
+    // label -> offset in .text
+    size_t* label_offsets;
+
+    struct LabelFixup* fixups;
+    size_t fixups_length;
+    size_t fixups_capacity;
+};
+
+// condition code of jcc and setcc, by enum Condition
+static const uint8_t condition_codes[] = { 0x4, 0x5, 0xC, 0xF, 0xE, 0xD, 0x2, 0x7, 0x6, 0x3 };
+
+static void put_byte(struct Encoder* e, uint8_t byte) {
+    char c = (char) byte;
+    buffer_append_n(e->text, &c, 1);
+}
+
+static void put_int32(struct Encoder* e, int32_t value) {
+    buffer_append_n(e->text, (const char*) &value, sizeof(value));
+}
+
+// opcodes of up to three bytes, most significant first
+static void put_opcode(struct Encoder* e, uint32_t opcode) {
+    if (opcode > 0xFFFF) put_byte(e, opcode >> 16);
+    if (opcode > 0xFF) put_byte(e, opcode >> 8);
+    put_byte(e, opcode);
+}
+
+static bool fits_int8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static bool fits_int32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// registers numbered as in the instruction, vector ones from 0 too
+static int hardware_register(int reg) {
+    return reg >= REG_XMM0 ? reg - REG_XMM0 : reg;
+}
+
+static void add_label_fixup(struct Encoder* e, size_t label, size_t base) {
+    if (e->fixups_length == e->fixups_capacity) {
+        size_t capacity = e->fixups_capacity > 0 ? e->fixups_capacity * 2 : 32;
+        e->fixups = arena_grow(e->mf->arena, e->fixups, sizeof(struct LabelFixup) * e->fixups_capacity, sizeof(struct LabelFixup) * capacity);
+        e->fixups_capacity = capacity;
+    }
+
+    struct LabelFixup* fixup = &e->fixups[e->fixups_length++];
+    fixup->offset = e->text->length;
+    fixup->label = label;
+    fixup->base = base;
+    put_int32(e, 0);
+}
+
+// the REX.X and REX.B extensions of a register or memory operand
+static int operand_extension(struct MirOperand* rm) {
+    switch (rm->kind) {
+        case MOP_REG:
+            return hardware_register(rm->reg) >> 3;
+
+        case MOP_MEM: {
+            int x = rm->mem.index != REG_NONE ? rm->mem.index >> 3 : 0;
+            int b = rm->mem.base != REG_NONE ? rm->mem.base >> 3 : 0;
+            return x << 1 | b;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+// ModRM, SIB and displacement for the register `reg` and the operand `rm`;
+// symbols and labels are addressed relative to %rip, from the end of the
+// displacement since no immediate follows one in any instruction here
+static void encode_modrm(struct Encoder* e, int reg, struct MirOperand* rm) {
+    reg = hardware_register(reg) & 7;
+
+    if (rm->kind == MOP_REG) {
+        put_byte(e, 0xC0 | reg << 3 | (hardware_register(rm->reg) & 7));
+        return;
+    }
+
+    if (rm->kind == MOP_SYMBOL) {
+        put_byte(e, reg << 3 | 5);
+        object_add_relocation(e->obj, e->text->length, rm->symbol, -4);
+        put_int32(e, 0);
+        return;
+    }
+
+    if (rm->kind == MOP_LABEL) {
+        put_byte(e, reg << 3 | 5);
+        add_label_fixup(e, rm->label, e->text->length + 4);
+        return;
+    }
+
+    struct MirMemory* mem = &rm->mem;
+    int scale = mem->scale == 8 ? 3 : mem->scale == 4 ? 2 : mem->scale == 2 ? 1 : 0;
+    int index = mem->index != REG_NONE ? mem->index & 7 : 4;
+
+    // an absolute address, or one with only an index, has no base in the SIB
+    if (mem->base == REG_NONE) {
+        put_byte(e, reg << 3 | 4);
+        put_byte(e, scale << 6 | index << 3 | 5);
+        put_int32(e, mem->disp);
+        return;
+    }
+
+    // %rbp and %r13 as base always take a displacement, mod 0 means %rip or no base
+    int base = mem->base & 7;
+    int mod = mem->disp == 0 && base != REG_RBP ? 0 : fits_int8(mem->disp) ? 1 : 2;
+
+    // %rsp and %r12 as base always take a SIB
+    if (mem->index != REG_NONE || base == REG_RSP) {
+        put_byte(e, mod << 6 | reg << 3 | 4);
+        put_byte(e, scale << 6 | index << 3 | base);
+    } else {
+        put_byte(e, mod << 6 | reg << 3 | base);
+    }
+
+    if (mod == 1) put_byte(e, (uint8_t) mem->disp);
+    if (mod == 2) put_int32(e, mem->disp);
+}
+
+static bool needs_empty_rex(int reg) {
+    return reg >= REG_RSP && reg <= REG_RDI;
+}
+
+// [prefix] [REX] opcode ModRM ..., with REX.W for 8-byte operations and an
+// empty REX for the byte registers %spl, %bpl, %sil and %dil; a ModRM digit
+// of 4 to 7 in `reg` gets one too, which changes nothing
+static void encode_rm(struct Encoder* e, uint8_t prefix, int size, uint32_t opcode, int reg, struct MirOperand* rm) {
+    if (prefix != 0) put_byte(e, prefix);
+
+    int rex = (size == 8) << 3 | (hardware_register(reg) >> 3) << 2 | operand_extension(rm);
+    bool byte_register = needs_empty_rex(reg) || (rm->kind == MOP_REG && needs_empty_rex(rm->reg));
+    if (rex != 0 || (size == 1 && byte_register)) {
+        put_byte(e, 0x40 | rex);
+    }
+
+    put_opcode(e, opcode);
+    encode_modrm(e, reg, rm);
+}
+
+// opcodes with the register in their low three bits
+static void encode_plus_register(struct Encoder* e, int size, uint8_t opcode, int reg) {
+    int rex = (size == 8) << 3 | reg >> 3;
+    if (rex != 0 || (size == 1 && needs_empty_rex(reg))) {
+        put_byte(e, 0x40 | rex);
+    }
+
+    put_byte(e, opcode + (reg & 7));
+}
+
+// VEX prefix of `pp` (none, 66, F3, F2) and the opcode map (0F, 0F38, 0F3A),
+// in the two-byte form when nothing needs the three-byte one; `source` is
+// the extra operand, 0 where there is none
+static void encode_vex(struct Encoder* e, int pp, int map, int size, uint8_t opcode, int reg, int source, struct MirOperand* rm) {
+    int r = hardware_register(reg) >> 3;
+    int xb = operand_extension(rm);
+    int vvvv = ~(source != 0 ? hardware_register(source) : 0) & 15;
+    int l = size == 32;
+
+    if (xb == 0 && map == 1) {
+        put_byte(e, 0xC5);
+        put_byte(e, !r << 7 | vvvv << 3 | l << 2 | pp);
+    } else {
+        put_byte(e, 0xC4);
+        put_byte(e, !r << 7 | (~xb & 3) << 5 | map);
+        put_byte(e, vvvv << 3 | l << 2 | pp);
+    }
+
+    put_byte(e, opcode);
+    encode_modrm(e, reg, rm);
+}
+
+// add, sub, xor and cmp share their encodings, told apart by a ModRM digit
+static void encode_arithmetic(struct Encoder* e, int digit, struct MirInst* inst) {
+    int size = inst->dst.size;
+    bool byte = size == 1;
+
+    if (inst->src.kind == MOP_IMM) {
+        bool short_imm = byte || fits_int8(inst->src.imm);
+        encode_rm(e, 0, size, byte ? 0x80 : short_imm ? 0x83 : 0x81, digit, &inst->dst);
+        if (short_imm) {
+            put_byte(e, (uint8_t) inst->src.imm);
+        } else {
+            put_int32(e, (int32_t) inst->src.imm);
+        }
+    } else if (inst->src.kind == MOP_REG) {
+        encode_rm(e, 0, size, digit << 3 | (byte ? 0 : 1), inst->src.reg, &inst->dst);
+    } else {
+        encode_rm(e, 0, size, digit << 3 | (byte ? 2 : 3), inst->dst.reg, &inst->src);
+    }
+}
+
+static void encode_mov(struct Encoder* e, struct MirInst* inst) {
+    int size = inst->dst.size;
+    bool byte = size == 1;
+
+    if (inst->src.kind == MOP_IMM && inst->dst.kind == MOP_REG && (size == 4 || (size == 8 && !fits_int32(inst->src.imm)))) {
+        // movl $imm, %reg and movabsq for what does not sign-extend from 32 bits
+        encode_plus_register(e, size, 0xB8, inst->dst.reg);
+        if (size == 8) {
+            buffer_append_n(e->text, (const char*) &inst->src.imm, 8);
+        } else {
+            put_int32(e, (int32_t) inst->src.imm);
+        }
+    } else if (inst->src.kind == MOP_IMM) {
+        encode_rm(e, 0, size, byte ? 0xC6 : 0xC7, 0, &inst->dst);
+        if (byte) {
+            put_byte(e, (uint8_t) inst->src.imm);
+        } else {
+            put_int32(e, (int32_t) inst->src.imm);
+        }
+    } else if (inst->src.kind == MOP_REG) {
+        encode_rm(e, 0, size, byte ? 0x88 : 0x89, inst->src.reg, &inst->dst);
+    } else {
+        encode_rm(e, 0, size, byte ? 0x8A : 0x8B, inst->dst.reg, &inst->src);
+    }
+}
+
+// shifts by an immediate, with a form of their own for 1, or by %cl
+static void encode_shift(struct Encoder* e, int digit, struct MirInst* inst) {
+    int size = inst->dst.size;
+    if (inst->src.kind == MOP_IMM && inst->src.imm == 1) {
+        encode_rm(e, 0, size, size == 1 ? 0xD0 : 0xD1, digit, &inst->dst);
+    } else if (inst->src.kind == MOP_IMM) {
+        encode_rm(e, 0, size, size == 1 ? 0xC0 : 0xC1, digit, &inst->dst);
+        put_byte(e, (uint8_t) inst->src.imm);
+    } else {
+        encode_rm(e, 0, size, size == 1 ? 0xD2 : 0xD3, digit, &inst->dst);
+    }
+}
+
+// paddd and friends: dst op= src, with dst as the extra VEX source
+static void encode_vector_arithmetic(struct Encoder* e, uint32_t opcode, struct MirOperand* src, struct MirOperand* dst) {
+    if (e->mf->vex) {
+        encode_vex(e, 1, opcode > 0xFFFF ? 2 : 1, dst->size, opcode, dst->reg, dst->reg, src);
+    } else {
+        encode_rm(e, 0x66, dst->size, opcode, dst->reg, src);
+    }
+}
+
+static void encode_jump_table(struct Encoder* e, struct MirInst* inst) {
+    struct MirJumpTable* table = &e->mf->tables[inst->args];
+
+    // leaq table(%rip), %r11; movslq (%r11,index,4), %r10; addq %r11, %r10; jmp *%r10
+    struct MirOperand address = mop_label(table->label);
+    struct MirOperand entry = mop_mem(REG_R11, inst->dst.reg, 4, 0, 4);
+    struct MirOperand r10 = mop_reg(REG_R10, 8);
+    encode_rm(e, 0, 8, 0x8D, REG_R11, &address);
+    encode_rm(e, 0, 8, 0x63, REG_R10, &entry);
+    encode_rm(e, 0, 8, 0x01, REG_R11, &r10);
+    encode_rm(e, 0, 4, 0xFF, 4, &r10);
+
+    while (e->text->length % 4 != 0) {
+        put_byte(e, 0x90);
+    }
+
+    size_t start = e->text->length;
+    e->label_offsets[table->label] = start;
+    for (size_t i = 0; i < table->targets_length; i++) {
+        add_label_fixup(e, table->targets[i], start);
+    }
+}
+
+static void encode_inst(struct Encoder* e, struct MirInst* inst) {
+    struct MirOperand* src = &inst->src;
+    struct MirOperand* dst = &inst->dst;
+
+    switch (inst->op) {
+        case MIR_LABEL:
+            e->label_offsets[dst->label] = e->text->length;
+            break;
+
+        case MIR_COMMENT:
+            break;
+
+        case MIR_MOV:
+            encode_mov(e, inst);
+            break;
+
+        case MIR_MOVZB:
+            encode_rm(e, 0, 1, 0x0FB6, dst->reg, src);
+            break;
+
+        case MIR_MOVSX:
+            encode_rm(e, 0, 8, 0x63, dst->reg, src);
+            break;
+
+        case MIR_LEA:
+            encode_rm(e, 0, dst->size, 0x8D, dst->reg, src);
+            break;
+
+        case MIR_PUSH:
+            encode_plus_register(e, 4, 0x50, dst->reg);
+            break;
+
+        case MIR_POP:
+            encode_plus_register(e, 4, 0x58, dst->reg);
+            break;
+
+        case MIR_ADD:
+            encode_arithmetic(e, 0, inst);
+            break;
+
+        case MIR_SUB:
+            encode_arithmetic(e, 5, inst);
+            break;
+
+        case MIR_XOR:
+            encode_arithmetic(e, 6, inst);
+            break;
+
+        case MIR_CMP:
+            encode_arithmetic(e, 7, inst);
+            break;
+
+        case MIR_IMUL:
+            if (src->kind == MOP_IMM) {
+                bool short_imm = fits_int8(src->imm);
+                encode_rm(e, 0, dst->size, short_imm ? 0x6B : 0x69, dst->reg, dst);
+                if (short_imm) {
+                    put_byte(e, (uint8_t) src->imm);
+                } else {
+                    put_int32(e, (int32_t) src->imm);
+                }
+            } else {
+                encode_rm(e, 0, dst->size, 0x0FAF, dst->reg, src);
+            }
+            break;
+
+        case MIR_NEG:
+            encode_rm(e, 0, dst->size, 0xF7, 3, dst);
+            break;
+
+        case MIR_IDIV:
+            encode_rm(e, 0, dst->size, 0xF7, 7, dst);
+            break;
+
+        case MIR_SHL:
+            encode_shift(e, 4, inst);
+            break;
+
+        case MIR_SHR:
+            encode_shift(e, 5, inst);
+            break;
+
+        case MIR_SAR:
+            encode_shift(e, 7, inst);
+            break;
+
+        case MIR_CLTD:
+            put_byte(e, 0x99);
+            break;
+
+        case MIR_REP_STOS:
+            put_byte(e, 0xF3);
+            put_byte(e, 0xAB);
+            break;
+
+        case MIR_REP_MOVS:
+            put_byte(e, 0xF3);
+            put_byte(e, 0xA5);
+            break;
+
+        case MIR_BT:
+            if (src->kind == MOP_IMM) {
+                encode_rm(e, 0, dst->size, 0x0FBA, 4, dst);
+                put_byte(e, (uint8_t) src->imm);
+            } else {
+                encode_rm(e, 0, dst->size, 0x0FA3, src->reg, dst);
+            }
+            break;
+
+        case MIR_SETCC:
+            encode_rm(e, 0, 1, 0x0F90 | condition_codes[inst->cond], 0, dst);
+            break;
+
+        case MIR_JMP:
+            put_byte(e, 0xE9);
+            add_label_fixup(e, dst->label, e->text->length + 4);
+            break;
+
+        case MIR_JCC:
+            put_byte(e, 0x0F);
+            put_byte(e, 0x80 | condition_codes[inst->cond]);
+            add_label_fixup(e, dst->label, e->text->length + 4);
+            break;
+
+        case MIR_JMP_TABLE:
+            encode_jump_table(e, inst);
+            break;
+
+        case MIR_CALL:
+        case MIR_TAIL_CALL:
+            put_byte(e, inst->op == MIR_CALL ? 0xE8 : 0xE9);
+            object_add_relocation(e->obj, e->text->length, dst->symbol, -4);
+            put_int32(e, 0);
+            break;
+
+        case MIR_RET:
+            put_byte(e, 0xC3);
+            break;
+
+        case MIR_VMOV: {
+            // movdqu loads with 6F and stores with 7F
+            bool store = dst->kind == MOP_MEM;
+            struct MirOperand* reg = store ? src : dst;
+            struct MirOperand* rm = store ? dst : src;
+            if (e->mf->vex) {
+                encode_vex(e, 2, 1, reg->size, store ? 0x7F : 0x6F, reg->reg, 0, rm);
+            } else {
+                encode_rm(e, 0xF3, reg->size, store ? 0x0F7F : 0x0F6F, reg->reg, rm);
+            }
+            break;
+        }
+
+        case MIR_VZERO:
+            encode_vector_arithmetic(e, 0x0FEF, dst, dst);
+            break;
+
+        case MIR_VADD:
+            encode_vector_arithmetic(e, 0x0FFE, src, dst);
+            break;
+
+        case MIR_VSUB:
+            encode_vector_arithmetic(e, 0x0FFA, src, dst);
+            break;
+
+        case MIR_VMUL:
+            encode_vector_arithmetic(e, 0x0F3840, src, dst);
+            break;
+
+        case MIR_VBROADCAST: {
+            // movd to the low lane of the destination, then copied to the others
+            struct MirOperand low = mop_reg(dst->reg, 16);
+            if (e->mf->vex) {
+                encode_vex(e, 1, 1, 16, 0x6E, dst->reg, 0, src);
+                encode_vex(e, 1, 2, dst->size, 0x58, dst->reg, 0, &low);
+            } else {
+                encode_rm(e, 0x66, 4, 0x0F6E, dst->reg, src);
+                encode_rm(e, 0x66, 16, 0x0F70, dst->reg, &low);
+                put_byte(e, 0);
+            }
+            break;
+        }
+
+        case MIR_VZEROUPPER:
+            put_byte(e, 0xC5);
+            put_byte(e, 0xF8);
+            put_byte(e, 0x77);
+            break;
+    }
+}
+
+// appends the function to .text and defines its symbol, global only for main
+void encode_function(struct ObjectFile* obj, struct MirFunction* mf) {
+    struct Encoder e;
+    memset(&e, 0, sizeof(e));
+    e.obj = obj;
+    e.mf = mf;
+    e.text = &obj->text;
+    e.label_offsets = arena_calloc(mf->arena, sizeof(size_t) * (mf->label_count + 1));
+
+    size_t start = obj->text.length;
+    for (size_t i = 0; i < mf->insts_length; i++) {
+        encode_inst(&e, &mf->insts[i]);
+    }
+
+    for (size_t i = 0; i < e.fixups_length; i++) {
+        struct LabelFixup* fixup = &e.fixups[i];
+        int32_t value = (int32_t) (e.label_offsets[fixup->label] - fixup->base);
+        memcpy(obj->text.data + fixup->offset, &value, sizeof(value));
+    }
+
+    object_define_symbol(obj, mf->name, OBJECT_TEXT, start, obj->text.length - start, strcmp(mf->name, "main") == 0);
+}
+
+#endif
@@ -0,0 +1,445 @@
+#ifndef CFCC_FOLD_C
+#define CFCC_FOLD_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hir.c"
+
+// Constant folding over the HIR: constant subexpressions are evaluated at
+// compile time, algebraic identities drop no-op arithmetic, and `if`
+// statements whose condition folds to a constant keep only the branch
+// that can run. Arithmetic wraps like the 32-bit machine instructions.
+
+static bool is_constant(struct Expression* expr, int32_t* value) {
+    if (expr->kind != EXPR_LITERAL) return false;
+    if (expr->expr_literal.type->kind != TYPE_KIND_BASIC || expr->expr_literal.type->basic != TYPE_I32) return false;
+
+    *value = expr->expr_literal.integer;
+    return true;
+}
+
+// the value of a case label, false unless it folded to an integer constant
+bool case_value(struct StmtCase* case_stmt, int32_t* value) {
+    return !case_stmt->is_default && is_constant(&case_stmt->value, value);
+}
+
+// whether evaluating `expr` can be skipped without losing a side effect
+static bool is_pure(struct Expression* expr) {
+    switch (expr->kind) {
+        case EXPR_VARIABLE:
+        case EXPR_LITERAL:
+            return true;
+
+        case EXPR_INDEX:
+            return is_pure(expr->expr_index.location) && is_pure(expr->expr_index.expression);
+
+        case EXPR_ADDRESS_OF:
+            return is_pure(expr->expr_address_of.expression);
+
+        case EXPR_BIN_OP:
+            return is_pure(expr->expr_binary_op.left) && is_pure(expr->expr_binary_op.right);
+
+        default:
+            return false;
+    }
+}
+
+// comparisons and logical operators already produce 0 or 1
+static bool is_boolean(struct Expression* expr) {
+    if (expr->kind != EXPR_BIN_OP) return false;
+
+    switch (expr->expr_binary_op.kind) {
+        case BINARY_OP_ADD:
+        case BINARY_OP_SUB:
+        case BINARY_OP_DIV:
+        case BINARY_OP_MUL:
+        case BINARY_OP_MOD:
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+static void make_constant(struct Unit* unit, struct Expression* expr, int32_t value) {
+    char text[16];
+    int length = snprintf(text, sizeof(text), "%d", value);
+
+    struct Type* type = arena_alloc(&unit->arena, sizeof(struct Type));
+    type->kind = TYPE_KIND_BASIC;
+    type->basic = TYPE_I32;
+
+    expr->kind = EXPR_LITERAL;
+    expr->expr_literal.value = intern(&unit->interner, &unit->arena, text, length);
+    expr->expr_literal.type = type;
+    expr->expr_literal.integer = value;
+}
+
+// replaces `expr` with `operand != 0`, or with `operand` if that is already 0 or 1
+static void make_truth_test(struct Unit* unit, struct Expression* expr, struct Expression* operand) {
+    if (is_boolean(operand)) {
+        *expr = *operand;
+        return;
+    }
+
+    struct Expression* zero = arena_alloc(&unit->arena, sizeof(struct Expression));
+    make_constant(unit, zero, 0);
+
+    struct Expression* left = arena_alloc(&unit->arena, sizeof(struct Expression));
+    *left = *operand;
+
+    expr->kind = EXPR_BIN_OP;
+    expr->expr_binary_op.kind = BINARY_OP_NE;
+    expr->expr_binary_op.left = left;
+    expr->expr_binary_op.right = zero;
+}
+
+static bool evaluate_binary(enum BinaryOperation op, int32_t a, int32_t b, int32_t* out) {
+    switch (op) {
+        case BINARY_OP_ADD: *out = (int32_t) ((uint32_t) a + (uint32_t) b); return true;
+        case BINARY_OP_SUB: *out = (int32_t) ((uint32_t) a - (uint32_t) b); return true;
+        case BINARY_OP_MUL: *out = (int32_t) ((uint32_t) a * (uint32_t) b); return true;
+
+        case BINARY_OP_DIV:
+            // leave traps to the program
+            if (b == 0 || (a == INT32_MIN && b == -1)) return false;
+            *out = a / b;
+            return true;
+
+        case BINARY_OP_MOD:
+            if (b == 0 || (a == INT32_MIN && b == -1)) return false;
+            *out = a % b;
+            return true;
+
+        case BINARY_OP_LT:  *out = a <  b; return true;
+        case BINARY_OP_GT:  *out = a >  b; return true;
+        case BINARY_OP_LET: *out = a <= b; return true;
+        case BINARY_OP_GET: *out = a >= b; return true;
+        case BINARY_OP_EQ:  *out = a == b; return true;
+        case BINARY_OP_NE:  *out = a != b; return true;
+        case BINARY_OP_AND: *out = a && b; return true;
+        case BINARY_OP_OR:  *out = a || b; return true;
+    }
+
+    return false;
+}
+
+static void fold_logical(struct Unit* unit, struct Expression* expr) {
+    struct ExprBinaryOp* bin_op = &expr->expr_binary_op;
+
+    // `a && b` is decided by a false operand, `a || b` by a true one
+    bool decides = bin_op->kind == BINARY_OP_OR;
+
+    int32_t value;
+    if (is_constant(bin_op->left, &value)) {
+        if ((value != 0) == decides) {
+            make_constant(unit, expr, decides);
+        } else {
+            make_truth_test(unit, expr, bin_op->right);
+        }
+    } else if (is_constant(bin_op->right, &value)) {
+        if ((value != 0) != decides) {
+            make_truth_test(unit, expr, bin_op->left);
+        } else if (is_pure(bin_op->left)) {
+            make_constant(unit, expr, decides);
+        }
+    }
+}
+
+static void fold_arithmetic(struct Unit* unit, struct Expression* expr) {
+    struct ExprBinaryOp* bin_op = &expr->expr_binary_op;
+    struct Expression* left = bin_op->left;
+    struct Expression* right = bin_op->right;
+
+    int32_t l;
+    int32_t r;
+    bool left_constant = is_constant(left, &l);
+    bool right_constant = is_constant(right, &r);
+
+    // commutative operators keep their constant on the right, where codegen
+    // can use it as an immediate
+    bool commutative = bin_op->kind == BINARY_OP_ADD || bin_op->kind == BINARY_OP_MUL;
+    if (commutative && left_constant && !right_constant) {
+        bin_op->left = right;
+        bin_op->right = left;
+        fold_arithmetic(unit, expr);
+        return;
+    }
+
+    switch (bin_op->kind) {
+        case BINARY_OP_ADD:
+            if (right_constant && r == 0) { *expr = *left; return; }
+            if (left_constant && l == 0) { *expr = *right; return; }
+            break;
+
+        case BINARY_OP_SUB:
+            if (right_constant && r == 0) { *expr = *left; return; }
+            break;
+
+        case BINARY_OP_MUL:
+            if (right_constant && r == 1) { *expr = *left; return; }
+            if (left_constant && l == 1) { *expr = *right; return; }
+            if ((right_constant && r == 0 && is_pure(left)) || (left_constant && l == 0 && is_pure(right))) {
+                make_constant(unit, expr, 0);
+                return;
+            }
+            break;
+
+        case BINARY_OP_DIV:
+            if (right_constant && r == 1) { *expr = *left; return; }
+            break;
+
+        case BINARY_OP_MOD:
+            if (right_constant && (r == 1 || r == -1) && is_pure(left)) {
+                make_constant(unit, expr, 0);
+                return;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    // (x + c1) + c2 -> x + (c1 + c2), same for subtraction
+    bool additive = bin_op->kind == BINARY_OP_ADD || bin_op->kind == BINARY_OP_SUB;
+    if (additive && right_constant && left->kind == EXPR_BIN_OP) {
+        struct ExprBinaryOp* inner = &left->expr_binary_op;
+        int32_t c;
+        if ((inner->kind == BINARY_OP_ADD || inner->kind == BINARY_OP_SUB) && is_constant(inner->right, &c)) {
+            uint32_t offset = inner->kind == BINARY_OP_ADD ? (uint32_t) c : -(uint32_t) c;
+            offset = bin_op->kind == BINARY_OP_ADD ? offset + (uint32_t) r : offset - (uint32_t) r;
+
+            struct Expression* constant = arena_alloc(&unit->arena, sizeof(struct Expression));
+            make_constant(unit, constant, (int32_t) offset);
+
+            bin_op->kind = BINARY_OP_ADD;
+            bin_op->left = inner->left;
+            bin_op->right = constant;
+            fold_arithmetic(unit, expr);
+        }
+    }
+}
+
+void fold_expression(struct Unit* unit, struct Expression* expr) {
+    switch (expr->kind) {
+        case EXPR_INDEX:
+            fold_expression(unit, expr->expr_index.location);
+            fold_expression(unit, expr->expr_index.expression);
+            break;
+
+        case EXPR_ADDRESS_OF:
+            fold_expression(unit, expr->expr_address_of.expression);
+            break;
+
+        case EXPR_ASSIGNMENT:
+            fold_expression(unit, expr->expr_assignment.location);
+            fold_expression(unit, expr->expr_assignment.expression);
+            break;
+
+        case EXPR_CALL:
+            for (int i = 0; i < expr->expr_call.args_length; i++) {
+                fold_expression(unit, expr->expr_call.args[i]);
+            }
+            break;
+
+        case EXPR_BIN_OP: {
+            struct ExprBinaryOp* bin_op = &expr->expr_binary_op;
+            fold_expression(unit, bin_op->left);
+            fold_expression(unit, bin_op->right);
+
+            int32_t l;
+            int32_t r;
+            int32_t value;
+            if (is_constant(bin_op->left, &l) && is_constant(bin_op->right, &r) && evaluate_binary(bin_op->kind, l, r, &value)) {
+                make_constant(unit, expr, value);
+            } else if (bin_op->kind == BINARY_OP_AND || bin_op->kind == BINARY_OP_OR) {
+                fold_logical(unit, expr);
+            } else {
+                fold_arithmetic(unit, expr);
+            }
+
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+static bool contains_label(struct Scope* scope);
+
+// case labels count, a switch can jump to them
+static bool statement_contains_label(struct Statement* stmt) {
+    switch (stmt->kind) {
+        case STMT_LABEL:
+        case STMT_CASE:
+            return true;
+
+        case STMT_SWITCH:
+            return contains_label(&stmt->stmt_switch.scope);
+
+        case STMT_COMPOUND:
+            return contains_label(&stmt->stmt_compound.scope);
+
+        case STMT_IF:
+        case STMT_IF_ELSE:
+            return contains_label(&stmt->stmt_if.success_scope) || contains_label(&stmt->stmt_if.failure_scope);
+
+        case STMT_WHILE:
+        case STMT_DO_WHILE:
+            return contains_label(&stmt->stmt_loop.scope) || contains_label(&stmt->stmt_loop.body);
+
+        default:
+            return false;
+    }
+}
+
+static bool contains_label(struct Scope* scope) {
+    for (int i = 0; i < scope->statements_length; i++) {
+        if (statement_contains_label(scope->statements[i])) return true;
+    }
+
+    return false;
+}
+
+// statements after a return, goto, break or continue never run, unless a label below makes them reachable
+static void prune_unreachable(struct Scope* scope) {
+    size_t kept = 0;
+    bool reachable = true;
+
+    for (int i = 0; i < scope->statements_length; i++) {
+        struct Statement* stmt = scope->statements[i];
+        if (!reachable && !statement_contains_label(stmt)) continue;
+
+        scope->statements[kept++] = stmt;
+        reachable = stmt->kind != STMT_RETURN && stmt->kind != STMT_GOTO && stmt->kind != STMT_BREAK && stmt->kind != STMT_CONTINUE;
+    }
+
+    scope->statements_length = kept;
+}
+
+// nested scopes point at their parent, which moved
+static void reparent_scope(struct Scope* scope) {
+    for (int i = 0; i < scope->statements_length; i++) {
+        struct Statement* stmt = scope->statements[i];
+        switch (stmt->kind) {
+            case STMT_COMPOUND:
+                stmt->stmt_compound.scope.outer = scope;
+                break;
+
+            case STMT_LABEL:
+                stmt->stmt_label.scope.outer = scope;
+                break;
+
+            case STMT_SWITCH:
+                stmt->stmt_switch.scope.outer = scope;
+                break;
+
+            case STMT_IF:
+            case STMT_IF_ELSE:
+                stmt->stmt_if.success_scope.outer = scope;
+                stmt->stmt_if.failure_scope.outer = scope;
+                break;
+
+            case STMT_WHILE:
+            case STMT_DO_WHILE:
+                stmt->stmt_loop.scope.outer = scope;
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+static void fold_scope(struct Unit* unit, struct Scope* scope);
+
+static void fold_statement(struct Unit* unit, struct Statement* stmt) {
+    switch (stmt->kind) {
+        case STMT_COMPOUND:
+            fold_scope(unit, &stmt->stmt_compound.scope);
+            break;
+
+        case STMT_LABEL:
+            fold_scope(unit, &stmt->stmt_label.scope);
+            break;
+
+        case STMT_IF:
+        case STMT_IF_ELSE: {
+            fold_expression(unit, &stmt->stmt_if.condition_expr);
+            fold_scope(unit, &stmt->stmt_if.success_scope);
+            fold_scope(unit, &stmt->stmt_if.failure_scope);
+
+            int32_t value;
+            if (!is_constant(&stmt->stmt_if.condition_expr, &value)) break;
+
+            // the branch that can never run goes away, unless something jumps into it
+            struct Scope* live = value != 0 ? &stmt->stmt_if.success_scope : &stmt->stmt_if.failure_scope;
+            struct Scope* dead = value != 0 ? &stmt->stmt_if.failure_scope : &stmt->stmt_if.success_scope;
+            if (contains_label(dead)) break;
+
+            struct Scope kept = *live;
+            stmt->kind = STMT_COMPOUND;
+            stmt->stmt_compound.scope = kept;
+            reparent_scope(&stmt->stmt_compound.scope);
+            break;
+        }
+
+        case STMT_RETURN:
+            fold_expression(unit, &stmt->stmt_return.expr);
+            break;
+
+        case STMT_EXPRESSION:
+            fold_expression(unit, &stmt->stmt_expression.expr);
+            break;
+
+        case STMT_SWITCH:
+            fold_expression(unit, &stmt->stmt_switch.value);
+            fold_scope(unit, &stmt->stmt_switch.scope);
+            break;
+
+        case STMT_CASE:
+            if (!stmt->stmt_case.is_default) fold_expression(unit, &stmt->stmt_case.value);
+            break;
+
+        case STMT_WHILE:
+        case STMT_DO_WHILE: {
+            struct StmtLoop* loop = &stmt->stmt_loop;
+            fold_scope(unit, &loop->scope);
+            fold_scope(unit, &loop->body);
+            if (loop->has_step) fold_expression(unit, &loop->step);
+            if (!loop->has_condition) break;
+
+            // a condition that always holds is no condition at all
+            fold_expression(unit, &loop->condition);
+
+            int32_t value;
+            if (is_constant(&loop->condition, &value) && value != 0) loop->has_condition = false;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+static void fold_scope(struct Unit* unit, struct Scope* scope) {
+    prune_unreachable(scope);
+
+    for (int i = 0; i < scope->statements_length; i++) {
+        fold_statement(unit, scope->statements[i]);
+    }
+}
+
+void fold_unit(struct Unit* unit) {
+    for (int i = 0; i < unit->scope.functions_length; i++) {
+        struct Function* func = unit->scope.functions[i];
+        if (func->prototype) continue;
+
+        fold_scope(unit, &func->scope);
+    }
+}
+
+#endif
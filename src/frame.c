@@ -0,0 +1,139 @@
+#ifndef CFCC_FRAME_C
+#define CFCC_FRAME_C
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hir.c"
+#include "type.c"
+
+// Stack frame layout: every variable of a function that was not promoted
+// to a register gets a fixed slot below %rbp once, so codegen can address
+// it without searching scopes.
+// Sibling scopes are never alive at the same time, so they are laid out
+// from the same starting offset and share stack space; the frame only
+// needs to hold the deepest chain of nested scopes.
+static size_t align_offset(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// scalars whose address is never taken live in registers instead of the frame
+static bool is_promotable(struct Variable* var) {
+    if (var->address_taken) return false;
+    if (var->type->kind == TYPE_KIND_POINTER) return true;
+    return var->type->kind == TYPE_KIND_BASIC && var->type->basic == TYPE_I32;
+}
+
+static int promote_scope(struct Scope* scope, int next);
+
+static int promote_statement(struct Statement* stmt, int next) {
+    switch (stmt->kind) {
+        case STMT_COMPOUND:
+            return promote_scope(&stmt->stmt_compound.scope, next);
+
+        case STMT_LABEL:
+            return promote_scope(&stmt->stmt_label.scope, next);
+
+        case STMT_SWITCH:
+            return promote_scope(&stmt->stmt_switch.scope, next);
+
+        case STMT_IF:
+        case STMT_IF_ELSE:
+            next = promote_scope(&stmt->stmt_if.success_scope, next);
+            return promote_scope(&stmt->stmt_if.failure_scope, next);
+
+        case STMT_WHILE:
+        case STMT_DO_WHILE:
+            next = promote_scope(&stmt->stmt_loop.scope, next);
+            return promote_scope(&stmt->stmt_loop.body, next);
+
+        default:
+            return next;
+    }
+}
+
+static int promote_scope(struct Scope* scope, int next) {
+    for (int i = 0; i < scope->variables_length; i++) {
+        struct Variable* var = scope->variables[i];
+        var->vreg = is_promotable(var) ? next++ : -1;
+    }
+
+    for (int i = 0; i < scope->statements_length; i++) {
+        next = promote_statement(scope->statements[i], next);
+    }
+
+    return next;
+}
+
+// numbers the promotable variables from `first` upwards and marks the rest
+// with -1, returns the next unused number
+int promote_variables(struct Function* func, int first) {
+    return promote_scope(&func->scope, first);
+}
+
+static size_t layout_scope(struct Scope* scope, size_t offset);
+
+static size_t layout_statement(struct Statement* stmt, size_t offset) {
+    switch (stmt->kind) {
+        case STMT_COMPOUND:
+            return layout_scope(&stmt->stmt_compound.scope, offset);
+
+        case STMT_LABEL:
+            return layout_scope(&stmt->stmt_label.scope, offset);
+
+        case STMT_SWITCH:
+            return layout_scope(&stmt->stmt_switch.scope, offset);
+
+        case STMT_IF:
+        case STMT_IF_ELSE: {
+            size_t success_end = layout_scope(&stmt->stmt_if.success_scope, offset);
+            size_t failure_end = layout_scope(&stmt->stmt_if.failure_scope, offset);
+            return success_end > failure_end ? success_end : failure_end;
+        }
+
+        // the body is nested in the scope of the initializer
+        case STMT_WHILE:
+        case STMT_DO_WHILE:
+            return layout_scope(&stmt->stmt_loop.body, layout_scope(&stmt->stmt_loop.scope, offset));
+
+        default:
+            return offset;
+    }
+}
+
+// gives each of the variables that is not promoted a slot below `offset`, returns the new end
+size_t layout_variables(struct Variable** variables, size_t variables_length, size_t offset) {
+    for (size_t i = 0; i < variables_length; i++) {
+        struct Variable* var = variables[i];
+        if (var->vreg >= 0) continue;
+
+        // slots grow downwards, so the offset points at the start of the variable
+        offset = align_offset(offset + type_size(var->type), type_align(var->type));
+        var->offset = offset;
+    }
+
+    return offset;
+}
+
+// returns the deepest offset used by `scope` and its nested scopes
+static size_t layout_scope(struct Scope* scope, size_t offset) {
+    offset = layout_variables(scope->variables, scope->variables_length, offset);
+
+    // nested scopes all start right below the variables of this one
+    size_t end = offset;
+    for (int i = 0; i < scope->statements_length; i++) {
+        size_t statement_end = layout_statement(scope->statements[i], offset);
+        if (statement_end > end) {
+            end = statement_end;
+        }
+    }
+
+    return end;
+}
+
+// assigns a frame offset to every parameter and local, returns the frame size
+size_t layout_frame(struct Function* func) {
+    return layout_scope(&func->scope, 0);
+}
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef CFCC_GVN_C
+#define CFCC_GVN_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.c"
+#include "dce.c"
+#include "ir.c"
+#include "mir.c"
+#include "pass.c"
+#include "symbol.c"
+
+// Global value numbering: blocks are visited in reverse postorder and every
+// pure instruction is looked up among the ones already seen. One computing
+// the same thing in a dominating block (or earlier in the same block) takes
+// its place. Arithmetic on constants becomes a constant first, which is what
+// carries constant arguments of inlined calls through the body.
+// Loads are numbered by what memory holds: a load from an address that was
+// just stored to or loaded from is that value, as long as nothing in
+// between may have written there. What memory holds is tracked through a
+// block and on into a successor that has no other way in.
+
+struct ValueTable {
+    struct IrInst** entries;
+    size_t capacity;
+};
+
+// a load or store and the value it leaves at its address
+struct MemoryEntry {
+    struct IrInst* access;
+    struct IrInst* value;
+};
+
+struct MemoryState {
+    struct MemoryEntry* entries;
+    size_t entries_length;
+};
+
+// accesses remembered at once, keeps long blocks of stores from going quadratic
+#define MEMORY_ENTRIES_MAX 64
+
+static bool is_pure_op(enum IrOp op) {
+    switch (op) {
+        case IR_CONST:
+        case IR_SLOT:
+        case IR_PHI:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_MOD:
+        case IR_CMP:
+        case IR_SEXT:
+        case IR_SPLAT:
+        case IR_LEA:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// wraps `value` to the width of a value of `size` bytes
+static int64_t truncate_constant(int64_t value, int size) {
+    return size == 8 ? value : (int64_t) (int32_t) (uint32_t) value;
+}
+
+// turns arithmetic on constants into the constant it computes
+static bool fold_constant(struct IrInst* inst) {
+    if (inst->operands_length == 0) return false;
+    for (size_t i = 0; i < inst->operands_length; i++) {
+        if (inst->operands[i]->op != IR_CONST) return false;
+    }
+
+    int64_t a = inst->operands[0]->imm;
+    int64_t b = inst->operands_length > 1 ? inst->operands[1]->imm : 0;
+    uint64_t ua = (uint64_t) a;
+    uint64_t ub = (uint64_t) b;
+
+    int64_t value;
+    switch (inst->op) {
+        case IR_ADD: value = (int64_t) (ua + ub); break;
+        case IR_SUB: value = (int64_t) (ua - ub); break;
+        case IR_MUL: value = (int64_t) (ua * ub); break;
+        case IR_SEXT: value = a; break;
+        case IR_CMP: value = evaluate_condition(inst->cond, a, b); break;
+
+        case IR_DIV:
+        case IR_MOD:
+            // division by zero and the one overflowing quotient are left to trap at run time
+            if (b == 0 || (b == -1 && a == (inst->size == 8 ? INT64_MIN : INT32_MIN))) return false;
+            value = inst->op == IR_DIV ? a / b : a % b;
+            break;
+
+        default:
+            return false;
+    }
+
+    inst->op = IR_CONST;
+    inst->imm = truncate_constant(value, inst->size);
+    inst->operands_length = 0;
+    inst->scale = 1;
+    inst->cond = COND_E;
+    return true;
+}
+
+// equal values are equal instructions once commutative operands are ordered
+static void canonicalize(struct IrInst* inst) {
+    if (inst->operands_length != 2) return;
+
+    struct IrInst* left = inst->operands[0];
+    struct IrInst* right = inst->operands[1];
+    if (left->id <= right->id) return;
+
+    if (inst->op == IR_ADD || inst->op == IR_MUL) {
+        inst->operands[0] = right;
+        inst->operands[1] = left;
+    } else if (inst->op == IR_CMP) {
+        inst->operands[0] = right;
+        inst->operands[1] = left;
+        inst->cond = swap_condition(inst->cond);
+    }
+}
+
+static uint64_t hash_inst(struct IrInst* inst) {
+    uint64_t hash = 14695981039346656037ull;
+    uint64_t fields[] = { inst->op, inst->size, (uint64_t) inst->imm, inst->scale, inst->cond, (uint64_t) (uintptr_t) inst->variable };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        hash = (hash ^ fields[i]) * 1099511628211ull;
+    }
+
+    for (size_t i = 0; i < inst->operands_length; i++) {
+        hash = (hash ^ (uint64_t) inst->operands[i]->id) * 1099511628211ull;
+    }
+
+    // phis only mean the same thing in the same block
+    if (inst->op == IR_PHI) hash = (hash ^ (uint64_t) inst->block->id) * 1099511628211ull;
+    return hash;
+}
+
+static bool same_value(struct IrInst* a, struct IrInst* b) {
+    if (a->op != b->op || a->size != b->size || a->imm != b->imm || a->scale != b->scale) return false;
+    if (a->cond != b->cond || a->variable != b->variable || a->operands_length != b->operands_length) return false;
+    if (a->op == IR_PHI && a->block != b->block) return false;
+
+    for (size_t i = 0; i < a->operands_length; i++) {
+        if (a->operands[i] != b->operands[i]) return false;
+    }
+
+    return true;
+}
+
+// an equal instruction available where `inst` is, after which `inst` itself is
+static struct IrInst* find_or_insert(struct ValueTable* table, struct IrInst* inst) {
+    size_t mask = table->capacity - 1;
+    size_t index = hash_inst(inst) & mask;
+
+    while (table->entries[index] != NULL) {
+        struct IrInst* entry = table->entries[index];
+        if (same_value(entry, inst) && ir_dominates(entry->block, inst->block)) return entry;
+        index = (index + 1) & mask;
+    }
+
+    table->entries[index] = inst;
+    return inst;
+}
+
+// frame variables whose address is used for more than loading and storing,
+// anything could write to those
+static void find_escaping_slots(struct IrFunction* fn, struct SymbolTable* escaping) {
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            bool memory = inst->op == IR_LOAD || inst->op == IR_STORE;
+
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                struct IrInst* operand = inst->operands[k];
+                if (operand->op != IR_SLOT || (memory && (int) k == ir_address_start(inst))) continue;
+
+                symbol_table_set(escaping, fn->arena, (const char*) operand->variable, operand);
+            }
+        }
+    }
+}
+
+static int access_width(struct IrInst* access) {
+    return access->op == IR_STORE ? access->operands[0]->size : access->size;
+}
+
+static struct IrInst* access_index(struct IrInst* access) {
+    return ir_has_index(access) ? access->operands[ir_address_start(access) + 1] : NULL;
+}
+
+static bool same_base(struct IrInst* a, struct IrInst* b) {
+    return a == b || (a->op == IR_SLOT && b->op == IR_SLOT && a->variable == b->variable);
+}
+
+static bool same_location(struct IrInst* a, struct IrInst* b) {
+    return same_base(a->operands[ir_address_start(a)], b->operands[ir_address_start(b)])
+        && access_index(a) == access_index(b) && a->scale == b->scale && a->imm == b->imm
+        && access_width(a) == access_width(b);
+}
+
+static bool may_alias(struct SymbolTable* escaping, struct IrInst* a, struct IrInst* b) {
+    struct IrInst* base_a = a->operands[ir_address_start(a)];
+    struct IrInst* base_b = b->operands[ir_address_start(b)];
+
+    if (!same_base(base_a, base_b)) {
+        if (base_a->op == IR_SLOT && base_b->op == IR_SLOT) return false;
+
+        // through a pointer only variables whose address got out are reachable
+        struct IrInst* slot = base_a->op == IR_SLOT ? base_a : base_b->op == IR_SLOT ? base_b : NULL;
+        return slot == NULL || symbol_table_find(escaping, (const char*) slot->variable) != NULL;
+    }
+
+    // the same base and index only overlap if the byte ranges do
+    if (access_index(a) != access_index(b) || (access_index(a) != NULL && a->scale != b->scale)) return true;
+    return a->imm < b->imm + access_width(b) && b->imm < a->imm + access_width(a);
+}
+
+static void remember_access(struct MemoryState* state, struct IrInst* access, struct IrInst* value) {
+    if (state->entries_length == MEMORY_ENTRIES_MAX) {
+        memmove(&state->entries[0], &state->entries[1], sizeof(struct MemoryEntry) * (MEMORY_ENTRIES_MAX - 1));
+        state->entries_length -= 1;
+    }
+
+    state->entries[state->entries_length++] = (struct MemoryEntry) { access, value };
+}
+
+// forgets every access `store` may overwrite, with `store` NULL every one a call may
+static void clobber_memory(struct MemoryState* state, struct SymbolTable* escaping, struct IrInst* store) {
+    size_t kept = 0;
+    for (size_t i = 0; i < state->entries_length; i++) {
+        struct IrInst* access = state->entries[i].access;
+
+        bool clobbered;
+        if (store != NULL) {
+            clobbered = may_alias(escaping, access, store);
+        } else {
+            struct IrInst* base = access->operands[ir_address_start(access)];
+            clobbered = base->op != IR_SLOT || symbol_table_find(escaping, (const char*) base->variable) != NULL;
+        }
+
+        if (!clobbered) state->entries[kept++] = state->entries[i];
+    }
+
+    state->entries_length = kept;
+}
+
+static struct IrInst* forward_load(struct MemoryState* state, struct IrInst* load) {
+    for (size_t i = state->entries_length; i-- > 0;) {
+        struct MemoryEntry* entry = &state->entries[i];
+        if (same_location(entry->access, load)) {
+            struct IrInst* value = ir_resolve(entry->value);
+            return value->size == load->size ? value : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+static bool number_values(struct IrFunction* fn) {
+    ir_compute_dominators(fn);
+
+    struct ValueTable table;
+    table.capacity = 16;
+    while (table.capacity < (size_t) fn->value_count * 2) table.capacity *= 2;
+    table.entries = arena_calloc(fn->arena, sizeof(struct IrInst*) * table.capacity);
+
+    struct SymbolTable escaping;
+    init_symbol_table(&escaping);
+    find_escaping_slots(fn, &escaping);
+
+    // block id -> what memory holds at its end
+    struct MemoryState* states = arena_calloc(fn->arena, sizeof(struct MemoryState) * fn->block_count);
+    bool changed = false;
+
+    for (size_t i = 0; i < fn->rpo_length; i++) {
+        struct IrBlock* block = fn->rpo[i];
+
+        struct MemoryState* state = &states[block->id];
+        state->entries = arena_alloc(fn->arena, sizeof(struct MemoryEntry) * MEMORY_ENTRIES_MAX);
+        state->entries_length = 0;
+
+        // a block with a single way in starts from where its predecessor ended,
+        // unless that is a back edge
+        if (block->preds_length == 1 && block->preds[0]->order < block->order) {
+            struct MemoryState* from = &states[block->preds[0]->id];
+            memcpy(state->entries, from->entries, sizeof(struct MemoryEntry) * from->entries_length);
+            state->entries_length = from->entries_length;
+        }
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                inst->operands[k] = ir_resolve(inst->operands[k]);
+            }
+
+            if (is_pure_op(inst->op)) {
+                changed |= fold_constant(inst);
+                canonicalize(inst);
+
+                struct IrInst* leader = find_or_insert(&table, inst);
+                if (leader != inst) {
+                    inst->replacement = leader;
+                    changed = true;
+                }
+            } else if (inst->op == IR_LOAD) {
+                struct IrInst* value = forward_load(state, inst);
+                if (value != NULL) {
+                    inst->replacement = value;
+                    changed = true;
+                } else {
+                    remember_access(state, inst, inst);
+                }
+            } else if (inst->op == IR_STORE) {
+                clobber_memory(state, &escaping, inst);
+                remember_access(state, inst, inst->operands[0]);
+            } else if (inst->op == IR_CALL) {
+                clobber_memory(state, &escaping, NULL);
+            }
+        }
+    }
+
+    if (changed) ir_apply_replacements(fn);
+    return changed;
+}
+
+const struct IrPass gvn_pass = { "gvn", number_values };
+
+#endif
@@ -2,16 +2,27 @@
 #define CFCC_HIR_C
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.c"
+#include "symbol.c"
 #include "type.c"
 
 // Common types
 struct Variable {
     const char* identifier;
     struct Type* type;
+
+    // distance below %rbp, assigned by layout_frame
+    size_t offset;
+
+    // number of the register the variable was promoted to (a virtual register,
+    // or its ssa variable), -1 when it lives in the frame
+    int vreg;
+    bool address_taken;
 };
 
 struct Function;
@@ -21,20 +32,28 @@ struct Scope {
 
     struct Function** functions;
     size_t functions_length;
+    size_t functions_capacity;
     
     struct Variable** variables;
     size_t variables_length;
+    size_t variables_capacity;
 
     struct Statement** statements;
     size_t statements_length;
+    size_t statements_capacity;
+
+    // identifier -> declaration, keyed by interned identifiers
+    struct SymbolTable function_table;
+    struct SymbolTable variable_table;
 };
 
 
 struct Function {
-    char* identifier;
+    const char* identifier;
     
     struct Variable** params;
     size_t params_length;
+    size_t params_capacity;
 
     struct Type* return_type;
 
@@ -45,6 +64,12 @@ struct Function {
 // Compilation Unit
 struct Unit {
     struct Scope scope;
+
+    // owns every node, identifier and list reachable from `scope`
+    struct Arena arena;
+
+    // every string extracted from the source is interned here
+    struct Interner interner;
 };
 
 // Expressions
@@ -78,8 +103,11 @@ struct ExprAssignmentPointer {
 };
 
 struct ExprLiteral {
-    char* value;
+    const char* value;
     struct Type* type;
+
+    // integer literals are parsed once while lowering
+    int32_t integer;
 };
 
 struct ExprCall {
@@ -87,6 +115,7 @@ struct ExprCall {
 
     struct Expression** args;
     size_t args_length;
+    size_t args_capacity;
 };
 
 enum BinaryOperation {
@@ -95,6 +124,7 @@ enum BinaryOperation {
     BINARY_OP_SUB,
     BINARY_OP_DIV,
     BINARY_OP_MUL,
+    BINARY_OP_MOD,
     
     // relational
     BINARY_OP_LT,
@@ -172,6 +202,35 @@ struct StmtExpression {
     struct Expression expr;
 };
 
+struct StmtSwitch {
+    struct Expression value;
+    struct Scope scope;
+
+    // the case labels of this switch anywhere in its body, in source order
+    struct Statement** cases;
+    size_t cases_length;
+    size_t cases_capacity;
+};
+
+struct StmtCase {
+    // unused for `default`
+    struct Expression value;
+    bool is_default;
+};
+
+// `while`, `for` and `do ... while` loops; the initializer of a `for` and the
+// variables it declares live in `scope`, the body is nested in it
+struct StmtLoop {
+    struct Scope scope;
+    struct Scope body;
+
+    // a missing condition is always true
+    bool has_condition;
+    struct Expression condition;
+    bool has_step;
+    struct Expression step;
+};
+
 enum StatementKind {
     STMT_COMPOUND,
     STMT_GOTO,
@@ -180,6 +239,12 @@ enum StatementKind {
     STMT_IF_ELSE,
     STMT_RETURN,
     STMT_EXPRESSION,
+    STMT_SWITCH,
+    STMT_CASE,
+    STMT_BREAK,
+    STMT_WHILE,
+    STMT_DO_WHILE,
+    STMT_CONTINUE,
 };
 
 struct Statement {
@@ -191,6 +256,9 @@ struct Statement {
         struct StmtIf stmt_if;
         struct StmtReturn stmt_return;
         struct StmtExpression stmt_expression;
+        struct StmtSwitch stmt_switch;
+        struct StmtCase stmt_case;
+        struct StmtLoop stmt_loop;
     };
 };
 
@@ -242,19 +310,14 @@ void dbg_node_named(TSNode node) {
     }
 }
 
-char* tsnstr(const char* src, TSNode node) {
+const char* tsnstr(struct Unit* unit, const char* src, TSNode node) {
     size_t start = ts_node_start_byte(node);
     size_t end = ts_node_end_byte(node);
-    size_t length = end - start;
 
-    char* buffer = malloc(length + 1);
-    memcpy(buffer, &src[start], length);
-    buffer[length] = '\0';
-
-    return buffer;
+    return intern(&unit->interner, &unit->arena, &src[start], end - start);
 }
 
-enum BinaryOperation parse_binary_op(char* str) {
+enum BinaryOperation parse_binary_op(const char* str) {
     if (strcmp(str, "+") == 0)
         return BINARY_OP_ADD;
 
@@ -267,6 +330,9 @@ enum BinaryOperation parse_binary_op(char* str) {
     else if (strcmp(str, "/") == 0)
         return BINARY_OP_DIV;
 
+    else if (strcmp(str, "%") == 0)
+        return BINARY_OP_MOD;
+
     else if (strcmp(str, "<") == 0)
         return BINARY_OP_LT;
 
@@ -295,40 +361,44 @@ enum BinaryOperation parse_binary_op(char* str) {
         return -1;
 }
 
-char* parse_declarator(struct Type** type, const char* src, TSNode node) {
+const char* parse_declarator(struct Unit* unit, struct Type** type, const char* src, TSNode node) {
     switch (ts_node_symbol(node)) {
         case sym_identifier: {
-            return tsnstr(src, node);
+            return tsnstr(unit, src, node);
         }
 
         case sym_pointer_declarator: {
             struct Type* inner = (*type);
-            *type = malloc(sizeof(struct Type));
+            *type = arena_alloc(&unit->arena, sizeof(struct Type));
             (*type)->kind = TYPE_KIND_POINTER;
             (*type)->pointer.type = inner;
-            return parse_declarator(type, src, ts_node_named_child(node, 0));
+            return parse_declarator(unit, type, src, ts_node_named_child(node, 0));
         }
 
         case sym_array_declarator: {
             TSNode ident_node = ts_node_named_child(node, 0);
-            TSNode length_node = ts_node_named_child(node, 1);
-            char* length_str = tsnstr(src, length_node);
 
             struct Type* inner = (*type);
-            *type = malloc(sizeof(struct Type));
+            *type = arena_alloc(&unit->arena, sizeof(struct Type));
             (*type)->kind = TYPE_KIND_ARRAY;
             (*type)->array.type = inner;
+            (*type)->array.length = 0;
+
+            // `[]` is left at 0 for an initializer list to fill in
+            if (ts_node_named_child_count(node) < 2) {
+                return tsnstr(unit, src, ident_node);
+            }
 
             // TODO: implement const expressions in array declarators
+            const char* length_str = tsnstr(unit, src, ts_node_named_child(node, 1));
             size_t length = strtol(length_str, NULL, 10);
             if (length == 0) {
                 printf("failed to parse array length, must be const\n");
             }
 
             (*type)->array.length = length;
-            free(length_str);
 
-            return tsnstr(src, ident_node);
+            return tsnstr(unit, src, ident_node);
         }
 
         default: {
@@ -337,31 +407,27 @@ char* parse_declarator(struct Type** type, const char* src, TSNode node) {
     }
 }
 
-struct Function* find_func(char* identifier, struct Scope* scope) {
-    for (int i = 0; i < scope->functions_length; i++) {
-        if (strcmp(identifier, scope->functions[i]->identifier) == 0) {
-            return scope->functions[i];
+// `identifier` must be interned
+struct Function* find_func(const char* identifier, struct Scope* scope) {
+    for (; scope != NULL; scope = scope->outer) {
+        struct Function* func = symbol_table_find(&scope->function_table, identifier);
+        if (func != NULL) {
+            return func;
         }
     }
 
-    if (scope->outer != NULL) {
-        return find_func(identifier, scope->outer);
-    }
-
     return NULL;
 }
 
-struct Variable* find_var(char* identifier, struct Scope* scope) {
-    for (int i = 0; i < scope->variables_length; i++) {
-        if (strcmp(identifier, scope->variables[i]->identifier) == 0) {
-            return scope->variables[i];
+// `identifier` must be interned
+struct Variable* find_var(const char* identifier, struct Scope* scope) {
+    for (; scope != NULL; scope = scope->outer) {
+        struct Variable* var = symbol_table_find(&scope->variable_table, identifier);
+        if (var != NULL) {
+            return var;
         }
     }
 
-    if (scope->outer != NULL) {
-        return find_var(identifier, scope->outer);
-    }
-
     return NULL;
 }
 
@@ -373,17 +439,22 @@ void init_scope(struct Scope* scope, struct Scope* outer) {
     scope->variables_length = 0;
     scope->statements_length = 0;
 
+    scope->functions_capacity = 0;
+    scope->variables_capacity = 0;
+    scope->statements_capacity = 0;
+
     scope->functions = NULL;
     scope->variables = NULL;
     scope->statements = NULL;
 
-    scope->variables = NULL;
-    scope->variables_length = 0;
+    init_symbol_table(&scope->function_table);
+    init_symbol_table(&scope->variable_table);
 }
 
 void init_func(struct Function* func, struct Scope* outer) {
     func->params = NULL;
     func->params_length = 0;
+    func->params_capacity = 0;
 
     func->prototype = false;
 
@@ -391,50 +462,123 @@ void init_func(struct Function* func, struct Scope* outer) {
 }
 
 // list helper functions
-struct Statement* append_stmt(struct Scope* scope) {
-    scope->statements_length += 1;
-    scope->statements = realloc(scope->statements, sizeof(struct Statement) * scope->statements_length);
-    return scope->statements[scope->statements_length - 1] = malloc(sizeof(struct Statement));
+static void* grow_list(struct Arena* arena, void* list, size_t length, size_t* capacity, size_t element_size) {
+    if (length < *capacity) {
+        return list;
+    }
+
+    size_t new_capacity = *capacity > 0 ? *capacity * 2 : 4;
+    list = arena_grow(arena, list, element_size * *capacity, element_size * new_capacity);
+    *capacity = new_capacity;
+    return list;
+}
+
+struct Statement* append_stmt(struct Arena* arena, struct Scope* scope) {
+    scope->statements = grow_list(arena, scope->statements, scope->statements_length, &scope->statements_capacity, sizeof(struct Statement*));
+    return scope->statements[scope->statements_length++] = arena_alloc(arena, sizeof(struct Statement));
+}
+
+void append_case(struct Arena* arena, struct StmtSwitch* switch_stmt, struct Statement* case_stmt) {
+    switch_stmt->cases = grow_list(arena, switch_stmt->cases, switch_stmt->cases_length, &switch_stmt->cases_capacity, sizeof(struct Statement*));
+    switch_stmt->cases[switch_stmt->cases_length++] = case_stmt;
+}
+
+// gathers the case labels in `scope` that belong to `switch_stmt`, nested switches keep theirs
+static void collect_cases(struct Arena* arena, struct StmtSwitch* switch_stmt, struct Scope* scope) {
+    for (int i = 0; i < scope->statements_length; i++) {
+        struct Statement* stmt = scope->statements[i];
+        switch (stmt->kind) {
+            case STMT_CASE:
+                append_case(arena, switch_stmt, stmt);
+                break;
+
+            case STMT_COMPOUND:
+                collect_cases(arena, switch_stmt, &stmt->stmt_compound.scope);
+                break;
+
+            case STMT_LABEL:
+                collect_cases(arena, switch_stmt, &stmt->stmt_label.scope);
+                break;
+
+            case STMT_IF:
+            case STMT_IF_ELSE:
+                collect_cases(arena, switch_stmt, &stmt->stmt_if.success_scope);
+                collect_cases(arena, switch_stmt, &stmt->stmt_if.failure_scope);
+                break;
+
+            case STMT_WHILE:
+            case STMT_DO_WHILE:
+                collect_cases(arena, switch_stmt, &stmt->stmt_loop.scope);
+                collect_cases(arena, switch_stmt, &stmt->stmt_loop.body);
+                break;
+
+            default:
+                break;
+        }
+    }
 }
 
-struct Expression* append_arg(struct ExprCall* call_expr) {
-    call_expr->args_length += 1;
-    call_expr->args = realloc(call_expr->args, sizeof(struct Statement) * call_expr->args_length);
-    return call_expr->args[call_expr->args_length - 1] = malloc(sizeof(struct Expression));
+struct Expression* append_arg(struct Arena* arena, struct ExprCall* call_expr) {
+    call_expr->args = grow_list(arena, call_expr->args, call_expr->args_length, &call_expr->args_capacity, sizeof(struct Expression*));
+    return call_expr->args[call_expr->args_length++] = arena_alloc(arena, sizeof(struct Expression));
 }
 
-struct Function* append_func(struct Scope* scope) {
-    scope->functions_length += 1;
-    scope->functions = realloc(scope->functions, sizeof(struct Function) * scope->functions_length);
-    struct Function* func = malloc(sizeof(struct Function));
+struct Function* append_func(struct Arena* arena, struct Scope* scope, const char* identifier) {
+    scope->functions = grow_list(arena, scope->functions, scope->functions_length, &scope->functions_capacity, sizeof(struct Function*));
+    struct Function* func = arena_alloc(arena, sizeof(struct Function));
     init_func(func, scope);
-    return scope->functions[scope->functions_length - 1] = func;
+    func->identifier = identifier;
+
+    symbol_table_insert(&scope->function_table, arena, identifier, func);
+    return scope->functions[scope->functions_length++] = func;
+}
+
+struct Variable* append_var(struct Arena* arena, struct Scope* scope, const char* identifier, struct Type* type) {
+    scope->variables = grow_list(arena, scope->variables, scope->variables_length, &scope->variables_capacity, sizeof(struct Variable*));
+    struct Variable* var = arena_alloc(arena, sizeof(struct Variable));
+    var->identifier = identifier;
+    var->type = type;
+    var->offset = 0;
+    var->vreg = -1;
+    var->address_taken = false;
+
+    symbol_table_insert(&scope->variable_table, arena, identifier, var);
+    return scope->variables[scope->variables_length++] = var;
 }
 
-struct Variable* append_var(struct Scope* scope) {
-    scope->variables_length += 1;
-    scope->variables = realloc(scope->variables, sizeof(struct Variable) * scope->variables_length);
-    return scope->variables[scope->variables_length - 1] = malloc(sizeof(struct Variable));
+struct Variable* append_param(struct Arena* arena, struct Function* func, const char* identifier, struct Type* type) {
+    func->params = grow_list(arena, func->params, func->params_length, &func->params_capacity, sizeof(struct Variable*));
+    struct Variable* param = append_var(arena, &func->scope, identifier, type);
+    return func->params[func->params_length++] = param;
 }
 
-struct Variable* append_param(struct Function* func) {
-    func->params_length += 1;
-    func->scope.variables_length += 1;
-    func->params = realloc(func->params, sizeof(struct Variable) * func->params_length);
-    func->scope.variables = realloc(func->scope.variables, sizeof(struct Variable) * func->scope.variables_length);
-    return func->params[func->params_length - 1] = func->scope.variables[func->scope.variables_length - 1] = malloc(sizeof(struct Variable));
+static struct Expression* integer_literal(struct Unit* unit, int32_t value) {
+    char text[16];
+    int length = snprintf(text, sizeof(text), "%d", value);
+
+    struct Expression* expr = arena_alloc(&unit->arena, sizeof(struct Expression));
+    expr->kind = EXPR_LITERAL;
+    expr->expr_literal.value = intern(&unit->interner, &unit->arena, text, length);
+    expr->expr_literal.type = arena_alloc(&unit->arena, sizeof(struct Type));
+    expr->expr_literal.type->kind = TYPE_KIND_BASIC;
+    expr->expr_literal.type->basic = TYPE_I32;
+    expr->expr_literal.integer = value;
+    return expr;
 }
 
 // ast -> hir
-void lower_expression(struct Expression* expr, struct Scope* scope, const char* src, TSNode node) {
+void lower_expression(struct Unit* unit, struct Expression* expr, struct Scope* scope, const char* src, TSNode node) {
+    struct Arena* arena = &unit->arena;
+
     switch (ts_node_symbol(node)) {
         case sym_call_expression: {
             expr->kind = EXPR_CALL;
             expr->expr_call.args = NULL;
             expr->expr_call.args_length = 0;
+            expr->expr_call.args_capacity = 0;
             
             TSNode ident_node = ts_node_named_child(node, 0);
-            char* identifier = tsnstr(src, ident_node);
+            const char* identifier = tsnstr(unit, src, ident_node);
             expr->expr_call.func = find_func(identifier, scope);
             
             if (expr->expr_call.func == NULL) {
@@ -445,8 +589,8 @@ void lower_expression(struct Expression* expr, struct Scope* scope, const char*
             size_t args_count = ts_node_named_child_count(args_node);
             for (int j = 0; j < args_count; j++) {
                 TSNode arg_node = ts_node_named_child(args_node, j);
-                struct Expression* arg = append_arg(&expr->expr_call);
-                lower_expression(arg, scope, src, arg_node);
+                struct Expression* arg = append_arg(arena, &expr->expr_call);
+                lower_expression(unit, arg, scope, src, arg_node);
             }
 
             break;
@@ -455,7 +599,7 @@ void lower_expression(struct Expression* expr, struct Scope* scope, const char*
         case sym_identifier: {
             expr->kind = EXPR_VARIABLE;
 
-            char* identifier = tsnstr(src, node);
+            const char* identifier = tsnstr(unit, src, node);
             expr->expr_variable.variable = find_var(identifier, scope);
 
             if (expr->expr_variable.variable == NULL) {
@@ -472,20 +616,34 @@ void lower_expression(struct Expression* expr, struct Scope* scope, const char*
             TSNode index_expr_node = ts_node_named_child(node, 1);
             
             expr->kind = EXPR_INDEX;
-            expr->expr_assignment.location = malloc(sizeof(struct Expression));
-            expr->expr_assignment.expression = malloc(sizeof(struct Expression));
-            lower_expression(expr->expr_index.location, scope, src, location_node);
-            lower_expression(expr->expr_index.expression, scope, src, index_expr_node);
+            expr->expr_assignment.location = arena_alloc(arena, sizeof(struct Expression));
+            expr->expr_assignment.expression = arena_alloc(arena, sizeof(struct Expression));
+            lower_expression(unit, expr->expr_index.location, scope, src, location_node);
+            lower_expression(unit, expr->expr_index.expression, scope, src, index_expr_node);
 
             break;
         }
 
         case sym_pointer_expression: {
             TSNode op_node = ts_node_child(node, 0);
-            char* op = tsnstr(src, op_node);
+            const char* op = tsnstr(unit, src, op_node);
             switch (op[0])
             {
             case '*': {
+                // *p is p[0], which already loads and stores through a pointer
+                struct Expression* pointer = arena_alloc(arena, sizeof(struct Expression));
+                TSNode expr_node = ts_node_named_child(node, 0);
+                lower_expression(unit, pointer, scope, src, expr_node);
+
+                // *&e is e
+                if (pointer->kind == EXPR_ADDRESS_OF) {
+                    *expr = *pointer->expr_address_of.expression;
+                    break;
+                }
+
+                expr->kind = EXPR_INDEX;
+                expr->expr_index.location = pointer;
+                expr->expr_index.expression = integer_literal(unit, 0);
 
                 break;
             }
@@ -494,8 +652,13 @@ void lower_expression(struct Expression* expr, struct Scope* scope, const char*
                 expr->kind = EXPR_ADDRESS_OF;
 
                 TSNode expr_node = ts_node_named_child(node, 0);
-                expr->expr_address_of.expression = malloc(sizeof(struct Expression));
-                lower_expression(expr->expr_address_of.expression, scope, src, expr_node);
+                expr->expr_address_of.expression = arena_alloc(arena, sizeof(struct Expression));
+                lower_expression(unit, expr->expr_address_of.expression, scope, src, expr_node);
+
+                // such variables must keep a frame slot
+                if (expr->expr_address_of.expression->kind == EXPR_VARIABLE && expr->expr_address_of.expression->expr_variable.variable != NULL) {
+                    expr->expr_address_of.expression->expr_variable.variable->address_taken = true;
+                }
 
                 break;
             }
@@ -512,16 +675,16 @@ void lower_expression(struct Expression* expr, struct Scope* scope, const char*
             TSNode expr_node = ts_node_named_child(node, 1);
 
             expr->kind = EXPR_ASSIGNMENT;
-            expr->expr_assignment.location = malloc(sizeof(struct Expression));
-            expr->expr_assignment.expression = malloc(sizeof(struct Expression));
-            lower_expression(expr->expr_assignment.location, scope, src, lval_node);
-            lower_expression(expr->expr_assignment.expression, scope, src, expr_node);
+            expr->expr_assignment.location = arena_alloc(arena, sizeof(struct Expression));
+            expr->expr_assignment.expression = arena_alloc(arena, sizeof(struct Expression));
+            lower_expression(unit, expr->expr_assignment.location, scope, src, lval_node);
+            lower_expression(unit, expr->expr_assignment.expression, scope, src, expr_node);
             break;
         }
 
         case sym_parenthesized_expression: {
             TSNode inner_node = ts_node_named_child(node, 0);
-            lower_expression(expr, scope, src, inner_node);
+            lower_expression(unit, expr, scope, src, inner_node);
             break;
         }
 
@@ -534,34 +697,36 @@ void lower_expression(struct Expression* expr, struct Scope* scope, const char*
             TSNode  left_node = ts_node_child(node, 0);
             TSNode   mid_node = ts_node_child(node, 1);
             TSNode right_node = ts_node_child(node, 2);
-            enum BinaryOperation op = parse_binary_op(tsnstr(src, mid_node));
+            enum BinaryOperation op = parse_binary_op(tsnstr(unit, src, mid_node));
             expr->expr_binary_op.kind = op;
 
-            expr->expr_binary_op.left = malloc(sizeof(struct Expression));
-            lower_expression(expr->expr_binary_op.left, scope, src, left_node);
+            expr->expr_binary_op.left = arena_alloc(arena, sizeof(struct Expression));
+            lower_expression(unit, expr->expr_binary_op.left, scope, src, left_node);
 
-            expr->expr_binary_op.right = malloc(sizeof(struct Expression));
-            lower_expression(expr->expr_binary_op.right, scope, src, right_node);
+            expr->expr_binary_op.right = arena_alloc(arena, sizeof(struct Expression));
+            lower_expression(unit, expr->expr_binary_op.right, scope, src, right_node);
             break;
         }
 
         case sym_number_literal: {
             expr->kind = EXPR_LITERAL;
 
-            char* str = tsnstr(src, node);
+            const char* str = tsnstr(unit, src, node);
             expr->expr_literal.value = str;
+            expr->expr_literal.integer = 0;
 
             // TODO: implement other number literals
             if (strstr(str, ".") != NULL) {
                 // float
-                expr->expr_literal.type = malloc(sizeof(struct Type));
+                expr->expr_literal.type = arena_alloc(arena, sizeof(struct Type));
                 expr->expr_literal.type->kind = TYPE_KIND_BASIC;
                 expr->expr_literal.type->basic = TYPE_F32;
             } else {
                 // int
-                expr->expr_literal.type = malloc(sizeof(struct Type));
+                expr->expr_literal.type = arena_alloc(arena, sizeof(struct Type));
                 expr->expr_literal.type->kind = TYPE_KIND_BASIC;
                 expr->expr_literal.type->basic = TYPE_I32;
+                expr->expr_literal.integer = strtol(str, NULL, 0);
             }
 
             break;
@@ -573,10 +738,48 @@ void lower_expression(struct Expression* expr, struct Scope* scope, const char*
     }
 }
 
-void lower_statement(struct Scope* scope, const char* src, TSNode node) {
+// `int a[n] = { e0, e1, ... }`: an assignment per element in order, the
+// elements without a value are zeroed; runs of these stores become block
+// fills and copies when the IR is lowered
+static void lower_array_initializer(struct Unit* unit, struct Scope* scope, const char* src, struct Variable* var, TSNode list_node) {
+    struct Arena* arena = &unit->arena;
+
+    size_t values_length = ts_node_named_child_count(list_node);
+    size_t length = var->type->array.length;
+    if (values_length > length) {
+        printf("too many initializers for `%s`\n", var->identifier);
+        values_length = length;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        struct Statement* stmt = append_stmt(arena, scope);
+        stmt->kind = STMT_EXPRESSION;
+
+        struct Expression* element = arena_alloc(arena, sizeof(struct Expression));
+        element->kind = EXPR_INDEX;
+        element->expr_index.location = arena_alloc(arena, sizeof(struct Expression));
+        element->expr_index.location->kind = EXPR_VARIABLE;
+        element->expr_index.location->expr_variable.variable = var;
+        element->expr_index.expression = integer_literal(unit, (int32_t) i);
+
+        struct Expression* expr = &stmt->stmt_expression.expr;
+        expr->kind = EXPR_ASSIGNMENT;
+        expr->expr_assignment.location = element;
+        if (i < values_length) {
+            expr->expr_assignment.expression = arena_alloc(arena, sizeof(struct Expression));
+            lower_expression(unit, expr->expr_assignment.expression, scope, src, ts_node_named_child(list_node, i));
+        } else {
+            expr->expr_assignment.expression = integer_literal(unit, 0);
+        }
+    }
+}
+
+void lower_statement(struct Unit* unit, struct Scope* scope, const char* src, TSNode node) {
+    struct Arena* arena = &unit->arena;
+
     switch (ts_node_symbol(node)) {
         case sym_compound_statement: {
-            struct Statement* stmt = append_stmt(scope);
+            struct Statement* stmt = append_stmt(arena, scope);
             stmt->kind = STMT_COMPOUND;
 
             struct Scope* compound_scope = &stmt->stmt_compound.scope;
@@ -585,30 +788,30 @@ void lower_statement(struct Scope* scope, const char* src, TSNode node) {
             size_t cmpd_stmt_node_children_length = ts_node_named_child_count(node);
             for (int i = 0; i < cmpd_stmt_node_children_length; i++) {
                 TSNode stmt_node = ts_node_named_child(node, i);
-                lower_statement(compound_scope, src, stmt_node);
+                lower_statement(unit, compound_scope, src, stmt_node);
             }
 
             break;
         }
 
         case sym_labeled_statement: {
-            struct Statement* stmt = append_stmt(scope);
+            struct Statement* stmt = append_stmt(arena, scope);
             stmt->kind = STMT_LABEL;
-            stmt->stmt_label.label = tsnstr(src, ts_node_named_child(node, 0));
+            stmt->stmt_label.label = tsnstr(unit, src, ts_node_named_child(node, 0));
             init_scope(&stmt->stmt_label.scope, scope);
-            lower_statement(&stmt->stmt_label.scope, src, ts_node_named_child(node, 1));
+            lower_statement(unit, &stmt->stmt_label.scope, src, ts_node_named_child(node, 1));
             break;
         }
 
         case sym_goto_statement: {
-            struct Statement* stmt = append_stmt(scope);
+            struct Statement* stmt = append_stmt(arena, scope);
             stmt->kind = STMT_GOTO;
-            stmt->stmt_goto.label = tsnstr(src, ts_node_named_child(node, 0));
+            stmt->stmt_goto.label = tsnstr(unit, src, ts_node_named_child(node, 0));
             break;
         }
 
         case sym_if_statement: {
-            struct Statement* stmt = append_stmt(scope);
+            struct Statement* stmt = append_stmt(arena, scope);
             stmt->kind = STMT_IF;
             
             struct Scope* success_scope = &stmt->stmt_if.success_scope;
@@ -618,41 +821,123 @@ void lower_statement(struct Scope* scope, const char* src, TSNode node) {
 
             TSNode condition_expr_node = ts_node_named_child(node, 0);
             struct Expression* condition_expr = &stmt->stmt_if.condition_expr;
-            lower_expression(condition_expr, scope, src, condition_expr_node);
+            lower_expression(unit, condition_expr, scope, src, condition_expr_node);
 
             TSNode success_compound_node = ts_node_named_child(node, 1);
-            lower_statement(success_scope, src, success_compound_node);
+            lower_statement(unit, success_scope, src, success_compound_node);
 
             // else branch
             size_t node_children_count = ts_node_named_child_count(node);
             if (node_children_count > 2) {
                 stmt->kind = STMT_IF_ELSE;
                 TSNode failure_compound_node = ts_node_named_child(node, node_children_count - 1);
-                lower_statement(failure_scope, src, failure_compound_node);
+                lower_statement(unit, failure_scope, src, failure_compound_node);
             }
             break;
         }
 
         case sym_return_statement: {
-            struct Statement* stmt = append_stmt(scope);
+            struct Statement* stmt = append_stmt(arena, scope);
             stmt->kind = STMT_RETURN;
 
             struct Expression* expr = &stmt->stmt_return.expr;
             TSNode expr_node = ts_node_named_child(node, 0);
-            lower_expression(expr, scope, src, expr_node);
+            lower_expression(unit, expr, scope, src, expr_node);
+            break;
+        }
+
+        case sym_switch_statement: {
+            struct Statement* stmt = append_stmt(arena, scope);
+            stmt->kind = STMT_SWITCH;
+
+            struct StmtSwitch* switch_stmt = &stmt->stmt_switch;
+            switch_stmt->cases = NULL;
+            switch_stmt->cases_length = 0;
+            switch_stmt->cases_capacity = 0;
+            init_scope(&switch_stmt->scope, scope);
+
+            lower_expression(unit, &switch_stmt->value, scope, src, ts_node_named_child(node, 0));
+            lower_statement(unit, &switch_stmt->scope, src, ts_node_named_child(node, 1));
+            collect_cases(arena, switch_stmt, &switch_stmt->scope);
+            break;
+        }
+
+        case sym_case_statement: {
+            // the label goes into the enclosing scope, followed by the statements after it
+            struct Statement* stmt = append_stmt(arena, scope);
+            stmt->kind = STMT_CASE;
+            stmt->stmt_case.is_default = strcmp(tsnstr(unit, src, ts_node_child(node, 0)), "default") == 0;
+
+            int first = 0;
+            if (!stmt->stmt_case.is_default) {
+                lower_expression(unit, &stmt->stmt_case.value, scope, src, ts_node_named_child(node, 0));
+                first = 1;
+            }
+
+            size_t case_children_length = ts_node_named_child_count(node);
+            for (int i = first; i < case_children_length; i++) {
+                lower_statement(unit, scope, src, ts_node_named_child(node, i));
+            }
+
+            break;
+        }
+
+        case sym_break_statement: {
+            struct Statement* stmt = append_stmt(arena, scope);
+            stmt->kind = STMT_BREAK;
+            break;
+        }
+
+        case sym_continue_statement: {
+            struct Statement* stmt = append_stmt(arena, scope);
+            stmt->kind = STMT_CONTINUE;
+            break;
+        }
+
+        case sym_while_statement:
+        case sym_do_statement:
+        case sym_for_statement: {
+            struct Statement* stmt = append_stmt(arena, scope);
+            stmt->kind = ts_node_symbol(node) == sym_do_statement ? STMT_DO_WHILE : STMT_WHILE;
+
+            struct StmtLoop* loop = &stmt->stmt_loop;
+            init_scope(&loop->scope, scope);
+            init_scope(&loop->body, &loop->scope);
+
+            // declarations are statements of their own, expressions become one
+            TSNode init_node = ts_node_child_by_field_name(node, "initializer", strlen("initializer"));
+            if (!ts_node_is_null(init_node)) {
+                if (ts_node_symbol(init_node) == sym_declaration) {
+                    lower_statement(unit, &loop->scope, src, init_node);
+                } else {
+                    struct Statement* init_stmt = append_stmt(arena, &loop->scope);
+                    init_stmt->kind = STMT_EXPRESSION;
+                    lower_expression(unit, &init_stmt->stmt_expression.expr, &loop->scope, src, init_node);
+                }
+            }
+
+            TSNode condition_node = ts_node_child_by_field_name(node, "condition", strlen("condition"));
+            loop->has_condition = !ts_node_is_null(condition_node);
+            if (loop->has_condition) {
+                lower_expression(unit, &loop->condition, &loop->scope, src, condition_node);
+            }
+
+            TSNode step_node = ts_node_child_by_field_name(node, "update", strlen("update"));
+            loop->has_step = !ts_node_is_null(step_node);
+            if (loop->has_step) {
+                lower_expression(unit, &loop->step, &loop->scope, src, step_node);
+            }
+
+            lower_statement(unit, &loop->body, src, ts_node_child_by_field_name(node, "body", strlen("body")));
             break;
         }
 
         case sym_declaration: {
             TSNode decl_type_node = ts_node_named_child(node, 0);
             TSNode decl_decl_node = ts_node_named_child(node, 1);
-            struct Type* type = malloc(sizeof(struct Type));
+            struct Type* type = arena_alloc(arena, sizeof(struct Type));
             lower_type(src, decl_type_node, type);
 
-            struct Variable* local = append_var(scope);
-            local->identifier = parse_declarator(&type, src, decl_decl_node);
-            local->type = type;
-
             // declaration declarators can be:
             // * <identifier>
             // * <array_declarator>
@@ -666,7 +951,12 @@ void lower_statement(struct Scope* scope, const char* src, TSNode node) {
             switch (ts_node_symbol(decl_decl_node)) {
                 default: {
                     // declarators also contain some type information
-                    local->identifier = parse_declarator(&local->type, src, decl_decl_node);
+                    const char* identifier = parse_declarator(unit, &type, src, decl_decl_node);
+                    if (ts_node_symbol(decl_decl_node) == sym_array_declarator && ts_node_named_child_count(decl_decl_node) < 2) {
+                        printf("array `%s` needs a length or an initializer list\n", identifier);
+                    }
+
+                    append_var(arena, scope, identifier, type);
                     break;
                 }
 
@@ -675,16 +965,35 @@ void lower_statement(struct Scope* scope, const char* src, TSNode node) {
                     TSNode decl_node = ts_node_named_child(decl_decl_node, 0);
                     TSNode expr_node = ts_node_named_child(decl_decl_node, 1);
 
-                    local->identifier = parse_declarator(&local->type, src, decl_node);
+                    const char* identifier = parse_declarator(unit, &type, src, decl_node);
+                    if (ts_node_symbol(expr_node) == sym_initializer_list) {
+                        // `int a[] = { ... }` takes its length from the list
+                        if (type->kind == TYPE_KIND_ARRAY && type->array.length == 0) {
+                            type->array.length = ts_node_named_child_count(expr_node);
+                        }
 
-                    struct Statement* stmt = append_stmt(scope);
+                        struct Variable* var = append_var(arena, scope, identifier, type);
+                        if (type->kind != TYPE_KIND_ARRAY) {
+                            printf("initializer list for `%s`, which is not an array\n", identifier);
+                            break;
+                        }
+
+                        lower_array_initializer(unit, scope, src, var, expr_node);
+                        break;
+                    }
+
+                    struct Variable* var = append_var(arena, scope, identifier, type);
+
+                    struct Statement* stmt = append_stmt(arena, scope);
                     stmt->kind = STMT_EXPRESSION;
 
                     struct Expression* expr = &stmt->stmt_expression.expr;
                     expr->kind = EXPR_ASSIGNMENT;
-                    // expr->expr_assignment.variable = local;
-                    expr->expr_assignment.expression = malloc(sizeof(struct Expression));
-                    lower_expression(expr->expr_assignment.expression, scope, src, expr_node);
+                    expr->expr_assignment.location = arena_alloc(arena, sizeof(struct Expression));
+                    expr->expr_assignment.location->kind = EXPR_VARIABLE;
+                    expr->expr_assignment.location->expr_variable.variable = var;
+                    expr->expr_assignment.expression = arena_alloc(arena, sizeof(struct Expression));
+                    lower_expression(unit, expr->expr_assignment.expression, scope, src, expr_node);
 
                     break;
                 }
@@ -694,12 +1003,12 @@ void lower_statement(struct Scope* scope, const char* src, TSNode node) {
         }
 
         case sym_expression_statement: {
-            struct Statement* stmt = append_stmt(scope);
+            struct Statement* stmt = append_stmt(arena, scope);
             stmt->kind = STMT_EXPRESSION;
 
             struct Expression* expr = &stmt->stmt_expression.expr;
             TSNode expr_node = ts_node_named_child(node, 0);
-            lower_expression(expr, scope, src, expr_node);
+            lower_expression(unit, expr, scope, src, expr_node);
             break;
         }
 
@@ -714,6 +1023,9 @@ void lower_statement(struct Scope* scope, const char* src, TSNode node) {
 }
 
 void lower_unit(struct Unit* unit, const char* src) {
+    struct Arena* arena = &unit->arena;
+    init_arena(arena);
+    init_interner(&unit->interner);
     init_scope(&unit->scope, NULL);
 
     TSParser* parser = ts_parser_new();
@@ -736,26 +1048,23 @@ void lower_unit(struct Unit* unit, const char* src) {
                 TSNode func_return_type_node = ts_node_named_child(node, 0);
                 TSNode func_declarator_node = ts_node_named_child(node, 1);
 
-                struct Function* func = append_func(&unit->scope);
-                struct Type* type = malloc(sizeof(struct Type));
+                TSNode func_identifier_node = ts_node_named_child(func_declarator_node, 0);
+                struct Function* func = append_func(arena, &unit->scope, tsnstr(unit, src, func_identifier_node));
+
+                struct Type* type = arena_alloc(arena, sizeof(struct Type));
                 lower_type(src, func_return_type_node, type);
                 func->return_type = type;
 
-                TSNode func_identifier_node = ts_node_named_child(func_declarator_node, 0);
-                func->identifier = tsnstr(src, func_identifier_node);
-
                 TSNode func_params_node = ts_node_named_child(func_declarator_node, 1);
                 size_t func_params_count = ts_node_named_child_count(func_params_node);
                 for (int j = 0; j < func_params_count; j++) {
                     TSNode param_node = ts_node_named_child(func_params_node, j);
                     TSNode param_type_node = ts_node_named_child(param_node, 0);
                     TSNode param_ident_node = ts_node_named_child(param_node, 1);
-                    struct Type* type = malloc(sizeof(struct Type));
+                    struct Type* type = arena_alloc(arena, sizeof(struct Type));
                     lower_type(src, param_type_node, type);
 
-                    struct Variable* param = append_param(func);
-                    param->identifier = tsnstr(src, param_ident_node);
-                    param->type = type;
+                    append_param(arena, func, tsnstr(unit, src, param_ident_node), type);
                 }
 
                 func->prototype = true;
@@ -767,32 +1076,30 @@ void lower_unit(struct Unit* unit, const char* src) {
                 TSNode func_declarator_node = ts_node_named_child(node, 1);
                 TSNode func_cmpd_stmt_node = ts_node_named_child(node, 2);
                 
-                struct Function* func = append_func(&unit->scope);
-                struct Type* type = malloc(sizeof(struct Type));
+                TSNode func_identifier_node = ts_node_named_child(func_declarator_node, 0);
+                struct Function* func = append_func(arena, &unit->scope, tsnstr(unit, src, func_identifier_node));
+
+                struct Type* type = arena_alloc(arena, sizeof(struct Type));
                 lower_type(src, func_return_type_node, type);
                 func->return_type = type;
 
-                TSNode func_identifier_node = ts_node_named_child(func_declarator_node, 0);
-                func->identifier = tsnstr(src, func_identifier_node);
-
                 TSNode func_params_node = ts_node_named_child(func_declarator_node, 1);
                 size_t func_params_count = ts_node_named_child_count(func_params_node);
                 for (int j = 0; j < func_params_count; j++) {
                     TSNode param_node = ts_node_named_child(func_params_node, j);
                     TSNode param_type_node = ts_node_named_child(param_node, 0);
                     TSNode param_decl_node = ts_node_named_child(param_node, 1);
-                    struct Type* type = malloc(sizeof(struct Type));
+                    struct Type* type = arena_alloc(arena, sizeof(struct Type));
                     lower_type(src, param_type_node, type);
 
-                    struct Variable* param = append_param(func);
-                    param->identifier = parse_declarator(&type, src, param_decl_node);
-                    param->type = type;
+                    const char* identifier = parse_declarator(unit, &type, src, param_decl_node);
+                    append_param(arena, func, identifier, type);
                 }
                 
                 size_t func_cmpd_stmt_node_children_length = ts_node_named_child_count(func_cmpd_stmt_node);
                 for (int j = 0; j < func_cmpd_stmt_node_children_length; j++) {
                     TSNode stmt_node = ts_node_named_child(func_cmpd_stmt_node, j);
-                    lower_statement(&func->scope, src, stmt_node);
+                    lower_statement(unit, &func->scope, src, stmt_node);
                 }
 
                 break;
@@ -812,4 +1119,11 @@ void lower_unit(struct Unit* unit, const char* src) {
     ts_parser_delete(parser);
 }
 
+// releases the whole hir in one go, every pointer into the unit becomes invalid
+void free_unit(struct Unit* unit) {
+    free_arena(&unit->arena);
+    init_interner(&unit->interner);
+    init_scope(&unit->scope, NULL);
+}
+
 #endif
\ No newline at end of file
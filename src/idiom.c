@@ -0,0 +1,402 @@
+#ifndef CFCC_IDIOM_C
+#define CFCC_IDIOM_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.c"
+#include "gvn.c"
+#include "ir.c"
+#include "symbol.c"
+
+// Memory idioms: stores of the same value to consecutive `int` elements, or
+// of elements loaded one by one from consecutive elements of another array,
+// are a fill or a copy of the whole run. Short runs become vector stores,
+// longer ones `rep stosl` or `rep movsl`, and the longest ones calls to
+// memset (when every byte of the value is the same) or memcpy.
+// The run is done at once where its last store was, so nothing between its
+// accesses may touch the memory it reads or writes. This is lowered right
+// before instruction selection, the passes never see a fill or a copy.
+
+// fewer bytes are left to the scalar stores
+#define IDIOM_BYTES_MIN 16
+
+// up to here vector stores, then rep, then the library
+#define IDIOM_VECTOR_BYTES_MAX 128
+#define IDIOM_REP_BYTES_MAX 1024
+
+enum RunKind {
+    RUN_NONE,
+    RUN_FILL,
+    RUN_COPY,
+};
+
+// whether the accesses are to consecutive elements of the same array, in order
+static bool consecutive_accesses(struct IrInst** accesses, size_t length) {
+    struct IrInst* first = accesses[0];
+    for (size_t i = 1; i < length; i++) {
+        struct IrInst* access = accesses[i];
+        if (!same_base(access->operands[ir_address_start(access)], first->operands[ir_address_start(first)])) return false;
+        if (access_index(access) != access_index(first) || access->scale != first->scale) return false;
+        if (access->imm != first->imm + 4 * (int64_t) i) return false;
+    }
+
+    return true;
+}
+
+// orders stores by array, then index and element, so consecutive ones end up next to each other
+static int compare_stores(const void* a, const void* b) {
+    struct IrInst* left = *(struct IrInst* const*) a;
+    struct IrInst* right = *(struct IrInst* const*) b;
+
+    struct IrInst* left_base = left->operands[1];
+    struct IrInst* right_base = right->operands[1];
+    uintptr_t left_key = left_base->op == IR_SLOT ? (uintptr_t) left_base->variable : (uintptr_t) left_base;
+    uintptr_t right_key = right_base->op == IR_SLOT ? (uintptr_t) right_base->variable : (uintptr_t) right_base;
+    if (left_key != right_key) return left_key < right_key ? -1 : 1;
+
+    int left_index = access_index(left) != NULL ? access_index(left)->id : -1;
+    int right_index = access_index(right) != NULL ? access_index(right)->id : -1;
+    if (left_index != right_index) return left_index < right_index ? -1 : 1;
+    if (left->scale != right->scale) return left->scale < right->scale ? -1 : 1;
+    if (left->imm != right->imm) return left->imm < right->imm ? -1 : 1;
+    return left->id < right->id ? -1 : left->id > right->id;
+}
+
+// the stores of i32 values in `block`, sorted so runs of consecutive ones are next to each other
+static size_t collect_stores(struct IrFunction* fn, struct IrBlock* block, struct IrInst*** out) {
+    struct IrInst** stores = arena_alloc(fn->arena, sizeof(struct IrInst*) * (block->insts_length + 1));
+    size_t length = 0;
+    for (size_t i = 0; i < block->insts_length; i++) {
+        struct IrInst* inst = block->insts[i];
+        if (inst->op == IR_STORE && inst->operands[0]->size == 4) stores[length++] = inst;
+    }
+
+    qsort(stores, length, sizeof(struct IrInst*), compare_stores);
+    *out = stores;
+    return length;
+}
+
+// the end of the run of consecutive stores starting at `start`
+static size_t run_end(struct IrInst** stores, size_t length, size_t start) {
+    size_t end = start + 1;
+    while (end < length && consecutive_accesses(&stores[end - 1], 2)) end++;
+    return end;
+}
+
+// instruction id -> position in its block, one array for the whole function that
+// only the block being rewritten is renumbered in; grows with the instructions added
+static size_t* number_insts(struct IrFunction* fn, struct IrBlock* block, size_t* positions, size_t* capacity) {
+    if ((size_t) fn->value_count > *capacity) {
+        size_t grown = *capacity * 2 > (size_t) fn->value_count ? *capacity * 2 : (size_t) fn->value_count;
+        positions = arena_grow(fn->arena, positions, sizeof(size_t) * *capacity, sizeof(size_t) * grown);
+        *capacity = grown;
+    }
+
+    for (size_t i = 0; i < block->insts_length; i++) {
+        positions[block->insts[i]->id] = i;
+    }
+
+    return positions;
+}
+
+// the fill or copy the run of stores starts with, with how many stores it takes
+static enum RunKind run_prefix(struct IrBlock* block, struct IrInst** stores, size_t length, size_t* prefix) {
+    struct IrInst* first = stores[0]->operands[0];
+
+    size_t fill = 1;
+    while (fill < length) {
+        struct IrInst* value = stores[fill]->operands[0];
+        if (value != first && !(value->op == IR_CONST && first->op == IR_CONST && value->imm == first->imm)) break;
+        fill++;
+    }
+
+    *prefix = fill;
+    if (fill > 1) return RUN_FILL;
+
+    // the loads are moved to the end of the run too, so they must be in its block
+    size_t copy = 0;
+    while (copy < length) {
+        struct IrInst* value = stores[copy]->operands[0];
+        if (value->op != IR_LOAD || value->size != 4 || value->block != block) break;
+
+        struct IrInst* loads[2] = { copy > 0 ? stores[copy - 1]->operands[0] : value, value };
+        if (copy > 0 && !consecutive_accesses(loads, 2)) break;
+        copy++;
+    }
+
+    *prefix = copy > 1 ? copy : 1;
+    return copy > 1 ? RUN_COPY : RUN_NONE;
+}
+
+// how many stores from the start of the run go to a fill or copy too long for a few vectors, 0 if none
+size_t block_run_prefix(struct IrBlock* block, struct IrInst** stores, size_t length) {
+    size_t prefix;
+    enum RunKind kind = run_prefix(block, stores, length, &prefix);
+    return kind != RUN_NONE && prefix * 4 > IDIOM_VECTOR_BYTES_MAX ? prefix : 0;
+}
+
+// an access to all the bytes `length` accesses from `first` on cover
+static struct IrInst whole_run(struct IrInst* first, size_t length) {
+    int start = ir_address_start(first);
+    struct IrInst access = *first;
+    access.op = IR_LOAD;
+    access.size = (int) length * 4;
+    access.operands = &first->operands[start];
+    access.operands_length = first->operands_length - start;
+    return access;
+}
+
+// whether no memory operation between the first access of the run and its last store
+// may touch what the run writes, or what a copy reads
+static bool run_can_move(struct IrBlock* block, struct SymbolTable* escaping, struct IrInst** stores, size_t length, enum RunKind kind, size_t* positions) {
+    size_t first = SIZE_MAX;
+    size_t last = 0;
+    for (size_t i = 0; i < length; i++) {
+        size_t position = positions[stores[i]->id];
+        if (position > last) last = position;
+        if (position < first) first = position;
+        if (kind == RUN_COPY && positions[stores[i]->operands[0]->id] < first) first = positions[stores[i]->operands[0]->id];
+    }
+
+    struct IrInst destination = whole_run(stores[0], length);
+    struct IrInst source;
+    if (kind == RUN_COPY) {
+        source = whole_run(stores[0]->operands[0], length);
+        if (may_alias(escaping, &destination, &source)) return false;
+    }
+
+    for (size_t i = first + 1; i < last; i++) {
+        struct IrInst* inst = block->insts[i];
+        if (inst->op == IR_CALL || inst->op == IR_FILL || inst->op == IR_COPY) return false;
+        if (inst->op != IR_LOAD && inst->op != IR_STORE) continue;
+
+        // the run's own accesses are at elements of their own
+        bool own = false;
+        for (size_t j = 0; j < length && !own; j++) {
+            own = inst == stores[j] || (kind == RUN_COPY && inst == stores[j]->operands[0]);
+        }
+
+        if (own) continue;
+        if (may_alias(escaping, inst, &destination)) return false;
+        if (kind == RUN_COPY && inst->op == IR_STORE && may_alias(escaping, inst, &source)) return false;
+    }
+
+    return true;
+}
+
+static struct IrInst* new_value(struct IrFunction* fn, enum IrOp op, int size, struct IrInst* left, struct IrInst* right) {
+    struct IrInst* inst = ir_new_inst(fn, op, size);
+    if (left != NULL) ir_add_operand(fn, inst, left);
+    if (right != NULL) ir_add_operand(fn, inst, right);
+    return inst;
+}
+
+static struct IrInst* new_constant(struct IrFunction* fn, int64_t value, int size) {
+    struct IrInst* inst = ir_new_inst(fn, IR_CONST, size);
+    inst->imm = value;
+    return inst;
+}
+
+// a memory operation at the address of `access` moved by `offset` bytes
+static struct IrInst* new_address(struct IrFunction* fn, enum IrOp op, int size, struct IrInst* value, struct IrInst* access, int64_t offset) {
+    int start = ir_address_start(access);
+    struct IrInst* inst = new_value(fn, op, size, value, NULL);
+    for (size_t i = start; i < access->operands_length; i++) {
+        ir_add_operand(fn, inst, access->operands[i]);
+    }
+
+    inst->scale = access->scale;
+    inst->imm = access->imm + offset;
+    return inst;
+}
+
+// the byte every byte of a fill with `value` is, -1 when they differ
+static int fill_byte(struct IrInst* value) {
+    if (value->op != IR_CONST) return -1;
+
+    uint32_t bits = (uint32_t) value->imm;
+    uint32_t byte = bits & 0xff;
+    return bits == byte * 0x01010101u ? (int) byte : -1;
+}
+
+// replaces the run with what does all of it, the instructions go in front of `insts[last]`
+static size_t lower_run(struct IrFunction* fn, struct IrInst** stores, size_t length, enum RunKind kind, struct IrInst** insts) {
+    size_t insts_length = 0;
+    struct IrInst* value = stores[0]->operands[0];
+    int64_t bytes = (int64_t) length * 4;
+
+    if (bytes <= IDIOM_VECTOR_BYTES_MAX) {
+        // the widest vectors first, elements that do not fill a vector stay scalar stores
+        int width = fn->module->vector_width;
+        struct IrInst* splat = NULL;
+        int64_t offset = 0;
+        for (; width >= 16; width /= 2) {
+            for (; bytes - offset >= width; offset += width) {
+                struct IrInst* vector;
+                if (kind == RUN_FILL) {
+                    if (splat == NULL || splat->size != width) {
+                        splat = new_value(fn, IR_SPLAT, width, value, NULL);
+                        insts[insts_length++] = splat;
+                    }
+
+                    vector = splat;
+                } else {
+                    vector = new_address(fn, IR_LOAD, width, NULL, value, offset);
+                    insts[insts_length++] = vector;
+                }
+
+                insts[insts_length++] = new_address(fn, IR_STORE, 0, vector, stores[0], offset);
+            }
+        }
+
+        return insts_length;
+    }
+
+    struct IrInst* destination = new_address(fn, IR_LEA, 8, NULL, stores[0], 0);
+    insts[insts_length++] = destination;
+
+    struct IrInst* other = value;
+    if (kind == RUN_COPY) {
+        other = new_address(fn, IR_LEA, 8, NULL, value, 0);
+        insts[insts_length++] = other;
+    }
+
+    struct IrInst* inst;
+    int byte = kind == RUN_FILL ? fill_byte(value) : 0;
+    if (bytes > IDIOM_REP_BYTES_MAX && byte >= 0) {
+        inst = new_value(fn, IR_CALL, 0, destination, kind == RUN_FILL ? new_constant(fn, byte, 4) : other);
+        inst->symbol = kind == RUN_FILL ? "memset" : "memcpy";
+        ir_add_operand(fn, inst, new_constant(fn, bytes, 8));
+    } else {
+        inst = new_value(fn, kind == RUN_FILL ? IR_FILL : IR_COPY, 0, destination, other);
+        ir_add_operand(fn, inst, new_constant(fn, (int64_t) length, 8));
+    }
+
+    for (size_t i = 0; i < inst->operands_length; i++) {
+        if (inst->operands[i]->op == IR_CONST && inst->operands[i]->block == NULL) insts[insts_length++] = inst->operands[i];
+    }
+
+    insts[insts_length++] = inst;
+    return insts_length;
+}
+
+// per instruction state of the lowering, the ids are the ones there were before it
+// started; the instructions it adds are never part of a run
+struct IdiomState {
+    struct SymbolTable escaping;
+
+    // loads only the lowered stores used go with them, nothing removes them after this
+    int* uses;
+
+    // replaced by a fill or copy, dropped when its block is rebuilt
+    bool* lowered;
+    int value_count;
+
+    size_t* positions;
+    size_t positions_capacity;
+};
+
+// marks the stores of the run the lowering covers, and the loads only such a store used
+static void mark_lowered(struct IdiomState* state, struct IrInst** stores, size_t length, size_t covered) {
+    for (size_t i = 0; i < length; i++) {
+        if (stores[i]->imm >= stores[0]->imm + (int64_t) covered) continue;
+
+        struct IrInst* value = stores[i]->operands[0];
+        state->lowered[stores[i]->id] = true;
+        if (value->op == IR_LOAD && value->block == stores[i]->block && value->id < state->value_count && state->uses[value->id] == 1) {
+            state->lowered[value->id] = true;
+        }
+    }
+}
+
+static bool is_lowered(struct IdiomState* state, struct IrInst* inst) {
+    return inst->id < state->value_count && state->lowered[inst->id];
+}
+
+static bool lower_block_idioms(struct IrFunction* fn, struct IrBlock* block, struct IdiomState* state) {
+    struct IrInst** stores;
+    size_t stores_length = collect_stores(fn, block, &stores);
+    size_t* positions = number_insts(fn, block, state->positions, &state->positions_capacity);
+    state->positions = positions;
+
+    bool changed = false;
+    for (size_t start = 0; start < stores_length;) {
+        size_t end = run_end(stores, stores_length, start);
+
+        for (size_t i = start; i < end;) {
+            struct IrInst** run = &stores[i];
+
+            size_t length;
+            enum RunKind kind = run_prefix(block, run, end - i, &length);
+            i += length;
+
+            if (kind == RUN_NONE || length * 4 < IDIOM_BYTES_MIN || !run_can_move(block, &state->escaping, run, length, kind, positions)) continue;
+
+            size_t last = 0;
+            for (size_t j = 0; j < length; j++) {
+                if (positions[run[j]->id] > last) last = positions[run[j]->id];
+            }
+
+            // at most a splat or a load with each store and a constant or two
+            struct IrInst* lowered[IDIOM_VECTOR_BYTES_MAX / 16 * 2 + 8];
+            size_t lowered_length = lower_run(fn, run, length, kind, lowered);
+
+            // what the vectors do not cover stays as it was
+            size_t covered = length * 4;
+            if (covered <= IDIOM_VECTOR_BYTES_MAX) covered -= covered % 16;
+            mark_lowered(state, run, length, covered);
+
+            size_t capacity = block->insts_length + lowered_length;
+            struct IrInst** insts = arena_alloc(fn->arena, sizeof(struct IrInst*) * capacity);
+            size_t insts_length = 0;
+            for (size_t j = 0; j < block->insts_length; j++) {
+                if (j == last) {
+                    for (size_t k = 0; k < lowered_length; k++) {
+                        lowered[k]->block = block;
+                        insts[insts_length++] = lowered[k];
+                    }
+                }
+
+                if (!is_lowered(state, block->insts[j])) insts[insts_length++] = block->insts[j];
+            }
+
+            block->insts = insts;
+            block->insts_length = insts_length;
+            block->insts_capacity = capacity;
+            positions = number_insts(fn, block, positions, &state->positions_capacity);
+            state->positions = positions;
+            changed = true;
+        }
+
+        start = end;
+    }
+
+    return changed;
+}
+
+void lower_memory_idioms(struct IrFunction* fn) {
+    struct IdiomState state;
+    init_symbol_table(&state.escaping);
+    find_escaping_slots(fn, &state.escaping);
+
+    state.value_count = fn->value_count;
+    state.uses = arena_calloc(fn->arena, sizeof(int) * (state.value_count + 1));
+    state.positions = NULL;
+    state.positions_capacity = 0;
+    state.lowered = arena_calloc(fn->arena, sizeof(bool) * (state.value_count + 1));
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            for (size_t k = 0; k < inst->operands_length; k++) state.uses[inst->operands[k]->id] += 1;
+        }
+    }
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        lower_block_idioms(fn, fn->blocks[i], &state);
+    }
+}
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef CFCC_INLINE_C
+#define CFCC_INLINE_C
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "arena.c"
+#include "hir.c"
+#include "ir.c"
+#include "pass.c"
+
+// Inlining: calls to small functions of the same unit are replaced by a copy
+// of the callee's body. Callees are optimized before their callers, so the
+// copy is already simplified and the size the cost model sees is close to
+// what the caller gets. Parameters become the arguments themselves, which
+// lets the passes after this one fold constant arguments through the body.
+// A function that is still being optimized when its caller gets to it calls
+// itself directly or through others and is never inlined.
+
+// a caller stops taking bodies in once it has grown past this many instructions
+#define INLINE_CALLER_LIMIT 2000
+
+// instructions that end up as machine code, constants and slots are folded into their uses
+static int inline_cost(struct IrFunction* fn) {
+    int cost = 0;
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            enum IrOp op = block->insts[j]->op;
+            if (op == IR_CONST || op == IR_UNDEF || op == IR_PARAM || op == IR_PHI || op == IR_SLOT) continue;
+
+            cost += 1;
+        }
+    }
+
+    return cost;
+}
+
+static bool should_inline(struct IrFunction* caller, struct IrInst* call, struct IrFunction* callee, int caller_cost) {
+    if (callee == NULL || callee == caller || !callee->optimized) return false;
+    if (call->operands_length != callee->func->params_length) return false;
+    if (caller_cost > INLINE_CALLER_LIMIT) return false;
+    return inline_cost(callee) <= caller->module->inline_threshold;
+}
+
+// moves the instructions after `call` to a new block that takes over the
+// successors of `block`, and drops `call`; returns the new block
+static struct IrBlock* split_after_call(struct IrFunction* fn, struct IrBlock* block, size_t position) {
+    struct IrBlock* rest = ir_new_block(fn);
+    for (size_t i = position + 1; i < block->insts_length; i++) {
+        ir_append(fn, rest, block->insts[i]);
+    }
+
+    block->insts_length = position;
+
+    // in place, so the phis of the successors keep their operand order
+    struct IrBlock* succs[2];
+    int succs_length = ir_successors(rest, succs);
+    for (int k = 0; k < succs_length; k++) {
+        for (size_t l = 0; l < succs[k]->preds_length; l++) {
+            if (succs[k]->preds[l] == block) succs[k]->preds[l] = rest;
+        }
+    }
+
+    return rest;
+}
+
+// a frame variable of the caller for every one of the callee, one group per call site
+static struct Variable* clone_variable(struct IrFunction* fn, struct SymbolTable* variables, struct Variable* var) {
+    struct Variable* clone = symbol_table_find(variables, (const char*) var);
+    if (clone != NULL) return clone;
+
+    clone = arena_alloc(fn->arena, sizeof(struct Variable));
+    *clone = *var;
+    clone->vreg = -1;
+
+    symbol_table_set(variables, fn->arena, (const char*) var, clone);
+    ir_add_slot(fn, clone);
+    return clone;
+}
+
+// replaces the call at `position` of `block` by a copy of `callee`,
+// returns the block the code after the call continues in
+static struct IrBlock* inline_call(struct IrFunction* fn, struct IrBlock* block, size_t position, struct IrFunction* callee) {
+    struct IrInst* call = block->insts[position];
+    struct IrBlock* rest = split_after_call(fn, block, position);
+
+    // callee value id -> copy, callee block id -> copy
+    struct IrInst** values = arena_calloc(fn->arena, sizeof(struct IrInst*) * callee->value_count);
+    struct IrBlock** blocks = arena_calloc(fn->arena, sizeof(struct IrBlock*) * callee->block_count);
+
+    struct SymbolTable variables;
+    init_symbol_table(&variables);
+    ir_begin_slot_group(fn);
+
+    for (size_t i = 0; i < callee->blocks_length; i++) {
+        blocks[callee->blocks[i]->id] = ir_new_block(fn);
+    }
+
+    // values first, phis may use values of blocks that come later
+    for (size_t i = 0; i < callee->blocks_length; i++) {
+        struct IrBlock* from = callee->blocks[i];
+        struct IrBlock* to = blocks[from->id];
+
+        for (size_t j = 0; j < from->insts_length; j++) {
+            struct IrInst* inst = from->insts[j];
+
+            if (inst->op == IR_PARAM) {
+                values[inst->id] = call->operands[inst->imm];
+                continue;
+            }
+
+            if (inst->op == IR_UNDEF) {
+                values[inst->id] = ir_undefined(fn, inst->size);
+                continue;
+            }
+
+            struct IrInst* copy;
+            if (inst->op == IR_RETURN) {
+                copy = ir_new_inst(fn, IR_JUMP, 0);
+                copy->targets[0] = rest;
+                ir_add_pred(fn, rest, to);
+            } else {
+                copy = ir_new_inst(fn, inst->op, inst->size);
+                copy->imm = inst->imm;
+                copy->scale = inst->scale;
+                copy->cond = inst->cond;
+                copy->symbol = inst->symbol;
+                copy->variable = inst->op == IR_SLOT ? clone_variable(fn, &variables, inst->variable) : inst->variable;
+                copy->targets[0] = inst->targets[0] != NULL ? blocks[inst->targets[0]->id] : NULL;
+                copy->targets[1] = inst->targets[1] != NULL ? blocks[inst->targets[1]->id] : NULL;
+            }
+
+            ir_append(fn, to, copy);
+            values[inst->id] = copy;
+        }
+
+        for (size_t k = 0; k < from->preds_length; k++) {
+            ir_add_pred(fn, to, blocks[from->preds[k]->id]);
+        }
+    }
+
+    for (size_t i = 0; i < callee->blocks_length; i++) {
+        struct IrBlock* from = callee->blocks[i];
+        for (size_t j = 0; j < from->insts_length; j++) {
+            struct IrInst* inst = from->insts[j];
+            if (inst->op == IR_PARAM || inst->op == IR_UNDEF || inst->op == IR_RETURN) continue;
+
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                ir_add_operand(fn, values[inst->id], values[inst->operands[k]->id]);
+            }
+        }
+    }
+
+    // the returned values meet where the caller continues
+    if (call->size > 0) {
+        struct IrInst* result = ir_new_inst(fn, IR_PHI, call->size);
+        for (size_t i = 0; i < callee->blocks_length; i++) {
+            struct IrInst* term = ir_terminator(callee->blocks[i]);
+            if (term->op != IR_RETURN) continue;
+
+            struct IrInst* value = term->operands_length > 0 ? values[term->operands[0]->id] : ir_undefined(fn, call->size);
+            ir_add_operand(fn, result, value);
+        }
+
+        ir_insert(fn, rest, 0, result);
+        call->replacement = result;
+    }
+
+    struct IrInst* enter = ir_new_inst(fn, IR_JUMP, 0);
+    enter->targets[0] = blocks[callee->blocks[0]->id];
+    ir_append(fn, block, enter);
+    ir_add_pred(fn, enter->targets[0], block);
+
+    // the copy goes between the call and the code after it
+    size_t added = callee->blocks_length + 1;
+    size_t at = 0;
+    while (fn->blocks[at] != block) at++;
+
+    struct IrBlock** moved = arena_alloc(fn->arena, sizeof(struct IrBlock*) * added);
+    memcpy(moved, &fn->blocks[fn->blocks_length - added], sizeof(struct IrBlock*) * added);
+    memmove(moved, &moved[1], sizeof(struct IrBlock*) * (added - 1));
+    moved[added - 1] = rest;
+
+    memmove(&fn->blocks[at + 1 + added], &fn->blocks[at + 1], sizeof(struct IrBlock*) * (fn->blocks_length - added - at - 1));
+    memcpy(&fn->blocks[at + 1], moved, sizeof(struct IrBlock*) * added);
+    return rest;
+}
+
+static bool inline_calls(struct IrFunction* fn) {
+    int cost = inline_cost(fn);
+    bool changed = false;
+
+    // only the calls that were there before, inlined bodies are final already
+    size_t blocks_length = fn->blocks_length;
+    struct IrBlock** blocks = arena_alloc(fn->arena, sizeof(struct IrBlock*) * blocks_length);
+    memcpy(blocks, fn->blocks, sizeof(struct IrBlock*) * blocks_length);
+
+    for (size_t i = 0; i < blocks_length; i++) {
+        struct IrBlock* block = blocks[i];
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            if (inst->op != IR_CALL) continue;
+
+            struct IrFunction* callee = ir_find_function(fn->module, inst->symbol);
+            if (!should_inline(fn, inst, callee, cost)) continue;
+
+            cost += inline_cost(callee);
+            block = inline_call(fn, block, j, callee);
+            j = (size_t) -1;
+            changed = true;
+        }
+    }
+
+    if (changed) ir_apply_replacements(fn);
+    return changed;
+}
+
+const struct IrPass inline_pass = { "inline", inline_calls };
+
+#endif
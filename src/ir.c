@@ -0,0 +1,773 @@
+#ifndef CFCC_IR_C
+#define CFCC_IR_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.c"
+#include "buffer.c"
+#include "hir.c"
+#include "mir.c"
+#include "symbol.c"
+
+// Mid-level IR in SSA form: a function is a list of basic blocks, every
+// block ends in exactly one terminator and knows its predecessors, and every
+// instruction defines at most one value that is never reassigned. Values
+// merging at join points go through phi nodes at the start of a block.
+// Scalars that never have their address taken are SSA values, everything
+// else lives in frame slots and is reached through loads and stores.
+enum IrOp {
+    // values
+    IR_CONST,
+    IR_UNDEF,
+    IR_PARAM,
+    IR_PHI,
+
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_MOD,
+    IR_CMP,
+    IR_SEXT,
+
+    // vectors of i32 lanes are 16 or 32 bytes wide, add, sub, mul, load and
+    // store work on them lane by lane and splat fills every lane with an i32
+    IR_SPLAT,
+
+    // memory, addresses are `base + index * scale + imm`
+    IR_SLOT,
+    IR_LEA,
+    IR_LOAD,
+    IR_STORE,
+
+    IR_CALL,
+
+    // `rep stos` and `rep movs` of i32 elements, fill has [destination, value,
+    // count] and copy [destination, source, count]; only made by the memory
+    // idiom lowering right before instruction selection, like switches
+    IR_FILL,
+    IR_COPY,
+
+    // terminators
+    IR_JUMP,
+    IR_BRANCH,
+    IR_RETURN,
+
+    // only made by switch lowering right before instruction selection, the
+    // passes never see one and ir_successors does not list its targets
+    IR_SWITCH,
+};
+
+static const char* ir_op_names[] = {
+    "const", "undef", "param", "phi",
+    "add", "sub", "mul", "div", "mod", "cmp", "sext",
+    "splat",
+    "slot", "lea", "load", "store",
+    "call", "fill", "copy",
+    "jmp", "br", "ret", "switch",
+};
+
+struct IrBlock;
+
+struct IrInst {
+    enum IrOp op;
+    int id;
+    struct IrBlock* block;
+
+    // width of the value in bytes, 0 when the instruction defines none
+    int size;
+
+    // phis have one operand per predecessor, in predecessor order;
+    // memory operations have [base, index?] and stores put the value first
+    struct IrInst** operands;
+    size_t operands_length;
+    size_t operands_capacity;
+
+    // constant, parameter number or address displacement
+    int64_t imm;
+    int scale;
+    enum Condition cond;
+
+    // frame variable of a slot, or the variable a phi merges while building
+    struct Variable* variable;
+    const char* symbol;
+    struct IrBlock* targets[2];
+
+    // switches: the cases by increasing value and where each goes, targets[0]
+    // is the default; `imm` is 1 when the value is always one of the cases
+    int64_t* case_values;
+    struct IrBlock** case_targets;
+    size_t cases_length;
+
+    // set when a pass replaced the value, uses are redirected by ir_apply_replacements
+    struct IrInst* replacement;
+};
+
+struct IrBlock {
+    int id;
+
+    struct IrInst** insts;
+    size_t insts_length;
+    size_t insts_capacity;
+
+    struct IrBlock** preds;
+    size_t preds_length;
+    size_t preds_capacity;
+
+    // ssa construction: all predecessors are known, and variable -> current value
+    bool sealed;
+    struct SymbolTable definitions;
+
+    // filled by ir_compute_dominators, `order` is -1 for unreachable blocks
+    int order;
+    struct IrBlock* idom;
+};
+
+struct IrModule;
+
+struct IrFunction {
+    struct Function* func;
+    struct Arena* arena;
+    struct IrModule* module;
+
+    struct IrBlock** blocks;
+    size_t blocks_length;
+    size_t blocks_capacity;
+
+    int value_count;
+    int block_count;
+
+    // reachable blocks in reverse postorder, filled by ir_compute_dominators
+    struct IrBlock** rpo;
+    size_t rpo_length;
+
+    // frame variables that are not in the scopes of `func`, inlined callees bring theirs
+    struct Variable** slots;
+    size_t slots_length;
+    size_t slots_capacity;
+
+    // index in `slots` where the variables of each inlined call site start
+    size_t* slot_groups;
+    size_t slot_groups_length;
+    size_t slot_groups_capacity;
+
+    // the pipeline has run over it, so it is final enough to be inlined
+    bool optimized;
+};
+
+// the functions of a unit, for passes that look across calls
+struct IrModule {
+    // owns the IR of every function
+    struct Arena arena;
+
+    struct IrFunction** functions;
+    size_t functions_length;
+    size_t functions_capacity;
+
+    // identifier -> function
+    struct SymbolTable lookup;
+
+    // largest callee the inliner copies into a caller, in instructions
+    int inline_threshold;
+
+    // widest vector the target has registers for, in bytes
+    int vector_width;
+};
+
+bool ir_is_terminator(enum IrOp op) {
+    return op >= IR_JUMP;
+}
+
+// index of the first address operand of a memory operation
+int ir_address_start(struct IrInst* inst) {
+    return inst->op == IR_STORE ? 1 : 0;
+}
+
+bool ir_has_index(struct IrInst* inst) {
+    return inst->operands_length > ir_address_start(inst) + 1;
+}
+
+void init_ir_function(struct IrFunction* fn, struct Function* func, struct Arena* arena) {
+    memset(fn, 0, sizeof(struct IrFunction));
+    fn->func = func;
+    fn->arena = arena;
+}
+
+struct IrBlock* ir_new_block(struct IrFunction* fn) {
+    struct IrBlock* block = arena_calloc(fn->arena, sizeof(struct IrBlock));
+    block->id = fn->block_count++;
+    block->order = -1;
+    init_symbol_table(&block->definitions);
+
+    if (fn->blocks_length == fn->blocks_capacity) {
+        size_t capacity = fn->blocks_capacity > 0 ? fn->blocks_capacity * 2 : 16;
+        fn->blocks = arena_grow(fn->arena, fn->blocks, sizeof(struct IrBlock*) * fn->blocks_capacity, sizeof(struct IrBlock*) * capacity);
+        fn->blocks_capacity = capacity;
+    }
+
+    fn->blocks[fn->blocks_length++] = block;
+    return block;
+}
+
+// position of `block` in the block order, which must hold it
+size_t ir_block_position(struct IrFunction* fn, struct IrBlock* block) {
+    size_t position = 0;
+    while (fn->blocks[position] != block) position++;
+    return position;
+}
+
+// a new block placed at `position` of the block order
+struct IrBlock* ir_new_block_at(struct IrFunction* fn, size_t position) {
+    struct IrBlock* block = ir_new_block(fn);
+    memmove(&fn->blocks[position + 1], &fn->blocks[position], sizeof(struct IrBlock*) * (fn->blocks_length - position - 1));
+    fn->blocks[position] = block;
+    return block;
+}
+
+void init_ir_module(struct IrModule* module) {
+    init_arena(&module->arena);
+    module->functions = NULL;
+    module->functions_length = 0;
+    module->functions_capacity = 0;
+    init_symbol_table(&module->lookup);
+    module->inline_threshold = 0;
+    module->vector_width = 16;
+}
+
+void free_ir_module(struct IrModule* module) {
+    free_arena(&module->arena);
+}
+
+void ir_add_function(struct IrModule* module, struct IrFunction* fn) {
+    if (module->functions_length == module->functions_capacity) {
+        size_t capacity = module->functions_capacity > 0 ? module->functions_capacity * 2 : 16;
+        module->functions = arena_grow(&module->arena, module->functions, sizeof(struct IrFunction*) * module->functions_capacity, sizeof(struct IrFunction*) * capacity);
+        module->functions_capacity = capacity;
+    }
+
+    module->functions[module->functions_length++] = fn;
+    symbol_table_set(&module->lookup, &module->arena, fn->func->identifier, fn);
+    fn->module = module;
+}
+
+// the function defined under `identifier`, NULL for prototypes and unknown names
+struct IrFunction* ir_find_function(struct IrModule* module, const char* identifier) {
+    return module != NULL ? symbol_table_find(&module->lookup, identifier) : NULL;
+}
+
+void ir_add_slot(struct IrFunction* fn, struct Variable* var) {
+    if (fn->slots_length == fn->slots_capacity) {
+        size_t capacity = fn->slots_capacity > 0 ? fn->slots_capacity * 2 : 8;
+        fn->slots = arena_grow(fn->arena, fn->slots, sizeof(struct Variable*) * fn->slots_capacity, sizeof(struct Variable*) * capacity);
+        fn->slots_capacity = capacity;
+    }
+
+    fn->slots[fn->slots_length++] = var;
+}
+
+// the slots added from here on belong to one more inlined call site
+void ir_begin_slot_group(struct IrFunction* fn) {
+    if (fn->slot_groups_length == fn->slot_groups_capacity) {
+        size_t capacity = fn->slot_groups_capacity > 0 ? fn->slot_groups_capacity * 2 : 8;
+        fn->slot_groups = arena_grow(fn->arena, fn->slot_groups, sizeof(size_t) * fn->slot_groups_capacity, sizeof(size_t) * capacity);
+        fn->slot_groups_capacity = capacity;
+    }
+
+    fn->slot_groups[fn->slot_groups_length++] = fn->slots_length;
+}
+
+// a detached instruction, see ir_append and ir_insert
+struct IrInst* ir_new_inst(struct IrFunction* fn, enum IrOp op, int size) {
+    struct IrInst* inst = arena_calloc(fn->arena, sizeof(struct IrInst));
+    inst->op = op;
+    inst->id = fn->value_count++;
+    inst->size = size;
+    inst->scale = 1;
+    return inst;
+}
+
+void ir_add_operand(struct IrFunction* fn, struct IrInst* inst, struct IrInst* operand) {
+    if (inst->operands_length == inst->operands_capacity) {
+        size_t capacity = inst->operands_capacity > 0 ? inst->operands_capacity * 2 : 2;
+        inst->operands = arena_grow(fn->arena, inst->operands, sizeof(struct IrInst*) * inst->operands_capacity, sizeof(struct IrInst*) * capacity);
+        inst->operands_capacity = capacity;
+    }
+
+    inst->operands[inst->operands_length++] = operand;
+}
+
+// places `inst` at `position` of the block, shifting the instructions after it
+void ir_insert(struct IrFunction* fn, struct IrBlock* block, size_t position, struct IrInst* inst) {
+    if (block->insts_length == block->insts_capacity) {
+        size_t capacity = block->insts_capacity > 0 ? block->insts_capacity * 2 : 8;
+        block->insts = arena_grow(fn->arena, block->insts, sizeof(struct IrInst*) * block->insts_capacity, sizeof(struct IrInst*) * capacity);
+        block->insts_capacity = capacity;
+    }
+
+    memmove(&block->insts[position + 1], &block->insts[position], sizeof(struct IrInst*) * (block->insts_length - position));
+    block->insts[position] = inst;
+    block->insts_length += 1;
+    inst->block = block;
+}
+
+void ir_append(struct IrFunction* fn, struct IrBlock* block, struct IrInst* inst) {
+    ir_insert(fn, block, block->insts_length, inst);
+}
+
+void ir_add_pred(struct IrFunction* fn, struct IrBlock* block, struct IrBlock* pred) {
+    if (block->preds_length == block->preds_capacity) {
+        size_t capacity = block->preds_capacity > 0 ? block->preds_capacity * 2 : 4;
+        block->preds = arena_grow(fn->arena, block->preds, sizeof(struct IrBlock*) * block->preds_capacity, sizeof(struct IrBlock*) * capacity);
+        block->preds_capacity = capacity;
+    }
+
+    block->preds[block->preds_length++] = pred;
+}
+
+// the undefined value of the given width, kept at the start of the entry block
+struct IrInst* ir_undefined(struct IrFunction* fn, int size) {
+    struct IrBlock* entry = fn->blocks[0];
+    for (size_t i = 0; i < entry->insts_length && entry->insts[i]->op == IR_UNDEF; i++) {
+        if (entry->insts[i]->size == size) return entry->insts[i];
+    }
+
+    struct IrInst* undefined = ir_new_inst(fn, IR_UNDEF, size);
+    ir_insert(fn, entry, 0, undefined);
+    return undefined;
+}
+
+// drops the `index`th predecessor edge of `block` together with its phi operands
+void ir_remove_pred(struct IrBlock* block, size_t index) {
+    for (size_t i = 0; i < block->insts_length && block->insts[i]->op == IR_PHI; i++) {
+        struct IrInst* phi = block->insts[i];
+        memmove(&phi->operands[index], &phi->operands[index + 1], sizeof(struct IrInst*) * (phi->operands_length - index - 1));
+        phi->operands_length -= 1;
+    }
+
+    memmove(&block->preds[index], &block->preds[index + 1], sizeof(struct IrBlock*) * (block->preds_length - index - 1));
+    block->preds_length -= 1;
+}
+
+struct IrInst* ir_terminator(struct IrBlock* block) {
+    if (block->insts_length == 0) return NULL;
+
+    struct IrInst* last = block->insts[block->insts_length - 1];
+    return ir_is_terminator(last->op) ? last : NULL;
+}
+
+// successors in terminator order, returns how many there are
+int ir_successors(struct IrBlock* block, struct IrBlock** out) {
+    struct IrInst* term = ir_terminator(block);
+    if (term == NULL) return 0;
+
+    switch (term->op) {
+        case IR_JUMP:
+            out[0] = term->targets[0];
+            return 1;
+
+        case IR_BRANCH:
+            out[0] = term->targets[0];
+            out[1] = term->targets[1];
+            return 2;
+
+        default:
+            return 0;
+    }
+}
+
+// follows replacements to the value that stands for `inst` now
+struct IrInst* ir_resolve(struct IrInst* inst) {
+    struct IrInst* value = inst;
+    while (value->replacement != NULL) value = value->replacement;
+
+    // path compression, chains of replaced phis can get long
+    while (inst->replacement != NULL && inst->replacement != value) {
+        struct IrInst* next = inst->replacement;
+        inst->replacement = value;
+        inst = next;
+    }
+
+    return value;
+}
+
+// redirects every use of a replaced value and drops the replaced instructions
+void ir_apply_replacements(struct IrFunction* fn) {
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+
+        size_t kept = 0;
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            if (inst->replacement != NULL) continue;
+
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                inst->operands[k] = ir_resolve(inst->operands[k]);
+            }
+
+            block->insts[kept++] = inst;
+        }
+
+        block->insts_length = kept;
+    }
+}
+
+// position of `pred` among the predecessors of `block`, -1 if it is none
+int ir_pred_index(struct IrBlock* block, struct IrBlock* pred) {
+    for (size_t i = 0; i < block->preds_length; i++) {
+        if (block->preds[i] == pred) return i;
+    }
+
+    return -1;
+}
+
+static struct IrBlock* intersect_dominators(struct IrBlock* a, struct IrBlock* b) {
+    while (a != b) {
+        while (a->order > b->order) a = a->idom;
+        while (b->order > a->order) b = b->idom;
+    }
+
+    return a;
+}
+
+// reverse postorder and immediate dominators, see Cooper, Harvey and Kennedy,
+// "A Simple, Fast Dominance Algorithm"
+void ir_compute_dominators(struct IrFunction* fn) {
+    size_t count = fn->blocks_length;
+    fn->rpo = arena_alloc(fn->arena, sizeof(struct IrBlock*) * (count + 1));
+    fn->rpo_length = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        fn->blocks[i]->order = -1;
+        fn->blocks[i]->idom = NULL;
+    }
+
+    if (count == 0) return;
+
+    // iterative depth first search, `order` marks visited blocks with -2 until numbered
+    struct IrBlock** stack = arena_alloc(fn->arena, sizeof(struct IrBlock*) * count);
+    int* next_successor = arena_calloc(fn->arena, sizeof(int) * fn->block_count);
+    struct IrBlock** postorder = arena_alloc(fn->arena, sizeof(struct IrBlock*) * count);
+    size_t postorder_length = 0;
+    size_t depth = 0;
+
+    stack[depth++] = fn->blocks[0];
+    fn->blocks[0]->order = -2;
+    while (depth > 0) {
+        struct IrBlock* block = stack[depth - 1];
+        struct IrBlock* succs[2];
+        int succs_length = ir_successors(block, succs);
+
+        if (next_successor[block->id] < succs_length) {
+            struct IrBlock* succ = succs[next_successor[block->id]++];
+            if (succ->order == -1) {
+                succ->order = -2;
+                stack[depth++] = succ;
+            }
+
+            continue;
+        }
+
+        postorder[postorder_length++] = block;
+        depth -= 1;
+    }
+
+    for (size_t i = 0; i < postorder_length; i++) {
+        struct IrBlock* block = postorder[postorder_length - 1 - i];
+        block->order = i;
+        fn->rpo[fn->rpo_length++] = block;
+    }
+
+    struct IrBlock* entry = fn->rpo[0];
+    entry->idom = entry;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (size_t i = 1; i < fn->rpo_length; i++) {
+            struct IrBlock* block = fn->rpo[i];
+
+            struct IrBlock* idom = NULL;
+            for (size_t j = 0; j < block->preds_length; j++) {
+                struct IrBlock* pred = block->preds[j];
+                if (pred->idom == NULL) continue;
+
+                idom = idom == NULL ? pred : intersect_dominators(pred, idom);
+            }
+
+            if (idom != block->idom) {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+// both blocks must be reachable
+bool ir_dominates(struct IrBlock* a, struct IrBlock* b) {
+    while (b->order > a->order) b = b->idom;
+    return a == b;
+}
+
+static void verify_error(struct IrFunction* fn, const char* after, struct IrBlock* block, const char* message) {
+    fprintf(stderr, "ir verifier: %s: bb%d after %s: %s\n", fn->func->identifier, block->id, after, message);
+}
+
+// checks the structural invariants of the IR and reports every violation,
+// `after` names the pass that ran last
+bool ir_verify(struct IrFunction* fn, const char* after) {
+    bool valid = true;
+    ir_compute_dominators(fn);
+
+    // value -> position in its block, -1 for values that are not in the function
+    int* positions = arena_alloc(fn->arena, sizeof(int) * (fn->value_count + 1));
+    memset(positions, 0xff, sizeof(int) * (fn->value_count + 1));
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            if (inst->block != block) {
+                verify_error(fn, after, block, "instruction records the wrong block");
+                valid = false;
+            }
+
+            positions[inst->id] = j;
+        }
+    }
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+
+        if (ir_terminator(block) == NULL) {
+            verify_error(fn, after, block, "block does not end in a terminator");
+            valid = false;
+        }
+
+        bool phis_done = false;
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+
+            if (ir_is_terminator(inst->op) && j + 1 != block->insts_length) {
+                verify_error(fn, after, block, "terminator in the middle of a block");
+                valid = false;
+            }
+
+            if (inst->op == IR_PHI) {
+                if (phis_done) {
+                    verify_error(fn, after, block, "phi after a non-phi instruction");
+                    valid = false;
+                }
+
+                if (inst->operands_length != block->preds_length) {
+                    verify_error(fn, after, block, "phi operand count differs from the predecessor count");
+                    valid = false;
+                }
+            } else {
+                phis_done = true;
+            }
+
+            if (inst->replacement != NULL) {
+                verify_error(fn, after, block, "replaced instruction left in the block");
+                valid = false;
+            }
+
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                struct IrInst* operand = inst->operands[k];
+                if (operand == NULL || positions[operand->id] < 0 || operand->block->insts[positions[operand->id]] != operand) {
+                    verify_error(fn, after, block, "operand is not defined in the function");
+                    valid = false;
+                    continue;
+                }
+
+                if (operand->size == 0) {
+                    verify_error(fn, after, block, "operand does not define a value");
+                    valid = false;
+                }
+
+                // definitions dominate their uses, phi uses sit at the end of the predecessor
+                if (block->order < 0) continue;
+
+                struct IrBlock* use_block = block;
+                if (inst->op == IR_PHI) {
+                    if (k >= block->preds_length) continue;
+                    use_block = block->preds[k];
+                    if (use_block->order < 0) continue;
+                }
+
+                bool dominates;
+                if (operand->block == use_block && inst->op != IR_PHI) {
+                    dominates = positions[operand->id] < (int) j;
+                } else {
+                    dominates = operand->block->order >= 0 && ir_dominates(operand->block, use_block);
+                }
+
+                if (!dominates) {
+                    verify_error(fn, after, block, "definition does not dominate its use");
+                    valid = false;
+                }
+            }
+        }
+
+        // edges are recorded on both ends, once per edge
+        struct IrBlock* succs[2];
+        int succs_length = ir_successors(block, succs);
+        for (int k = 0; k < succs_length; k++) {
+            int edges = 0;
+            for (int l = 0; l < succs_length; l++) edges += succs[l] == succs[k];
+
+            int preds = 0;
+            for (size_t l = 0; l < succs[k]->preds_length; l++) preds += succs[k]->preds[l] == block;
+
+            if (edges != preds) {
+                verify_error(fn, after, block, "successor does not list the block as predecessor");
+                valid = false;
+            }
+        }
+
+        for (size_t k = 0; k < block->preds_length; k++) {
+            struct IrBlock* pred = block->preds[k];
+            int pred_succs_length = ir_successors(pred, succs);
+
+            bool found = false;
+            for (int l = 0; l < pred_succs_length; l++) found |= succs[l] == block;
+
+            if (!found) {
+                verify_error(fn, after, block, "predecessor does not branch to the block");
+                valid = false;
+            }
+        }
+    }
+
+    return valid;
+}
+
+static void dump_value(struct IrInst* inst, struct Buffer* buffer) {
+    if (inst->op == IR_CONST) {
+        buffer_format(buffer, "%lld", (long long) inst->imm);
+    } else {
+        buffer_format(buffer, "%%%d", inst->id);
+    }
+}
+
+static void dump_address(struct IrInst* inst, struct Buffer* buffer) {
+    int start = ir_address_start(inst);
+
+    buffer_append(buffer, "[");
+    dump_value(inst->operands[start], buffer);
+    if (ir_has_index(inst)) {
+        buffer_append(buffer, " + ");
+        dump_value(inst->operands[start + 1], buffer);
+        if (inst->scale != 1) buffer_format(buffer, " * %d", inst->scale);
+    }
+
+    if (inst->imm != 0) buffer_format(buffer, " %c %lld", inst->imm < 0 ? '-' : '+', (long long) (inst->imm < 0 ? -inst->imm : inst->imm));
+    buffer_append(buffer, "]");
+}
+
+void ir_dump_inst(struct IrInst* inst, struct Buffer* buffer) {
+    buffer_append(buffer, "    ");
+    if (inst->size > 0) buffer_format(buffer, "%%%d = ", inst->id);
+
+    buffer_append(buffer, ir_op_names[inst->op]);
+    if (inst->op == IR_CMP) buffer_format(buffer, ".%s", condition_names[inst->cond]);
+    if (inst->size > 8) {
+        buffer_format(buffer, " v%di32", inst->size / 4);
+    } else if (inst->size > 0) {
+        buffer_append(buffer, inst->size == 8 ? " i64" : " i32");
+    }
+
+    switch (inst->op) {
+        case IR_CONST:
+        case IR_PARAM:
+            buffer_format(buffer, " %lld", (long long) inst->imm);
+            break;
+
+        case IR_SLOT:
+            buffer_format(buffer, " %s", inst->variable->identifier);
+            break;
+
+        case IR_PHI:
+            for (size_t i = 0; i < inst->operands_length; i++) {
+                buffer_append(buffer, i == 0 ? " [" : ", [");
+                dump_value(inst->operands[i], buffer);
+                buffer_format(buffer, ", bb%d]", inst->block->preds[i]->id);
+            }
+            break;
+
+        case IR_LEA:
+        case IR_LOAD:
+            buffer_append(buffer, " ");
+            dump_address(inst, buffer);
+            break;
+
+        case IR_STORE:
+            buffer_append(buffer, " ");
+            dump_value(inst->operands[0], buffer);
+            buffer_append(buffer, ", ");
+            dump_address(inst, buffer);
+            break;
+
+        case IR_CALL:
+            buffer_format(buffer, " %s(", inst->symbol);
+            for (size_t i = 0; i < inst->operands_length; i++) {
+                if (i > 0) buffer_append(buffer, ", ");
+                dump_value(inst->operands[i], buffer);
+            }
+            buffer_append(buffer, ")");
+            break;
+
+        case IR_JUMP:
+            buffer_format(buffer, " bb%d", inst->targets[0]->id);
+            break;
+
+        case IR_BRANCH:
+            buffer_append(buffer, " ");
+            dump_value(inst->operands[0], buffer);
+            buffer_format(buffer, ", bb%d, bb%d", inst->targets[0]->id, inst->targets[1]->id);
+            break;
+
+        case IR_SWITCH:
+            buffer_append(buffer, " ");
+            dump_value(inst->operands[0], buffer);
+            buffer_format(buffer, ", bb%d", inst->targets[0]->id);
+            for (size_t i = 0; i < inst->cases_length; i++) {
+                buffer_format(buffer, ", %lld: bb%d", (long long) inst->case_values[i], inst->case_targets[i]->id);
+            }
+            break;
+
+        default:
+            for (size_t i = 0; i < inst->operands_length; i++) {
+                buffer_append(buffer, i == 0 ? " " : ", ");
+                dump_value(inst->operands[i], buffer);
+            }
+            break;
+    }
+
+    buffer_append(buffer, "\n");
+}
+
+void ir_dump_function(struct IrFunction* fn, struct Buffer* buffer) {
+    buffer_format(buffer, "function %s\n", fn->func->identifier);
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+
+        buffer_format(buffer, "bb%d:", block->id);
+        for (size_t j = 0; j < block->preds_length; j++) {
+            buffer_format(buffer, "%s bb%d", j == 0 ? "    ; preds:" : ",", block->preds[j]->id);
+        }
+        buffer_append(buffer, "\n");
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            ir_dump_inst(block->insts[j], buffer);
+        }
+    }
+
+    buffer_append(buffer, "\n");
+}
+
+#endif
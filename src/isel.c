@@ -0,0 +1,714 @@
+#ifndef CFCC_ISEL_C
+#define CFCC_ISEL_C
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "buffer.c"
+#include "codegen.c"
+#include "frame.c"
+#include "idiom.c"
+#include "ir.c"
+#include "mir.c"
+#include "switch.c"
+
+// Instruction selection: turns the SSA IR into MIR over virtual registers,
+// one IR value per register. Constants become immediates where x86 takes
+// them and frame slots fold into rbp-relative addresses, so neither is
+// computed on its own. A comparison used only by branches is never
+// materialized, every branch compares the operands again itself.
+// Phis are resolved by copies at the end of every predecessor, straight into
+// the phi's register. Edges from a block with two successors into a block
+// with phis are split first, so the copies never run on the other path.
+// The copies into one block's phis happen at once, phis reading each other
+// are ordered (with a temporary for cycles) so no value is lost.
+// Switches become bit tests when a few targets share a small range of cases,
+// a jump table when the cases are dense, and a binary search otherwise.
+// Fills and copies pin their pointers and count to the registers rep takes.
+// Vector values get xmm or ymm registers by their width. Functions using ymm
+// registers clear their upper halves before calls and returns, so code that
+// only knows SSE does not pay for the transition.
+struct Selector {
+    struct Context* ctx;
+    struct IrFunction* fn;
+
+    // value id -> virtual register, REG_NONE until first needed
+    int* vregs;
+
+    // value id -> number of uses, and how many of them are branches
+    int* uses;
+    int* branch_uses;
+
+    // block id -> mir label
+    size_t* labels;
+
+    // some value is a 256-bit vector
+    bool wide_vectors;
+
+    // nothing in the frame can be pointed to, so calls in tail position can
+    // tear it down and jump to the callee
+    bool tail_calls;
+};
+
+static int value_register(struct Selector* s, struct IrInst* value) {
+    if (s->vregs[value->id] == REG_NONE) {
+        s->vregs[value->id] = new_vreg(&s->ctx->mir);
+    }
+
+    return s->vregs[value->id];
+}
+
+// a register holding `value`, constants and slot addresses are materialized at every use
+static int select_register(struct Selector* s, struct IrInst* value) {
+    struct MirFunction* mf = &s->ctx->mir;
+
+    switch (value->op) {
+        case IR_CONST: {
+            int r = new_vreg(mf);
+            emit(mf, MIR_MOV, mop_imm(value->imm, value->size), mop_reg(r, value->size));
+            return r;
+        }
+
+        case IR_SLOT: {
+            int r = new_vreg(mf);
+            emit(mf, MIR_LEA, mop_mem(REG_RBP, REG_NONE, 1, -(int32_t) value->variable->offset, 8), mop_reg(r, 8));
+            return r;
+        }
+
+        default:
+            return value_register(s, value);
+    }
+}
+
+static bool is_immediate(struct IrInst* value) {
+    return value->op == IR_CONST && value->imm >= INT32_MIN && value->imm <= INT32_MAX;
+}
+
+static struct MirOperand select_operand(struct Selector* s, struct IrInst* value) {
+    if (is_immediate(value)) {
+        return mop_imm(value->imm, value->size);
+    }
+
+    return mop_reg(select_register(s, value), value->size);
+}
+
+static struct MirOperand select_address(struct Selector* s, struct IrInst* inst, int size) {
+    int start = ir_address_start(inst);
+    struct IrInst* base = inst->operands[start];
+
+    struct MirOperand address;
+    if (base->op == IR_SLOT) {
+        address = mop_mem(REG_RBP, REG_NONE, 1, -(int32_t) base->variable->offset + inst->imm, size);
+    } else {
+        address = mop_mem(select_register(s, base), REG_NONE, 1, inst->imm, size);
+    }
+
+    if (ir_has_index(inst)) {
+        address.mem.index = select_register(s, inst->operands[start + 1]);
+        address.mem.scale = inst->scale;
+    }
+
+    return address;
+}
+
+// the result of `inst` was computed into `r` by a helper
+static void bind_result(struct Selector* s, struct IrInst* inst, int r) {
+    if (s->vregs[inst->id] == REG_NONE) {
+        s->vregs[inst->id] = r;
+    } else {
+        emit(&s->ctx->mir, MIR_MOV, mop_reg(r, inst->size), mop_reg(s->vregs[inst->id], inst->size));
+    }
+}
+
+// a comparison only feeding branches is selected with each of them, setting
+// the flags again is cheaper than keeping the result in a register
+static bool is_fused_comparison(struct Selector* s, struct IrInst* inst) {
+    return inst->op == IR_CMP && s->uses[inst->id] == s->branch_uses[inst->id];
+}
+
+// compares the operands of `cmp` and returns the condition that holds when it is true
+static enum Condition select_flags(struct Selector* s, struct IrInst* cmp) {
+    struct MirFunction* mf = &s->ctx->mir;
+    struct IrInst* left = cmp->operands[0];
+    struct IrInst* right = cmp->operands[1];
+    enum Condition cond = cmp->cond;
+
+    // cmp takes an immediate on the right only
+    if (is_immediate(left) && !is_immediate(right)) {
+        struct IrInst* swapped = left;
+        left = right;
+        right = swapped;
+        cond = swap_condition(cond);
+    }
+
+    struct MirOperand operand = select_operand(s, right);
+    emit(mf, MIR_CMP, operand, mop_reg(select_register(s, left), left->size));
+    return cond;
+}
+
+// copies the values flowing along the edge `block` -> `succ` into the phis of `succ`
+static void select_phi_copies(struct Selector* s, struct IrBlock* block, struct IrBlock* succ) {
+    struct MirFunction* mf = &s->ctx->mir;
+
+    size_t count = 0;
+    while (count < succ->insts_length && succ->insts[count]->op == IR_PHI) count++;
+    if (count == 0) return;
+
+    int pred = ir_pred_index(succ, block);
+    struct MirOperand sources[count];
+    int destinations[count];
+    for (size_t i = 0; i < count; i++) {
+        struct IrInst* phi = succ->insts[i];
+        sources[i] = select_operand(s, phi->operands[pred]);
+        destinations[i] = value_register(s, phi);
+    }
+
+    // a copy can go once no other pending copy still reads its destination
+    size_t pending = count;
+    while (pending > 0) {
+        bool progress = false;
+
+        for (size_t i = 0; i < pending; i++) {
+            bool read = false;
+            for (size_t j = 0; j < pending; j++) {
+                read |= j != i && sources[j].kind == MOP_REG && sources[j].reg == destinations[i];
+            }
+
+            if (read) continue;
+
+            if (sources[i].kind != MOP_REG || sources[i].reg != destinations[i]) {
+                emit(mf, MIR_MOV, sources[i], mop_reg(destinations[i], sources[i].size));
+            }
+
+            pending -= 1;
+            sources[i] = sources[pending];
+            destinations[i] = destinations[pending];
+            progress = true;
+            break;
+        }
+
+        if (progress) continue;
+
+        // only cycles are left, move one destination out of the way
+        int saved = new_vreg(mf);
+        emit(mf, MIR_MOV, mop_reg(destinations[0], 8), mop_reg(saved, 8));
+        for (size_t j = 0; j < pending; j++) {
+            if (sources[j].kind == MOP_REG && sources[j].reg == destinations[0]) sources[j].reg = saved;
+        }
+    }
+}
+
+// edges from a block with two successors into a block with phis get a block of
+// their own for the copies
+static void split_critical_edges(struct IrFunction* fn) {
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        struct IrInst* term = ir_terminator(block);
+        if (term->op != IR_BRANCH) continue;
+
+        for (int k = 0; k < 2; k++) {
+            struct IrBlock* succ = term->targets[k];
+            if (succ->preds_length < 2 || succ->insts_length == 0 || succ->insts[0]->op != IR_PHI) continue;
+
+            // placed right after the branch, which can fall through into it; the
+            // copies on a back edge go right before the loop they fall into instead,
+            // so going around takes the one branch
+            size_t position = ir_block_position(fn, succ);
+            struct IrBlock* edge = ir_new_block_at(fn, position <= i ? position : i + 1);
+            if (position <= i) i += 1;
+
+            struct IrInst* jump = ir_new_inst(fn, IR_JUMP, 0);
+            jump->targets[0] = succ;
+            ir_append(fn, edge, jump);
+            ir_add_pred(fn, edge, block);
+
+            succ->preds[ir_pred_index(succ, block)] = edge;
+            term->targets[k] = edge;
+        }
+    }
+}
+
+static void select_jump(struct Selector* s, struct IrBlock* target, struct IrBlock* next) {
+    if (target != next) emit_jmp(&s->ctx->mir, s->labels[target->id]);
+}
+
+// jump tables need this many cases, at least one in SWITCH_TABLE_DENSITY
+// values of their range, and at most SWITCH_TABLE_MAX entries
+#define SWITCH_TABLE_MIN_CASES 4
+#define SWITCH_TABLE_DENSITY 3
+#define SWITCH_TABLE_MAX 4096
+
+// bit tests take a range of up to 64 cases going to this many targets
+#define SWITCH_BIT_TEST_TARGETS 3
+
+// runs of cases a binary search compares one after the other
+#define SWITCH_LEAF_CASES 3
+
+// the position of `value` in a range of cases starting at `low`, 32-bit
+// arithmetic zero-extends it for use as a 64-bit index
+static int select_case_index(struct Selector* s, int value, int64_t low) {
+    struct MirFunction* mf = &s->ctx->mir;
+    if (low == 0) return value;
+
+    int r = new_vreg(mf);
+    emit(mf, MIR_MOV, mop_reg(value, 4), mop_reg(r, 4));
+    emit(mf, MIR_SUB, mop_imm(low, 4), mop_reg(r, 4));
+    return r;
+}
+
+// values past the range go to the default, unless none can get there
+static void select_range_check(struct Selector* s, struct IrInst* inst, int index, int64_t range) {
+    struct MirFunction* mf = &s->ctx->mir;
+    if (inst->imm != 0) return;
+
+    emit(mf, MIR_CMP, mop_imm(range - 1, 4), mop_reg(index, 4));
+    emit_jcc(mf, COND_A, s->labels[inst->targets[0]->id]);
+}
+
+// a mask of the cases going to each target, tested with bt
+static void select_bit_tests(struct Selector* s, struct IrInst* inst, int value, struct IrBlock** targets, size_t targets_length, struct IrBlock* next) {
+    struct MirFunction* mf = &s->ctx->mir;
+    int64_t low = inst->case_values[0];
+    int64_t range = inst->case_values[inst->cases_length - 1] - low + 1;
+
+    int index = select_case_index(s, value, low);
+    select_range_check(s, inst, index, range);
+
+    uint64_t masks[SWITCH_BIT_TEST_TARGETS];
+    uint64_t covered = 0;
+    size_t largest = 0;
+    for (size_t t = 0; t < targets_length; t++) {
+        masks[t] = 0;
+        for (size_t i = 0; i < inst->cases_length; i++) {
+            if (inst->case_targets[i] == targets[t]) masks[t] |= (uint64_t) 1 << (inst->case_values[i] - low);
+        }
+
+        covered |= masks[t];
+        if (__builtin_popcountll(masks[t]) > __builtin_popcountll(masks[largest])) largest = t;
+    }
+
+    // once every value left is a case, the target with the most of them needs no test
+    uint64_t full = range == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << range) - 1;
+    bool complete = inst->imm != 0 || covered == full;
+
+    int size = range <= 32 ? 4 : 8;
+    for (size_t t = 0; t < targets_length; t++) {
+        if (complete && t == largest) continue;
+
+        int mask = new_vreg(mf);
+        emit(mf, MIR_MOV, mop_imm((int64_t) masks[t], size), mop_reg(mask, size));
+        emit(mf, MIR_BT, mop_reg(index, size), mop_reg(mask, size));
+        emit_jcc(mf, COND_B, s->labels[targets[t]->id]);
+    }
+
+    select_jump(s, complete ? targets[largest] : inst->targets[0], next);
+}
+
+static void select_jump_table(struct Selector* s, struct IrInst* inst, int value) {
+    struct MirFunction* mf = &s->ctx->mir;
+    int64_t low = inst->case_values[0];
+    int64_t range = inst->case_values[inst->cases_length - 1] - low + 1;
+
+    int index = select_case_index(s, value, low);
+    select_range_check(s, inst, index, range);
+
+    size_t* targets = arena_alloc(mf->arena, sizeof(size_t) * range);
+    for (int64_t i = 0; i < range; i++) {
+        targets[i] = s->labels[inst->targets[0]->id];
+    }
+
+    for (size_t i = 0; i < inst->cases_length; i++) {
+        targets[inst->case_values[i] - low] = s->labels[inst->case_targets[i]->id];
+    }
+
+    emit_jump_table(mf, index, targets, range);
+}
+
+// binary search over the cases `first` to `last`, the last run of cases
+// leaves the jump to the default to the caller
+static void select_decision_tree(struct Selector* s, struct IrInst* inst, int value, size_t first, size_t last, bool at_end) {
+    struct MirFunction* mf = &s->ctx->mir;
+
+    if (last - first <= SWITCH_LEAF_CASES) {
+        for (size_t i = first; i < last; i++) {
+            emit(mf, MIR_CMP, mop_imm(inst->case_values[i], 4), mop_reg(value, 4));
+            emit_jcc(mf, COND_E, s->labels[inst->case_targets[i]->id]);
+        }
+
+        if (!at_end) emit_jmp(mf, s->labels[inst->targets[0]->id]);
+        return;
+    }
+
+    size_t middle = first + (last - first) / 2;
+    size_t upper = new_label(mf, NULL);
+    emit(mf, MIR_CMP, mop_imm(inst->case_values[middle], 4), mop_reg(value, 4));
+    emit_jcc(mf, COND_E, s->labels[inst->case_targets[middle]->id]);
+    emit_jcc(mf, COND_G, upper);
+
+    select_decision_tree(s, inst, value, first, middle, false);
+    emit_label(mf, upper);
+    select_decision_tree(s, inst, value, middle + 1, last, at_end);
+}
+
+static void select_switch(struct Selector* s, struct IrInst* inst, struct IrBlock* next) {
+    size_t length = inst->cases_length;
+    if (length == 0) {
+        select_jump(s, inst->targets[0], next);
+        return;
+    }
+
+    int value = select_register(s, inst->operands[0]);
+    int64_t range = inst->case_values[length - 1] - inst->case_values[0] + 1;
+
+    struct IrBlock* targets[SWITCH_BIT_TEST_TARGETS];
+    size_t targets_length = 0;
+    bool few_targets = true;
+    for (size_t i = 0; i < length && few_targets; i++) {
+        size_t t = 0;
+        while (t < targets_length && targets[t] != inst->case_targets[i]) t++;
+        if (t < targets_length) continue;
+
+        if (targets_length == SWITCH_BIT_TEST_TARGETS) {
+            few_targets = false;
+        } else {
+            targets[targets_length++] = inst->case_targets[i];
+        }
+    }
+
+    if (few_targets && range <= 64) {
+        select_bit_tests(s, inst, value, targets, targets_length, next);
+    } else if (length >= SWITCH_TABLE_MIN_CASES && range <= (int64_t) length * SWITCH_TABLE_DENSITY && range <= SWITCH_TABLE_MAX) {
+        select_jump_table(s, inst, value);
+    } else {
+        select_decision_tree(s, inst, value, 0, length, true);
+        select_jump(s, inst->targets[0], next);
+    }
+}
+
+// passes the arguments of a call, returns how many go in registers
+static int select_arguments(struct Selector* s, struct IrInst* inst) {
+    struct MirFunction* mf = &s->ctx->mir;
+
+    // every argument is computed before any argument register is pinned
+    size_t args_length = inst->operands_length;
+    struct MirOperand args[args_length + 1];
+    for (size_t i = 0; i < args_length; i++) {
+        args[i] = select_operand(s, inst->operands[i]);
+    }
+
+    int registers = emit_call_arguments(mf, args, args_length);
+    if (s->wide_vectors) emit(mf, MIR_VZEROUPPER, mop_none(), mop_none());
+    return registers;
+}
+
+static void select_call(struct Selector* s, struct IrInst* inst) {
+    struct MirFunction* mf = &s->ctx->mir;
+    emit_call(mf, inst->symbol, select_arguments(s, inst));
+
+    // results nobody reads stay in rax
+    if (inst->size > 0 && s->uses[inst->id] > 0) {
+        emit(mf, MIR_MOV, mop_reg(REG_RAX, inst->size), mop_reg(value_register(s, inst), inst->size));
+    }
+}
+
+// whether the instruction at `position` is a call whose result the block returns right away
+static bool is_tail_call(struct Selector* s, struct IrBlock* block, size_t position) {
+    if (!s->tail_calls || position + 2 != block->insts_length) return false;
+
+    struct IrInst* call = block->insts[position];
+    struct IrInst* ret = block->insts[position + 1];
+    if (call->op != IR_CALL || ret->op != IR_RETURN || ret->operands_length != 1 || ret->operands[0] != call) return false;
+    return s->uses[call->id] == 1 && call->operands_length <= s->ctx->mir.argument_count;
+}
+
+// rep stos or movs, every operand is computed before any register is pinned
+static void select_block_memory(struct Selector* s, struct IrInst* inst) {
+    struct MirFunction* mf = &s->ctx->mir;
+    struct MirOperand destination = select_operand(s, inst->operands[0]);
+    struct MirOperand other = select_operand(s, inst->operands[1]);
+    struct MirOperand count = select_operand(s, inst->operands[2]);
+
+    bool fill = inst->op == IR_FILL;
+    emit(mf, MIR_MOV, destination, mop_reg(REG_RDI, 8));
+    emit(mf, MIR_MOV, other, mop_reg(fill ? REG_RAX : REG_RSI, other.size));
+    emit(mf, MIR_MOV, count, mop_reg(REG_RCX, 8));
+    emit(mf, fill ? MIR_REP_STOS : MIR_REP_MOVS, mop_none(), mop_none());
+}
+
+static void select_inst(struct Selector* s, struct IrInst* inst, struct IrBlock* next) {
+    struct Context* ctx = s->ctx;
+    struct MirFunction* mf = &ctx->mir;
+
+    switch (inst->op) {
+        // used where they are needed
+        case IR_CONST:
+        case IR_UNDEF:
+        case IR_SLOT:
+        case IR_PHI:
+            break;
+
+        case IR_PARAM: {
+            struct MirOperand incoming;
+            if (inst->imm < mf->argument_count) {
+                incoming = mop_reg(mf->argument_registers[inst->imm], inst->size);
+            } else {
+                incoming = mop_mem(REG_RBP, REG_NONE, 1, STACK_ARGUMENTS_OFFSET + 8 * (inst->imm - mf->argument_count), inst->size);
+            }
+
+            emit(mf, MIR_MOV, incoming, mop_reg(value_register(s, inst), inst->size));
+            break;
+        }
+
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL: {
+            struct IrInst* left = inst->operands[0];
+            struct IrInst* right = inst->operands[1];
+            if (inst->op != IR_SUB && is_immediate(left) && !is_immediate(right)) {
+                left = inst->operands[1];
+                right = inst->operands[0];
+            }
+
+            struct MirOperand operand = select_operand(s, right);
+            if (inst->op == IR_MUL && operand.kind == MOP_IMM) {
+                bind_result(s, inst, generate_constant_product(select_register(s, left), operand.imm, inst->size, ctx));
+                break;
+            }
+
+            if (inst->size >= 16) {
+                static const enum MirOp vector_ops[] = { [IR_ADD] = MIR_VADD, [IR_SUB] = MIR_VSUB, [IR_MUL] = MIR_VMUL };
+                int r = value_register(s, inst);
+                emit(mf, MIR_VMOV, mop_reg(value_register(s, left), inst->size), mop_reg(r, inst->size));
+                emit(mf, vector_ops[inst->op], mop_reg(value_register(s, right), inst->size), mop_reg(r, inst->size));
+                break;
+            }
+
+            static const enum MirOp ops[] = { [IR_ADD] = MIR_ADD, [IR_SUB] = MIR_SUB, [IR_MUL] = MIR_IMUL };
+            int r = value_register(s, inst);
+            emit(mf, MIR_MOV, select_operand(s, left), mop_reg(r, inst->size));
+            emit(mf, ops[inst->op], operand, mop_reg(r, inst->size));
+            break;
+        }
+
+        case IR_DIV:
+        case IR_MOD: {
+            int dividend = select_register(s, inst->operands[0]);
+            struct MirOperand divisor = select_operand(s, inst->operands[1]);
+            enum BinaryOperation op = inst->op == IR_DIV ? BINARY_OP_DIV : BINARY_OP_MOD;
+            bind_result(s, inst, generate_division(op, dividend, divisor, ctx));
+            break;
+        }
+
+        case IR_CMP: {
+            if (is_fused_comparison(s, inst)) break;
+
+            int r = value_register(s, inst);
+            enum Condition cond = select_flags(s, inst);
+            emit_setcc(mf, cond, r);
+            emit(mf, MIR_MOVZB, mop_reg(r, 1), mop_reg(r, 4));
+            break;
+        }
+
+        case IR_SEXT: {
+            int r = value_register(s, inst);
+            struct IrInst* value = inst->operands[0];
+            if (is_immediate(value)) {
+                emit(mf, MIR_MOV, mop_imm(value->imm, 8), mop_reg(r, 8));
+            } else {
+                emit(mf, MIR_MOVSX, mop_reg(select_register(s, value), 4), mop_reg(r, 8));
+            }
+            break;
+        }
+
+        case IR_SPLAT: {
+            int r = value_register(s, inst);
+            struct IrInst* value = inst->operands[0];
+            if (value->op == IR_CONST && value->imm == 0) {
+                emit(mf, MIR_VZERO, mop_none(), mop_reg(r, inst->size));
+            } else {
+                emit(mf, MIR_VBROADCAST, mop_reg(select_register(s, value), 4), mop_reg(r, inst->size));
+            }
+            break;
+        }
+
+        case IR_LEA:
+            emit(mf, MIR_LEA, select_address(s, inst, 8), mop_reg(value_register(s, inst), 8));
+            break;
+
+        case IR_LOAD: {
+            enum MirOp op = inst->size >= 16 ? MIR_VMOV : MIR_MOV;
+            emit(mf, op, select_address(s, inst, inst->size), mop_reg(value_register(s, inst), inst->size));
+            break;
+        }
+
+        case IR_STORE: {
+            struct MirOperand value = select_operand(s, inst->operands[0]);
+            emit(mf, value.size >= 16 ? MIR_VMOV : MIR_MOV, value, select_address(s, inst, value.size));
+            break;
+        }
+
+        case IR_CALL:
+            select_call(s, inst);
+            break;
+
+        case IR_FILL:
+        case IR_COPY:
+            select_block_memory(s, inst);
+            break;
+
+        case IR_JUMP:
+            select_phi_copies(s, inst->block, inst->targets[0]);
+            select_jump(s, inst->targets[0], next);
+            break;
+
+        case IR_BRANCH: {
+            struct IrBlock* success = inst->targets[0];
+            struct IrBlock* failure = inst->targets[1];
+            select_phi_copies(s, inst->block, success);
+            select_phi_copies(s, inst->block, failure);
+
+            struct IrInst* condition = inst->operands[0];
+            enum Condition cond;
+            if (is_fused_comparison(s, condition)) {
+                cond = select_flags(s, condition);
+            } else {
+                emit(mf, MIR_CMP, mop_imm(0, condition->size), mop_reg(select_register(s, condition), condition->size));
+                cond = COND_NE;
+            }
+
+            // fall through to whichever target comes next
+            if (success == next) {
+                emit_jcc(mf, negate_condition(cond), s->labels[failure->id]);
+            } else {
+                emit_jcc(mf, cond, s->labels[success->id]);
+                select_jump(s, failure, next);
+            }
+            break;
+        }
+
+        case IR_SWITCH:
+            select_switch(s, inst, next);
+            break;
+
+        case IR_RETURN:
+            if (s->wide_vectors) emit(mf, MIR_VZEROUPPER, mop_none(), mop_none());
+            if (inst->operands_length > 0) {
+                struct MirOperand value = select_operand(s, inst->operands[0]);
+                emit(mf, MIR_MOV, value, mop_reg(REG_RAX, value.size));
+            }
+
+            // the exit label follows the last block
+            if (next != NULL) emit_jmp(mf, ctx->exit_label);
+            break;
+    }
+}
+
+// every block got a label, the ones no jump refers to are only in the way
+static void remove_unused_labels(struct MirFunction* mf, struct Arena* arena) {
+    bool* used = arena_calloc(arena, sizeof(bool) * (mf->label_count + 1));
+    for (size_t i = 0; i < mf->insts_length; i++) {
+        struct MirInst* inst = &mf->insts[i];
+        if (inst->op == MIR_JMP || inst->op == MIR_JCC) used[inst->dst.label] = true;
+    }
+
+    for (size_t i = 0; i < mf->tables_length; i++) {
+        struct MirJumpTable* table = &mf->tables[i];
+        for (size_t j = 0; j < table->targets_length; j++) used[table->targets[j]] = true;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < mf->insts_length; i++) {
+        struct MirInst* inst = &mf->insts[i];
+        if (inst->op == MIR_LABEL && !used[inst->dst.label]) continue;
+        mf->insts[kept++] = *inst;
+    }
+
+    mf->insts_length = kept;
+}
+
+// an inlined body only runs between its call site and the code after it,
+// so the slots of every call site start from the same offset, like the
+// sibling scopes of layout_frame
+static size_t layout_inlined_slots(struct IrFunction* fn, size_t offset) {
+    size_t first = fn->slot_groups_length > 0 ? fn->slot_groups[0] : fn->slots_length;
+    offset = layout_variables(fn->slots, first, offset);
+
+    size_t end = offset;
+    for (size_t i = 0; i < fn->slot_groups_length; i++) {
+        size_t start = fn->slot_groups[i];
+        size_t stop = i + 1 < fn->slot_groups_length ? fn->slot_groups[i + 1] : fn->slots_length;
+        size_t group_end = layout_variables(&fn->slots[start], stop - start, offset);
+        if (group_end > end) {
+            end = group_end;
+        }
+    }
+
+    return end;
+}
+
+// selects one optimized function of the IR
+void select_function(struct IrFunction* fn, struct Context* ctx, struct Buffer* buffer) {
+    struct Function* func = fn->func;
+    struct Arena* arena = &ctx->arena;
+    begin_function(func, ctx);
+    split_critical_edges(fn);
+    lower_switches(fn);
+    lower_memory_idioms(fn);
+
+    // variables of inlined callees go below the caller's own
+    size_t frame_size = layout_frame(func);
+    frame_size = layout_inlined_slots(fn, frame_size);
+    emit_function_entry(func, ctx);
+
+    struct Selector s;
+    s.ctx = ctx;
+    s.fn = fn;
+    s.vregs = arena_alloc(arena, sizeof(int) * fn->value_count);
+    s.uses = arena_calloc(arena, sizeof(int) * fn->value_count);
+    s.branch_uses = arena_calloc(arena, sizeof(int) * fn->value_count);
+    s.labels = arena_alloc(arena, sizeof(size_t) * fn->block_count);
+    s.wide_vectors = false;
+    s.tail_calls = frame_size == 0;
+    ctx->mir.vex = fn->module->vector_width >= 32;
+
+    for (int i = 0; i < fn->value_count; i++) {
+        s.vregs[i] = REG_NONE;
+    }
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        s.labels[block->id] = new_label(&ctx->mir, NULL);
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                s.uses[inst->operands[k]->id] += 1;
+            }
+
+            if (inst->op == IR_BRANCH) s.branch_uses[inst->operands[0]->id] += 1;
+            if (inst->size == 32) s.wide_vectors = true;
+        }
+    }
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        struct IrBlock* next = i + 1 < fn->blocks_length ? fn->blocks[i + 1] : NULL;
+        if (i > 0) emit_label(&ctx->mir, s.labels[block->id]);
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            if (is_tail_call(&s, block, j)) {
+                emit_tail_call(&ctx->mir, block->insts[j]->symbol, select_arguments(&s, block->insts[j]));
+                break;
+            }
+
+            select_inst(&s, block->insts[j], next);
+        }
+    }
+
+    remove_unused_labels(&ctx->mir, arena);
+    finish_function(func, ctx, frame_size, buffer);
+}
+
+#endif
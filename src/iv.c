@@ -0,0 +1,443 @@
+#ifndef CFCC_IV_C
+#define CFCC_IV_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.c"
+#include "ir.c"
+#include "loop.c"
+#include "pass.c"
+
+// Induction variable strength reduction: a header phi that steps by a
+// constant every iteration is an induction variable, and the values of the
+// loop computed from one as `base + iv * scale + offset` are an affine
+// family of it. Every family with a sign extension, multiplication or
+// address in it gets a 64-bit phi of its own stepping by `step * scale`, so
+// `&a[i]` becomes a pointer that moves on by 4 bytes per iteration instead
+// of a movslq, an imul and a lea. Members of the family are that phi plus a
+// constant, which memory operations take into their displacement.
+// When all that is left of an `int` counter is the test ending the loop,
+// the test compares the 64-bit phi against the bound instead and the
+// counter goes away with the next dce.
+
+// a phi of the loop header that `next`, what the latch passes back, moves on by `step`
+struct InductionVariable {
+    struct IrInst* phi;
+    struct IrInst* init;
+    struct IrInst* next;
+    int64_t step;
+};
+
+// `base + iv * scale + offset`, with `base` NULL or a pointer from outside of the loop
+struct AffineValue {
+    struct InductionVariable* iv;
+    struct IrInst* base;
+    int64_t scale;
+    int64_t offset;
+};
+
+// the 64-bit phi standing for `base + iv * scale` and its value on the next iteration
+struct ReducedFamily {
+    struct InductionVariable* iv;
+    struct IrInst* base;
+    int64_t scale;
+
+    struct IrInst* phi;
+    struct IrInst* next;
+};
+
+struct Reduction {
+    struct IrFunction* fn;
+    struct IrLoop* loop;
+    struct IrBlock* preheader;
+    int preheader_index;
+    int latch_index;
+
+    struct InductionVariable* ivs;
+    size_t ivs_length;
+
+    // instruction id -> affine value, `iv` is NULL for the other instructions
+    struct AffineValue* affine;
+    size_t affine_length;
+
+    struct ReducedFamily* families;
+    size_t families_length;
+    size_t families_capacity;
+};
+
+static struct AffineValue* affine_value(struct Reduction* r, struct IrInst* inst) {
+    if (inst->id >= (int) r->affine_length || r->affine[inst->id].iv == NULL) return NULL;
+    return &r->affine[inst->id];
+}
+
+static bool is_loop_invariant(struct Reduction* r, struct IrInst* value) {
+    return !ir_loop_contains(r->loop, value->block);
+}
+
+static void find_induction_variables(struct Reduction* r) {
+    struct IrBlock* header = r->loop->header;
+
+    size_t count = 0;
+    while (count < header->insts_length && header->insts[count]->op == IR_PHI) count++;
+    r->ivs = arena_alloc(r->fn->arena, sizeof(struct InductionVariable) * (count > 0 ? count : 1));
+
+    for (size_t i = 0; i < count; i++) {
+        struct IrInst* phi = header->insts[i];
+        struct IrInst* next = phi->operands[r->latch_index];
+        if (!ir_loop_contains(r->loop, next->block) || next->size != phi->size) continue;
+        if (next->op != IR_ADD && next->op != IR_SUB) continue;
+
+        struct IrInst* left = next->operands[0];
+        struct IrInst* right = next->operands[1];
+        if (next->op == IR_ADD && left->op == IR_CONST) {
+            left = next->operands[1];
+            right = next->operands[0];
+        }
+
+        if (left != phi || right->op != IR_CONST) continue;
+
+        int64_t step = next->op == IR_ADD ? right->imm : -right->imm;
+        r->ivs[r->ivs_length++] = (struct InductionVariable) { phi, phi->operands[r->preheader_index], next, step };
+    }
+}
+
+// what `inst` is in terms of an induction variable, from what its operands are
+static struct AffineValue analyze_affine(struct Reduction* r, struct IrInst* inst) {
+    struct AffineValue none = { 0 };
+    struct IrInst** operands = inst->operands;
+
+    switch (inst->op) {
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL: {
+            struct AffineValue* value = affine_value(r, operands[0]);
+            struct IrInst* other = operands[1];
+            if (value == NULL && inst->op != IR_SUB) {
+                value = affine_value(r, operands[1]);
+                other = operands[0];
+            }
+
+            if (value == NULL) return none;
+            struct AffineValue result = *value;
+
+            if (other->op == IR_CONST) {
+                if (inst->op == IR_ADD) result.offset += other->imm;
+                if (inst->op == IR_SUB) result.offset -= other->imm;
+                if (inst->op == IR_MUL) {
+                    if (result.base != NULL) return none;
+                    result.scale *= other->imm;
+                    result.offset *= other->imm;
+                }
+
+                return result;
+            }
+
+            // a pointer from outside of the loop moved on by the family
+            if (inst->op != IR_ADD || inst->size != 8 || result.base != NULL || !is_loop_invariant(r, other)) return none;
+            result.base = other;
+            return result;
+        }
+
+        case IR_SEXT: {
+            struct AffineValue* value = affine_value(r, operands[0]);
+            return value != NULL && value->base == NULL ? *value : none;
+        }
+
+        case IR_LEA: {
+            struct AffineValue* base = affine_value(r, operands[0]);
+            if (!ir_has_index(inst)) {
+                if (base == NULL) return none;
+
+                struct AffineValue result = *base;
+                result.offset += inst->imm;
+                return result;
+            }
+
+            struct AffineValue* index = affine_value(r, operands[1]);
+            if (index == NULL || index->base != NULL || !is_loop_invariant(r, operands[0])) return none;
+
+            return (struct AffineValue) {
+                index->iv, operands[0], index->scale * inst->scale, index->offset * inst->scale + inst->imm,
+            };
+        }
+
+        default:
+            return none;
+    }
+}
+
+// whether computing the value takes more than an add of a constant, the members making a family worth a phi
+static bool is_costly_member(struct IrInst* inst) {
+    return inst->op == IR_SEXT || inst->op == IR_MUL || (inst->op == IR_LEA && ir_has_index(inst));
+}
+
+// a value that is already its family's phi, or that phi plus a constant
+static bool is_reduced(struct IrInst* inst, struct AffineValue* value) {
+    return inst->size != 8 || (value->iv->phi->size == 8 && value->base == NULL && value->scale == 1);
+}
+
+static struct ReducedFamily* find_family(struct Reduction* r, struct AffineValue* value) {
+    for (size_t i = 0; i < r->families_length; i++) {
+        struct ReducedFamily* family = &r->families[i];
+        if (family->iv == value->iv && family->base == value->base && family->scale == value->scale) return family;
+    }
+
+    return NULL;
+}
+
+static struct IrInst* insert_before(struct Reduction* r, struct IrBlock* block, size_t position, enum IrOp op, struct IrInst* left, struct IrInst* right) {
+    struct IrInst* inst = ir_new_inst(r->fn, op, 8);
+    ir_add_operand(r->fn, inst, left);
+    if (right != NULL) ir_add_operand(r->fn, inst, right);
+
+    ir_insert(r->fn, block, position, inst);
+    return inst;
+}
+
+static struct IrInst* insert_constant(struct Reduction* r, struct IrBlock* block, size_t position, int64_t value) {
+    struct IrInst* constant = ir_new_inst(r->fn, IR_CONST, 8);
+    constant->imm = value;
+
+    ir_insert(r->fn, block, position, constant);
+    return constant;
+}
+
+// `value` widened to 64 bits at the end of the preheader
+static struct IrInst* widen_invariant(struct Reduction* r, struct IrInst* value) {
+    struct IrBlock* preheader = r->preheader;
+    if (value->op == IR_CONST) return insert_constant(r, preheader, preheader->insts_length - 1, value->imm);
+    if (value->size == 8) return value;
+
+    return insert_before(r, preheader, preheader->insts_length - 1, IR_SEXT, value, NULL);
+}
+
+static size_t inst_position(struct IrInst* inst) {
+    struct IrBlock* block = inst->block;
+    for (size_t i = 0; i < block->insts_length; i++) {
+        if (block->insts[i] == inst) return i;
+    }
+
+    return block->insts_length;
+}
+
+// the phi for the family of `value`, made on first use with its initial value computed in the preheader
+static struct ReducedFamily* reduce_family(struct Reduction* r, struct AffineValue* value) {
+    struct ReducedFamily* family = find_family(r, value);
+    if (family != NULL) return family;
+
+    if (r->families_length == r->families_capacity) {
+        size_t capacity = r->families_capacity > 0 ? r->families_capacity * 2 : 4;
+        r->families = arena_grow(r->fn->arena, r->families, sizeof(struct ReducedFamily) * r->families_capacity, sizeof(struct ReducedFamily) * capacity);
+        r->families_capacity = capacity;
+    }
+
+    struct IrBlock* preheader = r->preheader;
+    struct InductionVariable* iv = value->iv;
+
+    // addressing modes scale by 1, 2, 4 or 8 only, other scales are multiplied first
+    struct IrInst* init = widen_invariant(r, iv->init);
+    int64_t scale = value->scale;
+    if (value->base == NULL || (scale != 1 && scale != 2 && scale != 4 && scale != 8)) {
+        if (scale != 1) {
+            struct IrInst* constant = insert_constant(r, preheader, preheader->insts_length - 1, scale);
+            init = insert_before(r, preheader, preheader->insts_length - 1, IR_MUL, init, constant);
+        }
+
+        scale = 1;
+    }
+
+    if (value->base != NULL) {
+        init = insert_before(r, preheader, preheader->insts_length - 1, IR_LEA, value->base, init);
+        init->scale = scale;
+    }
+
+    struct IrInst* phi = ir_new_inst(r->fn, IR_PHI, 8);
+    for (size_t i = 0; i < r->loop->header->preds_length; i++) {
+        ir_add_operand(r->fn, phi, init);
+    }
+
+    ir_insert(r->fn, r->loop->header, 0, phi);
+
+    // the step goes right after the one of the induction variable, which reaches the latch
+    struct IrBlock* block = iv->next->block;
+    size_t position = inst_position(iv->next) + 1;
+    struct IrInst* step = insert_constant(r, block, position, iv->step * value->scale);
+    struct IrInst* next = insert_before(r, block, position + 1, IR_ADD, phi, step);
+    phi->operands[r->latch_index] = next;
+
+    family = &r->families[r->families_length++];
+    *family = (struct ReducedFamily) { iv, value->base, value->scale, phi, next };
+    return family;
+}
+
+static bool is_family_phi(struct Reduction* r, struct IrInst* inst) {
+    for (size_t i = 0; i < r->families_length; i++) {
+        if (r->families[i].phi == inst) return true;
+    }
+
+    return false;
+}
+
+// takes `family phi + constant` into the displacement of the memory operations using it
+static void fold_offsets(struct Reduction* r) {
+    for (size_t i = 0; i < r->loop->blocks_length; i++) {
+        struct IrBlock* block = r->loop->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            if (inst->op != IR_LOAD && inst->op != IR_STORE && inst->op != IR_LEA) continue;
+
+            int start = ir_address_start(inst);
+            int count = ir_has_index(inst) ? 2 : 1;
+            for (int k = 0; k < count; k++) {
+                struct IrInst* operand = inst->operands[start + k];
+                if (operand->op != IR_ADD || !is_family_phi(r, operand->operands[0]) || operand->operands[1]->op != IR_CONST) continue;
+
+                int64_t disp = inst->imm + operand->operands[1]->imm * (k == 0 ? 1 : inst->scale);
+                if (disp < INT32_MIN || disp > INT32_MAX) continue;
+
+                inst->operands[start + k] = operand->operands[0];
+                inst->imm = disp;
+            }
+        }
+    }
+}
+
+// a compare in the loop of `value` against something from outside of it, with signed or equality conditions
+static bool is_exit_test(struct Reduction* r, struct IrInst* inst, struct IrInst* value) {
+    if (inst->op != IR_CMP || !ir_loop_contains(r->loop, inst->block)) return false;
+    if (inst->cond == COND_B || inst->cond == COND_A || inst->cond == COND_BE || inst->cond == COND_AE) return false;
+
+    struct IrInst* left = inst->operands[0];
+    struct IrInst* right = inst->operands[1];
+    return (left == value && is_loop_invariant(r, right)) || (right == value && is_loop_invariant(r, left));
+}
+
+// rewrites the tests on a 32-bit induction variable to ones on its 64-bit copy when nothing else uses it
+static bool replace_exit_tests(struct Reduction* r, struct InductionVariable* iv) {
+    struct AffineValue plain = { iv, NULL, 1, 0 };
+    struct ReducedFamily* family = find_family(r, &plain);
+    if (family == NULL || iv->phi->size != 4) return false;
+
+    struct IrFunction* fn = r->fn;
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                struct IrInst* operand = inst->operands[k];
+                if (operand == iv->phi && inst != iv->next && !is_exit_test(r, inst, iv->phi)) return false;
+                if (operand == iv->next && inst != iv->phi && !is_exit_test(r, inst, iv->next)) return false;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < r->loop->blocks_length; i++) {
+        struct IrBlock* block = r->loop->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            if (inst->op != IR_CMP) continue;
+
+            for (int k = 0; k < 2; k++) {
+                struct IrInst* operand = inst->operands[k];
+                struct IrInst* other = inst->operands[1 - k];
+                if (operand != iv->phi && operand != iv->next) continue;
+
+                inst->operands[k] = operand == iv->phi ? family->phi : family->next;
+                inst->operands[1 - k] = widen_invariant(r, other);
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool reduce_loop(struct IrFunction* fn, struct IrLoop* loop) {
+    struct IrBlock* preheader = ir_loop_preheader(loop);
+    struct IrBlock* latch = ir_loop_latch(loop);
+    if (preheader == NULL || latch == NULL || loop->header->preds_length != 2) return false;
+
+    struct Reduction r = { 0 };
+    r.fn = fn;
+    r.loop = loop;
+    r.preheader = preheader;
+    r.preheader_index = ir_pred_index(loop->header, preheader);
+    r.latch_index = ir_pred_index(loop->header, latch);
+
+    find_induction_variables(&r);
+    if (r.ivs_length == 0) return false;
+
+    r.affine_length = fn->value_count;
+    r.affine = arena_calloc(fn->arena, sizeof(struct AffineValue) * r.affine_length);
+    for (size_t i = 0; i < r.ivs_length; i++) {
+        r.affine[r.ivs[i].phi->id] = (struct AffineValue) { &r.ivs[i], NULL, 1, 0 };
+    }
+
+    // operands come first in reverse postorder, phis aside, and those are the induction variables
+    struct IrInst** members = arena_alloc(fn->arena, sizeof(struct IrInst*) * fn->value_count);
+    size_t members_length = 0;
+
+    for (size_t i = 0; i < loop->blocks_length; i++) {
+        struct IrBlock* block = loop->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            if (inst->op == IR_PHI) continue;
+
+            struct AffineValue value = analyze_affine(&r, inst);
+            if (value.iv == NULL) continue;
+
+            r.affine[inst->id] = value;
+            if (!is_reduced(inst, &value)) members[members_length++] = inst;
+        }
+    }
+
+    // families are only worth a phi when they save more than adds
+    for (size_t i = 0; i < members_length; i++) {
+        if (is_costly_member(members[i])) reduce_family(&r, &r.affine[members[i]->id]);
+    }
+
+    if (r.families_length == 0) return false;
+
+    for (size_t i = 0; i < members_length; i++) {
+        struct IrInst* member = members[i];
+        struct AffineValue* value = &r.affine[member->id];
+        struct ReducedFamily* family = find_family(&r, value);
+        if (family == NULL) continue;
+
+        struct IrInst* replacement = family->phi;
+        if (value->offset != 0) {
+            size_t position = inst_position(member);
+            struct IrInst* offset = insert_constant(&r, member->block, position, value->offset);
+            replacement = insert_before(&r, member->block, position + 1, IR_ADD, family->phi, offset);
+        }
+
+        member->replacement = replacement;
+    }
+
+    ir_apply_replacements(fn);
+    fold_offsets(&r);
+
+    for (size_t i = 0; i < r.ivs_length; i++) {
+        replace_exit_tests(&r, &r.ivs[i]);
+    }
+
+    return true;
+}
+
+static bool reduce_strength(struct IrFunction* fn) {
+    struct IrLoops loops;
+    bool changed = ir_canonicalize_loops(fn, &loops);
+
+    // every loop gets the families of its own induction variables, nothing found moves
+    for (size_t i = loops.loops_length; i-- > 0;) {
+        changed |= reduce_loop(fn, loops.loops[i]);
+    }
+
+    return changed;
+}
+
+const struct IrPass strength_reduce_pass = { "strength-reduce", reduce_strength };
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef CFCC_LICM_C
+#define CFCC_LICM_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.c"
+#include "gvn.c"
+#include "ir.c"
+#include "loop.c"
+#include "pass.c"
+#include "symbol.c"
+
+// Loop-invariant code motion: an instruction whose operands all come from
+// outside of a loop computes the same value on every iteration, so it moves
+// to the end of the preheader and runs once. Inner loops go first, which
+// lets what leaves them leave the loops around them next.
+// Arithmetic moves when it cannot trap. Loads move when nothing in the loop
+// may write where they read, and loads through pointers only when every way
+// out of the loop passes them, so a loop that never gets to one does not
+// start faulting on it.
+
+// what a loop does to memory, loads are checked against it
+struct LoopMemory {
+    struct IrInst** stores;
+    size_t stores_length;
+    size_t stores_capacity;
+
+    bool calls;
+};
+
+static void collect_loop_memory(struct IrFunction* fn, struct IrLoop* loop, struct LoopMemory* memory) {
+    *memory = (struct LoopMemory) { 0 };
+
+    for (size_t i = 0; i < loop->blocks_length; i++) {
+        struct IrBlock* block = loop->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            if (inst->op == IR_CALL) memory->calls = true;
+            if (inst->op != IR_STORE) continue;
+
+            if (memory->stores_length == memory->stores_capacity) {
+                size_t capacity = memory->stores_capacity > 0 ? memory->stores_capacity * 2 : 8;
+                memory->stores = arena_grow(fn->arena, memory->stores, sizeof(struct IrInst*) * memory->stores_capacity, sizeof(struct IrInst*) * capacity);
+                memory->stores_capacity = capacity;
+            }
+
+            memory->stores[memory->stores_length++] = inst;
+        }
+    }
+}
+
+// whether `block` runs on every way out of the loop, those returning from inside included
+static bool runs_before_exit(struct IrLoop* loop, struct IrBlock* block) {
+    for (size_t i = 0; i < loop->blocks_length; i++) {
+        struct IrBlock* exiting = loop->blocks[i];
+
+        struct IrBlock* succs[2];
+        int succs_length = ir_successors(exiting, succs);
+
+        bool exits = succs_length == 0;
+        for (int j = 0; j < succs_length; j++) {
+            if (!ir_loop_contains(loop, succs[j])) exits = true;
+        }
+
+        if (exits && !ir_dominates(block, exiting)) return false;
+    }
+
+    return true;
+}
+
+static bool is_invariant(struct IrLoop* loop, struct IrInst* inst) {
+    for (size_t i = 0; i < inst->operands_length; i++) {
+        if (ir_loop_contains(loop, inst->operands[i]->block)) return false;
+    }
+
+    return true;
+}
+
+static bool can_hoist(struct IrLoop* loop, struct LoopMemory* memory, struct SymbolTable* escaping, struct IrInst* inst) {
+    if (inst->op == IR_PHI || !is_invariant(loop, inst)) return false;
+
+    // division only traps on a divisor that is zero, or -1 next to the smallest dividend
+    if (inst->op == IR_DIV || inst->op == IR_MOD) {
+        struct IrInst* divisor = inst->operands[1];
+        return divisor->op == IR_CONST && divisor->imm != 0 && divisor->imm != -1;
+    }
+
+    if (is_pure_op(inst->op)) return true;
+    if (inst->op != IR_LOAD) return false;
+
+    struct IrInst* base = inst->operands[0];
+    bool local = base->op == IR_SLOT && symbol_table_find(escaping, (const char*) base->variable) == NULL;
+    if (memory->calls && !local) return false;
+
+    for (size_t i = 0; i < memory->stores_length; i++) {
+        if (may_alias(escaping, inst, memory->stores[i])) return false;
+    }
+
+    // frame variables can always be read, pointers only where the loop would have
+    return base->op == IR_SLOT || runs_before_exit(loop, inst->block);
+}
+
+static bool hoist_loop(struct IrFunction* fn, struct IrLoop* loop, struct SymbolTable* escaping) {
+    struct IrBlock* preheader = ir_loop_preheader(loop);
+    if (preheader == NULL) return false;
+
+    struct LoopMemory memory;
+    collect_loop_memory(fn, loop, &memory);
+
+    // in reverse postorder operands are hoisted before the instructions using them
+    bool changed = false;
+    for (size_t i = 0; i < loop->blocks_length; i++) {
+        struct IrBlock* block = loop->blocks[i];
+
+        size_t kept = 0;
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            if (!can_hoist(loop, &memory, escaping, inst)) {
+                block->insts[kept++] = inst;
+                continue;
+            }
+
+            ir_insert(fn, preheader, preheader->insts_length - 1, inst);
+            changed = true;
+        }
+
+        block->insts_length = kept;
+    }
+
+    return changed;
+}
+
+static bool hoist_invariants(struct IrFunction* fn) {
+    struct IrLoops loops;
+    bool changed = ir_canonicalize_loops(fn, &loops);
+
+    struct SymbolTable escaping;
+    init_symbol_table(&escaping);
+    find_escaping_slots(fn, &escaping);
+
+    for (size_t i = loops.loops_length; i-- > 0;) {
+        changed |= hoist_loop(fn, loops.loops[i], &escaping);
+    }
+
+    return changed;
+}
+
+const struct IrPass licm_pass = { "licm", hoist_invariants };
+
+#endif
@@ -0,0 +1,516 @@
+#ifndef CFCC_LOOP_C
+#define CFCC_LOOP_C
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "arena.c"
+#include "ir.c"
+#include "pass.c"
+
+// Loops: natural loops are found from the back edges of the dominator tree,
+// whether a `while` made them or a `goto` jumping up. A loop is the header
+// the back edges go to and every block that reaches one of them without
+// passing the header. Cycles that can be entered in more than one place are
+// not natural loops and are left alone.
+// Passes working on loops want them canonical: a preheader that is the only
+// way in from outside and ends in a jump to the header, and a single latch
+// holding the one back edge.
+// Rotation turns a loop that tests at the top into one that tests at the
+// bottom. The header is copied into the preheader, where it guards the
+// first iteration, and into the latch, where it decides on the next one,
+// so every iteration takes a single branch.
+struct IrLoop {
+    struct IrBlock* header;
+
+    // blocks of the loop in reverse postorder, the header first and those of inner loops included
+    struct IrBlock** blocks;
+    size_t blocks_length;
+
+    // block id -> in the loop, for the blocks that existed when loops were found
+    bool* contains;
+    size_t contains_length;
+
+    struct IrLoop* parent;
+    int depth;
+};
+
+struct IrLoops {
+    // outer loops before the loops nested in them
+    struct IrLoop** loops;
+    size_t loops_length;
+    size_t loops_capacity;
+
+    // block id -> innermost loop holding the block, NULL outside of loops
+    struct IrLoop** innermost;
+};
+
+// headers copied by rotation have at most this many instructions besides phis
+#define ROTATE_HEADER_MAX 8
+
+bool ir_loop_contains(struct IrLoop* loop, struct IrBlock* block) {
+    return block->id < (int) loop->contains_length && loop->contains[block->id];
+}
+
+static void add_loop(struct IrFunction* fn, struct IrLoops* loops, struct IrLoop* loop) {
+    if (loops->loops_length == loops->loops_capacity) {
+        size_t capacity = loops->loops_capacity > 0 ? loops->loops_capacity * 2 : 8;
+        loops->loops = arena_grow(fn->arena, loops->loops, sizeof(struct IrLoop*) * loops->loops_capacity, sizeof(struct IrLoop*) * capacity);
+        loops->loops_capacity = capacity;
+    }
+
+    loops->loops[loops->loops_length++] = loop;
+}
+
+// the loop `header` heads, made of the blocks that reach a back edge into it without passing it
+static struct IrLoop* collect_loop(struct IrFunction* fn, struct IrBlock* header) {
+    struct IrLoop* loop = arena_calloc(fn->arena, sizeof(struct IrLoop));
+    loop->header = header;
+    loop->contains = arena_calloc(fn->arena, sizeof(bool) * fn->block_count);
+    loop->contains_length = fn->block_count;
+    loop->contains[header->id] = true;
+
+    struct IrBlock** worklist = arena_alloc(fn->arena, sizeof(struct IrBlock*) * fn->block_count);
+    size_t worklist_length = 0;
+    for (size_t i = 0; i < header->preds_length; i++) {
+        struct IrBlock* pred = header->preds[i];
+        if (pred->order < 0 || !ir_dominates(header, pred) || loop->contains[pred->id]) continue;
+
+        loop->contains[pred->id] = true;
+        worklist[worklist_length++] = pred;
+    }
+
+    while (worklist_length > 0) {
+        struct IrBlock* block = worklist[--worklist_length];
+        for (size_t i = 0; i < block->preds_length; i++) {
+            struct IrBlock* pred = block->preds[i];
+            if (pred->order < 0 || loop->contains[pred->id]) continue;
+
+            loop->contains[pred->id] = true;
+            worklist[worklist_length++] = pred;
+        }
+    }
+
+    loop->blocks = arena_alloc(fn->arena, sizeof(struct IrBlock*) * fn->rpo_length);
+    for (size_t i = 0; i < fn->rpo_length; i++) {
+        if (loop->contains[fn->rpo[i]->id]) loop->blocks[loop->blocks_length++] = fn->rpo[i];
+    }
+
+    return loop;
+}
+
+// finds the natural loops of `fn` and how they nest, computing dominators first
+void ir_find_loops(struct IrFunction* fn, struct IrLoops* loops) {
+    ir_compute_dominators(fn);
+
+    loops->loops = NULL;
+    loops->loops_length = 0;
+    loops->loops_capacity = 0;
+    loops->innermost = arena_calloc(fn->arena, sizeof(struct IrLoop*) * fn->block_count);
+
+    // a header dominates the headers of the loops nested in it, so it comes first in reverse postorder
+    for (size_t i = 0; i < fn->rpo_length; i++) {
+        struct IrBlock* block = fn->rpo[i];
+
+        bool header = false;
+        for (size_t j = 0; j < block->preds_length; j++) {
+            struct IrBlock* pred = block->preds[j];
+            header |= pred->order >= 0 && ir_dominates(block, pred);
+        }
+
+        if (header) add_loop(fn, loops, collect_loop(fn, block));
+    }
+
+    for (size_t i = 0; i < loops->loops_length; i++) {
+        struct IrLoop* loop = loops->loops[i];
+
+        // the innermost loop around this one is the last outer one holding its header
+        for (size_t j = i; j-- > 0;) {
+            if (!ir_loop_contains(loops->loops[j], loop->header)) continue;
+
+            loop->parent = loops->loops[j];
+            break;
+        }
+
+        loop->depth = loop->parent != NULL ? loop->parent->depth + 1 : 1;
+        for (size_t j = 0; j < loop->blocks_length; j++) {
+            loops->innermost[loop->blocks[j]->id] = loop;
+        }
+    }
+}
+
+// the one predecessor from outside of the loop when it ends in a jump to the header, NULL otherwise
+struct IrBlock* ir_loop_preheader(struct IrLoop* loop) {
+    struct IrBlock* preheader = NULL;
+    for (size_t i = 0; i < loop->header->preds_length; i++) {
+        struct IrBlock* pred = loop->header->preds[i];
+        if (ir_loop_contains(loop, pred)) continue;
+        if (preheader != NULL) return NULL;
+
+        preheader = pred;
+    }
+
+    return preheader != NULL && ir_terminator(preheader)->op == IR_JUMP ? preheader : NULL;
+}
+
+// the one predecessor from inside of the loop, NULL if there are several
+struct IrBlock* ir_loop_latch(struct IrLoop* loop) {
+    struct IrBlock* latch = NULL;
+    for (size_t i = 0; i < loop->header->preds_length; i++) {
+        struct IrBlock* pred = loop->header->preds[i];
+        if (!ir_loop_contains(loop, pred)) continue;
+        if (latch != NULL && latch != pred) return NULL;
+
+        latch = pred;
+    }
+
+    return latch;
+}
+
+// moves the edges into the header from inside of the loop (or from outside
+// of it) to a new block at `position` that jumps to the header; the phis of
+// the header get what the moved edges carried merged in the new block
+static struct IrBlock* split_header_edges(struct IrFunction* fn, struct IrLoop* loop, bool inside, size_t position) {
+    struct IrBlock* header = loop->header;
+    struct IrBlock* split = ir_new_block_at(fn, position);
+
+    size_t phis_length = 0;
+    while (phis_length < header->insts_length && header->insts[phis_length]->op == IR_PHI) phis_length++;
+
+    struct IrInst** merged = arena_alloc(fn->arena, sizeof(struct IrInst*) * (phis_length + 1));
+    for (size_t i = 0; i < phis_length; i++) {
+        struct IrInst* phi = header->insts[i];
+        struct IrInst* split_phi = ir_new_inst(fn, IR_PHI, phi->size);
+
+        bool same = true;
+        for (size_t j = 0; j < header->preds_length; j++) {
+            if (ir_loop_contains(loop, header->preds[j]) != inside) continue;
+
+            ir_add_operand(fn, split_phi, phi->operands[j]);
+            same &= phi->operands[j] == split_phi->operands[0];
+        }
+
+        if (!same) ir_append(fn, split, split_phi);
+        merged[i] = same ? split_phi->operands[0] : split_phi;
+    }
+
+    for (size_t j = 0; j < header->preds_length; j++) {
+        struct IrBlock* pred = header->preds[j];
+        if (ir_loop_contains(loop, pred) != inside) continue;
+
+        struct IrInst* term = ir_terminator(pred);
+        for (int k = 0; k < 2; k++) {
+            if (term->targets[k] == header) term->targets[k] = split;
+        }
+
+        ir_add_pred(fn, split, pred);
+    }
+
+    for (size_t j = header->preds_length; j-- > 0;) {
+        if (ir_loop_contains(loop, header->preds[j]) == inside) ir_remove_pred(header, j);
+    }
+
+    struct IrInst* jump = ir_new_inst(fn, IR_JUMP, 0);
+    jump->targets[0] = header;
+    ir_append(fn, split, jump);
+
+    ir_add_pred(fn, header, split);
+    for (size_t i = 0; i < phis_length; i++) {
+        ir_add_operand(fn, header->insts[i], merged[i]);
+    }
+
+    return split;
+}
+
+// gives the loop a preheader and a single latch where it lacks them, returns
+// whether blocks were added; dominators and loops have to be found again then
+bool ir_canonicalize_loop(struct IrFunction* fn, struct IrLoop* loop) {
+    bool changed = false;
+
+    if (ir_loop_preheader(loop) == NULL) {
+        split_header_edges(fn, loop, false, ir_block_position(fn, loop->header));
+        changed = true;
+    }
+
+    if (ir_loop_latch(loop) == NULL) {
+        // right after the last of the latches, at the bottom of the loop
+        size_t position = 0;
+        for (size_t i = 0; i < loop->header->preds_length; i++) {
+            struct IrBlock* pred = loop->header->preds[i];
+            if (!ir_loop_contains(loop, pred)) continue;
+
+            size_t after = ir_block_position(fn, pred) + 1;
+            if (after > position) position = after;
+        }
+
+        split_header_edges(fn, loop, true, position);
+        changed = true;
+    }
+
+    return changed;
+}
+
+// finds the loops of `fn` and canonicalizes them, returns whether blocks were added
+bool ir_canonicalize_loops(struct IrFunction* fn, struct IrLoops* loops) {
+    ir_find_loops(fn, loops);
+
+    bool changed = false;
+    for (size_t i = 0; i < loops->loops_length; i++) {
+        changed |= ir_canonicalize_loop(fn, loops->loops[i]);
+    }
+
+    if (changed) ir_find_loops(fn, loops);
+    return changed;
+}
+
+// Rotation
+
+// what the header computed, for each of its instructions: the value on entry
+// (from the guard), the one for the next iteration (from the latch), and the
+// phis merging both where the body now starts and where the loop is left
+struct Rotation {
+    struct IrFunction* fn;
+    struct IrBlock* header;
+    struct IrBlock* body;
+    struct IrBlock* exit;
+
+    struct IrInst** guard_values;
+    struct IrInst** latch_values;
+    struct IrInst** body_phis;
+    struct IrInst** exit_phis;
+
+    // phis at the start of `exit`, when the loop is left from the body too
+    struct IrInst** exit_merges;
+
+    struct IrBlock* new_body;
+    struct IrBlock* new_exit;
+};
+
+static size_t header_position(struct Rotation* r, struct IrInst* inst) {
+    size_t position = 0;
+    while (r->header->insts[position] != inst) position++;
+    return position;
+}
+
+// whether a header value used at the end of `use` has a phi to stand for it after rotation
+static bool can_rotate_use(struct Rotation* r, struct IrBlock* use) {
+    if (use->order < 0) return false;
+    if (use == r->header || ir_dominates(r->body, use)) return true;
+    if (!ir_dominates(r->exit, use)) return false;
+
+    // other ways out into the exit come from the body, which has the value in a phi
+    for (size_t i = 0; i < r->exit->preds_length; i++) {
+        struct IrBlock* pred = r->exit->preds[i];
+        if (pred != r->header && (pred->order < 0 || !ir_dominates(r->body, pred))) return false;
+    }
+
+    return true;
+}
+
+// what stands for the header `value` at the end of `use`, an old block or
+// one of the two new ones
+static struct IrInst* rotated_value(struct Rotation* r, struct IrInst* value, struct IrBlock* use) {
+    size_t position = header_position(r, value);
+    if (use == r->new_exit) return r->exit_phis[position];
+    if (use == r->new_body || ir_dominates(r->body, use)) return r->body_phis[position];
+    if (r->exit->preds_length == 1) return r->exit_phis[position];
+
+    if (r->exit_merges[position] == NULL) {
+        struct IrInst* merge = ir_new_inst(r->fn, IR_PHI, value->size);
+        for (size_t i = 0; i < r->exit->preds_length; i++) {
+            struct IrBlock* pred = r->exit->preds[i];
+            ir_add_operand(r->fn, merge, pred == r->new_exit ? r->exit_phis[position] : r->body_phis[position]);
+        }
+
+        ir_insert(r->fn, r->exit, 0, merge);
+        r->exit_merges[position] = merge;
+    }
+
+    return r->exit_merges[position];
+}
+
+// copies the instructions of the header to the end of `block`, reading
+// `values` for what the header computed, and branches to the new body or
+// exit on the copied condition
+static void copy_header(struct Rotation* r, struct IrBlock* block, struct IrInst** values) {
+    struct IrInst* branch = ir_terminator(r->header);
+
+    for (size_t i = 0; i + 1 < r->header->insts_length; i++) {
+        struct IrInst* inst = r->header->insts[i];
+        if (inst->op == IR_PHI) continue;
+
+        struct IrInst* copy = ir_new_inst(r->fn, inst->op, inst->size);
+        copy->imm = inst->imm;
+        copy->scale = inst->scale;
+        copy->cond = inst->cond;
+        copy->variable = inst->variable;
+        copy->symbol = inst->symbol;
+
+        for (size_t k = 0; k < inst->operands_length; k++) {
+            struct IrInst* operand = inst->operands[k];
+            ir_add_operand(r->fn, copy, operand->block == r->header ? values[header_position(r, operand)] : operand);
+        }
+
+        ir_append(r->fn, block, copy);
+        values[i] = copy;
+    }
+
+    struct IrInst* condition = branch->operands[0];
+    struct IrInst* copy = ir_new_inst(r->fn, IR_BRANCH, 0);
+    ir_add_operand(r->fn, copy, condition->block == r->header ? values[header_position(r, condition)] : condition);
+
+    for (int k = 0; k < 2; k++) {
+        copy->targets[k] = branch->targets[k] == r->body ? r->new_body : r->new_exit;
+        ir_add_pred(r->fn, copy->targets[k], block);
+    }
+
+    ir_append(r->fn, block, copy);
+}
+
+// rotates a canonical loop whose header decides whether to leave it, returns
+// whether it did; dominators must be those of the loop as it is
+static bool rotate_loop(struct IrFunction* fn, struct IrLoop* loop) {
+    struct IrBlock* header = loop->header;
+    struct IrBlock* preheader = ir_loop_preheader(loop);
+    struct IrBlock* latch = ir_loop_latch(loop);
+    struct IrInst* branch = ir_terminator(header);
+    if (preheader == NULL || latch == NULL || latch == header || branch->op != IR_BRANCH) return false;
+    if (ir_terminator(latch)->op != IR_JUMP) return false;
+
+    bool first_inside = ir_loop_contains(loop, branch->targets[0]);
+    if (first_inside == ir_loop_contains(loop, branch->targets[1])) return false;
+
+    struct Rotation r;
+    r.fn = fn;
+    r.header = header;
+    r.body = branch->targets[first_inside ? 0 : 1];
+    r.exit = branch->targets[first_inside ? 1 : 0];
+
+    size_t copied = 0;
+    for (size_t i = 0; i + 1 < header->insts_length; i++) {
+        struct IrInst* inst = header->insts[i];
+        if (inst->op == IR_CALL) return false;
+        if (inst->op != IR_PHI) copied += 1;
+    }
+
+    if (copied > ROTATE_HEADER_MAX) return false;
+
+    // every use of what the header computes must get a phi in its place
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        if (block == header) continue;
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                if (inst->operands[k]->block != header) continue;
+
+                struct IrBlock* use = inst->op == IR_PHI ? block->preds[k] : block;
+                if (!can_rotate_use(&r, use)) return false;
+            }
+        }
+    }
+
+    size_t length = header->insts_length;
+    r.guard_values = arena_calloc(fn->arena, sizeof(struct IrInst*) * length);
+    r.latch_values = arena_calloc(fn->arena, sizeof(struct IrInst*) * length);
+    r.body_phis = arena_calloc(fn->arena, sizeof(struct IrInst*) * length);
+    r.exit_phis = arena_calloc(fn->arena, sizeof(struct IrInst*) * length);
+    r.exit_merges = arena_calloc(fn->arena, sizeof(struct IrInst*) * length);
+
+    // the new body takes the place of the header, the exit goes right after the latch
+    size_t position = ir_block_position(fn, header);
+    memmove(&fn->blocks[position], &fn->blocks[position + 1], sizeof(struct IrBlock*) * (fn->blocks_length - position - 1));
+    fn->blocks_length -= 1;
+    r.new_body = ir_new_block_at(fn, position);
+    r.new_exit = ir_new_block_at(fn, ir_block_position(fn, latch) + 1);
+
+    for (size_t i = 0; i + 1 < length; i++) {
+        struct IrInst* inst = header->insts[i];
+        if (inst->size == 0) continue;
+
+        r.body_phis[i] = ir_new_inst(fn, IR_PHI, inst->size);
+        r.exit_phis[i] = ir_new_inst(fn, IR_PHI, inst->size);
+        ir_append(fn, r.new_body, r.body_phis[i]);
+        ir_append(fn, r.new_exit, r.exit_phis[i]);
+    }
+
+    // the header's phis on entry and at the end of the latch, where values of
+    // the current iteration come from the phis of the new body
+    for (size_t i = 0; i < length && header->insts[i]->op == IR_PHI; i++) {
+        struct IrInst* phi = header->insts[i];
+        struct IrInst* entry = phi->operands[ir_pred_index(header, preheader)];
+        struct IrInst* back = phi->operands[ir_pred_index(header, latch)];
+
+        r.guard_values[i] = entry;
+        r.latch_values[i] = back->block == header ? rotated_value(&r, back, latch) : back;
+    }
+
+    preheader->insts_length -= 1;
+    latch->insts_length -= 1;
+    copy_header(&r, preheader, r.guard_values);
+    copy_header(&r, latch, r.latch_values);
+
+    for (size_t i = 0; i + 1 < length; i++) {
+        if (r.body_phis[i] == NULL) continue;
+
+        ir_add_operand(fn, r.body_phis[i], r.guard_values[i]);
+        ir_add_operand(fn, r.body_phis[i], r.latch_values[i]);
+        ir_add_operand(fn, r.exit_phis[i], r.guard_values[i]);
+        ir_add_operand(fn, r.exit_phis[i], r.latch_values[i]);
+    }
+
+    struct IrBlock* targets[2] = { r.body, r.exit };
+    struct IrBlock* sources[2] = { r.new_body, r.new_exit };
+    for (int k = 0; k < 2; k++) {
+        struct IrInst* jump = ir_new_inst(fn, IR_JUMP, 0);
+        jump->targets[0] = targets[k];
+        ir_append(fn, sources[k], jump);
+        targets[k]->preds[ir_pred_index(targets[k], header)] = sources[k];
+    }
+
+    // the rest of the function reads the phis now, the copies read the right values already
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        if (block == r.new_body || block == r.new_exit) continue;
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                struct IrInst* operand = inst->operands[k];
+                if (operand->block != header) continue;
+
+                struct IrBlock* use = inst->op == IR_PHI ? block->preds[k] : block;
+                inst->operands[k] = rotated_value(&r, operand, use);
+            }
+        }
+    }
+
+    return true;
+}
+
+// rotates the loops that test at the top one at a time, finding them again
+// after each; the header of a rotated loop only jumps, so none is rotated twice
+static bool rotate_loops(struct IrFunction* fn) {
+    bool changed = false;
+
+    bool progress = true;
+    while (progress) {
+        progress = false;
+
+        struct IrLoops loops;
+        changed |= ir_canonicalize_loops(fn, &loops);
+
+        for (size_t i = 0; i < loops.loops_length && !progress; i++) {
+            progress = rotate_loop(fn, loops.loops[i]);
+        }
+
+        changed |= progress;
+    }
+
+    return changed;
+}
+
+const struct IrPass loop_rotate_pass = { "loop-rotate", rotate_loops };
+
+#endif
@@ -1,34 +1,92 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.c"
+#include "buffer.c"
+#include "symbol.c"
 #include "hir.c"
 #include "type.c"
+#include "fold.c"
+#include "frame.c"
+#include "mir.c"
+#include "elf.c"
+#include "encode.c"
+#include "regalloc.c"
+#include "peephole.c"
 #include "codegen.c"
+#include "ir.c"
+#include "ssa.c"
+#include "pass.c"
+#include "dce.c"
+#include "gvn.c"
+#include "inline.c"
+#include "tailrec.c"
+#include "loop.c"
+#include "licm.c"
+#include "iv.c"
+#include "idiom.c"
+#include "vectorize.c"
+#include "switch.c"
+#include "isel.c"
+#include "backend.c"
+#include "options.c"
 #include "util.c"
 
-int main() {
+int main(int argc, char** argv) {
+    struct Options options;
+    if (!parse_options(&options, argc, argv)) {
+        return 1;
+    }
+
+    const char* src = read_file(options.input);
+    if (src == NULL) {
+        fprintf(stderr, "cfcc: cannot read `%s`\n", options.input);
+        return 1;
+    }
+
+    FILE* output = stdout;
+    if (options.output != NULL) {
+        output = fopen(options.output, options.object ? "wb" : "w");
+        if (output == NULL) {
+            fprintf(stderr, "cfcc: cannot write `%s`\n", options.output);
+            return 1;
+        }
+    }
+
     struct Unit unit = {};
-	const char* src = read_file("test.c");
     lower_unit(&unit, src);
+    fold_unit(&unit);
 
     // Generation
     struct Context* ctx = malloc(sizeof(struct Context));
-    
-    ctx->allocator.argument_count = 4;
-    ctx->allocator.argument = malloc(sizeof(const char*) * ctx->allocator.argument_count);
-    ctx->allocator.argument[0] = "di";
-    ctx->allocator.argument[1] = "si";
-    ctx->allocator.argument[2] = "dx";
-    ctx->allocator.argument[3] = "cx";
-
-    ctx->allocator.scratch_count = 4;
-    ctx->allocator.scratch_state = calloc(ctx->allocator.scratch_count, sizeof(int));
-    ctx->allocator.scratch = malloc(sizeof(const char*) * ctx->allocator.scratch_count);
-    ctx->allocator.scratch[0] = "r8";
-    ctx->allocator.scratch[1] = "r9";
-    ctx->allocator.scratch[2] = "r10";
-    ctx->allocator.scratch[3] = "r11";
-
-    char* str = generate(&unit, ctx);
-    printf("%s\n", str);
+
+    // output is streamed in chunks as it is generated, object files are
+    // written once every function is in them
+    struct ObjectFile object;
+    init_object_file(&object);
+    ctx->object = options.object ? &object : NULL;
+
+    struct Buffer buffer;
+    init_buffer(&buffer, output);
+    generate(&unit, ctx, &options, &buffer);
+
+    int status = 0;
+    if (!options.object) {
+        buffer_flush(&buffer, output);
+    } else if (!write_object_file(&object, output)) {
+        fprintf(stderr, "cfcc: cannot write `%s`\n", options.output);
+        status = 1;
+    }
+
+    free_buffer(&buffer);
+
+    free_object_file(&object);
+
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    free(ctx);
+    free_unit(&unit);
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,696 @@
+#ifndef CFCC_MIR_C
+#define CFCC_MIR_C
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.c"
+#include "buffer.c"
+
+// Machine IR: x86-64 instructions in AT&T operand order (src, dst).
+// Codegen appends instructions over an unbounded set of virtual
+// registers, the register allocator rewrites them to physical ones,
+// the peephole optimizer tidies up what is left and the result is
+// printed as assembly or encoded into an object file.
+
+// physical registers, in hardware encoding order
+enum Register {
+    REG_RAX,
+    REG_RCX,
+    REG_RDX,
+    REG_RBX,
+    REG_RSP,
+    REG_RBP,
+    REG_RSI,
+    REG_RDI,
+    REG_R8,
+    REG_R9,
+    REG_R10,
+    REG_R11,
+    REG_R12,
+    REG_R13,
+    REG_R14,
+    REG_R15,
+
+    // vector registers, xmm or ymm by the width of the operand
+    REG_XMM0,
+    REG_XMM1,
+    REG_XMM2,
+    REG_XMM3,
+    REG_XMM4,
+    REG_XMM5,
+    REG_XMM6,
+    REG_XMM7,
+    REG_XMM8,
+    REG_XMM9,
+    REG_XMM10,
+    REG_XMM11,
+    REG_XMM12,
+    REG_XMM13,
+    REG_XMM14,
+    REG_XMM15,
+    REG_COUNT,
+};
+
+// register ids below REG_COUNT are physical, the rest are virtual
+#define REG_NONE (-1)
+#define IS_VREG(reg) ((reg) >= REG_COUNT)
+
+static const char* register_names_64[REG_COUNT] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+static const char* register_names_32[REG_COUNT] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+};
+
+static const char* register_names_8[REG_COUNT] = {
+    "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+};
+
+static const char* register_names_128[REG_COUNT - REG_XMM0] = {
+    "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+    "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+};
+
+static const char* register_names_256[REG_COUNT - REG_XMM0] = {
+    "ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7",
+    "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15",
+};
+
+// signed, then unsigned (below/above) orderings
+enum Condition {
+    COND_E,
+    COND_NE,
+    COND_L,
+    COND_G,
+    COND_LE,
+    COND_GE,
+    COND_B,
+    COND_A,
+    COND_BE,
+    COND_AE,
+};
+
+static const char* condition_names[] = {
+    "e", "ne", "l", "g", "le", "ge", "b", "a", "be", "ae",
+};
+
+enum Condition negate_condition(enum Condition cond) {
+    switch (cond) {
+        case COND_E:  return COND_NE;
+        case COND_NE: return COND_E;
+        case COND_L:  return COND_GE;
+        case COND_G:  return COND_LE;
+        case COND_LE: return COND_G;
+        case COND_GE: return COND_L;
+        case COND_B:  return COND_AE;
+        case COND_A:  return COND_BE;
+        case COND_BE: return COND_A;
+        case COND_AE: return COND_B;
+    }
+
+    return cond;
+}
+
+// condition that holds for swapped operands
+enum Condition swap_condition(enum Condition cond) {
+    switch (cond) {
+        case COND_L:  return COND_G;
+        case COND_G:  return COND_L;
+        case COND_LE: return COND_GE;
+        case COND_GE: return COND_LE;
+        case COND_B:  return COND_A;
+        case COND_A:  return COND_B;
+        case COND_BE: return COND_AE;
+        case COND_AE: return COND_BE;
+        default:      return cond;
+    }
+}
+
+enum MirOp {
+    MIR_LABEL,
+    MIR_COMMENT,
+
+    // data movement
+    MIR_MOV,
+    MIR_MOVZB,
+    MIR_MOVSX,
+    MIR_LEA,
+    MIR_PUSH,
+    MIR_POP,
+
+    // arithmetic, dst is read and written
+    MIR_ADD,
+    MIR_SUB,
+    MIR_IMUL,
+    MIR_NEG,
+    MIR_XOR,
+    MIR_SHL,
+    MIR_SHR,
+    MIR_SAR,
+
+    // signed division of edx:eax by dst, quotient in eax and remainder in edx
+    MIR_CLTD,
+    MIR_IDIV,
+
+    // ecx 32-bit elements from eax to rdi, or from rsi to rdi, leaving both
+    // pointers past the end and ecx at 0
+    MIR_REP_STOS,
+    MIR_REP_MOVS,
+
+    // flags, bt copies bit src of dst into the carry flag
+    MIR_CMP,
+    MIR_BT,
+    MIR_SETCC,
+
+    // control flow
+    MIR_JMP,
+    MIR_JCC,
+    MIR_JMP_TABLE,
+    MIR_CALL,
+    MIR_RET,
+
+    // a call in tail position, printed as a jump after the epilogue
+    MIR_TAIL_CALL,
+
+    // vectors of 32-bit lanes, 16 bytes wide in xmm or 32 bytes in ymm
+    // registers; broadcast copies a 32-bit register into every lane
+    MIR_VMOV,
+    MIR_VZERO,
+    MIR_VBROADCAST,
+    MIR_VADD,
+    MIR_VSUB,
+    MIR_VMUL,
+    MIR_VZEROUPPER,
+};
+
+enum MirOperandKind {
+    MOP_NONE,
+    MOP_REG,
+    MOP_IMM,
+    MOP_MEM,
+    MOP_LABEL,
+    MOP_SYMBOL,
+};
+
+struct MirMemory {
+    int base;
+    int index;
+    int scale;
+    int32_t disp;
+};
+
+struct MirOperand {
+    enum MirOperandKind kind;
+
+    // access width in bytes: 1, 4 or 8, and 16 or 32 for vectors
+    unsigned char size;
+
+    union {
+        int reg;
+        int64_t imm;
+        struct MirMemory mem;
+        size_t label;
+        const char* symbol;
+    };
+};
+
+struct MirInst {
+    enum MirOp op;
+    enum Condition cond;
+
+    struct MirOperand src;
+    struct MirOperand dst;
+
+    // calls: how many argument registers are passed,
+    // table jumps: which jump table of the function
+    int args;
+};
+
+// targets of an indirect jump, indexed by the register the jump reads
+struct MirJumpTable {
+    size_t label;
+    size_t* targets;
+    size_t targets_length;
+};
+
+struct MirFunction {
+    const char* name;
+    struct Arena* arena;
+
+    struct MirInst* insts;
+    size_t insts_length;
+    size_t insts_capacity;
+
+    // number of virtual registers handed out so far
+    int vreg_count;
+
+    // labels are local to the function, printed as .L<label_base + id>
+    // unless they carry a name
+    const char** label_names;
+    size_t label_count;
+    size_t label_capacity;
+    size_t label_base;
+
+    struct MirJumpTable* tables;
+    size_t tables_length;
+    size_t tables_capacity;
+
+    // physical argument registers, in order
+    const int* argument_registers;
+    int argument_count;
+
+    // filled by the register allocator: bytes below %rbp, and for each
+    // callee-saved register in use the frame offset it is saved at
+    size_t frame_size;
+    size_t saved_offsets[REG_COUNT];
+
+    // bytes at the bottom of the frame that calls pass their stack arguments in
+    size_t outgoing_size;
+
+    // vector instructions are printed in their VEX encoding, which AVX2 targets have
+    bool vex;
+
+    // leaf functions may keep their frame in the red zone below %rsp, and
+    // without the frame pointer the frame is addressed from %rsp instead
+    bool red_zone;
+    bool omit_frame_pointer;
+};
+
+void init_mir_function(struct MirFunction* mf, struct Arena* arena, const char* name, size_t label_base) {
+    memset(mf, 0, sizeof(struct MirFunction));
+    mf->arena = arena;
+    mf->name = name;
+    mf->label_base = label_base;
+}
+
+int new_vreg(struct MirFunction* mf) {
+    return REG_COUNT + mf->vreg_count++;
+}
+
+size_t new_label(struct MirFunction* mf, const char* name) {
+    if (mf->label_count == mf->label_capacity) {
+        size_t capacity = mf->label_capacity > 0 ? mf->label_capacity * 2 : 16;
+        mf->label_names = arena_grow(mf->arena, mf->label_names, sizeof(const char*) * mf->label_capacity, sizeof(const char*) * capacity);
+        mf->label_capacity = capacity;
+    }
+
+    mf->label_names[mf->label_count] = name;
+    return mf->label_count++;
+}
+
+// operand constructors
+struct MirOperand mop_none() {
+    struct MirOperand op;
+    memset(&op, 0, sizeof(op));
+    op.kind = MOP_NONE;
+    return op;
+}
+
+struct MirOperand mop_reg(int reg, int size) {
+    struct MirOperand op = mop_none();
+    op.kind = MOP_REG;
+    op.size = size;
+    op.reg = reg;
+    return op;
+}
+
+struct MirOperand mop_imm(int64_t imm, int size) {
+    struct MirOperand op = mop_none();
+    op.kind = MOP_IMM;
+    op.size = size;
+    op.imm = imm;
+    return op;
+}
+
+struct MirOperand mop_mem(int base, int index, int scale, int32_t disp, int size) {
+    struct MirOperand op = mop_none();
+    op.kind = MOP_MEM;
+    op.size = size;
+    op.mem.base = base;
+    op.mem.index = index;
+    op.mem.scale = scale;
+    op.mem.disp = disp;
+    return op;
+}
+
+struct MirOperand mop_label(size_t label) {
+    struct MirOperand op = mop_none();
+    op.kind = MOP_LABEL;
+    op.label = label;
+    return op;
+}
+
+struct MirOperand mop_symbol(const char* symbol) {
+    struct MirOperand op = mop_none();
+    op.kind = MOP_SYMBOL;
+    op.symbol = symbol;
+    return op;
+}
+
+// instruction constructors
+struct MirInst* append_inst(struct MirFunction* mf) {
+    if (mf->insts_length == mf->insts_capacity) {
+        size_t capacity = mf->insts_capacity > 0 ? mf->insts_capacity * 2 : 64;
+        mf->insts = arena_grow(mf->arena, mf->insts, sizeof(struct MirInst) * mf->insts_capacity, sizeof(struct MirInst) * capacity);
+        mf->insts_capacity = capacity;
+    }
+
+    struct MirInst* inst = &mf->insts[mf->insts_length++];
+    memset(inst, 0, sizeof(struct MirInst));
+    return inst;
+}
+
+void emit(struct MirFunction* mf, enum MirOp op, struct MirOperand src, struct MirOperand dst) {
+    struct MirInst* inst = append_inst(mf);
+    inst->op = op;
+    inst->src = src;
+    inst->dst = dst;
+}
+
+void emit_label(struct MirFunction* mf, size_t label) {
+    emit(mf, MIR_LABEL, mop_none(), mop_label(label));
+}
+
+void emit_jmp(struct MirFunction* mf, size_t label) {
+    emit(mf, MIR_JMP, mop_none(), mop_label(label));
+}
+
+void emit_jcc(struct MirFunction* mf, enum Condition cond, size_t label) {
+    struct MirInst* inst = append_inst(mf);
+    inst->op = MIR_JCC;
+    inst->cond = cond;
+    inst->dst = mop_label(label);
+}
+
+void emit_setcc(struct MirFunction* mf, enum Condition cond, int reg) {
+    struct MirInst* inst = append_inst(mf);
+    inst->op = MIR_SETCC;
+    inst->cond = cond;
+    inst->dst = mop_reg(reg, 1);
+}
+
+void emit_call(struct MirFunction* mf, const char* symbol, int args) {
+    struct MirInst* inst = append_inst(mf);
+    inst->op = MIR_CALL;
+    inst->dst = mop_symbol(symbol);
+    inst->args = args;
+}
+
+void emit_tail_call(struct MirFunction* mf, const char* symbol, int args) {
+    struct MirInst* inst = append_inst(mf);
+    inst->op = MIR_TAIL_CALL;
+    inst->dst = mop_symbol(symbol);
+    inst->args = args;
+}
+
+// jumps to `targets[index]`, where `index` is a 32-bit register known to be in range
+void emit_jump_table(struct MirFunction* mf, int index, size_t* targets, size_t targets_length) {
+    if (mf->tables_length == mf->tables_capacity) {
+        size_t capacity = mf->tables_capacity > 0 ? mf->tables_capacity * 2 : 4;
+        mf->tables = arena_grow(mf->arena, mf->tables, sizeof(struct MirJumpTable) * mf->tables_capacity, sizeof(struct MirJumpTable) * capacity);
+        mf->tables_capacity = capacity;
+    }
+
+    struct MirJumpTable* table = &mf->tables[mf->tables_length];
+    table->label = new_label(mf, NULL);
+    table->targets = targets;
+    table->targets_length = targets_length;
+
+    struct MirInst* inst = append_inst(mf);
+    inst->op = MIR_JMP_TABLE;
+    inst->dst = mop_reg(index, 4);
+    inst->args = mf->tables_length++;
+}
+
+void emit_comment(struct MirFunction* mf, const char* text) {
+    emit(mf, MIR_COMMENT, mop_none(), mop_symbol(text));
+}
+
+// printing
+static char size_suffix(int size) {
+    switch (size) {
+        case 1: return 'b';
+        case 8: return 'q';
+        default: return 'l';
+    }
+}
+
+static const char* register_name(int reg, int size) {
+    switch (size) {
+        case 16: return register_names_128[reg - REG_XMM0];
+        case 32: return register_names_256[reg - REG_XMM0];
+        case 1: return register_names_8[reg];
+        case 8: return register_names_64[reg];
+        default: return register_names_32[reg];
+    }
+}
+
+static void print_label(struct MirFunction* mf, size_t label, struct Buffer* buffer) {
+    if (mf->label_names[label] != NULL) {
+        buffer_append(buffer, mf->label_names[label]);
+    } else {
+        buffer_format(buffer, ".L%zu", mf->label_base + label);
+    }
+}
+
+static void print_operand(struct MirFunction* mf, struct MirOperand* op, struct Buffer* buffer) {
+    switch (op->kind) {
+        case MOP_NONE:
+            break;
+
+        case MOP_REG:
+            if (IS_VREG(op->reg)) {
+                buffer_format(buffer, "%%v%d", op->reg - REG_COUNT);
+            } else {
+                buffer_format(buffer, "%%%s", register_name(op->reg, op->size));
+            }
+            break;
+
+        case MOP_IMM:
+            buffer_format(buffer, "$%lld", (long long) op->imm);
+            break;
+
+        case MOP_MEM:
+            if (op->mem.disp != 0 || op->mem.base == REG_NONE) {
+                buffer_format(buffer, "%d", op->mem.disp);
+            }
+
+            buffer_append(buffer, "(");
+            if (op->mem.base != REG_NONE) {
+                struct MirOperand base = mop_reg(op->mem.base, 8);
+                print_operand(mf, &base, buffer);
+            }
+
+            if (op->mem.index != REG_NONE) {
+                struct MirOperand index = mop_reg(op->mem.index, 8);
+                buffer_append(buffer, ",");
+                print_operand(mf, &index, buffer);
+                buffer_format(buffer, ",%d", op->mem.scale);
+            }
+
+            buffer_append(buffer, ")");
+            break;
+
+        case MOP_LABEL:
+            print_label(mf, op->label, buffer);
+            break;
+
+        case MOP_SYMBOL:
+            buffer_append(buffer, op->symbol);
+            break;
+    }
+}
+
+static void print_operands(struct MirFunction* mf, struct MirInst* inst, struct Buffer* buffer) {
+    if (inst->src.kind != MOP_NONE) {
+        buffer_append(buffer, " ");
+        print_operand(mf, &inst->src, buffer);
+        buffer_append(buffer, ",");
+    }
+
+    buffer_append(buffer, " ");
+    print_operand(mf, &inst->dst, buffer);
+    buffer_append(buffer, "\n");
+}
+
+static const char* mir_mnemonics[] = {
+    [MIR_MOV]  = "mov",
+    [MIR_LEA]  = "lea",
+    [MIR_PUSH] = "push",
+    [MIR_POP]  = "pop",
+    [MIR_ADD]  = "add",
+    [MIR_SUB]  = "sub",
+    [MIR_IMUL] = "imul",
+    [MIR_NEG]  = "neg",
+    [MIR_XOR]  = "xor",
+    [MIR_SHL]  = "shl",
+    [MIR_SHR]  = "shr",
+    [MIR_SAR]  = "sar",
+    [MIR_IDIV] = "idiv",
+    [MIR_CMP]  = "cmp",
+    [MIR_BT]   = "bt",
+};
+
+void print_mir_inst(struct MirFunction* mf, struct MirInst* inst, struct Buffer* buffer) {
+    switch (inst->op) {
+        case MIR_LABEL:
+            print_label(mf, inst->dst.label, buffer);
+            buffer_append(buffer, ":\n");
+            break;
+
+        case MIR_COMMENT:
+            buffer_format(buffer, "\t# %s\n", inst->dst.symbol);
+            break;
+
+        case MIR_MOVZB:
+            buffer_append(buffer, "\tmovzbl");
+            print_operands(mf, inst, buffer);
+            break;
+
+        case MIR_MOVSX:
+            buffer_append(buffer, "\tmovslq");
+            print_operands(mf, inst, buffer);
+            break;
+
+        case MIR_SETCC:
+            buffer_format(buffer, "\tset%s", condition_names[inst->cond]);
+            print_operands(mf, inst, buffer);
+            break;
+
+        case MIR_JMP:
+            buffer_append(buffer, "\tjmp");
+            print_operands(mf, inst, buffer);
+            break;
+
+        case MIR_JCC:
+            buffer_format(buffer, "\tj%s", condition_names[inst->cond]);
+            print_operands(mf, inst, buffer);
+            break;
+
+        case MIR_JMP_TABLE: {
+            // entries are offsets from the table, the index was zero-extended
+            // by the 32-bit instruction that wrote it
+            struct MirJumpTable* table = &mf->tables[inst->args];
+            buffer_append(buffer, "\tleaq ");
+            print_label(mf, table->label, buffer);
+            buffer_append(buffer, "(%rip), %r11\n");
+            struct MirOperand index = mop_reg(inst->dst.reg, 8);
+            buffer_append(buffer, "\tmovslq (%r11,");
+            print_operand(mf, &index, buffer);
+            buffer_append(buffer, ",4), %r10\n");
+            buffer_append(buffer, "\taddq %r11, %r10\n");
+            buffer_append(buffer, "\tjmp *%r10\n");
+
+            buffer_append(buffer, "\t.p2align 2\n");
+            print_label(mf, table->label, buffer);
+            buffer_append(buffer, ":\n");
+            for (size_t i = 0; i < table->targets_length; i++) {
+                buffer_append(buffer, "\t.long ");
+                print_label(mf, table->targets[i], buffer);
+                buffer_append(buffer, "-");
+                print_label(mf, table->label, buffer);
+                buffer_append(buffer, "\n");
+            }
+            break;
+        }
+
+        case MIR_CALL:
+            buffer_append(buffer, "\tcall");
+            print_operands(mf, inst, buffer);
+            break;
+
+        case MIR_RET:
+            buffer_append(buffer, "\tretq\n");
+            break;
+
+        case MIR_TAIL_CALL:
+            buffer_append(buffer, "\tjmp");
+            print_operands(mf, inst, buffer);
+            break;
+
+        case MIR_CLTD:
+            buffer_append(buffer, "\tcltd\n");
+            break;
+
+        case MIR_REP_STOS:
+            buffer_append(buffer, "\trep stosl\n");
+            break;
+
+        case MIR_REP_MOVS:
+            buffer_append(buffer, "\trep movsl\n");
+            break;
+
+        case MIR_VMOV:
+            buffer_append(buffer, mf->vex ? "\tvmovdqu" : "\tmovdqu");
+            print_operands(mf, inst, buffer);
+            break;
+
+        // the VEX forms take a separate destination, which is the second source here
+        case MIR_VZERO:
+        case MIR_VADD:
+        case MIR_VSUB:
+        case MIR_VMUL: {
+            static const char* names[] = { [MIR_VZERO] = "pxor", [MIR_VADD] = "paddd", [MIR_VSUB] = "psubd", [MIR_VMUL] = "pmulld" };
+            struct MirOperand* src = inst->op == MIR_VZERO ? &inst->dst : &inst->src;
+            buffer_format(buffer, mf->vex ? "\tv%s " : "\t%s ", names[inst->op]);
+            print_operand(mf, src, buffer);
+            buffer_append(buffer, ", ");
+            if (mf->vex) {
+                print_operand(mf, &inst->dst, buffer);
+                buffer_append(buffer, ", ");
+            }
+            print_operand(mf, &inst->dst, buffer);
+            buffer_append(buffer, "\n");
+            break;
+        }
+
+        case MIR_VBROADCAST: {
+            // through the low lane of the destination itself
+            struct MirOperand low = mop_reg(inst->dst.reg, 16);
+            buffer_append(buffer, mf->vex ? "\tvmovd " : "\tmovd ");
+            print_operand(mf, &inst->src, buffer);
+            buffer_append(buffer, ", ");
+            print_operand(mf, &low, buffer);
+            buffer_append(buffer, mf->vex ? "\n\tvpbroadcastd " : "\n\tpshufd $0, ");
+            print_operand(mf, &low, buffer);
+            buffer_append(buffer, ", ");
+            print_operand(mf, &inst->dst, buffer);
+            buffer_append(buffer, "\n");
+            break;
+        }
+
+        case MIR_VZEROUPPER:
+            buffer_append(buffer, "\tvzeroupper\n");
+            break;
+
+        // the address of a symbol, relative to %rip like everything in position independent code
+        case MIR_LEA:
+            if (inst->src.kind == MOP_SYMBOL) {
+                buffer_format(buffer, "\tleaq %s(%%rip), ", inst->src.symbol);
+                print_operand(mf, &inst->dst, buffer);
+                buffer_append(buffer, "\n");
+                break;
+            }
+
+            // fallthrough
+        default:
+            buffer_format(buffer, "\t%s%c", mir_mnemonics[inst->op], size_suffix(inst->dst.size));
+            print_operands(mf, inst, buffer);
+            break;
+    }
+}
+
+void print_mir_function(struct MirFunction* mf, struct Buffer* buffer) {
+    for (size_t i = 0; i < mf->insts_length; i++) {
+        print_mir_inst(mf, &mf->insts[i], buffer);
+    }
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef CFCC_OPTIONS_C
+#define CFCC_OPTIONS_C
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Command line: cfcc [-O0|-O1|-O2] [-msse2|-mavx2] [-mno-red-zone] [-fomit-frame-pointer] [-c] [-o output] [--inline-threshold n] [--dump-ir] [--verify-ir] [--peephole-stats] [input]
+// -O0 generates code straight from the hir and is the quickest to compile,
+// -O1 and -O2 go through the SSA IR with increasingly expensive pipelines.
+// Every x86-64 has SSE2, the vectorizers of -O2 only use AVX2 when asked to.
+struct Options {
+    // source file, test.c when none is given
+    const char* input;
+
+    // assembly output, stdout when NULL
+    const char* output;
+
+    // write a relocatable object file to `output` instead of assembly
+    bool object;
+
+    int optimize;
+
+    // largest function body inlined into its callers, in IR instructions
+    int inline_threshold;
+
+    // widest vector registers of the target in bytes, 16 with SSE2 and 32 with AVX2
+    int vector_width;
+
+    // leaf functions keep small frames below %rsp without moving it,
+    // and frames can be addressed from %rsp to leave %rbp alone
+    bool red_zone;
+    bool omit_frame_pointer;
+
+    // dump the IR to stderr and verify it after every pass
+    bool dump_ir;
+    bool verify_ir;
+
+    // report how often every peephole rule fired to stderr
+    bool peephole_stats;
+};
+
+#define OPTIMIZE_MAX 2
+
+// inline thresholds of -O1 and -O2 unless --inline-threshold says otherwise
+#define INLINE_THRESHOLD_O1 16
+#define INLINE_THRESHOLD_O2 80
+
+static void print_usage(FILE* file) {
+    fprintf(file,
+        "usage: cfcc [options] [input]\n"
+        "  -O0            generate code directly, fastest to compile (default)\n"
+        "  -O1            optimize through the SSA IR with cheap passes\n"
+        "  -O2            run the full optimization pipeline\n"
+        "  -msse2         vectorize with 128-bit SSE2 instructions (default)\n"
+        "  -mavx2         vectorize with 256-bit AVX2 instructions\n"
+        "  -mno-red-zone  never keep data below the stack pointer\n"
+        "  -fomit-frame-pointer\n"
+        "                 address the frame from %%rsp, without setting up %%rbp\n"
+        "  -c             write an ELF object file, needs -o\n"
+        "  -o <file>      write assembly to <file> instead of stdout\n"
+        "  --inline-threshold <n>\n"
+        "                 inline functions of up to <n> IR instructions\n"
+        "  --dump-ir      print the IR after every pass to stderr\n"
+        "  --verify-ir    check the IR after every pass\n"
+        "  --peephole-stats\n"
+        "                 count the peephole rewrites of every rule\n"
+        "  -h, --help     show this message\n"
+    );
+}
+
+// reports invalid command lines and returns false, exits after printing help
+bool parse_options(struct Options* options, int argc, char** argv) {
+    options->input = NULL;
+    options->output = NULL;
+    options->object = false;
+    options->optimize = 0;
+    options->dump_ir = false;
+    options->verify_ir = false;
+    options->peephole_stats = false;
+    options->inline_threshold = -1;
+    options->vector_width = 16;
+    options->red_zone = true;
+    options->omit_frame_pointer = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_usage(stdout);
+            exit(0);
+        }
+
+        if (strncmp(arg, "-O", 2) == 0) {
+            // like gcc, a bare -O means -O1 and higher levels mean the highest one
+            const char* level = arg + 2;
+            if (*level == '\0') {
+                options->optimize = 1;
+            } else if (strspn(level, "0123456789") == strlen(level)) {
+                options->optimize = atoi(level) < OPTIMIZE_MAX ? atoi(level) : OPTIMIZE_MAX;
+            } else {
+                fprintf(stderr, "cfcc: unknown optimization level `%s`\n", arg);
+                return false;
+            }
+
+            continue;
+        }
+
+        if (strcmp(arg, "-msse2") == 0 || strcmp(arg, "-mavx2") == 0) {
+            options->vector_width = strcmp(arg, "-mavx2") == 0 ? 32 : 16;
+            continue;
+        }
+
+        if (strcmp(arg, "-mred-zone") == 0 || strcmp(arg, "-mno-red-zone") == 0) {
+            options->red_zone = strcmp(arg, "-mred-zone") == 0;
+            continue;
+        }
+
+        if (strcmp(arg, "-fomit-frame-pointer") == 0 || strcmp(arg, "-fno-omit-frame-pointer") == 0) {
+            options->omit_frame_pointer = strcmp(arg, "-fomit-frame-pointer") == 0;
+            continue;
+        }
+
+        if (strcmp(arg, "-c") == 0) {
+            options->object = true;
+            continue;
+        }
+
+        if (strcmp(arg, "-o") == 0) {
+            if (i + 1 == argc) {
+                fprintf(stderr, "cfcc: missing file name after `-o`\n");
+                return false;
+            }
+
+            options->output = argv[++i];
+            continue;
+        }
+
+        if (strcmp(arg, "--inline-threshold") == 0) {
+            if (i + 1 == argc || strspn(argv[i + 1], "0123456789") != strlen(argv[i + 1]) || argv[i + 1][0] == '\0') {
+                fprintf(stderr, "cfcc: `--inline-threshold` expects a number\n");
+                return false;
+            }
+
+            options->inline_threshold = atoi(argv[++i]);
+            continue;
+        }
+
+        if (strcmp(arg, "--dump-ir") == 0) {
+            options->dump_ir = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--verify-ir") == 0) {
+            options->verify_ir = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--peephole-stats") == 0) {
+            options->peephole_stats = true;
+            continue;
+        }
+
+        if (arg[0] == '-' && arg[1] != '\0') {
+            fprintf(stderr, "cfcc: unknown option `%s`\n", arg);
+            print_usage(stderr);
+            return false;
+        }
+
+        if (options->input != NULL) {
+            fprintf(stderr, "cfcc: more than one input file\n");
+            return false;
+        }
+
+        options->input = arg;
+    }
+
+    if (options->input == NULL) {
+        options->input = "test.c";
+    }
+
+    if (options->object && options->output == NULL) {
+        fprintf(stderr, "cfcc: `-c` needs an output file given with `-o`\n");
+        return false;
+    }
+
+    if (options->inline_threshold < 0) {
+        options->inline_threshold = options->optimize >= 2 ? INLINE_THRESHOLD_O2 : INLINE_THRESHOLD_O1;
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef CFCC_PASS_C
+#define CFCC_PASS_C
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "arena.c"
+#include "buffer.c"
+#include "ir.c"
+#include "symbol.c"
+
+// Pass manager: a pipeline of passes that each rewrite one function of the
+// IR in place and report whether they changed it. The IR can be checked by
+// the verifier and dumped after every pass, which is the first thing to turn
+// on when a pass misbehaves.
+struct IrPass {
+    const char* name;
+    bool (*run)(struct IrFunction* fn);
+};
+
+struct PassManager {
+    const struct IrPass** passes;
+    size_t passes_length;
+    size_t passes_capacity;
+    struct Arena arena;
+
+    // verify after every pass, and dump the IR to `dump` unless it is NULL
+    bool verify;
+    struct Buffer* dump;
+};
+
+void init_pass_manager(struct PassManager* pm) {
+    pm->passes = NULL;
+    pm->passes_length = 0;
+    pm->passes_capacity = 0;
+    init_arena(&pm->arena);
+
+    pm->verify = false;
+    pm->dump = NULL;
+}
+
+void free_pass_manager(struct PassManager* pm) {
+    free_arena(&pm->arena);
+}
+
+void add_pass(struct PassManager* pm, const struct IrPass* pass) {
+    if (pm->passes_length == pm->passes_capacity) {
+        size_t capacity = pm->passes_capacity > 0 ? pm->passes_capacity * 2 : 8;
+        pm->passes = arena_grow(&pm->arena, pm->passes, sizeof(struct IrPass*) * pm->passes_capacity, sizeof(struct IrPass*) * capacity);
+        pm->passes_capacity = capacity;
+    }
+
+    pm->passes[pm->passes_length++] = pass;
+}
+
+static void check_pass(struct PassManager* pm, struct IrFunction* fn, const char* name) {
+    if (pm->dump != NULL) {
+        buffer_format(pm->dump, "; after %s\n", name);
+        ir_dump_function(fn, pm->dump);
+    }
+
+    if (pm->verify && !ir_verify(fn, name)) {
+        fprintf(stderr, "ir verifier: `%s` left invalid IR behind\n", name);
+    }
+}
+
+// runs the pipeline over a freshly built function
+void run_passes(struct PassManager* pm, struct IrFunction* fn) {
+    check_pass(pm, fn, "ssa construction");
+
+    for (size_t i = 0; i < pm->passes_length; i++) {
+        const struct IrPass* pass = pm->passes[i];
+        if (pass->run(fn)) {
+            check_pass(pm, fn, pass->name);
+        }
+    }
+}
+
+// a function whose calls are being walked, and the next instruction to look at
+struct CallFrame {
+    struct IrFunction* fn;
+    size_t block;
+    size_t inst;
+};
+
+struct CallStack {
+    struct CallFrame* frames;
+    size_t length;
+    size_t capacity;
+};
+
+static void push_call_frame(struct PassManager* pm, struct CallStack* stack, struct IrFunction* fn, struct SymbolTable* visited) {
+    if (symbol_table_find(visited, (const char*) fn) != NULL) return;
+    symbol_table_set(visited, &pm->arena, (const char*) fn, fn);
+
+    if (stack->length == stack->capacity) {
+        size_t capacity = stack->capacity > 0 ? stack->capacity * 2 : 16;
+        stack->frames = arena_grow(&pm->arena, stack->frames, sizeof(struct CallFrame) * stack->capacity, sizeof(struct CallFrame) * capacity);
+        stack->capacity = capacity;
+    }
+
+    stack->frames[stack->length++] = (struct CallFrame) { fn, 0, 0 };
+}
+
+// depth-first over the call graph with an explicit stack, call chains can be
+// far deeper than the native one; a function runs once all its callees have
+static void run_passes_from(struct PassManager* pm, struct CallStack* stack, struct IrFunction* root, struct SymbolTable* visited) {
+    push_call_frame(pm, stack, root, visited);
+
+    while (stack->length > 0) {
+        struct CallFrame* frame = &stack->frames[stack->length - 1];
+        struct IrFunction* fn = frame->fn;
+
+        // the next call to a function that was not visited yet
+        struct IrFunction* callee = NULL;
+        while (callee == NULL && frame->block < fn->blocks_length) {
+            struct IrBlock* block = fn->blocks[frame->block];
+            if (frame->inst == block->insts_length) {
+                frame->block += 1;
+                frame->inst = 0;
+                continue;
+            }
+
+            struct IrInst* inst = block->insts[frame->inst++];
+            if (inst->op != IR_CALL) continue;
+
+            callee = ir_find_function(fn->module, inst->symbol);
+            if (callee != NULL && symbol_table_find(visited, (const char*) callee) != NULL) callee = NULL;
+        }
+
+        if (callee != NULL) {
+            push_call_frame(pm, stack, callee, visited);
+            continue;
+        }
+
+        stack->length -= 1;
+        run_passes(pm, fn);
+        fn->optimized = true;
+    }
+}
+
+// runs the pipeline over every function of the module, callees before their callers
+void run_module_passes(struct PassManager* pm, struct IrModule* module) {
+    struct SymbolTable visited;
+    init_symbol_table(&visited);
+
+    struct CallStack stack = { NULL, 0, 0 };
+    for (size_t i = 0; i < module->functions_length; i++) {
+        run_passes_from(pm, &stack, module->functions[i], &visited);
+    }
+}
+
+// Passes
+
+// removes phis whose operands are all the same value or the phi itself;
+// dropping one can make others trivial, so this repeats until nothing changes
+static bool simplify_phis(struct IrFunction* fn) {
+    bool changed = false;
+    bool progress = true;
+
+    while (progress) {
+        progress = false;
+
+        for (size_t i = 0; i < fn->blocks_length; i++) {
+            struct IrBlock* block = fn->blocks[i];
+            for (size_t j = 0; j < block->insts_length && block->insts[j]->op == IR_PHI; j++) {
+                struct IrInst* phi = block->insts[j];
+                if (phi->replacement != NULL) continue;
+
+                struct IrInst* same = NULL;
+                bool trivial = true;
+                for (size_t k = 0; k < phi->operands_length; k++) {
+                    struct IrInst* operand = ir_resolve(phi->operands[k]);
+                    if (operand == same || operand == phi) continue;
+                    if (same != NULL) {
+                        trivial = false;
+                        break;
+                    }
+
+                    same = operand;
+                }
+
+                if (!trivial) continue;
+
+                phi->replacement = same != NULL ? same : ir_undefined(fn, phi->size);
+                progress = true;
+                changed = true;
+            }
+        }
+    }
+
+    if (changed) ir_apply_replacements(fn);
+    return changed;
+}
+
+const struct IrPass simplify_phis_pass = { "simplify-phis", simplify_phis };
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef CFCC_PEEPHOLE_C
+#define CFCC_PEEPHOLE_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.c"
+#include "mir.c"
+#include "regalloc.c"
+
+// Peephole optimization over the finished MIR of a function, after register
+// allocation and the prologue, right before it is printed. Each rule of the
+// table looks at the instructions starting at one position and rewrites
+// them in place when they match; the rules run over the function until none
+// of them fires anymore, and every rule counts how often it did.
+//
+// Removed instructions are only marked while the rules run, so that label
+// positions stay valid, and are dropped from the function at the end of
+// every round.
+
+// stands for the flags in the liveness queries, next to the registers
+#define PEEPHOLE_FLAGS REG_COUNT
+
+struct Peephole {
+    struct MirFunction* mf;
+    bool* removed;
+
+    // instruction index of every label, SIZE_MAX for labels never emitted,
+    // and how many jumps go to it
+    size_t* label_positions;
+    size_t* label_refs;
+
+    // liveness queries follow every label once, those the current one has
+    // reached are marked with its number
+    size_t* label_visits;
+    size_t query;
+};
+
+struct PeepholeRule {
+    const char* name;
+    bool (*apply)(struct Peephole* p, size_t i);
+    size_t hits;
+};
+
+// index of the first instruction after `i` that is still there, insts_length at the end
+static size_t next_inst(struct Peephole* p, size_t i) {
+    do {
+        i++;
+    } while (i < p->mf->insts_length && p->removed[i]);
+    return i;
+}
+
+// the instruction at `i` if there is one and it has `op`
+static struct MirInst* inst_at(struct Peephole* p, size_t i, enum MirOp op) {
+    if (i >= p->mf->insts_length || p->mf->insts[i].op != op) return NULL;
+    return &p->mf->insts[i];
+}
+
+static bool same_operand(struct MirOperand* a, struct MirOperand* b) {
+    if (a->kind != b->kind || a->size != b->size) return false;
+
+    switch (a->kind) {
+        case MOP_REG: return a->reg == b->reg;
+        case MOP_IMM: return a->imm == b->imm;
+        case MOP_MEM: return a->mem.base == b->mem.base && a->mem.index == b->mem.index && a->mem.scale == b->mem.scale && a->mem.disp == b->mem.disp;
+        case MOP_LABEL: return a->label == b->label;
+        default: return false;
+    }
+}
+
+static bool mentions_register(struct MirOperand* op, int reg) {
+    if (op->kind == MOP_REG) return op->reg == reg;
+    if (op->kind == MOP_MEM) return op->mem.base == reg || op->mem.index == reg;
+    return false;
+}
+
+// 32-bit and wider writes to a register replace all of it, narrower ones keep the rest
+static bool is_full_write(struct MirInst* inst) {
+    return inst->dst.size >= 4 && inst->op != MIR_SETCC;
+}
+
+static bool reads_flags(struct MirInst* inst) {
+    return inst->op == MIR_JCC || inst->op == MIR_SETCC;
+}
+
+static bool writes_flags(struct MirInst* inst) {
+    switch (inst->op) {
+        case MIR_ADD:
+        case MIR_SUB:
+        case MIR_IMUL:
+        case MIR_NEG:
+        case MIR_XOR:
+        case MIR_SHL:
+        case MIR_SHR:
+        case MIR_SAR:
+        case MIR_IDIV:
+        case MIR_CMP:
+        case MIR_BT:
+        case MIR_CALL:
+        case MIR_TAIL_CALL:
+            return true;
+
+        // the printed sequence adds the table address to the entry
+        case MIR_JMP_TABLE:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool live_from(struct Peephole* p, size_t i, int reg);
+
+// whether `reg` (or PEEPHOLE_FLAGS) is read at the label before being written,
+// a label reached before is answered by the path that reached it first
+static bool live_at_label(struct Peephole* p, size_t label, int reg) {
+    if (p->label_positions[label] == SIZE_MAX) return true;
+    return live_from(p, p->label_positions[label], reg);
+}
+
+static bool live_from(struct Peephole* p, size_t i, int reg) {
+    struct MirFunction* mf = p->mf;
+
+    for (; i < mf->insts_length; i = next_inst(p, i)) {
+        if (p->removed[i]) continue;
+        struct MirInst* inst = &mf->insts[i];
+
+        if (reg == PEEPHOLE_FLAGS) {
+            if (reads_flags(inst)) return true;
+            if (writes_flags(inst) || inst->op == MIR_RET) return false;
+        } else {
+            if (inst->op == MIR_CALL || inst->op == MIR_TAIL_CALL) {
+                for (int k = 0; k < inst->args; k++) {
+                    if (mf->argument_registers[k] == reg) return true;
+                }
+
+                if (inst->op == MIR_TAIL_CALL || !callee_saved_registers[reg]) return false;
+                continue;
+            }
+
+            if (inst->op == MIR_RET) return reg == REG_RAX;
+            if (inst->op == MIR_JMP_TABLE) return true;
+
+            uint32_t uses;
+            uint32_t defs;
+            implicit_registers(inst, &uses, &defs);
+            if (uses & (1u << reg)) return true;
+
+            struct RegisterRef refs[4];
+            int n = inst_refs(inst, refs);
+            for (int k = 0; k < n; k++) {
+                if (*refs[k].reg == reg && (refs[k].access & ACCESS_USE)) return true;
+            }
+
+            if (defs & (1u << reg)) return false;
+            if (inst->dst.kind == MOP_REG && inst->dst.reg == reg && (dst_access(inst->op) & ACCESS_DEF) && is_full_write(inst)) return false;
+        }
+
+        if (inst->op == MIR_LABEL) {
+            if (p->label_visits[inst->dst.label] == p->query) return false;
+            p->label_visits[inst->dst.label] = p->query;
+        }
+
+        if (inst->op == MIR_JMP) return live_at_label(p, inst->dst.label, reg);
+        if (inst->op == MIR_JCC && live_at_label(p, inst->dst.label, reg)) return true;
+    }
+
+    return false;
+}
+
+// whether the value of `reg` (or PEEPHOLE_FLAGS) right before instruction
+// `i` is read on some path before it is overwritten
+static bool live_at(struct Peephole* p, size_t i, int reg) {
+    p->query += 1;
+    return live_from(p, i, reg);
+}
+
+// whatever follows a jump or return up to the next label something jumps to
+static bool unreachable_code(struct Peephole* p, size_t i) {
+    enum MirOp op = p->mf->insts[i].op;
+    if (op != MIR_JMP && op != MIR_JMP_TABLE && op != MIR_RET && op != MIR_TAIL_CALL) return false;
+
+    size_t j = next_inst(p, i);
+    if (j == p->mf->insts_length) return false;
+
+    struct MirInst* label = inst_at(p, j, MIR_LABEL);
+    if (label != NULL && p->label_refs[label->dst.label] > 0) return false;
+
+    p->removed[j] = true;
+    return true;
+}
+
+// jmp L right before L
+static bool jump_to_next(struct Peephole* p, size_t i) {
+    struct MirInst* jmp = inst_at(p, i, MIR_JMP);
+    if (jmp == NULL) return false;
+
+    for (size_t j = next_inst(p, i); inst_at(p, j, MIR_LABEL) != NULL; j = next_inst(p, j)) {
+        if (p->mf->insts[j].dst.label == jmp->dst.label) {
+            p->removed[i] = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// jcc L1; jmp L2; L1: becomes jncc L2; L1:
+static bool branch_over_jump(struct Peephole* p, size_t i) {
+    struct MirInst* jcc = inst_at(p, i, MIR_JCC);
+    if (jcc == NULL) return false;
+
+    size_t j = next_inst(p, i);
+    struct MirInst* jmp = inst_at(p, j, MIR_JMP);
+    if (jmp == NULL) return false;
+
+    for (size_t k = next_inst(p, j); inst_at(p, k, MIR_LABEL) != NULL; k = next_inst(p, k)) {
+        if (p->mf->insts[k].dst.label == jcc->dst.label) {
+            jcc->cond = negate_condition(jcc->cond);
+            jcc->dst = jmp->dst;
+            p->removed[j] = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// a store reloaded right away: the reload copies the stored register instead
+static bool store_reload(struct Peephole* p, size_t i) {
+    struct MirInst* store = inst_at(p, i, MIR_MOV);
+    if (store == NULL || store->src.kind != MOP_REG || store->dst.kind != MOP_MEM) return false;
+
+    size_t j = next_inst(p, i);
+    struct MirInst* load = inst_at(p, j, MIR_MOV);
+    if (load == NULL || load->dst.kind != MOP_REG || !same_operand(&load->src, &store->dst)) return false;
+
+    if (load->dst.reg == store->src.reg) {
+        p->removed[j] = true;
+    } else {
+        load->src = store->src;
+    }
+
+    return true;
+}
+
+// a register move that the next instruction overwrites without reading it
+static bool dead_move(struct Peephole* p, size_t i) {
+    struct MirInst* first = inst_at(p, i, MIR_MOV);
+    if (first == NULL || first->dst.kind != MOP_REG || IS_VREG(first->dst.reg) || first->dst.reg >= REG_XMM0) return false;
+
+    struct MirInst* second = inst_at(p, next_inst(p, i), MIR_MOV);
+    if (second == NULL || second->dst.kind != MOP_REG || second->dst.reg != first->dst.reg || !is_full_write(second)) return false;
+    if (mentions_register(&second->src, first->dst.reg)) return false;
+
+    p->removed[i] = true;
+    return true;
+}
+
+// mov $0, r becomes the shorter xor r, r where nothing reads the flags it sets
+static bool zero_idiom(struct Peephole* p, size_t i) {
+    struct MirInst* mov = inst_at(p, i, MIR_MOV);
+    if (mov == NULL || mov->src.kind != MOP_IMM || mov->src.imm != 0 || mov->dst.kind != MOP_REG || mov->dst.size < 4) return false;
+    if (live_at(p, next_inst(p, i), PEEPHOLE_FLAGS)) return false;
+
+    // 32-bit writes clear the upper half as well
+    mov->op = MIR_XOR;
+    mov->dst.size = 4;
+    mov->src = mov->dst;
+    return true;
+}
+
+// setcc r; movzbl r, r; cmp $0, r; je/jne L branches on the first flags
+// directly when nothing reads r or the flags of the compare afterwards
+static bool setcc_branch(struct Peephole* p, size_t i) {
+    struct MirInst* setcc = inst_at(p, i, MIR_SETCC);
+    if (setcc == NULL || setcc->dst.kind != MOP_REG) return false;
+
+    size_t j = next_inst(p, i);
+    struct MirInst* extend = inst_at(p, j, MIR_MOVZB);
+    if (extend == NULL || extend->src.kind != MOP_REG || extend->src.reg != setcc->dst.reg || extend->dst.kind != MOP_REG) return false;
+
+    size_t k = next_inst(p, j);
+    struct MirInst* cmp = inst_at(p, k, MIR_CMP);
+    if (cmp == NULL || cmp->src.kind != MOP_IMM || cmp->src.imm != 0 || cmp->dst.kind != MOP_REG || cmp->dst.reg != extend->dst.reg) return false;
+
+    size_t l = next_inst(p, k);
+    struct MirInst* jcc = inst_at(p, l, MIR_JCC);
+    if (jcc == NULL || (jcc->cond != COND_E && jcc->cond != COND_NE)) return false;
+
+    if (live_at(p, l, extend->dst.reg) || live_at(p, next_inst(p, l), PEEPHOLE_FLAGS)) return false;
+
+    jcc->cond = jcc->cond == COND_NE ? setcc->cond : negate_condition(setcc->cond);
+    p->removed[i] = true;
+    p->removed[j] = true;
+    p->removed[k] = true;
+    return true;
+}
+
+struct PeepholeRule peephole_rules[] = {
+    { "unreachable-code", unreachable_code },
+    { "jump-to-next",     jump_to_next },
+    { "branch-over-jump", branch_over_jump },
+    { "store-reload",     store_reload },
+    { "dead-move",        dead_move },
+    { "setcc-branch",     setcc_branch },
+    { "zero-idiom",       zero_idiom },
+};
+
+#define PEEPHOLE_RULES_COUNT (sizeof(peephole_rules) / sizeof(peephole_rules[0]))
+
+static void find_labels(struct Peephole* p) {
+    struct MirFunction* mf = p->mf;
+    for (size_t l = 0; l < mf->label_count; l++) {
+        p->label_positions[l] = SIZE_MAX;
+        p->label_refs[l] = 0;
+    }
+
+    for (size_t i = 0; i < mf->insts_length; i++) {
+        struct MirInst* inst = &mf->insts[i];
+        if (inst->op == MIR_LABEL) p->label_positions[inst->dst.label] = i;
+        if (inst->op == MIR_JMP || inst->op == MIR_JCC) p->label_refs[inst->dst.label] += 1;
+    }
+
+    for (size_t t = 0; t < mf->tables_length; t++) {
+        for (size_t k = 0; k < mf->tables[t].targets_length; k++) {
+            p->label_refs[mf->tables[t].targets[k]] += 1;
+        }
+    }
+}
+
+// drops the instructions marked as removed
+static void compact_insts(struct Peephole* p) {
+    struct MirFunction* mf = p->mf;
+    size_t length = 0;
+    for (size_t i = 0; i < mf->insts_length; i++) {
+        if (!p->removed[i]) mf->insts[length++] = mf->insts[i];
+    }
+
+    mf->insts_length = length;
+    memset(p->removed, 0, sizeof(bool) * length);
+}
+
+void peephole_function(struct MirFunction* mf) {
+    struct Peephole p;
+    p.mf = mf;
+    p.removed = arena_alloc(mf->arena, sizeof(bool) * mf->insts_length);
+    p.label_positions = arena_alloc(mf->arena, sizeof(size_t) * mf->label_count);
+    p.label_refs = arena_alloc(mf->arena, sizeof(size_t) * mf->label_count);
+    p.label_visits = arena_alloc(mf->arena, sizeof(size_t) * mf->label_count);
+    p.query = 0;
+    memset(p.label_visits, 0, sizeof(size_t) * mf->label_count);
+    memset(p.removed, 0, sizeof(bool) * mf->insts_length);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        find_labels(&p);
+
+        for (size_t i = 0; i < mf->insts_length; i++) {
+            if (p.removed[i]) continue;
+
+            for (size_t r = 0; r < PEEPHOLE_RULES_COUNT && !p.removed[i]; r++) {
+                if (peephole_rules[r].apply(&p, i)) {
+                    peephole_rules[r].hits += 1;
+                    changed = true;
+                }
+            }
+        }
+
+        compact_insts(&p);
+    }
+}
+
+void print_peephole_stats(FILE* file) {
+    for (size_t r = 0; r < PEEPHOLE_RULES_COUNT; r++) {
+        fprintf(file, "peephole: %-18s %zu\n", peephole_rules[r].name, peephole_rules[r].hits);
+    }
+}
+
+#endif
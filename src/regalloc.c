@@ -0,0 +1,862 @@
+#ifndef CFCC_REGALLOC_C
+#define CFCC_REGALLOC_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mir.c"
+
+// Register allocation over a MIR function:
+// 1. liveness of virtual registers over the control flow graph,
+// 2. one live interval per virtual register covering all its live points,
+// 3. linear scan over the allocatable registers, honouring physical
+//    registers that are pinned by calls and argument passing,
+// 4. rewriting operands, with spilled values kept in frame slots and
+//    accessed through the reserved r10/r11 when an operand needs a register.
+//
+// Positions: instruction i reads its operands at 2i and writes at 2i + 1.
+
+// caller-saved registers come first, they cost nothing unless live across a call
+static const int allocatable_registers[] = {
+    REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_R8, REG_R9,
+    REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+#define ALLOCATABLE_COUNT (sizeof(allocatable_registers) / sizeof(allocatable_registers[0]))
+
+// vector registers are all caller-saved, the last two are kept for spills
+static const int allocatable_vector_registers[] = {
+    REG_XMM0, REG_XMM1, REG_XMM2, REG_XMM3, REG_XMM4, REG_XMM5, REG_XMM6, REG_XMM7,
+    REG_XMM8, REG_XMM9, REG_XMM10, REG_XMM11, REG_XMM12, REG_XMM13,
+};
+
+#define ALLOCATABLE_VECTOR_COUNT (sizeof(allocatable_vector_registers) / sizeof(allocatable_vector_registers[0]))
+
+static const bool callee_saved_registers[REG_COUNT] = {
+    [REG_RBX] = true,
+    [REG_R12] = true,
+    [REG_R13] = true,
+    [REG_R14] = true,
+    [REG_R15] = true,
+};
+
+// spilled operands that must be in a register are staged through these
+#define SCRATCH_0 REG_R10
+#define SCRATCH_1 REG_R11
+#define VECTOR_SCRATCH_0 REG_XMM14
+#define VECTOR_SCRATCH_1 REG_XMM15
+
+#define ACCESS_USE 1
+#define ACCESS_DEF 2
+
+// register operands of an instruction, with how they are accessed
+struct RegisterRef {
+    int* reg;
+    int access;
+};
+
+static int dst_access(enum MirOp op) {
+    switch (op) {
+        case MIR_MOV:
+        case MIR_MOVZB:
+        case MIR_MOVSX:
+        case MIR_LEA:
+        case MIR_SETCC:
+        case MIR_POP:
+        case MIR_VMOV:
+        case MIR_VZERO:
+        case MIR_VBROADCAST:
+            return ACCESS_DEF;
+
+        case MIR_ADD:
+        case MIR_SUB:
+        case MIR_IMUL:
+        case MIR_NEG:
+        case MIR_XOR:
+        case MIR_SHL:
+        case MIR_SHR:
+        case MIR_SAR:
+        case MIR_VADD:
+        case MIR_VSUB:
+        case MIR_VMUL:
+            return ACCESS_USE | ACCESS_DEF;
+
+        default:
+            return ACCESS_USE;
+    }
+}
+
+static int operand_refs(struct MirOperand* op, int access, struct RegisterRef* refs) {
+    switch (op->kind) {
+        case MOP_REG:
+            refs[0].reg = &op->reg;
+            refs[0].access = access;
+            return 1;
+
+        case MOP_MEM: {
+            int count = 0;
+            if (op->mem.base != REG_NONE) {
+                refs[count].reg = &op->mem.base;
+                refs[count++].access = ACCESS_USE;
+            }
+
+            if (op->mem.index != REG_NONE) {
+                refs[count].reg = &op->mem.index;
+                refs[count++].access = ACCESS_USE;
+            }
+
+            return count;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+// physical registers an instruction reads or writes without naming them
+static void implicit_registers(struct MirInst* inst, uint32_t* uses, uint32_t* defs) {
+    switch (inst->op) {
+        case MIR_CLTD:
+            *uses = 1u << REG_RAX;
+            *defs = 1u << REG_RDX;
+            break;
+
+        case MIR_IDIV:
+            *uses = 1u << REG_RAX | 1u << REG_RDX;
+            *defs = 1u << REG_RAX | 1u << REG_RDX;
+            break;
+
+        case MIR_REP_STOS:
+            *uses = 1u << REG_RAX | 1u << REG_RCX | 1u << REG_RDI;
+            *defs = 1u << REG_RCX | 1u << REG_RDI;
+            break;
+
+        case MIR_REP_MOVS:
+            *uses = 1u << REG_RSI | 1u << REG_RCX | 1u << REG_RDI;
+            *defs = 1u << REG_RSI | 1u << REG_RCX | 1u << REG_RDI;
+            break;
+
+        default:
+            *uses = 0;
+            *defs = 0;
+            break;
+    }
+}
+
+// fills `refs` (at most 4 entries), returns how many there are
+static int inst_refs(struct MirInst* inst, struct RegisterRef* refs) {
+    int count = operand_refs(&inst->src, ACCESS_USE, refs);
+    return count + operand_refs(&inst->dst, dst_access(inst->op), &refs[count]);
+}
+
+// liveness
+struct LiveBlock {
+    size_t first;
+    size_t last;
+
+    // block indices, a table jump has one per entry
+    int* successors;
+    size_t successors_length;
+
+    int* predecessors;
+    size_t predecessors_length;
+};
+
+static bool ends_block(struct MirInst* inst) {
+    return inst->op == MIR_JMP || inst->op == MIR_JCC || inst->op == MIR_JMP_TABLE || inst->op == MIR_RET || inst->op == MIR_TAIL_CALL;
+}
+
+// splits the function into basic blocks, returns how many there are
+static size_t build_live_blocks(struct MirFunction* mf, struct LiveBlock** out) {
+    struct LiveBlock* blocks = arena_alloc(mf->arena, sizeof(struct LiveBlock) * (mf->insts_length + 1));
+    int* label_blocks = arena_alloc(mf->arena, sizeof(int) * (mf->label_count + 1));
+
+    size_t count = 0;
+    for (size_t i = 0; i < mf->insts_length; i++) {
+        struct MirInst* inst = &mf->insts[i];
+        bool starts = i == 0 || inst->op == MIR_LABEL || ends_block(&mf->insts[i - 1]);
+        if (starts) {
+            if (count > 0) blocks[count - 1].last = i - 1;
+            blocks[count].first = i;
+            count += 1;
+        }
+
+        if (inst->op == MIR_LABEL) {
+            label_blocks[inst->dst.label] = count - 1;
+        }
+    }
+
+    if (count > 0) blocks[count - 1].last = mf->insts_length - 1;
+
+    for (size_t b = 0; b < count; b++) {
+        struct LiveBlock* block = &blocks[b];
+        struct MirInst* last = &mf->insts[block->last];
+        bool fallthrough = b + 1 < count;
+
+        block->successors = arena_alloc(mf->arena, sizeof(int) * 2);
+        block->successors_length = 0;
+
+        switch (last->op) {
+            case MIR_JMP:
+                block->successors[block->successors_length++] = label_blocks[last->dst.label];
+                break;
+
+            case MIR_JCC:
+                block->successors[block->successors_length++] = label_blocks[last->dst.label];
+                if (fallthrough) block->successors[block->successors_length++] = b + 1;
+                break;
+
+            case MIR_JMP_TABLE: {
+                struct MirJumpTable* table = &mf->tables[last->args];
+                block->successors = arena_alloc(mf->arena, sizeof(int) * table->targets_length);
+                for (size_t i = 0; i < table->targets_length; i++) {
+                    block->successors[block->successors_length++] = label_blocks[table->targets[i]];
+                }
+                break;
+            }
+
+            case MIR_RET:
+            case MIR_TAIL_CALL:
+                break;
+
+            default:
+                if (fallthrough) block->successors[block->successors_length++] = b + 1;
+                break;
+        }
+    }
+
+    // predecessors, counted first so each block gets one exact array
+    for (size_t b = 0; b < count; b++) {
+        blocks[b].predecessors_length = 0;
+    }
+
+    for (size_t b = 0; b < count; b++) {
+        for (size_t s = 0; s < blocks[b].successors_length; s++) {
+            blocks[blocks[b].successors[s]].predecessors_length += 1;
+        }
+    }
+
+    for (size_t b = 0; b < count; b++) {
+        blocks[b].predecessors = arena_alloc(mf->arena, sizeof(int) * (blocks[b].predecessors_length + 1));
+        blocks[b].predecessors_length = 0;
+    }
+
+    for (size_t b = 0; b < count; b++) {
+        for (size_t s = 0; s < blocks[b].successors_length; s++) {
+            struct LiveBlock* successor = &blocks[blocks[b].successors[s]];
+            successor->predecessors[successor->predecessors_length++] = b;
+        }
+    }
+
+    *out = blocks;
+    return count;
+}
+
+// a block that writes a virtual register, or reads it before writing it
+struct BlockRef {
+    int vreg;
+    int block;
+    bool def;
+};
+
+struct BlockRefs {
+    struct BlockRef* refs;
+    size_t length;
+    size_t capacity;
+};
+
+static void block_ref_push(struct Arena* arena, struct BlockRefs* list, int vreg, int block, bool def) {
+    if (list->length == list->capacity) {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+        list->refs = arena_grow(arena, list->refs, sizeof(struct BlockRef) * list->capacity, sizeof(struct BlockRef) * capacity);
+        list->capacity = capacity;
+    }
+
+    list->refs[list->length].vreg = vreg;
+    list->refs[list->length].block = block;
+    list->refs[list->length].def = def;
+    list->length += 1;
+}
+
+static void extend_range(int* starts, int* ends, int v, int position) {
+    if (position < starts[v]) starts[v] = position;
+    if (position > ends[v]) ends[v] = position;
+}
+
+// widens each register's range over the blocks it is live through: every
+// read that comes before a write in its block walks the predecessors back
+// to the blocks that write the register. Nothing is kept per block and
+// register, so memory grows with blocks + registers, not their product
+static void compute_liveness(struct MirFunction* mf, struct LiveBlock* blocks, size_t count, int* starts, int* ends) {
+    size_t vreg_count = mf->vreg_count;
+
+    // block stamps, a register is written or read before written in that block
+    int* def_block = arena_alloc(mf->arena, sizeof(int) * (vreg_count + 1));
+    int* use_block = arena_alloc(mf->arena, sizeof(int) * (vreg_count + 1));
+    for (size_t v = 0; v < vreg_count; v++) {
+        def_block[v] = -1;
+        use_block[v] = -1;
+    }
+
+    struct BlockRefs list = { NULL, 0, 0 };
+    for (size_t b = 0; b < count; b++) {
+        struct LiveBlock* block = &blocks[b];
+        for (size_t i = block->first; i <= block->last; i++) {
+            struct RegisterRef refs[4];
+            int n = inst_refs(&mf->insts[i], refs);
+
+            // uses are read before the instruction writes anything
+            for (int k = 0; k < n; k++) {
+                int reg = *refs[k].reg;
+                if (!IS_VREG(reg) || !(refs[k].access & ACCESS_USE)) continue;
+
+                int v = reg - REG_COUNT;
+                if (def_block[v] == (int) b || use_block[v] == (int) b) continue;
+                use_block[v] = b;
+                block_ref_push(mf->arena, &list, v, b, false);
+            }
+
+            for (int k = 0; k < n; k++) {
+                int reg = *refs[k].reg;
+                if (!IS_VREG(reg) || !(refs[k].access & ACCESS_DEF)) continue;
+
+                int v = reg - REG_COUNT;
+                if (def_block[v] == (int) b) continue;
+                def_block[v] = b;
+                block_ref_push(mf->arena, &list, v, b, true);
+            }
+        }
+    }
+
+    // group the references by register
+    size_t* offsets = arena_calloc(mf->arena, sizeof(size_t) * (vreg_count + 1));
+    for (size_t i = 0; i < list.length; i++) {
+        offsets[list.refs[i].vreg + 1] += 1;
+    }
+
+    for (size_t v = 0; v < vreg_count; v++) {
+        offsets[v + 1] += offsets[v];
+    }
+
+    struct BlockRef* grouped = arena_alloc(mf->arena, sizeof(struct BlockRef) * (list.length + 1));
+    for (size_t i = 0; i < list.length; i++) {
+        grouped[offsets[list.refs[i].vreg]++] = list.refs[i];
+    }
+
+    // the fill moved every offset to the end of its group
+    for (size_t v = vreg_count; v > 0; v--) {
+        offsets[v] = offsets[v - 1];
+    }
+    offsets[0] = 0;
+
+    // per register, blocks that write it and blocks it is live into
+    int* writes = arena_alloc(mf->arena, sizeof(int) * (count + 1));
+    int* live_in = arena_alloc(mf->arena, sizeof(int) * (count + 1));
+    int* worklist = arena_alloc(mf->arena, sizeof(int) * (count + 1));
+    for (size_t b = 0; b < count; b++) {
+        writes[b] = -1;
+        live_in[b] = -1;
+    }
+
+    for (size_t v = 0; v < vreg_count; v++) {
+        size_t first = offsets[v];
+        size_t last = offsets[v + 1];
+
+        for (size_t i = first; i < last; i++) {
+            if (grouped[i].def) writes[grouped[i].block] = v;
+        }
+
+        size_t pending = 0;
+        for (size_t i = first; i < last; i++) {
+            if (grouped[i].def || live_in[grouped[i].block] == (int) v) continue;
+            live_in[grouped[i].block] = v;
+            worklist[pending++] = grouped[i].block;
+        }
+
+        // live-in reaches back to the block start, and on to the end of every predecessor
+        while (pending > 0) {
+            struct LiveBlock* block = &blocks[worklist[--pending]];
+            extend_range(starts, ends, v, 2 * block->first);
+
+            for (size_t p = 0; p < block->predecessors_length; p++) {
+                int pred = block->predecessors[p];
+                extend_range(starts, ends, v, 2 * blocks[pred].last + 1);
+                if (writes[pred] == (int) v || live_in[pred] == (int) v) continue;
+
+                live_in[pred] = v;
+                worklist[pending++] = pred;
+            }
+        }
+    }
+}
+
+// physical register reservations, sorted by start
+struct FixedRange {
+    int start;
+    int end;
+};
+
+struct FixedRanges {
+    struct FixedRange* ranges;
+    size_t length;
+    size_t capacity;
+    bool open;
+};
+
+static void fixed_range_push(struct Arena* arena, struct FixedRanges* fixed, int start, int end) {
+    if (fixed->length == fixed->capacity) {
+        size_t capacity = fixed->capacity > 0 ? fixed->capacity * 2 : 8;
+        fixed->ranges = arena_grow(arena, fixed->ranges, sizeof(struct FixedRange) * fixed->capacity, sizeof(struct FixedRange) * capacity);
+        fixed->capacity = capacity;
+    }
+
+    fixed->ranges[fixed->length].start = start;
+    fixed->ranges[fixed->length].end = end;
+    fixed->length += 1;
+}
+
+static void fixed_use(struct Arena* arena, struct FixedRanges* fixed, int position) {
+    if (fixed->open && fixed->length > 0) {
+        fixed->ranges[fixed->length - 1].end = position;
+    } else {
+        // used without a prior definition: live since function entry
+        fixed_range_push(arena, fixed, -1, position);
+        fixed->open = true;
+    }
+}
+
+static void fixed_def(struct Arena* arena, struct FixedRanges* fixed, int position) {
+    fixed_range_push(arena, fixed, position, position);
+    fixed->open = true;
+}
+
+static void collect_fixed_ranges(struct MirFunction* mf, struct FixedRanges* fixed) {
+    for (size_t i = 0; i < mf->insts_length; i++) {
+        struct MirInst* inst = &mf->insts[i];
+
+        if (inst->op == MIR_CALL || inst->op == MIR_TAIL_CALL) {
+            for (int k = 0; k < inst->args; k++) {
+                fixed_use(mf->arena, &fixed[mf->argument_registers[k]], 2 * i);
+            }
+
+            for (int r = 0; r < REG_COUNT; r++) {
+                if (!callee_saved_registers[r]) fixed_def(mf->arena, &fixed[r], 2 * i + 1);
+            }
+
+            continue;
+        }
+
+        uint32_t implicit_uses;
+        uint32_t implicit_defs;
+        implicit_registers(inst, &implicit_uses, &implicit_defs);
+
+        struct RegisterRef refs[4];
+        int n = inst_refs(inst, refs);
+        for (int k = 0; k < n; k++) {
+            int reg = *refs[k].reg;
+            if (!IS_VREG(reg) && (refs[k].access & ACCESS_USE)) implicit_uses |= 1u << reg;
+        }
+
+        for (int k = 0; k < n; k++) {
+            int reg = *refs[k].reg;
+            if (!IS_VREG(reg) && (refs[k].access & ACCESS_DEF)) implicit_defs |= 1u << reg;
+        }
+
+        for (int r = 0; r < REG_COUNT; r++) {
+            if (implicit_uses & (1u << r)) fixed_use(mf->arena, &fixed[r], 2 * i);
+        }
+
+        for (int r = 0; r < REG_COUNT; r++) {
+            if (implicit_defs & (1u << r)) fixed_def(mf->arena, &fixed[r], 2 * i + 1);
+        }
+    }
+}
+
+static bool fixed_conflicts(struct FixedRanges* fixed, int start, int end) {
+    // first range that ends at or after `start`
+    size_t low = 0;
+    size_t high = fixed->length;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (fixed->ranges[mid].end < start) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    // ranges are sorted by start but may nest, so scan the ones that can still overlap
+    for (size_t i = low; i < fixed->length && fixed->ranges[i].start <= end; i++) {
+        if (fixed->ranges[i].end >= start) return true;
+    }
+
+    return false;
+}
+
+// linear scan
+struct Interval {
+    int vreg;
+    int start;
+    int end;
+};
+
+static int compare_interval_start(const void* a, const void* b) {
+    const struct Interval* x = a;
+    const struct Interval* y = b;
+    if (x->start != y->start) return x->start < y->start ? -1 : 1;
+    return x->vreg - y->vreg;
+}
+
+struct Allocation {
+    // vreg index -> physical register, REG_NONE when spilled
+    int* location;
+
+    // vreg index -> width of the vector it holds, 0 for the general purpose ones
+    unsigned char* vector_size;
+
+    // vreg index -> frame offset below %rbp of its spill slot
+    int32_t* spill_offset;
+
+    size_t frame_size;
+};
+
+static bool register_available(int reg, struct Interval* interval, int* active_owner, struct FixedRanges* fixed) {
+    return active_owner[reg] < 0 && !fixed_conflicts(&fixed[reg], interval->start, interval->end);
+}
+
+static void linear_scan(struct MirFunction* mf, struct Interval* intervals, size_t count, int* hints, struct FixedRanges* fixed, struct Allocation* alloc) {
+    // active intervals of both register classes, kept sorted by increasing end
+    struct Interval** active = arena_alloc(mf->arena, sizeof(struct Interval*) * (ALLOCATABLE_COUNT + ALLOCATABLE_VECTOR_COUNT + 1));
+    size_t active_length = 0;
+
+    int active_owner[REG_COUNT];
+    for (int r = 0; r < REG_COUNT; r++) active_owner[r] = -1;
+
+    for (size_t i = 0; i < count; i++) {
+        struct Interval* current = &intervals[i];
+
+        // expire intervals that ended before this one starts
+        size_t kept = 0;
+        for (size_t a = 0; a < active_length; a++) {
+            if (active[a]->end < current->start) {
+                active_owner[alloc->location[active[a]->vreg]] = -1;
+            } else {
+                active[kept++] = active[a];
+            }
+        }
+        active_length = kept;
+
+        int chosen = REG_NONE;
+        bool vector = alloc->vector_size[current->vreg] != 0;
+        const int* registers = vector ? allocatable_vector_registers : allocatable_registers;
+        size_t registers_length = vector ? ALLOCATABLE_VECTOR_COUNT : ALLOCATABLE_COUNT;
+
+        // prefer the register of the value this one is copied from
+        int hint = hints[current->vreg];
+        if (hint >= 0 && alloc->location[hint] != REG_NONE && register_available(alloc->location[hint], current, active_owner, fixed)) {
+            chosen = alloc->location[hint];
+        }
+
+        for (size_t r = 0; chosen == REG_NONE && r < registers_length; r++) {
+            if (register_available(registers[r], current, active_owner, fixed)) {
+                chosen = registers[r];
+            }
+        }
+
+        if (chosen == REG_NONE) {
+            // spill whichever usable interval of the same class lives longest
+            struct Interval* victim = NULL;
+            for (size_t a = active_length; a-- > 0;) {
+                int reg = alloc->location[active[a]->vreg];
+                if ((alloc->vector_size[active[a]->vreg] != 0) != vector) continue;
+                if (!fixed_conflicts(&fixed[reg], current->start, current->end)) {
+                    victim = active[a];
+                    break;
+                }
+            }
+
+            if (victim == NULL || victim->end <= current->end) {
+                alloc->location[current->vreg] = REG_NONE;
+                continue;
+            }
+
+            chosen = alloc->location[victim->vreg];
+            alloc->location[victim->vreg] = REG_NONE;
+            active_owner[chosen] = -1;
+
+            size_t kept = 0;
+            for (size_t a = 0; a < active_length; a++) {
+                if (active[a] != victim) active[kept++] = active[a];
+            }
+            active_length = kept;
+        }
+
+        alloc->location[current->vreg] = chosen;
+        active_owner[chosen] = current->vreg;
+
+        size_t position = active_length;
+        while (position > 0 && active[position - 1]->end > current->end) {
+            active[position] = active[position - 1];
+            position -= 1;
+        }
+
+        active[position] = current;
+        active_length += 1;
+    }
+}
+
+// rewriting
+static bool spilled(struct Allocation* alloc, int reg) {
+    return IS_VREG(reg) && alloc->location[reg - REG_COUNT] == REG_NONE;
+}
+
+static struct MirOperand spill_slot(struct Allocation* alloc, int reg, int size) {
+    return mop_mem(REG_RBP, REG_NONE, 1, -alloc->spill_offset[reg - REG_COUNT], size);
+}
+
+static int physical(struct Allocation* alloc, int reg) {
+    return IS_VREG(reg) ? alloc->location[reg - REG_COUNT] : reg;
+}
+
+// whether the operand at `dst` may be a memory reference
+static bool memory_allowed(enum MirOp op, bool dst) {
+    switch (op) {
+        case MIR_MOV:
+        case MIR_ADD:
+        case MIR_SUB:
+        case MIR_NEG:
+        case MIR_XOR:
+        case MIR_SHL:
+        case MIR_SHR:
+        case MIR_SAR:
+        case MIR_IDIV:
+        case MIR_CMP:
+        case MIR_SETCC:
+        case MIR_PUSH:
+        case MIR_POP:
+            return true;
+
+        case MIR_IMUL:
+        case MIR_MOVZB:
+        case MIR_MOVSX:
+        case MIR_LEA:
+            return !dst;
+
+        // spill slots are not aligned for the legacy SSE forms, only moves take them
+        case MIR_VMOV:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static void rewrite_inst(struct MirFunction* mf, struct MirInst inst, struct Allocation* alloc) {
+    int scratch_used = 0;
+    int scratch[2] = { SCRATCH_0, SCRATCH_1 };
+    int vector_scratch_used = 0;
+    int vector_scratch[2] = { VECTOR_SCRATCH_0, VECTOR_SCRATCH_1 };
+
+    // memory operands: spilled base/index registers are loaded first
+    struct MirOperand* operands[2] = { &inst.src, &inst.dst };
+    for (int o = 0; o < 2; o++) {
+        struct MirOperand* op = operands[o];
+        if (op->kind != MOP_MEM) continue;
+
+        bool base_spilled = spilled(alloc, op->mem.base);
+        bool index_spilled = op->mem.index != REG_NONE && spilled(alloc, op->mem.index);
+
+        if (base_spilled && index_spilled) {
+            // fold the address into one scratch register so the other stays free
+            emit(mf, MIR_MOV, spill_slot(alloc, op->mem.base, 8), mop_reg(scratch[0], 8));
+            emit(mf, MIR_MOV, spill_slot(alloc, op->mem.index, 8), mop_reg(scratch[1], 8));
+            emit(mf, MIR_LEA, mop_mem(scratch[0], scratch[1], op->mem.scale, 0, 8), mop_reg(scratch[0], 8));
+            op->mem.base = scratch[0];
+            op->mem.index = REG_NONE;
+            scratch_used = 1;
+            continue;
+        }
+
+        if (base_spilled) {
+            emit(mf, MIR_MOV, spill_slot(alloc, op->mem.base, 8), mop_reg(scratch[scratch_used], 8));
+            op->mem.base = scratch[scratch_used++];
+        } else if (op->mem.base != REG_NONE) {
+            op->mem.base = physical(alloc, op->mem.base);
+        }
+
+        if (index_spilled) {
+            emit(mf, MIR_MOV, spill_slot(alloc, op->mem.index, 8), mop_reg(scratch[scratch_used], 8));
+            op->mem.index = scratch[scratch_used++];
+        } else if (op->mem.index != REG_NONE) {
+            op->mem.index = physical(alloc, op->mem.index);
+        }
+    }
+
+    // register operands: spilled ones become frame references where the
+    // instruction allows it, otherwise they go through a scratch register
+    struct MirOperand store_from;
+    struct MirOperand store_to;
+    bool store = false;
+
+    for (int o = 0; o < 2; o++) {
+        struct MirOperand* op = operands[o];
+        if (op->kind != MOP_REG) continue;
+
+        if (!spilled(alloc, op->reg)) {
+            op->reg = physical(alloc, op->reg);
+            continue;
+        }
+
+        struct MirOperand* other = operands[1 - o];
+        int access = o == 0 ? ACCESS_USE : dst_access(inst.op);
+        if (memory_allowed(inst.op, o == 1) && other->kind != MOP_MEM) {
+            *op = spill_slot(alloc, op->reg, op->size);
+            continue;
+        }
+
+        struct MirOperand slot = spill_slot(alloc, op->reg, op->size);
+        bool vector = op->size >= 16;
+        struct MirOperand reg = mop_reg(vector ? vector_scratch[vector_scratch_used++] : scratch[scratch_used++], op->size);
+        if (access & ACCESS_USE) {
+            if (op->size == 1) {
+                emit(mf, MIR_MOVZB, slot, mop_reg(reg.reg, 4));
+            } else {
+                emit(mf, vector ? MIR_VMOV : MIR_MOV, slot, reg);
+            }
+        }
+
+        if (access & ACCESS_DEF) {
+            store = true;
+            store_from = reg;
+            store_to = slot;
+        }
+
+        *op = reg;
+    }
+
+    // moves between identical locations are dropped
+    bool self_move = (inst.op == MIR_MOV || inst.op == MIR_VMOV) && inst.src.kind == inst.dst.kind
+        && ((inst.src.kind == MOP_REG && inst.src.reg == inst.dst.reg)
+            || (inst.src.kind == MOP_MEM && memcmp(&inst.src.mem, &inst.dst.mem, sizeof(struct MirMemory)) == 0));
+
+    if (!self_move) {
+        *append_inst(mf) = inst;
+    }
+
+    if (store) {
+        emit(mf, store_from.size >= 16 ? MIR_VMOV : MIR_MOV, store_from, store_to);
+    }
+}
+
+// assigns physical registers to every virtual register of `mf`,
+// spill slots are placed below the first `locals_size` bytes of the frame
+void allocate_registers(struct MirFunction* mf, size_t locals_size) {
+    size_t vreg_count = mf->vreg_count;
+
+    struct Allocation alloc;
+    alloc.location = arena_alloc(mf->arena, sizeof(int) * (vreg_count + 1));
+    alloc.spill_offset = arena_calloc(mf->arena, sizeof(int32_t) * (vreg_count + 1));
+    alloc.vector_size = arena_calloc(mf->arena, sizeof(unsigned char) * (vreg_count + 1));
+
+    // live intervals
+    int* starts = arena_alloc(mf->arena, sizeof(int) * (vreg_count + 1));
+    int* ends = arena_alloc(mf->arena, sizeof(int) * (vreg_count + 1));
+    int* hints = arena_alloc(mf->arena, sizeof(int) * (vreg_count + 1));
+    for (size_t v = 0; v < vreg_count; v++) {
+        starts[v] = INT32_MAX;
+        ends[v] = -1;
+        hints[v] = -1;
+    }
+
+    struct LiveBlock* blocks;
+    size_t block_count = build_live_blocks(mf, &blocks);
+    compute_liveness(mf, blocks, block_count, starts, ends);
+
+    for (size_t b = 0; b < block_count; b++) {
+        struct LiveBlock* block = &blocks[b];
+        for (size_t i = block->first; i <= block->last; i++) {
+            struct MirInst* inst = &mf->insts[i];
+            struct RegisterRef refs[4];
+            int n = inst_refs(inst, refs);
+            for (int k = 0; k < n; k++) {
+                int reg = *refs[k].reg;
+                if (!IS_VREG(reg)) continue;
+
+                int v = reg - REG_COUNT;
+                int first = refs[k].access & ACCESS_USE ? 2 * i : 2 * i + 1;
+                int last = refs[k].access & ACCESS_DEF ? 2 * i + 1 : 2 * i;
+                if (first < starts[v]) starts[v] = first;
+                if (last > ends[v]) ends[v] = last;
+            }
+
+            // registers named with a vector width hold vectors
+            struct MirOperand* operands[2] = { &inst->src, &inst->dst };
+            for (int o = 0; o < 2; o++) {
+                if (operands[o]->kind == MOP_REG && IS_VREG(operands[o]->reg) && operands[o]->size >= 16) {
+                    alloc.vector_size[operands[o]->reg - REG_COUNT] = operands[o]->size;
+                }
+            }
+
+            if ((inst->op == MIR_MOV || inst->op == MIR_VMOV) && inst->src.kind == MOP_REG && inst->dst.kind == MOP_REG
+                && IS_VREG(inst->src.reg) && IS_VREG(inst->dst.reg)) {
+                hints[inst->dst.reg - REG_COUNT] = inst->src.reg - REG_COUNT;
+            }
+        }
+    }
+
+    struct Interval* intervals = arena_alloc(mf->arena, sizeof(struct Interval) * (vreg_count + 1));
+    size_t interval_count = 0;
+    for (size_t v = 0; v < vreg_count; v++) {
+        alloc.location[v] = REG_NONE;
+        if (ends[v] < 0) continue;
+
+        intervals[interval_count].vreg = v;
+        intervals[interval_count].start = starts[v];
+        intervals[interval_count].end = ends[v];
+        interval_count += 1;
+    }
+
+    qsort(intervals, interval_count, sizeof(struct Interval), compare_interval_start);
+
+    struct FixedRanges fixed[REG_COUNT];
+    memset(fixed, 0, sizeof(fixed));
+    collect_fixed_ranges(mf, fixed);
+
+    linear_scan(mf, intervals, interval_count, hints, fixed, &alloc);
+
+    // frame: locals, then spill slots, then callee-saved registers
+    size_t offset = (locals_size + 7) & ~(size_t) 7;
+    for (size_t i = 0; i < interval_count; i++) {
+        int v = intervals[i].vreg;
+        if (alloc.location[v] == REG_NONE) {
+            offset += alloc.vector_size[v] != 0 ? alloc.vector_size[v] : 8;
+            alloc.spill_offset[v] = offset;
+        } else if (callee_saved_registers[alloc.location[v]] && mf->saved_offsets[alloc.location[v]] == 0) {
+            mf->saved_offsets[alloc.location[v]] = 1;
+        }
+    }
+
+    for (int r = 0; r < REG_COUNT; r++) {
+        if (mf->saved_offsets[r] != 0) {
+            offset += 8;
+            mf->saved_offsets[r] = offset;
+        }
+    }
+
+    mf->frame_size = offset;
+
+    // rewrite into a fresh instruction list
+    struct MirInst* insts = mf->insts;
+    size_t insts_length = mf->insts_length;
+    mf->insts = NULL;
+    mf->insts_length = 0;
+    mf->insts_capacity = 0;
+
+    for (size_t i = 0; i < insts_length; i++) {
+        rewrite_inst(mf, insts[i], &alloc);
+    }
+}
+
+#endif
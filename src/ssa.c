@@ -0,0 +1,772 @@
+#ifndef CFCC_SSA_C
+#define CFCC_SSA_C
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "codegen.c"
+#include "fold.c"
+#include "frame.c"
+#include "hir.c"
+#include "ir.c"
+#include "symbol.c"
+
+// Builds the SSA IR from the hir in a single walk, following Braun et al.,
+// "Simple and Efficient Construction of Static Single Assignment Form".
+// Every block maps the promoted variables assigned in it to their current
+// value; a read in another block looks the value up through the predecessors
+// and places a phi where paths merge. A block is sealed once all of its
+// predecessors are known, reads from an unsealed block leave an incomplete
+// phi that is filled in when it gets sealed. Labels can be jumped to from
+// anywhere in the function, so their blocks are sealed at the very end.
+struct SsaBuilder {
+    struct IrFunction* fn;
+
+    // block receiving instructions
+    struct IrBlock* block;
+
+    // user label -> block
+    struct SymbolTable labels;
+
+    // innermost switch and the block of each of its cases, and where
+    // `break` and `continue` go (NULL where they can't)
+    struct StmtSwitch* switch_stmt;
+    struct IrBlock** case_blocks;
+    struct IrBlock* break_block;
+    struct IrBlock* continue_block;
+
+    // blocks in the order code was placed in them, which becomes the block order
+    struct IrBlock** layout;
+    size_t layout_length;
+    size_t layout_capacity;
+};
+
+// where an lvalue lives in memory: `base + index * scale + disp`
+struct IrAddress {
+    struct IrInst* base;
+    struct IrInst* index;
+    int scale;
+    int64_t disp;
+};
+
+static struct IrInst* ssa_append(struct SsaBuilder* b, enum IrOp op, int size) {
+    struct IrInst* inst = ir_new_inst(b->fn, op, size);
+    ir_append(b->fn, b->block, inst);
+    return inst;
+}
+
+static struct IrInst* ssa_constant(struct SsaBuilder* b, int64_t value, int size) {
+    struct IrInst* inst = ssa_append(b, IR_CONST, size);
+    inst->imm = value;
+    return inst;
+}
+
+static struct IrInst* ssa_binary(struct SsaBuilder* b, enum IrOp op, int size, struct IrInst* left, struct IrInst* right) {
+    struct IrInst* inst = ssa_append(b, op, size);
+    ir_add_operand(b->fn, inst, left);
+    ir_add_operand(b->fn, inst, right);
+    return inst;
+}
+
+static void ssa_jump(struct SsaBuilder* b, struct IrBlock* target) {
+    struct IrInst* jump = ssa_append(b, IR_JUMP, 0);
+    jump->targets[0] = target;
+    ir_add_pred(b->fn, target, b->block);
+}
+
+static void ssa_branch(struct SsaBuilder* b, struct IrInst* condition, struct IrBlock* success, struct IrBlock* failure) {
+    struct IrInst* branch = ssa_append(b, IR_BRANCH, 0);
+    ir_add_operand(b->fn, branch, condition);
+    branch->targets[0] = success;
+    branch->targets[1] = failure;
+    ir_add_pred(b->fn, success, b->block);
+    ir_add_pred(b->fn, failure, b->block);
+}
+
+static void ssa_enter(struct SsaBuilder* b, struct IrBlock* block) {
+    if (b->layout_length == b->layout_capacity) {
+        size_t capacity = b->layout_capacity > 0 ? b->layout_capacity * 2 : 16;
+        b->layout = arena_grow(b->fn->arena, b->layout, sizeof(struct IrBlock*) * b->layout_capacity, sizeof(struct IrBlock*) * capacity);
+        b->layout_capacity = capacity;
+    }
+
+    b->layout[b->layout_length++] = block;
+    b->block = block;
+}
+
+// code after a jump or return is unreachable, it goes to a block without predecessors
+static void ssa_begin_dead_block(struct SsaBuilder* b) {
+    ssa_enter(b, ir_new_block(b->fn));
+    b->block->sealed = true;
+}
+
+// Variables
+static struct IrInst* read_variable(struct SsaBuilder* b, struct Variable* var, struct IrBlock* block);
+
+static void write_variable(struct SsaBuilder* b, struct Variable* var, struct IrBlock* block, struct IrInst* value) {
+    symbol_table_set(&block->definitions, b->fn->arena, (const char*) var, value);
+}
+
+static struct IrInst* new_phi(struct SsaBuilder* b, int size, struct IrBlock* block) {
+    struct IrInst* phi = ir_new_inst(b->fn, IR_PHI, size);
+
+    size_t position = 0;
+    while (position < block->insts_length && block->insts[position]->op == IR_PHI) position++;
+    ir_insert(b->fn, block, position, phi);
+    return phi;
+}
+
+// a phi merging only itself and one other value is that value
+static struct IrInst* remove_trivial_phi(struct SsaBuilder* b, struct IrInst* phi) {
+    struct IrInst* same = NULL;
+    for (size_t i = 0; i < phi->operands_length; i++) {
+        struct IrInst* operand = ir_resolve(phi->operands[i]);
+        if (operand == same || operand == phi) continue;
+        if (same != NULL) return phi;
+        same = operand;
+    }
+
+    if (same == NULL) same = ir_undefined(b->fn, phi->size);
+    phi->replacement = same;
+    return same;
+}
+
+static struct IrInst* add_phi_operands(struct SsaBuilder* b, struct Variable* var, struct IrInst* phi) {
+    for (size_t i = 0; i < phi->block->preds_length; i++) {
+        ir_add_operand(b->fn, phi, read_variable(b, var, phi->block->preds[i]));
+    }
+
+    return remove_trivial_phi(b, phi);
+}
+
+static struct IrInst* read_variable(struct SsaBuilder* b, struct Variable* var, struct IrBlock* block) {
+    struct IrInst* value = symbol_table_find(&block->definitions, (const char*) var);
+    if (value != NULL) return ir_resolve(value);
+
+    // straight-line chains of blocks are walked without recursing
+    struct IrBlock* source = block;
+    while (source->sealed && source->preds_length == 1) {
+        source = source->preds[0];
+
+        value = symbol_table_find(&source->definitions, (const char*) var);
+        if (value != NULL) {
+            value = ir_resolve(value);
+            write_variable(b, var, block, value);
+            return value;
+        }
+    }
+
+    int size = type_value_size(var->type);
+    if (!source->sealed) {
+        // completed by seal_block once every predecessor is known
+        value = new_phi(b, size, source);
+        value->variable = var;
+    } else if (source->preds_length == 0) {
+        value = ir_undefined(b->fn, size);
+    } else {
+        // the phi is defined before reading the operands to break cycles through loops
+        struct IrInst* phi = new_phi(b, size, source);
+        write_variable(b, var, source, phi);
+        value = add_phi_operands(b, var, phi);
+    }
+
+    write_variable(b, var, source, value);
+    if (source != block) write_variable(b, var, block, value);
+    return value;
+}
+
+static void seal_block(struct SsaBuilder* b, struct IrBlock* block) {
+    if (block->sealed) return;
+
+    // phis without operands were left incomplete while predecessors were missing
+    for (size_t i = 0; i < block->insts_length && block->insts[i]->op == IR_PHI; i++) {
+        struct IrInst* phi = block->insts[i];
+        if (phi->variable != NULL && phi->operands_length == 0 && phi->replacement == NULL) {
+            add_phi_operands(b, phi->variable, phi);
+        }
+    }
+
+    block->sealed = true;
+}
+
+// continues in `block`, whose predecessors must all be known by now
+static void ssa_switch_to(struct SsaBuilder* b, struct IrBlock* block) {
+    seal_block(b, block);
+    ssa_enter(b, block);
+}
+
+static struct IrBlock* label_block(struct SsaBuilder* b, const char* label) {
+    struct IrBlock* block = symbol_table_find(&b->labels, label);
+    if (block == NULL) {
+        block = ir_new_block(b->fn);
+        symbol_table_insert(&b->labels, b->fn->arena, label, block);
+    }
+
+    return block;
+}
+
+// Expressions
+static struct IrInst* lower_ssa_expression(struct SsaBuilder* b, struct Expression* expr);
+static void lower_ssa_condition(struct SsaBuilder* b, struct Expression* expr, struct IrBlock* success, struct IrBlock* failure);
+
+// expressions used as values, void calls read as undefined
+static struct IrInst* lower_ssa_value(struct SsaBuilder* b, struct Expression* expr) {
+    struct IrInst* value = lower_ssa_expression(b, expr);
+    return value != NULL ? value : ir_undefined(b->fn, 4);
+}
+
+static struct IrInst* frame_slot(struct SsaBuilder* b, struct Variable* var) {
+    struct IrInst* slot = ssa_append(b, IR_SLOT, 8);
+    slot->variable = var;
+    return slot;
+}
+
+static struct IrInst* memory_inst(struct SsaBuilder* b, enum IrOp op, int size, struct IrAddress* address) {
+    struct IrInst* inst = ir_new_inst(b->fn, op, size);
+    ir_add_operand(b->fn, inst, address->base);
+    if (address->index != NULL) ir_add_operand(b->fn, inst, address->index);
+    inst->scale = address->scale;
+    inst->imm = address->disp;
+    ir_append(b->fn, b->block, inst);
+    return inst;
+}
+
+static struct IrAddress lower_ssa_address(struct SsaBuilder* b, struct Expression* expr) {
+    struct IrAddress address = { NULL, NULL, 1, 0 };
+
+    switch (expr->kind) {
+        case EXPR_VARIABLE: {
+            struct Variable* var = expr->expr_variable.variable;
+            if (var->vreg >= 0) {
+                printf("cannot take the address of a register value\n");
+                break;
+            }
+
+            address.base = frame_slot(b, var);
+            return address;
+        }
+
+        case EXPR_INDEX: {
+            // `a[i]` and `i[a]` are the same thing
+            struct Expression* base = expr->expr_index.location;
+            struct Expression* index = expr->expr_index.expression;
+            if (!is_indirect(expression_type(base))) {
+                base = expr->expr_index.expression;
+                index = expr->expr_index.location;
+            }
+
+            struct Type* base_type = expression_type(base);
+            if (!is_indirect(base_type)) {
+                fprintf(stderr, "subscripted value is neither array nor pointer\n");
+                break;
+            }
+
+            int64_t scale = type_size(element_type(base_type));
+
+            // constant parts of the index go into the displacement
+            int64_t displacement = 0;
+            int32_t constant;
+            if (is_constant(index, &constant)) {
+                displacement = constant * scale;
+                index = NULL;
+            } else if (index->kind == EXPR_BIN_OP && is_constant(index->expr_binary_op.right, &constant)) {
+                enum BinaryOperation op = index->expr_binary_op.kind;
+                if (op == BINARY_OP_ADD || op == BINARY_OP_SUB) {
+                    displacement = (op == BINARY_OP_ADD ? constant : -(int64_t) constant) * scale;
+                    index = index->expr_binary_op.left;
+                }
+            }
+
+            if (base_type->kind == TYPE_KIND_ARRAY) {
+                address = lower_ssa_address(b, base);
+            } else {
+                address.base = lower_ssa_value(b, base);
+            }
+
+            address.disp += displacement;
+            if (index == NULL) {
+                return address;
+            }
+
+            // the index is computed before it is extended
+            struct IrInst* value = lower_ssa_value(b, index);
+            struct IrInst* offset = ssa_append(b, IR_SEXT, 8);
+            ir_add_operand(b->fn, offset, value);
+
+            // addressing modes scale by 1, 2, 4 or 8 only
+            if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+                offset = ssa_binary(b, IR_MUL, 8, offset, ssa_constant(b, scale, 8));
+                scale = 1;
+            }
+
+            if (address.index != NULL) {
+                struct IrInst* lea = memory_inst(b, IR_LEA, 8, &address);
+                address = (struct IrAddress) { lea, NULL, 1, 0 };
+            }
+
+            address.index = offset;
+            address.scale = scale;
+            return address;
+        }
+
+        default:
+            printf("expression is not assignable\n");
+            break;
+    }
+
+    address.base = ir_undefined(b->fn, 8);
+    return address;
+}
+
+static struct IrInst* lower_ssa_assignment(struct SsaBuilder* b, struct Expression* expr) {
+    struct Expression* location = expr->expr_assignment.location;
+
+    if (location->kind == EXPR_VARIABLE && location->expr_variable.variable->vreg >= 0) {
+        struct IrInst* value = lower_ssa_value(b, expr->expr_assignment.expression);
+        write_variable(b, location->expr_variable.variable, b->block, value);
+        return value;
+    }
+
+    struct IrAddress address = lower_ssa_address(b, location);
+    struct IrInst* value = lower_ssa_value(b, expr->expr_assignment.expression);
+
+    // constants take the width of the location they are stored to
+    int size = type_value_size(expression_type(location));
+    if (value->op == IR_CONST && value->size != size) {
+        value = ssa_constant(b, value->imm, size);
+    }
+
+    struct IrInst* store = ir_new_inst(b->fn, IR_STORE, 0);
+    ir_add_operand(b->fn, store, value);
+    ir_add_operand(b->fn, store, address.base);
+    if (address.index != NULL) ir_add_operand(b->fn, store, address.index);
+    store->scale = address.scale;
+    store->imm = address.disp;
+    ir_append(b->fn, b->block, store);
+    return value;
+}
+
+static bool comparison_op(enum BinaryOperation op) {
+    enum Condition cond;
+    return comparison_condition(op, &cond);
+}
+
+static struct IrInst* lower_ssa_comparison(struct SsaBuilder* b, struct ExprBinaryOp* bin_op) {
+    struct IrInst* left = lower_ssa_value(b, bin_op->left);
+    struct IrInst* right = lower_ssa_value(b, bin_op->right);
+
+    struct IrInst* cmp = ssa_binary(b, IR_CMP, 4, left, right);
+    comparison_condition(bin_op->kind, &cmp->cond);
+    return cmp;
+}
+
+static struct IrInst* lower_ssa_expression(struct SsaBuilder* b, struct Expression* expr) {
+    switch (expr->kind) {
+        case EXPR_VARIABLE: {
+            struct Variable* var = expr->expr_variable.variable;
+            if (var->vreg >= 0) {
+                return read_variable(b, var, b->block);
+            }
+
+            // arrays decay to the address of their first element
+            struct IrInst* slot = frame_slot(b, var);
+            if (var->type->kind == TYPE_KIND_ARRAY) {
+                return slot;
+            }
+
+            struct IrAddress address = { slot, NULL, 1, 0 };
+            return memory_inst(b, IR_LOAD, type_value_size(var->type), &address);
+        }
+
+        case EXPR_INDEX: {
+            struct IrAddress address = lower_ssa_address(b, expr);
+            return memory_inst(b, IR_LOAD, value_size(expr), &address);
+        }
+
+        case EXPR_ADDRESS_OF: {
+            struct IrAddress address = lower_ssa_address(b, expr->expr_address_of.expression);
+            if (address.index == NULL && address.disp == 0) {
+                return address.base;
+            }
+
+            return memory_inst(b, IR_LEA, 8, &address);
+        }
+
+        case EXPR_ASSIGNMENT:
+            return lower_ssa_assignment(b, expr);
+
+        case EXPR_LITERAL: {
+            struct Type* type = expr->expr_literal.type;
+            if (type->kind == TYPE_KIND_BASIC && type->basic == TYPE_I32) {
+                return ssa_constant(b, expr->expr_literal.integer, 4);
+            }
+
+            // TODO: other literals
+            return ir_undefined(b->fn, 4);
+        }
+
+        case EXPR_CALL: {
+            struct Function* callee = expr->expr_call.func;
+            if (callee == NULL) {
+                return NULL;
+            }
+
+            struct IrInst* call = ir_new_inst(b->fn, IR_CALL, 0);
+            call->symbol = callee->identifier;
+            for (size_t i = 0; i < expr->expr_call.args_length; i++) {
+                ir_add_operand(b->fn, call, lower_ssa_value(b, expr->expr_call.args[i]));
+            }
+
+            struct Type* return_type = callee->return_type;
+            if (return_type->kind != TYPE_KIND_BASIC || return_type->basic != TYPE_VOID) {
+                call->size = type_value_size(return_type);
+            }
+
+            ir_append(b->fn, b->block, call);
+            return call->size > 0 ? call : NULL;
+        }
+
+        case EXPR_BIN_OP: {
+            struct ExprBinaryOp* bin_op = &expr->expr_binary_op;
+
+            if (bin_op->kind == BINARY_OP_AND || bin_op->kind == BINARY_OP_OR) {
+                // materialized as 1 or 0 where the short-circuit paths meet
+                struct IrBlock* success = ir_new_block(b->fn);
+                struct IrBlock* failure = ir_new_block(b->fn);
+                struct IrBlock* end = ir_new_block(b->fn);
+                lower_ssa_condition(b, expr, success, failure);
+
+                ssa_switch_to(b, success);
+                struct IrInst* one = ssa_constant(b, 1, 4);
+                ssa_jump(b, end);
+
+                ssa_switch_to(b, failure);
+                struct IrInst* zero = ssa_constant(b, 0, 4);
+                ssa_jump(b, end);
+
+                ssa_switch_to(b, end);
+                struct IrInst* phi = new_phi(b, 4, end);
+                ir_add_operand(b->fn, phi, one);
+                ir_add_operand(b->fn, phi, zero);
+                return phi;
+            }
+
+            if (comparison_op(bin_op->kind)) {
+                return lower_ssa_comparison(b, bin_op);
+            }
+
+            enum IrOp op;
+            switch (bin_op->kind) {
+                case BINARY_OP_ADD: op = IR_ADD; break;
+                case BINARY_OP_SUB: op = IR_SUB; break;
+                case BINARY_OP_MUL: op = IR_MUL; break;
+                case BINARY_OP_DIV: op = IR_DIV; break;
+                default:            op = IR_MOD; break;
+            }
+
+            struct IrInst* left = lower_ssa_value(b, bin_op->left);
+            struct IrInst* right = lower_ssa_value(b, bin_op->right);
+            return ssa_binary(b, op, 4, left, right);
+        }
+    }
+
+    return NULL;
+}
+
+// ends the current block with a branch to `success` or `failure` depending
+// on `expr`, logical operators short-circuit through blocks of their own
+static void lower_ssa_condition(struct SsaBuilder* b, struct Expression* expr, struct IrBlock* success, struct IrBlock* failure) {
+    if (expr->kind == EXPR_BIN_OP) {
+        struct ExprBinaryOp* bin_op = &expr->expr_binary_op;
+
+        if (comparison_op(bin_op->kind)) {
+            ssa_branch(b, lower_ssa_comparison(b, bin_op), success, failure);
+            return;
+        }
+
+        if (bin_op->kind == BINARY_OP_AND || bin_op->kind == BINARY_OP_OR) {
+            struct IrBlock* right = ir_new_block(b->fn);
+            if (bin_op->kind == BINARY_OP_AND) {
+                lower_ssa_condition(b, bin_op->left, right, failure);
+            } else {
+                lower_ssa_condition(b, bin_op->left, success, right);
+            }
+
+            ssa_switch_to(b, right);
+            lower_ssa_condition(b, bin_op->right, success, failure);
+            return;
+        }
+    }
+
+    int32_t constant;
+    if (is_constant(expr, &constant)) {
+        ssa_jump(b, constant != 0 ? success : failure);
+        return;
+    }
+
+    struct IrInst* value = lower_ssa_value(b, expr);
+    struct IrInst* cmp = ssa_binary(b, IR_CMP, 4, value, ssa_constant(b, 0, value->size));
+    cmp->cond = COND_NE;
+    ssa_branch(b, cmp, success, failure);
+}
+
+// Statements
+static void lower_ssa_statement(struct SsaBuilder* b, struct Statement* stmt);
+
+static void lower_ssa_scope(struct SsaBuilder* b, struct Scope* scope) {
+    for (int i = 0; i < scope->statements_length; i++) {
+        lower_ssa_statement(b, scope->statements[i]);
+    }
+}
+
+static void lower_ssa_statement(struct SsaBuilder* b, struct Statement* stmt) {
+    switch (stmt->kind) {
+        case STMT_COMPOUND:
+            lower_ssa_scope(b, &stmt->stmt_compound.scope);
+            break;
+
+        case STMT_GOTO:
+            ssa_jump(b, label_block(b, stmt->stmt_goto.label));
+            ssa_begin_dead_block(b);
+            break;
+
+        case STMT_LABEL: {
+            // gotos further down can still reach the label, it stays unsealed
+            struct IrBlock* block = label_block(b, stmt->stmt_label.label);
+            ssa_jump(b, block);
+            ssa_enter(b, block);
+            lower_ssa_scope(b, &stmt->stmt_label.scope);
+            break;
+        }
+
+        case STMT_IF:
+        case STMT_IF_ELSE: {
+            struct IrBlock* success = ir_new_block(b->fn);
+            struct IrBlock* failure = stmt->kind == STMT_IF_ELSE ? ir_new_block(b->fn) : NULL;
+            struct IrBlock* end = ir_new_block(b->fn);
+
+            lower_ssa_condition(b, &stmt->stmt_if.condition_expr, success, failure != NULL ? failure : end);
+
+            ssa_switch_to(b, success);
+            lower_ssa_scope(b, &stmt->stmt_if.success_scope);
+            ssa_jump(b, end);
+
+            if (failure != NULL) {
+                ssa_switch_to(b, failure);
+                lower_ssa_scope(b, &stmt->stmt_if.failure_scope);
+                ssa_jump(b, end);
+            }
+
+            ssa_switch_to(b, end);
+            break;
+        }
+
+        case STMT_RETURN: {
+            struct IrInst* value = lower_ssa_expression(b, &stmt->stmt_return.expr);
+            struct IrInst* ret = ssa_append(b, IR_RETURN, 0);
+            if (value != NULL) ir_add_operand(b->fn, ret, value);
+
+            ssa_begin_dead_block(b);
+            break;
+        }
+
+        case STMT_EXPRESSION:
+            lower_ssa_expression(b, &stmt->stmt_expression.expr);
+            break;
+
+        case STMT_SWITCH: {
+            // a ladder of equality tests, instruction selection turns it into a
+            // jump table or a decision tree
+            struct StmtSwitch* switch_stmt = &stmt->stmt_switch;
+            struct IrInst* value = lower_ssa_value(b, &switch_stmt->value);
+
+            struct IrBlock** case_blocks = arena_alloc(b->fn->arena, sizeof(struct IrBlock*) * (switch_stmt->cases_length + 1));
+            struct IrBlock* end = ir_new_block(b->fn);
+            struct IrBlock* fallback = end;
+
+            for (size_t i = 0; i < switch_stmt->cases_length; i++) {
+                struct StmtCase* case_stmt = &switch_stmt->cases[i]->stmt_case;
+                case_blocks[i] = ir_new_block(b->fn);
+
+                int32_t constant;
+                if (case_stmt->is_default) {
+                    fallback = case_blocks[i];
+                    continue;
+                }
+
+                if (!case_value(case_stmt, &constant)) {
+                    printf("case label does not reduce to an integer constant\n");
+                    continue;
+                }
+
+                struct IrBlock* next = ir_new_block(b->fn);
+                struct IrInst* cmp = ssa_binary(b, IR_CMP, 4, value, ssa_constant(b, constant, value->size));
+                cmp->cond = COND_E;
+                ssa_branch(b, cmp, case_blocks[i], next);
+                ssa_switch_to(b, next);
+            }
+
+            ssa_jump(b, fallback);
+
+            struct StmtSwitch* outer_switch = b->switch_stmt;
+            struct IrBlock** outer_blocks = b->case_blocks;
+            struct IrBlock* outer_break = b->break_block;
+            b->switch_stmt = switch_stmt;
+            b->case_blocks = case_blocks;
+            b->break_block = end;
+
+            // code before the first case is never run
+            ssa_begin_dead_block(b);
+            lower_ssa_scope(b, &switch_stmt->scope);
+            ssa_jump(b, end);
+
+            b->switch_stmt = outer_switch;
+            b->case_blocks = outer_blocks;
+            b->break_block = outer_break;
+
+            ssa_switch_to(b, end);
+            break;
+        }
+
+        case STMT_CASE: {
+            // reached from the dispatch and by falling through, both are known by now
+            struct StmtSwitch* switch_stmt = b->switch_stmt;
+            for (size_t i = 0; switch_stmt != NULL && i < switch_stmt->cases_length; i++) {
+                if (switch_stmt->cases[i] != stmt) continue;
+
+                ssa_jump(b, b->case_blocks[i]);
+                ssa_switch_to(b, b->case_blocks[i]);
+            }
+            break;
+        }
+
+        case STMT_BREAK:
+            if (b->break_block == NULL) {
+                printf("`break` outside of a loop or switch\n");
+                break;
+            }
+
+            ssa_jump(b, b->break_block);
+            ssa_begin_dead_block(b);
+            break;
+
+        case STMT_CONTINUE:
+            if (b->continue_block == NULL) {
+                printf("`continue` outside of a loop\n");
+                break;
+            }
+
+            ssa_jump(b, b->continue_block);
+            ssa_begin_dead_block(b);
+            break;
+
+        case STMT_WHILE:
+        case STMT_DO_WHILE: {
+            // canonical form: a preheader jumps to the header, which tests the
+            // condition of a `while` first, and a single latch at the bottom
+            // goes back (testing the condition of a `do`); loop rotation moves
+            // the test of a `while` down later. The header stays unsealed
+            // until the latch is known.
+            struct StmtLoop* loop = &stmt->stmt_loop;
+            lower_ssa_scope(b, &loop->scope);
+
+            struct IrBlock* header = ir_new_block(b->fn);
+            struct IrBlock* latch = ir_new_block(b->fn);
+            struct IrBlock* end = ir_new_block(b->fn);
+            ssa_jump(b, header);
+            ssa_enter(b, header);
+
+            if (stmt->kind == STMT_WHILE && loop->has_condition) {
+                struct IrBlock* body = ir_new_block(b->fn);
+                lower_ssa_condition(b, &loop->condition, body, end);
+                ssa_switch_to(b, body);
+            }
+
+            struct IrBlock* outer_break = b->break_block;
+            struct IrBlock* outer_continue = b->continue_block;
+            b->break_block = end;
+            b->continue_block = latch;
+
+            lower_ssa_scope(b, &loop->body);
+            ssa_jump(b, latch);
+
+            b->break_block = outer_break;
+            b->continue_block = outer_continue;
+
+            ssa_switch_to(b, latch);
+            if (loop->has_step) lower_ssa_expression(b, &loop->step);
+
+            if (stmt->kind == STMT_DO_WHILE && loop->has_condition) {
+                lower_ssa_condition(b, &loop->condition, header, end);
+            } else {
+                ssa_jump(b, header);
+            }
+
+            seal_block(b, header);
+            ssa_switch_to(b, end);
+            break;
+        }
+    }
+}
+
+// lowers a function definition into SSA form, allocating everything in `arena`;
+// promoted variables are numbered as SSA variables, the rest keep frame slots
+struct IrFunction* build_ssa(struct Function* func, struct Arena* arena) {
+    struct IrFunction* fn = arena_alloc(arena, sizeof(struct IrFunction));
+    init_ir_function(fn, func, arena);
+    promote_variables(func, 0);
+
+    struct SsaBuilder b;
+    b.fn = fn;
+    init_symbol_table(&b.labels);
+    b.layout = NULL;
+    b.layout_length = 0;
+    b.layout_capacity = 0;
+    b.switch_stmt = NULL;
+    b.case_blocks = NULL;
+    b.break_block = NULL;
+    b.continue_block = NULL;
+
+    ssa_enter(&b, ir_new_block(fn));
+    b.block->sealed = true;
+
+    for (int i = 0; i < func->params_length; i++) {
+        struct Variable* param = func->params[i];
+        struct IrInst* value = ssa_append(&b, IR_PARAM, type_value_size(param->type));
+        value->imm = i;
+
+        if (param->vreg >= 0) {
+            write_variable(&b, param, b.block, value);
+        } else {
+            struct IrInst* store = ir_new_inst(fn, IR_STORE, 0);
+            ir_add_operand(fn, store, value);
+            ir_add_operand(fn, store, frame_slot(&b, param));
+            ir_append(fn, b.block, store);
+        }
+    }
+
+    lower_ssa_scope(&b, &func->scope);
+
+    // falling off the end returns whatever is in %eax, like the direct generator
+    ssa_append(&b, IR_RETURN, 0);
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        seal_block(&b, block);
+
+        // the block of a label that was never defined
+        if (ir_terminator(block) == NULL) {
+            printf("label used but not defined in `%s`\n", func->identifier);
+            ir_append(fn, block, ir_new_inst(fn, IR_RETURN, 0));
+            ssa_enter(&b, block);
+        }
+    }
+
+    memcpy(fn->blocks, b.layout, sizeof(struct IrBlock*) * b.layout_length);
+
+    ir_apply_replacements(fn);
+    return fn;
+}
+
+#endif
@@ -0,0 +1,503 @@
+#ifndef CFCC_SWITCH_C
+#define CFCC_SWITCH_C
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.c"
+#include "ir.c"
+#include "mir.c"
+
+// Switch lowering, right before instruction selection: a ladder of blocks
+// that do nothing but compare variables with constants for equality, which is
+// what a switch statement or a chain of `if (x == 1) ... else if (x == 2)`
+// becomes, is replaced by a single switch terminator. Instruction selection
+// turns that into a jump table, bit tests or a binary decision tree depending
+// on how dense the cases are.
+// Where each value goes is found by running the ladder for every constant it
+// tests and once for a value it does not. A ladder over several variables
+// becomes a switch over the position of each variable in its range of
+// constants, once every variable was checked to be in its range; that only
+// works when the constants of each variable are dense and every value out of
+// range ends up in the same place.
+
+// a ladder with fewer tests is left as it is
+#define SWITCH_MIN_TESTS 4
+
+#define LADDER_BLOCKS_MAX 256
+#define LADDER_VARIABLES_MAX 4
+#define LADDER_CONSTANTS_MAX 64
+
+// combinations of variable values a ladder over several variables is run for
+#define LADDER_RUNS_MAX 4096
+
+struct Ladder {
+    // the head first, then every block in the order it was reached
+    struct IrBlock* blocks[LADDER_BLOCKS_MAX];
+    size_t blocks_length;
+
+    // tested variables in the order they first appear, with their constants
+    struct IrInst* variables[LADDER_VARIABLES_MAX];
+    int64_t constants[LADDER_VARIABLES_MAX][LADDER_CONSTANTS_MAX];
+    size_t constants_length[LADDER_VARIABLES_MAX];
+    size_t variables_length;
+};
+
+// the variable, constant and sense of the equality test `block` ends in
+static bool ladder_test(struct IrBlock* block, struct IrInst** variable, int64_t* constant, bool* equal) {
+    struct IrInst* term = ir_terminator(block);
+    if (term == NULL || term->op != IR_BRANCH) return false;
+
+    struct IrInst* cmp = term->operands[0];
+    if (cmp->op != IR_CMP || (cmp->cond != COND_E && cmp->cond != COND_NE)) return false;
+
+    struct IrInst* left = cmp->operands[0];
+    struct IrInst* right = cmp->operands[1];
+    if (left->op == IR_CONST) {
+        struct IrInst* swapped = left;
+        left = right;
+        right = swapped;
+    }
+
+    if (left->op == IR_CONST || right->op != IR_CONST || left->size != 4) return false;
+
+    *variable = left;
+    *constant = right->imm;
+    *equal = cmp->cond == COND_E;
+    return true;
+}
+
+// a block that only tests, its constants and comparisons can move to the head
+static bool is_test_block(struct IrBlock* block) {
+    for (size_t i = 0; i + 1 < block->insts_length; i++) {
+        enum IrOp op = block->insts[i]->op;
+        if (op != IR_CONST && op != IR_CMP) return false;
+    }
+
+    struct IrInst* variable;
+    int64_t constant;
+    bool equal;
+    return ladder_test(block, &variable, &constant, &equal);
+}
+
+static bool in_ladder(struct Ladder* ladder, struct IrBlock* block) {
+    for (size_t i = 0; i < ladder->blocks_length; i++) {
+        if (ladder->blocks[i] == block) return true;
+    }
+
+    return false;
+}
+
+// takes in the test blocks only reached from the ladder until there are no more
+static void grow_ladder(struct Ladder* ladder, bool* taken) {
+    bool progress = true;
+    while (progress) {
+        progress = false;
+
+        for (size_t i = 0; i < ladder->blocks_length && ladder->blocks_length < LADDER_BLOCKS_MAX; i++) {
+            struct IrInst* term = ir_terminator(ladder->blocks[i]);
+
+            for (int k = 0; k < 2; k++) {
+                struct IrBlock* succ = term->targets[k];
+                if (taken[succ->id] || in_ladder(ladder, succ) || !is_test_block(succ)) continue;
+
+                bool inside = true;
+                for (size_t j = 0; j < succ->preds_length; j++) {
+                    inside &= in_ladder(ladder, succ->preds[j]);
+                }
+
+                if (!inside || ladder->blocks_length == LADDER_BLOCKS_MAX) continue;
+
+                ladder->blocks[ladder->blocks_length++] = succ;
+                progress = true;
+            }
+        }
+    }
+}
+
+// sorts the constants of every variable, fails when there are too many
+static bool collect_variables(struct Ladder* ladder) {
+    ladder->variables_length = 0;
+
+    for (size_t i = 0; i < ladder->blocks_length; i++) {
+        struct IrInst* variable;
+        int64_t constant;
+        bool equal;
+        ladder_test(ladder->blocks[i], &variable, &constant, &equal);
+
+        // values computed inside the ladder are not there yet at its head
+        if (variable->block != ladder->blocks[0] && in_ladder(ladder, variable->block)) return false;
+
+        size_t v = 0;
+        while (v < ladder->variables_length && ladder->variables[v] != variable) v++;
+        if (v == ladder->variables_length) {
+            if (v == LADDER_VARIABLES_MAX) return false;
+            ladder->variables[v] = variable;
+            ladder->constants_length[v] = 0;
+            ladder->variables_length += 1;
+        }
+
+        size_t c = 0;
+        while (c < ladder->constants_length[v] && ladder->constants[v][c] != constant) c++;
+        if (c == ladder->constants_length[v]) {
+            if (c == LADDER_CONSTANTS_MAX) return false;
+            ladder->constants[v][ladder->constants_length[v]++] = constant;
+        }
+    }
+
+    for (size_t v = 0; v < ladder->variables_length; v++) {
+        int64_t* constants = ladder->constants[v];
+        for (size_t i = 1; i < ladder->constants_length[v]; i++) {
+            for (size_t j = i; j > 0 && constants[j - 1] > constants[j]; j--) {
+                int64_t swapped = constants[j];
+                constants[j] = constants[j - 1];
+                constants[j - 1] = swapped;
+            }
+        }
+    }
+
+    return true;
+}
+
+// the block the ladder leaves to when every variable holds the constant
+// `choice` picks for it (-1 for a value it is never compared with),
+// NULL if the ladder goes around in circles
+static struct IrBlock* run_ladder(struct Ladder* ladder, int* choice) {
+    struct IrBlock* block = ladder->blocks[0];
+
+    for (size_t steps = 0; steps <= ladder->blocks_length; steps++) {
+        struct IrInst* variable;
+        int64_t constant;
+        bool equal;
+        ladder_test(block, &variable, &constant, &equal);
+
+        size_t v = 0;
+        while (ladder->variables[v] != variable) v++;
+
+        bool holds = choice[v] >= 0 && ladder->constants[v][choice[v]] == constant;
+        block = ir_terminator(block)->targets[holds == equal ? 0 : 1];
+        if (!in_ladder(ladder, block) || block == ladder->blocks[0]) return block;
+    }
+
+    return NULL;
+}
+
+static bool same_constant(struct IrInst* a, struct IrInst* b) {
+    if (a == NULL || b == NULL) return a == b;
+    return a == b || (a->op == IR_CONST && b->op == IR_CONST && a->imm == b->imm && a->size == b->size);
+}
+
+// blocks that only return the same constant, or only jump to the same block
+// passing it the same values, are interchangeable
+static bool same_exit(struct IrBlock* a, struct IrBlock* b) {
+    if (a == b) return true;
+
+    struct IrBlock* blocks[2] = { a, b };
+    for (int k = 0; k < 2; k++) {
+        for (size_t i = 0; i + 1 < blocks[k]->insts_length; i++) {
+            if (blocks[k]->insts[i]->op != IR_CONST) return false;
+        }
+    }
+
+    struct IrInst* term_a = ir_terminator(a);
+    struct IrInst* term_b = ir_terminator(b);
+    if (term_a->op != term_b->op) return false;
+
+    if (term_a->op == IR_RETURN) {
+        struct IrInst* value_a = term_a->operands_length > 0 ? term_a->operands[0] : NULL;
+        struct IrInst* value_b = term_b->operands_length > 0 ? term_b->operands[0] : NULL;
+        return same_constant(value_a, value_b);
+    }
+
+    if (term_a->op != IR_JUMP || term_a->targets[0] != term_b->targets[0]) return false;
+
+    struct IrBlock* target = term_a->targets[0];
+    int from_a = ir_pred_index(target, a);
+    int from_b = ir_pred_index(target, b);
+    for (size_t i = 0; i < target->insts_length && target->insts[i]->op == IR_PHI; i++) {
+        struct IrInst* phi = target->insts[i];
+        if (!same_constant(phi->operands[from_a], phi->operands[from_b])) return false;
+    }
+
+    return true;
+}
+
+// one block for every group of interchangeable exits
+static struct IrBlock* unique_exit(struct IrBlock** exits, size_t* exits_length, struct IrBlock* exit) {
+    for (size_t i = 0; i < *exits_length; i++) {
+        if (same_exit(exits[i], exit)) return exits[i];
+    }
+
+    exits[(*exits_length)++] = exit;
+    return exit;
+}
+
+static struct IrInst* append_value(struct IrFunction* fn, struct IrBlock* block, enum IrOp op, struct IrInst* left, struct IrInst* right) {
+    struct IrInst* inst = ir_new_inst(fn, op, 4);
+    ir_add_operand(fn, inst, left);
+    ir_add_operand(fn, inst, right);
+    ir_append(fn, block, inst);
+    return inst;
+}
+
+static struct IrInst* append_constant(struct IrFunction* fn, struct IrBlock* block, int64_t value) {
+    struct IrInst* inst = ir_new_inst(fn, IR_CONST, 4);
+    inst->imm = value;
+    ir_append(fn, block, inst);
+    return inst;
+}
+
+// ends `block` in a switch over `value`
+static void append_switch(struct IrFunction* fn, struct IrBlock* block, struct IrInst* value, struct IrBlock* fallback,
+    int64_t* values, struct IrBlock** targets, size_t length, bool bounded) {
+    struct IrInst* inst = ir_new_inst(fn, IR_SWITCH, 0);
+    ir_add_operand(fn, inst, value);
+    inst->targets[0] = fallback;
+    inst->case_values = values;
+    inst->case_targets = targets;
+    inst->cases_length = length;
+    inst->imm = bounded;
+    ir_append(fn, block, inst);
+
+    // once per target, their phis were ruled out
+    ir_add_pred(fn, fallback, block);
+    for (size_t i = 0; i < length; i++) {
+        bool seen = targets[i] == fallback;
+        for (size_t j = 0; j < i; j++) seen |= targets[j] == targets[i];
+        if (!seen) ir_add_pred(fn, targets[i], block);
+    }
+}
+
+// detaches the ladder from its exits and keeps only its head, which is left
+// without a terminator; `exits` are all the blocks the ladder left to
+static void remove_ladder(struct IrFunction* fn, struct Ladder* ladder, struct IrBlock** exits, size_t exits_length) {
+    struct IrBlock* head = ladder->blocks[0];
+    head->insts_length -= 1;
+
+    // constants and comparisons may still be used past the ladder, the head dominates those uses too
+    for (size_t i = 1; i < ladder->blocks_length; i++) {
+        struct IrBlock* block = ladder->blocks[i];
+        for (size_t j = 0; j + 1 < block->insts_length; j++) {
+            ir_append(fn, head, block->insts[j]);
+        }
+    }
+
+    for (size_t i = 0; i < exits_length; i++) {
+        struct IrBlock* exit = exits[i];
+        size_t kept = 0;
+        for (size_t j = 0; j < exit->preds_length; j++) {
+            if (!in_ladder(ladder, exit->preds[j])) exit->preds[kept++] = exit->preds[j];
+        }
+
+        exit->preds_length = kept;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        if (block == head || !in_ladder(ladder, block)) fn->blocks[kept++] = block;
+    }
+
+    fn->blocks_length = kept;
+}
+
+// a ladder over one variable, any constants
+static bool lower_single_ladder(struct IrFunction* fn, struct Ladder* ladder, struct IrBlock** exits, size_t exits_length) {
+    size_t length = ladder->constants_length[0];
+    int64_t* values = arena_alloc(fn->arena, sizeof(int64_t) * length);
+    struct IrBlock** targets = arena_alloc(fn->arena, sizeof(struct IrBlock*) * length);
+    struct IrBlock** unique = arena_alloc(fn->arena, sizeof(struct IrBlock*) * (length + 1));
+    size_t unique_length = 0;
+
+    int choice = -1;
+    struct IrBlock* fallback = run_ladder(ladder, &choice);
+    if (fallback == NULL) return false;
+    fallback = unique_exit(unique, &unique_length, fallback);
+
+    size_t cases = 0;
+    for (size_t c = 0; c < length; c++) {
+        choice = c;
+        struct IrBlock* exit = run_ladder(ladder, &choice);
+        if (exit == NULL) return false;
+
+        struct IrBlock* target = unique_exit(unique, &unique_length, exit);
+        if (target == fallback) continue;
+
+        values[cases] = ladder->constants[0][c];
+        targets[cases] = target;
+        cases += 1;
+    }
+
+    remove_ladder(fn, ladder, exits, exits_length);
+    append_switch(fn, ladder->blocks[0], ladder->variables[0], fallback, values, targets, cases, false);
+    return true;
+}
+
+// a ladder over several variables with dense constants, keyed by where in
+// their ranges the variables are
+static bool lower_multiple_ladder(struct IrFunction* fn, struct Ladder* ladder, struct IrBlock** exits, size_t exits_length) {
+    size_t variables_length = ladder->variables_length;
+
+    size_t runs = 1;
+    size_t keys = 1;
+    for (size_t v = 0; v < variables_length; v++) {
+        size_t length = ladder->constants_length[v];
+        if (ladder->constants[v][length - 1] - ladder->constants[v][0] != (int64_t) length - 1) return false;
+
+        runs *= length + 1;
+        keys *= length;
+        if (runs > LADDER_RUNS_MAX) return false;
+    }
+
+    struct IrBlock** unique = arena_alloc(fn->arena, sizeof(struct IrBlock*) * runs);
+    size_t unique_length = 0;
+
+    int64_t* values = arena_alloc(fn->arena, sizeof(int64_t) * keys);
+    struct IrBlock** targets = arena_alloc(fn->arena, sizeof(struct IrBlock*) * keys);
+    struct IrBlock* fallback = NULL;
+
+    // every combination, counting through the choices like an odometer
+    int choice[LADDER_VARIABLES_MAX];
+    for (size_t v = 0; v < variables_length; v++) choice[v] = -1;
+
+    for (size_t run = 0; run < runs; run++) {
+        struct IrBlock* exit = run_ladder(ladder, choice);
+        if (exit == NULL) return false;
+
+        struct IrBlock* target = unique_exit(unique, &unique_length, exit);
+
+        bool in_range = true;
+        size_t key = 0;
+        for (size_t v = 0; v < variables_length; v++) {
+            in_range &= choice[v] >= 0;
+            key = key * ladder->constants_length[v] + (choice[v] >= 0 ? choice[v] : 0);
+        }
+
+        if (in_range) {
+            values[key] = key;
+            targets[key] = target;
+        } else if (fallback == NULL) {
+            fallback = target;
+        } else if (fallback != target) {
+            return false;
+        }
+
+        for (size_t v = variables_length; v-- > 0;) {
+            if (++choice[v] < (int) ladder->constants_length[v]) break;
+            choice[v] = -1;
+        }
+    }
+
+    remove_ladder(fn, ladder, exits, exits_length);
+
+    // every variable is checked to be in range, then weighs in with its place in it
+    struct IrBlock* block = ladder->blocks[0];
+    struct IrInst* key = NULL;
+    for (size_t v = 0; v < variables_length; v++) {
+        int64_t low = ladder->constants[v][0];
+        int64_t length = ladder->constants_length[v];
+
+        struct IrInst* offset = ladder->variables[v];
+        if (low != 0) offset = append_value(fn, block, IR_SUB, offset, append_constant(fn, block, low));
+
+        struct IrInst* cmp = append_value(fn, block, IR_CMP, offset, append_constant(fn, block, length - 1));
+        cmp->cond = COND_A;
+
+        struct IrBlock* next = ir_new_block_at(fn, ir_block_position(fn, block) + 1);
+        struct IrInst* branch = ir_new_inst(fn, IR_BRANCH, 0);
+        ir_add_operand(fn, branch, cmp);
+        branch->targets[0] = fallback;
+        branch->targets[1] = next;
+        ir_append(fn, block, branch);
+        ir_add_pred(fn, fallback, block);
+        ir_add_pred(fn, next, block);
+        block = next;
+
+        if (key != NULL) {
+            struct IrInst* scaled = append_value(fn, block, IR_MUL, key, append_constant(fn, block, length));
+            key = append_value(fn, block, IR_ADD, scaled, offset);
+        } else {
+            key = offset;
+        }
+    }
+
+    append_switch(fn, block, key, fallback, values, targets, keys, true);
+    return true;
+}
+
+static bool lower_ladder(struct IrFunction* fn, struct Ladder* ladder) {
+    if (ladder->blocks_length < SWITCH_MIN_TESTS || !collect_variables(ladder)) return false;
+
+    // the exits must not care which block of the ladder they are reached from
+    struct IrBlock** exits = arena_alloc(fn->arena, sizeof(struct IrBlock*) * 2 * ladder->blocks_length);
+    size_t exits_length = 0;
+    for (size_t i = 0; i < ladder->blocks_length; i++) {
+        struct IrInst* term = ir_terminator(ladder->blocks[i]);
+        for (int k = 0; k < 2; k++) {
+            struct IrBlock* exit = term->targets[k];
+            if (exit == ladder->blocks[0]) return false;
+            if (in_ladder(ladder, exit)) continue;
+            if (exit->insts_length > 0 && exit->insts[0]->op == IR_PHI) return false;
+            exits[exits_length++] = exit;
+        }
+    }
+
+    bool lowered = ladder->variables_length == 1
+        ? lower_single_ladder(fn, ladder, exits, exits_length)
+        : lower_multiple_ladder(fn, ladder, exits, exits_length);
+    if (!lowered) return false;
+
+    // exits another equal one stands in for now may have no way in left
+    size_t kept = 0;
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+
+        bool orphaned = false;
+        for (size_t j = 0; j < exits_length; j++) orphaned |= exits[j] == block && block->preds_length == 0;
+        if (!orphaned) {
+            fn->blocks[kept++] = block;
+            continue;
+        }
+
+        struct IrInst* term = ir_terminator(block);
+        if (term->op == IR_JUMP) ir_remove_pred(term->targets[0], ir_pred_index(term->targets[0], block));
+    }
+
+    fn->blocks_length = kept;
+    return true;
+}
+
+// replaces every long enough ladder of equality tests in `fn` by a switch
+void lower_switches(struct IrFunction* fn) {
+    ir_compute_dominators(fn);
+
+    bool* taken = arena_calloc(fn->arena, sizeof(bool) * fn->block_count);
+    struct Ladder* ladder = arena_alloc(fn->arena, sizeof(struct Ladder));
+
+    // heads come before the rest of their ladder in reverse postorder
+    size_t rpo_length = fn->rpo_length;
+    struct IrBlock** rpo = arena_alloc(fn->arena, sizeof(struct IrBlock*) * (rpo_length + 1));
+    memcpy(rpo, fn->rpo, sizeof(struct IrBlock*) * rpo_length);
+
+    for (size_t i = 0; i < rpo_length; i++) {
+        // the head may compute anything before its test
+        struct IrBlock* head = rpo[i];
+        struct IrInst* variable;
+        int64_t constant;
+        bool equal;
+        if (taken[head->id] || !ladder_test(head, &variable, &constant, &equal)) continue;
+
+        ladder->blocks[0] = head;
+        ladder->blocks_length = 1;
+        grow_ladder(ladder, taken);
+
+        if (!lower_ladder(fn, ladder)) continue;
+
+        for (size_t j = 0; j < ladder->blocks_length; j++) {
+            taken[ladder->blocks[j]->id] = true;
+        }
+    }
+}
+
+#endif
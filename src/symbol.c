@@ -0,0 +1,183 @@
+#ifndef CFCC_SYMBOL_C
+#define CFCC_SYMBOL_C
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.c"
+
+// String interning: equal identifiers share one pointer, so symbol
+// lookups compare pointers instead of characters.
+struct InternEntry {
+    const char* str;
+    size_t length;
+    uint32_t hash;
+};
+
+struct Interner {
+    struct InternEntry* entries;
+    size_t length;
+    size_t capacity;
+};
+
+// Open addressing map keyed by interned strings, one per scope.
+struct SymbolEntry {
+    const char* key;
+    void* value;
+};
+
+struct SymbolTable {
+    struct SymbolEntry* entries;
+    size_t length;
+    size_t capacity;
+};
+
+static uint32_t hash_string(const char* str, size_t length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) str[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static size_t hash_pointer(const void* ptr) {
+    uintptr_t value = (uintptr_t) ptr;
+    value ^= value >> 17;
+    value *= 0x9E3779B97F4A7C15ull;
+    return value ^ (value >> 31);
+}
+
+void init_interner(struct Interner* interner) {
+    interner->entries = NULL;
+    interner->length = 0;
+    interner->capacity = 0;
+}
+
+static void interner_rehash(struct Interner* interner, struct Arena* arena) {
+    size_t capacity = interner->capacity > 0 ? interner->capacity * 2 : 256;
+    struct InternEntry* entries = arena_calloc(arena, sizeof(struct InternEntry) * capacity);
+
+    for (size_t i = 0; i < interner->capacity; i++) {
+        struct InternEntry* entry = &interner->entries[i];
+        if (entry->str == NULL) continue;
+
+        size_t slot = entry->hash & (capacity - 1);
+        while (entries[slot].str != NULL) slot = (slot + 1) & (capacity - 1);
+        entries[slot] = *entry;
+    }
+
+    interner->entries = entries;
+    interner->capacity = capacity;
+}
+
+const char* intern(struct Interner* interner, struct Arena* arena, const char* str, size_t length) {
+    // keep load factor below 1/2
+    if ((interner->length + 1) * 2 > interner->capacity) {
+        interner_rehash(interner, arena);
+    }
+
+    uint32_t hash = hash_string(str, length);
+    size_t slot = hash & (interner->capacity - 1);
+    while (interner->entries[slot].str != NULL) {
+        struct InternEntry* entry = &interner->entries[slot];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->str, str, length) == 0) {
+            return entry->str;
+        }
+
+        slot = (slot + 1) & (interner->capacity - 1);
+    }
+
+    struct InternEntry* entry = &interner->entries[slot];
+    entry->str = arena_strndup(arena, str, length);
+    entry->length = length;
+    entry->hash = hash;
+    interner->length += 1;
+
+    return entry->str;
+}
+
+void init_symbol_table(struct SymbolTable* table) {
+    table->entries = NULL;
+    table->length = 0;
+    table->capacity = 0;
+}
+
+static void symbol_table_rehash(struct SymbolTable* table, struct Arena* arena) {
+    size_t capacity = table->capacity > 0 ? table->capacity * 2 : 8;
+    struct SymbolEntry* entries = arena_calloc(arena, sizeof(struct SymbolEntry) * capacity);
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        struct SymbolEntry* entry = &table->entries[i];
+        if (entry->key == NULL) continue;
+
+        size_t slot = hash_pointer(entry->key) & (capacity - 1);
+        while (entries[slot].key != NULL) slot = (slot + 1) & (capacity - 1);
+        entries[slot] = *entry;
+    }
+
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+// `key` must be interned, returns NULL if missing
+void* symbol_table_find(struct SymbolTable* table, const char* key) {
+    if (table->length == 0) {
+        return NULL;
+    }
+
+    size_t slot = hash_pointer(key) & (table->capacity - 1);
+    while (table->entries[slot].key != NULL) {
+        if (table->entries[slot].key == key) {
+            return table->entries[slot].value;
+        }
+
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    return NULL;
+}
+
+// the first definition of a key wins, later ones are ignored
+void symbol_table_insert(struct SymbolTable* table, struct Arena* arena, const char* key, void* value) {
+    if ((table->length + 1) * 2 > table->capacity) {
+        symbol_table_rehash(table, arena);
+    }
+
+    size_t slot = hash_pointer(key) & (table->capacity - 1);
+    while (table->entries[slot].key != NULL) {
+        if (table->entries[slot].key == key) {
+            return;
+        }
+
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    table->entries[slot].key = key;
+    table->entries[slot].value = value;
+    table->length += 1;
+}
+
+// like symbol_table_insert, but a later definition replaces the earlier one
+void symbol_table_set(struct SymbolTable* table, struct Arena* arena, const char* key, void* value) {
+    if ((table->length + 1) * 2 > table->capacity) {
+        symbol_table_rehash(table, arena);
+    }
+
+    size_t slot = hash_pointer(key) & (table->capacity - 1);
+    while (table->entries[slot].key != NULL && table->entries[slot].key != key) {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    if (table->entries[slot].key == NULL) {
+        table->entries[slot].key = key;
+        table->length += 1;
+    }
+
+    table->entries[slot].value = value;
+}
+
+#endif
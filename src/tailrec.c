@@ -0,0 +1,172 @@
+#ifndef CFCC_TAILREC_C
+#define CFCC_TAILREC_C
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "arena.c"
+#include "ir.c"
+#include "pass.c"
+
+// Tail recursion elimination: a function that returns the result of calling
+// itself jumps back to its start instead, with the arguments of the call
+// flowing into phis that replace the parameters. The recursion runs in
+// constant stack and the loop passes see a loop. Frame slots would be shared
+// by every iteration instead of fresh for every call, so functions that have
+// any are left alone.
+//
+// Calls whose result only reaches a shared return through a phi get a return
+// of their own first, which is what makes them tail calls, here and for
+// instruction selection, which turns the rest into jumps to the callee.
+
+// whether the block ends in `return f(...)` of the function itself
+static bool is_self_tail_call(struct IrFunction* fn, struct IrBlock* block) {
+    if (block->insts_length < 2) return false;
+
+    struct IrInst* ret = block->insts[block->insts_length - 1];
+    struct IrInst* call = block->insts[block->insts_length - 2];
+    if (ret->op != IR_RETURN || ret->operands_length != 1 || ret->operands[0] != call) return false;
+    if (call->op != IR_CALL || strcmp(call->symbol, fn->func->identifier) != 0) return false;
+    return call->operands_length == (size_t) fn->func->params_length;
+}
+
+// `ret %call` in place of `jmp` to a block that only returns a phi of the call
+static bool duplicate_returns(struct IrFunction* fn) {
+    bool changed = false;
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        if (block->insts_length != 2 || block->insts[0]->op != IR_PHI) continue;
+
+        struct IrInst* phi = block->insts[0];
+        struct IrInst* ret = block->insts[1];
+        if (ret->op != IR_RETURN || ret->operands_length != 1 || ret->operands[0] != phi) continue;
+
+        for (size_t k = block->preds_length; k-- > 0;) {
+            struct IrBlock* pred = block->preds[k];
+            struct IrInst* call = phi->operands[k];
+            if (pred->insts_length < 2 || pred->insts[pred->insts_length - 2] != call || call->op != IR_CALL) continue;
+            if (ir_terminator(pred)->op != IR_JUMP) continue;
+
+            struct IrInst* copy = ir_new_inst(fn, IR_RETURN, 0);
+            ir_add_operand(fn, copy, call);
+            pred->insts[pred->insts_length - 1] = copy;
+            copy->block = pred;
+            ir_remove_pred(block, k);
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+static bool has_slots(struct IrFunction* fn) {
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            if (block->insts[j]->op == IR_SLOT) return true;
+        }
+    }
+
+    return false;
+}
+
+// moves everything but the parameters of the entry block to a new block
+// right after it, which is where the recursive calls jump to
+static struct IrBlock* split_entry(struct IrFunction* fn) {
+    struct IrBlock* entry = fn->blocks[0];
+    struct IrBlock* header = ir_new_block_at(fn, 1);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < entry->insts_length; i++) {
+        struct IrInst* inst = entry->insts[i];
+        if (inst->op == IR_PARAM) {
+            entry->insts[kept++] = inst;
+        } else {
+            ir_append(fn, header, inst);
+        }
+    }
+
+    entry->insts_length = kept;
+
+    struct IrBlock* succs[2];
+    int succs_length = ir_successors(header, succs);
+    for (int k = 0; k < succs_length; k++) {
+        for (size_t l = 0; l < succs[k]->preds_length; l++) {
+            if (succs[k]->preds[l] == entry) succs[k]->preds[l] = header;
+        }
+    }
+
+    struct IrInst* jump = ir_new_inst(fn, IR_JUMP, 0);
+    jump->targets[0] = header;
+    ir_append(fn, entry, jump);
+    ir_add_pred(fn, header, entry);
+    return header;
+}
+
+static bool eliminate_tail_recursion(struct IrFunction* fn) {
+    bool changed = duplicate_returns(fn);
+
+    bool found = false;
+    for (size_t i = 0; i < fn->blocks_length && !found; i++) {
+        found = is_self_tail_call(fn, fn->blocks[i]);
+    }
+
+    if (!found || has_slots(fn)) return changed;
+
+    struct IrBlock* entry = fn->blocks[0];
+    struct IrBlock* header = split_entry(fn);
+
+    // parameter number -> the phi that stands for it in the loop
+    int params_length = fn->func->params_length;
+    struct IrInst** params = arena_calloc(fn->arena, sizeof(struct IrInst*) * (params_length + 1));
+    struct IrInst** phis = arena_calloc(fn->arena, sizeof(struct IrInst*) * (params_length + 1));
+    for (size_t j = 0; j < entry->insts_length; j++) {
+        struct IrInst* param = entry->insts[j];
+        if (param->op != IR_PARAM || param->imm >= params_length) continue;
+
+        struct IrInst* phi = ir_new_inst(fn, IR_PHI, param->size);
+        ir_insert(fn, header, 0, phi);
+        params[param->imm] = param;
+        phis[param->imm] = phi;
+    }
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                struct IrInst* operand = inst->operands[k];
+                if (operand->op == IR_PARAM && operand->imm < params_length && params[operand->imm] == operand) {
+                    inst->operands[k] = phis[operand->imm];
+                }
+            }
+        }
+    }
+
+    // the entry comes in with the parameters, every call site with its arguments
+    for (int k = 0; k < params_length; k++) {
+        if (phis[k] != NULL) ir_add_operand(fn, phis[k], params[k]);
+    }
+
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        if (!is_self_tail_call(fn, block)) continue;
+
+        struct IrInst* call = block->insts[block->insts_length - 2];
+        for (int k = 0; k < params_length; k++) {
+            if (phis[k] != NULL) ir_add_operand(fn, phis[k], call->operands[k]);
+        }
+
+        block->insts_length -= 2;
+        struct IrInst* jump = ir_new_inst(fn, IR_JUMP, 0);
+        jump->targets[0] = header;
+        ir_append(fn, block, jump);
+        ir_add_pred(fn, header, block);
+    }
+
+    return true;
+}
+
+const struct IrPass tail_recursion_pass = { "tail-recursion", eliminate_tail_recursion };
+
+#endif
@@ -49,6 +49,7 @@ struct Type {
 };
 
 size_t type_size(struct Type* type);
+size_t type_align(struct Type* type);
 
 static size_t type_size_basic(enum Fundamental fundamental) {
     switch (fundamental) {
@@ -92,6 +93,19 @@ size_t type_size(struct Type* type) {
     }
 }
 
+size_t type_align(struct Type* type) {
+    switch (type->kind) {
+        case TYPE_KIND_ARRAY:
+            return type_align(type->array.type);
+
+        case TYPE_KIND_COMPOUND:
+            return 8; // TODO:
+
+        default:
+            return type_size(type);
+    }
+}
+
 #include "../deps/tree-sitter/lib/include/tree_sitter/api.h"
 
 
@@ -4,9 +4,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-char* read_file(char* filename) {
+// returns NULL if the file cannot be opened
+char* read_file(const char* filename) {
     FILE* f = fopen(filename, "rt");
-    
+    if (f == NULL) {
+        return NULL;
+    }
+
     fseek(f, 0, SEEK_END);
     long length = ftell(f);
     fseek(f, 0, SEEK_SET);
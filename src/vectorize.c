@@ -0,0 +1,729 @@
+#ifndef CFCC_VECTORIZE_C
+#define CFCC_VECTORIZE_C
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.c"
+#include "gvn.c"
+#include "idiom.c"
+#include "ir.c"
+#include "loop.c"
+#include "pass.c"
+#include "symbol.c"
+
+// Vectorization of `int` arrays, with lanes of i32 in 16-byte vectors, or
+// 32-byte ones when the target has AVX2.
+// The SLP vectorizer looks for stores to consecutive elements in a block
+// and packs the values stored into vectors, lane by lane: the same value
+// everywhere becomes a splat, loads of consecutive elements one vector load,
+// and the same arithmetic on every lane the vector operation over the packs
+// of its operands. The vector code goes where the last of the stores was,
+// so the memory operations it moves past must not touch what it accesses.
+// The loop vectorizer takes single-block loops stepping a 64-bit counter by
+// one (what strength reduction leaves of `for (i = ...; i < n; i++)`) whose
+// body only loads, computes and stores elements at the counter. A vector
+// loop does `lanes` iterations at once in front of the original loop, which
+// finishes the remainder. Elements of the same array may only be read ahead
+// of where they are written, and pointers that could overlap are checked
+// at run time before taking the vector loop.
+
+// deeper packs are not worth the compile time
+#define SLP_DEPTH_MAX 8
+
+static int vector_lanes(struct IrFunction* fn) {
+    return fn->module->vector_width / 4;
+}
+
+// pmulld came with SSE4.1, every AVX2 target has it
+static bool has_vector_op(struct IrFunction* fn, enum IrOp op) {
+    return op == IR_ADD || op == IR_SUB || (op == IR_MUL && fn->module->vector_width >= 32);
+}
+
+static struct IrInst* new_vector_inst(struct IrFunction* fn, enum IrOp op, int size, struct IrInst* left, struct IrInst* right) {
+    struct IrInst* inst = ir_new_inst(fn, op, size);
+    ir_add_operand(fn, inst, left);
+    if (right != NULL) ir_add_operand(fn, inst, right);
+    return inst;
+}
+
+static struct IrInst* new_access(struct IrFunction* fn, struct IrInst* access, int size, struct IrInst* value, struct IrInst* index, int64_t imm) {
+    struct IrInst* inst = ir_new_inst(fn, access->op, access->op == IR_STORE ? 0 : size);
+    if (value != NULL) ir_add_operand(fn, inst, value);
+    ir_add_operand(fn, inst, access->operands[ir_address_start(access)]);
+    if (index != NULL) ir_add_operand(fn, inst, index);
+
+    inst->scale = access->scale;
+    inst->imm = imm;
+    return inst;
+}
+
+// SLP
+struct SlpLoad {
+    struct IrInst* load;
+    int lane;
+};
+
+struct SlpPack {
+    struct IrFunction* fn;
+    struct IrBlock* block;
+    int lanes;
+
+    // new instructions in the order they go in
+    struct IrInst** insts;
+    size_t insts_length;
+    size_t insts_capacity;
+
+    // scalar loads the vector loads stand for, with the lane each one is in
+    struct SlpLoad* loads;
+    size_t loads_length;
+    size_t loads_capacity;
+};
+
+static void slp_emit(struct SlpPack* pack, struct IrInst* inst) {
+    if (pack->insts_length == pack->insts_capacity) {
+        size_t capacity = pack->insts_capacity > 0 ? pack->insts_capacity * 2 : 8;
+        pack->insts = arena_grow(pack->fn->arena, pack->insts, sizeof(struct IrInst*) * pack->insts_capacity, sizeof(struct IrInst*) * capacity);
+        pack->insts_capacity = capacity;
+    }
+
+    pack->insts[pack->insts_length++] = inst;
+}
+
+static void slp_add_load(struct SlpPack* pack, struct IrInst* load, int lane) {
+    if (pack->loads_length == pack->loads_capacity) {
+        size_t capacity = pack->loads_capacity > 0 ? pack->loads_capacity * 2 : 8;
+        pack->loads = arena_grow(pack->fn->arena, pack->loads, sizeof(struct SlpLoad) * pack->loads_capacity, sizeof(struct SlpLoad) * capacity);
+        pack->loads_capacity = capacity;
+    }
+
+    pack->loads[pack->loads_length++] = (struct SlpLoad) { load, lane };
+}
+
+// the vector holding `values` lane by lane, NULL when they do not pack
+static struct IrInst* slp_pack(struct SlpPack* pack, struct IrInst** values, int depth) {
+    struct IrFunction* fn = pack->fn;
+    int lanes = pack->lanes;
+    int size = lanes * 4;
+
+    struct IrInst* first = values[0];
+    bool splat = true;
+    bool same_op = true;
+    for (int i = 1; i < lanes; i++) {
+        struct IrInst* value = values[i];
+        splat &= value == first || (value->op == IR_CONST && first->op == IR_CONST && value->imm == first->imm);
+        same_op &= value->op == first->op && value->size == first->size;
+    }
+
+    if (first->size != 4) return NULL;
+
+    if (splat) {
+        struct IrInst* inst = new_vector_inst(fn, IR_SPLAT, size, first, NULL);
+        slp_emit(pack, inst);
+        return inst;
+    }
+
+    if (!same_op || depth == SLP_DEPTH_MAX) return NULL;
+
+    if (first->op == IR_LOAD) {
+        // the loads move to the vector code, which is in the block
+        for (int i = 0; i < lanes; i++) {
+            if (values[i]->block != pack->block) return NULL;
+        }
+
+        if (!consecutive_accesses(values, lanes)) return NULL;
+
+        for (int i = 0; i < lanes; i++) slp_add_load(pack, values[i], i);
+
+        struct IrInst* inst = new_access(fn, first, size, NULL, access_index(first), first->imm);
+        slp_emit(pack, inst);
+        return inst;
+    }
+
+    if (!has_vector_op(fn, first->op)) return NULL;
+
+    struct IrInst* lefts[lanes];
+    struct IrInst* rights[lanes];
+    for (int i = 0; i < lanes; i++) {
+        lefts[i] = values[i]->operands[0];
+        rights[i] = values[i]->operands[1];
+    }
+
+    struct IrInst* left = slp_pack(pack, lefts, depth + 1);
+    struct IrInst* right = left != NULL ? slp_pack(pack, rights, depth + 1) : NULL;
+    if (right == NULL) return NULL;
+
+    struct IrInst* inst = new_vector_inst(fn, first->op, size, left, right);
+    slp_emit(pack, inst);
+    return inst;
+}
+
+static bool slp_is_store(struct IrInst** stores, int lanes, struct IrInst* inst) {
+    for (int i = 0; i < lanes; i++) {
+        if (stores[i] == inst) return true;
+    }
+
+    return false;
+}
+
+static bool slp_is_load(struct SlpPack* pack, struct IrInst* inst) {
+    for (size_t i = 0; i < pack->loads_length; i++) {
+        if (pack->loads[i].load == inst) return true;
+    }
+
+    return false;
+}
+
+// whether the stores and the loads they read can all move down to the last store
+static bool slp_can_move(struct SlpPack* pack, struct SymbolTable* escaping, struct IrInst** stores, size_t* positions, size_t last) {
+    struct IrBlock* block = pack->block;
+    int lanes = pack->lanes;
+
+    // a lane may read the element it overwrites, nothing else the stores write
+    for (int i = 0; i < lanes; i++) {
+        for (size_t j = 0; j < pack->loads_length; j++) {
+            struct SlpLoad* load = &pack->loads[j];
+            if (!may_alias(escaping, stores[i], load->load)) continue;
+            if (load->lane != i || !same_location(stores[i], load->load) || positions[load->load->id] > positions[stores[i]->id]) return false;
+        }
+    }
+
+    for (size_t j = 0; j < pack->loads_length; j++) {
+        struct IrInst* load = pack->loads[j].load;
+        for (size_t k = positions[load->id] + 1; k < last; k++) {
+            struct IrInst* inst = block->insts[k];
+            if (inst->op == IR_CALL) return false;
+            if (inst->op == IR_STORE && !slp_is_store(stores, lanes, inst) && may_alias(escaping, inst, load)) return false;
+        }
+    }
+
+    for (int i = 0; i < lanes; i++) {
+        for (size_t k = positions[stores[i]->id] + 1; k < last; k++) {
+            struct IrInst* inst = block->insts[k];
+            if (inst->op == IR_CALL) return false;
+            if (inst->op != IR_LOAD && inst->op != IR_STORE) continue;
+            if (slp_is_store(stores, lanes, inst) || slp_is_load(pack, inst)) continue;
+            if (may_alias(escaping, inst, stores[i])) return false;
+        }
+    }
+
+    return true;
+}
+
+
+// replaces the stores with one vector store of the packed values, if they pack and may move
+static bool slp_vectorize_stores(struct IrFunction* fn, struct IrBlock* block, struct SymbolTable* escaping, struct IrInst** stores, int lanes, size_t* positions) {
+    struct SlpPack pack = { 0 };
+    pack.fn = fn;
+    pack.block = block;
+    pack.lanes = lanes;
+
+    struct IrInst* values[lanes];
+    for (int i = 0; i < lanes; i++) values[i] = stores[i]->operands[0];
+
+    struct IrInst* vector = slp_pack(&pack, values, 0);
+    if (vector == NULL) return false;
+
+    size_t last = 0;
+    for (int i = 0; i < lanes; i++) {
+        if (positions[stores[i]->id] > last) last = positions[stores[i]->id];
+    }
+
+    if (!slp_can_move(&pack, escaping, stores, positions, last)) return false;
+
+    slp_emit(&pack, new_access(fn, stores[0], lanes * 4, vector, access_index(stores[0]), stores[0]->imm));
+
+    // the scalar stores go, what they stored is left to dce
+    size_t capacity = block->insts_length - lanes + pack.insts_length;
+    struct IrInst** insts = arena_alloc(fn->arena, sizeof(struct IrInst*) * capacity);
+    size_t length = 0;
+    for (size_t i = 0; i < block->insts_length; i++) {
+        if (i == last) {
+            for (size_t j = 0; j < pack.insts_length; j++) {
+                pack.insts[j]->block = block;
+                insts[length++] = pack.insts[j];
+            }
+        }
+
+        if (!slp_is_store(stores, lanes, block->insts[i])) insts[length++] = block->insts[i];
+    }
+
+    block->insts = insts;
+    block->insts_length = length;
+    block->insts_capacity = capacity;
+    return true;
+}
+
+static bool slp_vectorize_block(struct IrFunction* fn, struct IrBlock* block, struct SymbolTable* escaping, size_t** numbering, size_t* numbering_capacity) {
+    struct IrInst** stores;
+    size_t stores_length = collect_stores(fn, block, &stores);
+    size_t* positions = *numbering = number_insts(fn, block, *numbering, numbering_capacity);
+    int widest = vector_lanes(fn);
+
+    bool changed = false;
+    for (size_t start = 0; start < stores_length;) {
+        size_t end = run_end(stores, stores_length, start);
+
+        // fills and copies too long for a few vectors are left to the memory idioms,
+        // the pieces of the run between them are packed
+        for (size_t i = start; i < end;) {
+            size_t piece = i;
+            size_t skipped = 0;
+            while (piece < end && (skipped = block_run_prefix(block, &stores[piece], end - piece)) == 0) piece++;
+
+            // the widest vectors first, narrower ones for what they cannot take
+            while (piece - i >= 4) {
+                int lanes = widest;
+                while (lanes >= 4 && (piece - i < (size_t) lanes || !slp_vectorize_stores(fn, block, escaping, &stores[i], lanes, positions))) {
+                    lanes /= 2;
+                }
+
+                if (lanes < 4) {
+                    i += 1;
+                    continue;
+                }
+
+                positions = *numbering = number_insts(fn, block, positions, numbering_capacity);
+                i += lanes;
+                changed = true;
+            }
+
+            i = piece + skipped;
+        }
+
+        start = end;
+    }
+
+    return changed;
+}
+
+static bool slp_vectorize(struct IrFunction* fn) {
+    struct SymbolTable escaping;
+    init_symbol_table(&escaping);
+    find_escaping_slots(fn, &escaping);
+
+    // instruction positions, shared by all blocks
+    size_t* positions = NULL;
+    size_t positions_capacity = 0;
+
+    bool changed = false;
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        changed |= slp_vectorize_block(fn, fn->blocks[i], &escaping, &positions, &positions_capacity);
+    }
+
+    return changed;
+}
+
+const struct IrPass slp_vectorize_pass = { "slp-vectorize", slp_vectorize };
+
+// Loops
+
+// pointers that may overlap, they are only vectorized when the ranges the loop goes over do not
+#define VECTOR_CHECKS_MAX 8
+
+struct VectorLoop {
+    struct IrBlock* body;
+    struct IrBlock* preheader;
+    struct IrBlock* exit;
+
+    struct IrInst* counter;
+    struct IrInst* init;
+    struct IrInst* next;
+    struct IrInst* compare;
+
+    // the counter stays below `bound`, or reaches it with `inclusive`
+    struct IrInst* bound;
+    bool inclusive;
+
+    struct IrInst* checks[VECTOR_CHECKS_MAX][2];
+    int checks_length;
+};
+
+static bool is_constant_value(struct IrInst* inst, int64_t value) {
+    return inst->op == IR_CONST && inst->imm == value;
+}
+
+// the element an access is at, relative to the counter
+static int64_t element_offset(struct VectorLoop* vl, struct IrInst* access) {
+    return access->imm + (access_index(access) == vl->next ? 4 : 0);
+}
+
+static bool is_vector_access(struct VectorLoop* vl, struct IrInst* access) {
+    struct IrInst* index = access_index(access);
+    if (access_width(access) != 4 || access->scale != 4) return false;
+    if (index != vl->counter && index != vl->next) return false;
+    return access->operands[ir_address_start(access)]->block != vl->body;
+}
+
+// whether `value` has a vector of lanes: computed in the body lane by lane, or the same everywhere
+static bool is_lane_value(struct VectorLoop* vl, struct IrInst* value) {
+    if (value->size != 4) return false;
+    if (value->block != vl->body) return true;
+
+    switch (value->op) {
+        case IR_CONST:
+        case IR_LOAD:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool find_counter(struct VectorLoop* vl, struct IrLoop* loop) {
+    struct IrBlock* body = loop->header;
+    if (loop->blocks_length != 1 || body->preds_length != 2) return false;
+
+    vl->body = body;
+    vl->preheader = ir_loop_preheader(loop);
+    if (vl->preheader == NULL) return false;
+
+    struct IrInst* counter = body->insts[0];
+    if (counter->op != IR_PHI || counter->size != 8 || body->insts[1]->op == IR_PHI) return false;
+
+    int entry = ir_pred_index(body, vl->preheader);
+    vl->counter = counter;
+    vl->init = counter->operands[entry];
+    vl->next = counter->operands[1 - entry];
+
+    struct IrInst* next = vl->next;
+    if (next->op != IR_ADD || next->block != body) return false;
+    if (!(next->operands[0] == counter && is_constant_value(next->operands[1], 1)) && !(next->operands[1] == counter && is_constant_value(next->operands[0], 1))) return false;
+
+    // the loop goes on while the next value of the counter is below the bound
+    struct IrInst* branch = ir_terminator(body);
+    if (branch->op != IR_BRANCH) return false;
+
+    struct IrInst* compare = branch->operands[0];
+    if (compare->op != IR_CMP || compare->block != body) return false;
+
+    enum Condition cond = branch->targets[0] == body ? compare->cond : negate_condition(compare->cond);
+    vl->exit = branch->targets[0] == body ? branch->targets[1] : branch->targets[0];
+    vl->compare = compare;
+
+    struct IrInst* bound = compare->operands[1];
+    if (compare->operands[0] != next) {
+        cond = swap_condition(cond);
+        bound = compare->operands[0];
+        if (compare->operands[1] != next) return false;
+    }
+
+    if (bound->block == body || bound->size != 8) return false;
+    if (cond != COND_L && cond != COND_LE && cond != COND_NE) return false;
+
+    vl->bound = bound;
+    vl->inclusive = cond == COND_LE;
+    return true;
+}
+
+// the bytes the accesses at `base` cover, relative to the element at the counter
+static void access_range(struct VectorLoop* vl, struct IrInst* base, int64_t* first, int64_t* last) {
+    *first = INT64_MAX;
+    *last = INT64_MIN;
+
+    struct IrBlock* body = vl->body;
+    for (size_t i = 0; i < body->insts_length; i++) {
+        struct IrInst* inst = body->insts[i];
+        if (inst->op != IR_LOAD && inst->op != IR_STORE) continue;
+        if (!same_base(inst->operands[ir_address_start(inst)], base)) continue;
+
+        int64_t offset = element_offset(vl, inst);
+        if (offset < *first) *first = offset;
+        if (offset + 4 > *last) *last = offset + 4;
+    }
+}
+
+static bool add_check(struct VectorLoop* vl, struct IrInst* a, struct IrInst* b) {
+    for (int i = 0; i < vl->checks_length; i++) {
+        if ((vl->checks[i][0] == a && vl->checks[i][1] == b) || (vl->checks[i][0] == b && vl->checks[i][1] == a)) return true;
+    }
+
+    if (vl->checks_length == VECTOR_CHECKS_MAX) return false;
+
+    vl->checks[vl->checks_length][0] = a;
+    vl->checks[vl->checks_length][1] = b;
+    vl->checks_length += 1;
+    return true;
+}
+
+// whether `lanes` iterations may run as one: a store only meets loads of the
+// same element, or ones ahead of it which have read before it writes
+static bool check_dependences(struct VectorLoop* vl, struct SymbolTable* escaping) {
+    struct IrBlock* body = vl->body;
+    for (size_t i = 0; i < body->insts_length; i++) {
+        struct IrInst* store = body->insts[i];
+        if (store->op != IR_STORE) continue;
+
+        for (size_t j = 0; j < body->insts_length; j++) {
+            struct IrInst* access = body->insts[j];
+            if (j == i || (access->op != IR_LOAD && access->op != IR_STORE)) continue;
+
+            struct IrInst* store_base = store->operands[1];
+            struct IrInst* base = access->operands[ir_address_start(access)];
+            if (same_base(store_base, base)) {
+                int64_t distance = element_offset(vl, access) - element_offset(vl, store);
+                if (distance == 0) continue;
+                if (access->op == IR_LOAD && distance > 0 && j < i) continue;
+                return false;
+            }
+
+            if (!may_alias(escaping, store, access)) continue;
+            if (!add_check(vl, store_base, base)) return false;
+        }
+    }
+
+    return true;
+}
+
+static bool can_vectorize_loop(struct VectorLoop* vl, struct IrFunction* fn, struct IrLoop* loop, struct SymbolTable* escaping) {
+    *vl = (struct VectorLoop) { 0 };
+    if (!find_counter(vl, loop)) return false;
+
+    struct IrBlock* body = vl->body;
+    bool stores = false;
+    for (size_t i = 1; i < body->insts_length - 1; i++) {
+        struct IrInst* inst = body->insts[i];
+        if (inst == vl->next || inst == vl->compare) continue;
+
+        switch (inst->op) {
+            case IR_CONST:
+                break;
+
+            case IR_LOAD:
+                if (!is_vector_access(vl, inst)) return false;
+                break;
+
+            case IR_STORE:
+                if (!is_vector_access(vl, inst) || !is_lane_value(vl, inst->operands[0])) return false;
+                stores = true;
+                break;
+
+            case IR_ADD:
+            case IR_SUB:
+            case IR_MUL:
+                if (inst->size != 4 || !has_vector_op(fn, inst->op)) return false;
+                if (!is_lane_value(vl, inst->operands[0]) || !is_lane_value(vl, inst->operands[1])) return false;
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    // the compare only decides the branch, the counter only counts
+    for (size_t i = 0; i < body->insts_length; i++) {
+        struct IrInst* inst = body->insts[i];
+        for (size_t j = 0; j < inst->operands_length; j++) {
+            struct IrInst* operand = inst->operands[j];
+            if (operand == vl->compare && inst->op != IR_BRANCH) return false;
+        }
+    }
+
+    // nothing computed in the loop is needed after it, the scalar loop may not run
+    for (size_t i = 0; i < fn->blocks_length; i++) {
+        struct IrBlock* block = fn->blocks[i];
+        if (block == body) continue;
+
+        for (size_t j = 0; j < block->insts_length; j++) {
+            struct IrInst* inst = block->insts[j];
+            for (size_t k = 0; k < inst->operands_length; k++) {
+                if (inst->operands[k]->block == body) return false;
+            }
+        }
+    }
+
+    return stores && check_dependences(vl, escaping);
+}
+
+static struct IrInst* append_op(struct IrFunction* fn, struct IrBlock* block, enum IrOp op, int size, struct IrInst* left, struct IrInst* right) {
+    struct IrInst* inst = new_vector_inst(fn, op, size, left, right);
+    ir_append(fn, block, inst);
+    return inst;
+}
+
+static struct IrInst* append_immediate(struct IrFunction* fn, struct IrBlock* block, int64_t value, int size) {
+    struct IrInst* constant = ir_new_inst(fn, IR_CONST, size);
+    constant->imm = value;
+    ir_append(fn, block, constant);
+    return constant;
+}
+
+struct VectorBody {
+    struct IrFunction* fn;
+    struct VectorLoop* vl;
+    struct IrBlock* guard;
+    struct IrBlock* block;
+    struct IrInst* counter;
+    int lanes;
+
+    // the vector of each scalar value, by id
+    struct IrInst** vectors;
+};
+
+static struct IrInst* vector_of(struct VectorBody* vb, struct IrInst* value) {
+    if (vb->vectors[value->id] != NULL) return vb->vectors[value->id];
+
+    // the same value in every lane, made once before the loop
+    struct IrFunction* fn = vb->fn;
+    struct IrInst* scalar = value;
+    if (value->block == vb->vl->body) scalar = append_immediate(fn, vb->guard, value->imm, value->size);
+
+    struct IrInst* splat = append_op(fn, vb->guard, IR_SPLAT, vb->lanes * 4, scalar, NULL);
+    vb->vectors[value->id] = splat;
+    return splat;
+}
+
+static void emit_vector_body(struct VectorBody* vb) {
+    struct IrFunction* fn = vb->fn;
+    struct VectorLoop* vl = vb->vl;
+    struct IrBlock* body = vl->body;
+    int size = vb->lanes * 4;
+
+    for (size_t i = 1; i < body->insts_length - 1; i++) {
+        struct IrInst* inst = body->insts[i];
+        if (inst == vl->next || inst == vl->compare || inst->op == IR_CONST) continue;
+
+        struct IrInst* vector;
+        switch (inst->op) {
+            case IR_LOAD:
+                vector = new_access(fn, inst, size, NULL, vb->counter, element_offset(vl, inst));
+                break;
+
+            case IR_STORE:
+                vector = new_access(fn, inst, size, vector_of(vb, inst->operands[0]), vb->counter, element_offset(vl, inst));
+                break;
+
+            default:
+                vector = new_vector_inst(fn, inst->op, size, vector_of(vb, inst->operands[0]), vector_of(vb, inst->operands[1]));
+                break;
+        }
+
+        ir_append(fn, vb->block, vector);
+        vb->vectors[inst->id] = vector;
+    }
+}
+
+static struct IrInst* append_compare(struct IrFunction* fn, struct IrBlock* block, enum Condition cond, struct IrInst* left, struct IrInst* right) {
+    struct IrInst* compare = append_op(fn, block, IR_CMP, 4, left, right);
+    compare->cond = cond;
+    return compare;
+}
+
+static void append_branch(struct IrFunction* fn, struct IrBlock* block, struct IrInst* condition, struct IrBlock* then, struct IrBlock* otherwise) {
+    struct IrInst* branch = ir_new_inst(fn, IR_BRANCH, 0);
+    ir_add_operand(fn, branch, condition);
+    branch->targets[0] = then;
+    branch->targets[1] = otherwise;
+    ir_append(fn, block, branch);
+}
+
+// the bytes from the first element the loop touches at `base` to past the last one
+static void append_range(struct IrFunction* fn, struct IrBlock* block, struct VectorLoop* vl, struct IrInst* base, struct IrInst* end, struct IrInst** range) {
+    int64_t first, last;
+    access_range(vl, base, &first, &last);
+
+    range[0] = append_op(fn, block, IR_LEA, 8, base, vl->init);
+    range[0]->scale = 4;
+    range[0]->imm = first;
+
+    range[1] = append_op(fn, block, IR_LEA, 8, base, end);
+    range[1]->scale = 4;
+    range[1]->imm = last;
+}
+
+// Places a vector loop in front of the body:
+//   guard:  limit = end - lanes; if (init <= limit && no overlap) goto vector; else goto body
+//   vector: i = phi(init, i'); ...; i' = i + lanes; if (i' <= limit) goto vector; else goto rest
+//   rest:   if (i' < end) goto body; else goto exit
+// with the body picking the counter up from either the preheader's value or i'.
+static void vectorize_loop(struct IrFunction* fn, struct VectorLoop* vl) {
+    struct IrBlock* body = vl->body;
+    size_t position = ir_block_position(fn, body);
+    struct IrBlock* guard = ir_new_block_at(fn, position);
+    struct IrBlock* vector = ir_new_block_at(fn, position + 1);
+    struct IrBlock* rest = ir_new_block_at(fn, position + 2);
+    int lanes = vector_lanes(fn);
+
+    ir_terminator(vl->preheader)->targets[0] = guard;
+    ir_add_pred(fn, guard, vl->preheader);
+    body->preds[ir_pred_index(body, vl->preheader)] = guard;
+
+    struct IrInst* end = vl->bound;
+    if (vl->inclusive) end = append_op(fn, guard, IR_ADD, 8, end, append_immediate(fn, guard, 1, 8));
+
+    struct IrInst* step = append_immediate(fn, guard, lanes, 8);
+    struct IrInst* limit = append_op(fn, guard, IR_SUB, 8, end, step);
+    struct IrInst* skip = append_compare(fn, guard, COND_G, vl->init, limit);
+
+    struct IrInst* zero = append_immediate(fn, guard, 0, 4);
+    for (int i = 0; i < vl->checks_length; i++) {
+        struct IrInst* a[2];
+        struct IrInst* b[2];
+        append_range(fn, guard, vl, vl->checks[i][0], end, a);
+        append_range(fn, guard, vl, vl->checks[i][1], end, b);
+
+        // the ranges overlap unless one ends before the other starts
+        struct IrInst* before = append_compare(fn, guard, COND_BE, a[1], b[0]);
+        struct IrInst* after = append_compare(fn, guard, COND_BE, b[1], a[0]);
+        struct IrInst* disjoint = append_op(fn, guard, IR_ADD, 4, before, after);
+        skip = append_op(fn, guard, IR_ADD, 4, skip, append_compare(fn, guard, COND_E, disjoint, zero));
+    }
+
+    struct IrInst* counter = ir_new_inst(fn, IR_PHI, 8);
+    ir_append(fn, vector, counter);
+    ir_add_pred(fn, vector, guard);
+    ir_add_pred(fn, vector, vector);
+
+    struct VectorBody vb = { fn, vl, guard, vector, counter, lanes, NULL };
+    vb.vectors = arena_calloc(fn->arena, sizeof(struct IrInst*) * fn->value_count);
+    emit_vector_body(&vb);
+
+    struct IrInst* next = append_op(fn, vector, IR_ADD, 8, counter, step);
+    ir_add_operand(fn, counter, vl->init);
+    ir_add_operand(fn, counter, next);
+    append_branch(fn, vector, append_compare(fn, vector, COND_LE, next, limit), vector, rest);
+
+    append_branch(fn, guard, append_compare(fn, guard, COND_E, skip, zero), vector, body);
+
+    ir_add_pred(fn, rest, vector);
+    append_branch(fn, rest, append_compare(fn, rest, COND_L, next, end), body, vl->exit);
+
+    ir_add_pred(fn, body, rest);
+    ir_add_operand(fn, vl->counter, next);
+
+    // the exit is reached from the rest too, with what it got from the loop
+    int from_body = ir_pred_index(vl->exit, body);
+    for (size_t i = 0; i < vl->exit->insts_length && vl->exit->insts[i]->op == IR_PHI; i++) {
+        struct IrInst* phi = vl->exit->insts[i];
+        ir_add_operand(fn, phi, phi->operands[from_body]);
+    }
+
+    ir_add_pred(fn, vl->exit, rest);
+}
+
+static bool loop_vectorize(struct IrFunction* fn) {
+    struct IrLoops loops;
+    bool changed = ir_canonicalize_loops(fn, &loops);
+
+    struct SymbolTable escaping;
+    init_symbol_table(&escaping);
+    find_escaping_slots(fn, &escaping);
+
+    // a vectorized loop only adds blocks around itself, the other loops stay as found
+    for (size_t i = 0; i < loops.loops_length; i++) {
+        struct VectorLoop vl;
+        if (!can_vectorize_loop(&vl, fn, loops.loops[i], &escaping)) continue;
+
+        vectorize_loop(fn, &vl);
+        changed = true;
+    }
+
+    return changed;
+}
+
+const struct IrPass loop_vectorize_pass = { "loop-vectorize", loop_vectorize };
+
+#endif